@@ -108,7 +108,11 @@ msg_loading_stage2: db "Loading Stage2...", 0x0D, 0x0A, 0
 msg_stage2_loaded: db "Stage2 loaded!", 0x0D, 0x0A, 0
 msg_disk_error:    db "Disk Error!", 0x0D, 0x0A, 0
 
-; === Boot Sector Padding and Signature ===
-; Fill remaining space to make exactly 512 bytes
-times 510-($-$$) db 0     ; Pad with zeros to byte 510
+; === Boot Sector Padding, Partition Table and Signature ===
+; Code must end before the MBR partition table at byte 446
+times 446-($-$$) db 0     ; Pad with zeros to byte 446
+
+; MBR partition table (4 x 16 bytes) - filled in by create_hdd.sh
+times 64 db 0
+
 dw 0xAA55                 ; Boot signature (BIOS requirement)
@@ -9,8 +9,9 @@
 
 ; === Constants ===
 KERNEL_OFFSET equ 0x10000       ; Load kernel at 64KB (safe location)
-KERNEL_SECTORS equ 93           ; Max sectors for kernel (93 * 512 = 47616 bytes)
-KERNEL_START_SECTOR equ 11      ; Kernel starts at sector 11
+KERNEL_SECTORS equ 256          ; Max sectors for kernel (256 * 512 = 128KB)
+KERNEL_START_LBA equ 10         ; Kernel starts at sector 10 (LBA)
+KERNEL_CHUNK_SECTORS equ 64     ; Sectors per BIOS read (32KB, never crosses 64KB)
 
 ; GDT segment selectors
 CODE_SEG equ gdt_code - gdt_start
@@ -81,36 +82,32 @@ load_kernel_16bit:
     mov si, msg_loading_kernel
     call print_string
     
-    ; Setup parameters for kernel loading
-    ; Set ES:BX to point to KERNEL_OFFSET (0x10000)
-    mov ax, KERNEL_OFFSET >> 4  ; Segment = 0x1000
-    mov es, ax
-    mov bx, 0                   ; Offset = 0 (ES:BX = 0x1000:0x0000 = 0x10000)
-    mov dh, KERNEL_SECTORS      ; Number of sectors (85)
-    mov dl, [boot_drive]        ; Boot drive number
-    mov ch, 0                   ; Cylinder 0
-    mov cl, KERNEL_START_SECTOR ; Starting sector (11)
+    ; Load the kernel with BIOS extended reads (INT 13h AH=42h) in
+    ; KERNEL_CHUNK_SECTORS pieces; a single CHS read cannot cover a kernel
+    ; this size
+    mov word [dap_segment], KERNEL_OFFSET >> 4
+    mov dword [dap_lba], KERNEL_START_LBA
+    mov cx, KERNEL_SECTORS / KERNEL_CHUNK_SECTORS
 
-    ; Load kernel using BIOS disk services
+.next_chunk:
     call disk_load_extended
-    
-    ; Reset ES to 0
-    xor ax, ax
-    mov es, ax
+    add word [dap_segment], (KERNEL_CHUNK_SECTORS * 512) >> 4
+    add dword [dap_lba], KERNEL_CHUNK_SECTORS
+    loop .next_chunk
     
     mov si, msg_kernel_loaded
     call print_string
     ret
 
-; === Extended Disk Load Function for Large Reads ===
+; === Extended Disk Load Function (LBA) ===
+; Reads KERNEL_CHUNK_SECTORS sectors described by disk_address_packet
 disk_load_extended:
     pusha
     
-    ; For large reads, we need to load in chunks due to BIOS limitations
-    mov al, dh              ; Number of sectors to read
-    mov ah, 0x02            ; BIOS read sectors function
-    mov dh, 0               ; Head number = 0
-    ; CH, CL, BX, DL already set by caller
+    mov word [dap_count], KERNEL_CHUNK_SECTORS
+    mov si, disk_address_packet
+    mov ah, 0x42            ; BIOS extended read
+    mov dl, [boot_drive]    ; Boot drive number
     
     int 0x13                ; BIOS disk interrupt
     jc .disk_error          ; Jump if carry flag set (error)
@@ -124,6 +121,16 @@ disk_load_extended:
     cli
     hlt
 
+; Disk address packet for INT 13h AH=42h
+disk_address_packet:
+    db 0x10                 ; Packet size
+    db 0                    ; Reserved
+dap_count:   dw 0           ; Sectors to read (BIOS writes back sectors read)
+dap_offset:  dw 0           ; Destination offset
+dap_segment: dw 0           ; Destination segment
+dap_lba:     dd 0           ; Starting LBA (low 32 bits)
+             dd 0           ; Starting LBA (high 32 bits)
+
 ; Store boot drive number
 boot_drive: db 0
 
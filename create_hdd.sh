@@ -10,7 +10,21 @@ HDD_IMAGE="build/hard-disk.img"
 STAGE1_BIN="build/stage1.bin"
 STAGE2_BIN="build/stage2.bin"
 KERNEL_BIN="build/kernel.bin"
-HDD_SIZE_MB=10  # Hard disk image size (10MB)
+HDD_SIZE_MB=64  # Hard disk image size (64MB)
+
+# Kernel load limits, read from the Stage 2 loader so the two cannot drift
+STAGE2_SRC="boot/stage2.asm"
+KERNEL_MAX_SECTORS=$(awk '$1 == "KERNEL_SECTORS" && $2 == "equ" { print $3 }' "$STAGE2_SRC")
+KERNEL_START_LBA=$(awk '$1 == "KERNEL_START_LBA" && $2 == "equ" { print $3 }' "$STAGE2_SRC")
+
+# Partition layout (sectors, 1MB aligned - boot code lives in the first 1MB)
+PART_ALIGN=2048                              # 1MB alignment
+PART1_START=$PART_ALIGN                      # FAT32 data partition
+PART1_SECTORS=$((48 * 2048))                 # 48MB (enough clusters for FAT32)
+PART2_START=$((PART1_START + PART1_SECTORS)) # Raw partition (swap/log)
+PART2_SECTORS=$((HDD_SIZE_MB * 2048 - PART2_START))
+PART1_TYPE=0x0C                              # FAT32 (LBA)
+PART2_TYPE=0xDA                              # Non-filesystem data
 
 # Colors for terminal output
 RED='\033[0;31m'
@@ -49,6 +63,10 @@ main() {
     # Stage 3: Install Stage 1 bootloader (MBR - sector 0)
     install_stage1
     
+    # Stage 3-1: Write MBR partition table and format the FAT32 partition
+    write_partition_table
+    format_data_partition
+    
     # Stage 4: Install Stage 2 bootloader (sectors 2-9)
     install_stage2
     
@@ -91,6 +109,23 @@ check_required_files() {
         exit 1
     fi
     
+    # Check Stage 2 loads the whole kernel (it reads KERNEL_SECTORS and no more)
+    if [ -z "$KERNEL_MAX_SECTORS" ] || [ -z "$KERNEL_START_LBA" ]; then
+        log_error "KERNEL_SECTORS or KERNEL_START_LBA not found in $STAGE2_SRC"
+        exit 1
+    fi
+    KERNEL_SIZE=$(stat -f%z "$KERNEL_BIN" 2>/dev/null || stat -c%s "$KERNEL_BIN" 2>/dev/null)
+    if [ $(((KERNEL_SIZE + 511) / 512)) -gt "$KERNEL_MAX_SECTORS" ]; then
+        log_error "Kernel too large: $KERNEL_SIZE bytes, Stage 2 loads $KERNEL_MAX_SECTORS sectors ($((KERNEL_MAX_SECTORS * 512)) bytes)"
+        exit 1
+    fi
+    
+    # Check the loaded area stays in front of the first partition
+    if [ $((KERNEL_START_LBA + KERNEL_MAX_SECTORS)) -gt "$PART_ALIGN" ]; then
+        log_error "Kernel area (sectors $KERNEL_START_LBA-$((KERNEL_START_LBA + KERNEL_MAX_SECTORS - 1))) overlaps the first partition"
+        exit 1
+    fi
+    
     # Check Stage 2 size (should be reasonable, up to 4KB = 8 sectors)
     STAGE2_SIZE=$(stat -f%z "$STAGE2_BIN" 2>/dev/null || stat -c%s "$STAGE2_BIN" 2>/dev/null)
     STAGE2_MAX_SIZE=$((8 * 512))  # 8 sectors = 4KB
@@ -129,6 +164,53 @@ install_stage1() {
     log_success "Stage 1 bootloader installed to MBR"
 }
 
+# Emit a 32-bit value as little-endian bytes for printf
+le32() {
+    printf '\\x%02x\\x%02x\\x%02x\\x%02x' \
+        $(($1 & 0xFF)) $((($1 >> 8) & 0xFF)) $((($1 >> 16) & 0xFF)) $((($1 >> 24) & 0xFF))
+}
+
+# Write one MBR partition entry: index status type first_lba sector_count
+# CHS fields are set to the "use LBA" marker (0xFE 0xFF 0xFF)
+write_mbr_entry() {
+    local offset=$((446 + $1 * 16))
+    local status type
+    status=$(printf '\\x%02x' $2)
+    type=$(printf '\\x%02x' $3)
+    printf "${status}\xfe\xff\xff${type}\xfe\xff\xff$(le32 $4)$(le32 $5)" | \
+        dd of="$HDD_IMAGE" bs=1 seek=$offset conv=notrunc status=none
+}
+
+# Write the MBR partition table (Stage 1 leaves bytes 446-509 free for it)
+write_partition_table() {
+    log_info "Writing MBR partition table..."
+    
+    write_mbr_entry 0 0x00 $PART1_TYPE $PART1_START $PART1_SECTORS
+    write_mbr_entry 1 0x00 $PART2_TYPE $PART2_START $PART2_SECTORS
+    
+    log_success "Partition 1: FAT32, sectors $PART1_START-$((PART1_START + PART1_SECTORS - 1))"
+    log_success "Partition 2: raw,   sectors $PART2_START-$((PART2_START + PART2_SECTORS - 1))"
+}
+
+# Format partition 1 as FAT32 (needs mkfs.fat from dosfstools)
+format_data_partition() {
+    local part_image="build/partition1.img"
+    
+    if ! command -v mkfs.fat >/dev/null 2>&1; then
+        log_warning "mkfs.fat not found - partition 1 left unformatted"
+        return
+    fi
+    
+    log_info "Formatting partition 1 as FAT32..."
+    
+    dd if=/dev/zero of="$part_image" bs=512 count=$PART1_SECTORS status=none
+    mkfs.fat -F 32 -s 1 -h $PART1_START -n CHANUX "$part_image" >/dev/null
+    dd if="$part_image" of="$HDD_IMAGE" bs=512 seek=$PART1_START conv=notrunc status=none
+    rm -f "$part_image"
+    
+    log_success "Partition 1 formatted as FAT32"
+}
+
 # Install Stage 2 bootloader starting from sector 2
 install_stage2() {
     log_info "Installing Stage 2 bootloader starting from sector 2..."
@@ -148,7 +230,7 @@ install_kernel() {
     # Install kernel starting from sector 10 (matching KERNEL_START_SECTOR in stage2.asm)
     # seek=10: skip 10 sectors (5120 bytes) in output file before writing
     # This places kernel after Stage 1 (sector 0), gap (sector 1), and Stage 2 (sectors 2-9)
-    dd if="$KERNEL_BIN" of="$HDD_IMAGE" bs=512 seek=10 conv=notrunc status=none
+    dd if="$KERNEL_BIN" of="$HDD_IMAGE" bs=512 seek=$KERNEL_START_LBA conv=notrunc status=none
     
     log_success "Kernel installed starting from sector 10"
 }
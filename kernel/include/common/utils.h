@@ -20,4 +20,7 @@ void* memset(void* ptr, int value, size_t num);
 void* memcpy(void* dest, const void* src, size_t num);
 int memcmp(const void* ptr1, const void* ptr2, size_t num);
 
+/* Checksum functions */
+uint32_t crc32(uint32_t crc, const void* data, size_t length);
+
 #endif /* UTILS_H */
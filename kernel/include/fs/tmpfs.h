@@ -0,0 +1,18 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "../common/types.h"
+
+/* tmpfs constants */
+#define TMPFS_MAX_MOUNTS        4       /* Concurrent tmpfs instances */
+#define TMPFS_DEFAULT_SHARE     4       /* Default size limit: 1/4 of the free page pool */
+
+/* Mount options, passed as the vfs_mount source (NULL = defaults) */
+typedef struct {
+    uint32_t max_pages;                 /* Size limit in pages, metadata included (0 = default) */
+} tmpfs_options_t;
+
+/* Register the "tmpfs" filesystem type with the VFS */
+void tmpfs_register(void);
+
+#endif /* TMPFS_H */
@@ -0,0 +1,200 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include "../common/types.h"
+
+/* VFS constants */
+#define VFS_MAX_FILESYSTEMS     4       /* Registered backends */
+#define VFS_MAX_MOUNTS          8       /* Mount table entries */
+#define VFS_MAX_OPEN_FILES      64      /* System-wide open file table */
+#define VFS_VNODE_PAGES         8       /* Pages holding the vnode cache */
+#define VFS_HASH_BUCKETS        128     /* Dentry hash buckets, power of two */
+#define VFS_NAME_MAX            255     /* Longest path component */
+#define VFS_PATH_MAX            256     /* Longest path, terminator included */
+#define VFS_FS_NAME_MAX         15      /* Longest filesystem type name */
+
+/* Filesystem type flags */
+#define VFS_FS_CASE_INSENSITIVE 0x01    /* Names compare without regard to ASCII case */
+
+/* Open flags - the low bits match the FAT32 open modes */
+#define VFS_O_READ              0x01
+#define VFS_O_WRITE             0x02
+#define VFS_O_APPEND            0x04
+#define VFS_O_CREATE            0x08
+#define VFS_O_TRUNCATE          0x10
+#define VFS_O_EXCLUSIVE         0x20
+#define VFS_O_DIRECTORY         0x40    /* Open a directory for vfs_readdir */
+
+/* Seek origins */
+#define VFS_SEEK_SET            0
+#define VFS_SEEK_CUR            1
+#define VFS_SEEK_END            2
+
+/* VFS error codes */
+typedef enum {
+    VFS_SUCCESS = 0,
+    VFS_ERROR_NOT_INITIALIZED,
+    VFS_ERROR_INVALID_PARAMETER,
+    VFS_ERROR_NOT_FOUND,
+    VFS_ERROR_EXISTS,
+    VFS_ERROR_NOT_DIRECTORY,
+    VFS_ERROR_IS_DIRECTORY,
+    VFS_ERROR_NOT_EMPTY,
+    VFS_ERROR_BUSY,
+    VFS_ERROR_CROSS_DEVICE,
+    VFS_ERROR_NAME_TOO_LONG,
+    VFS_ERROR_NO_SPACE,
+    VFS_ERROR_NO_MEMORY,
+    VFS_ERROR_TOO_MANY_OPEN,
+    VFS_ERROR_BAD_DESCRIPTOR,
+    VFS_ERROR_ACCESS_DENIED,
+    VFS_ERROR_READ_ONLY,
+    VFS_ERROR_NOT_SUPPORTED,
+    VFS_ERROR_IO,
+    VFS_ERROR_EOF
+} vfs_result_t;
+
+/* Vnode types */
+typedef enum {
+    VFS_TYPE_NONE = 0,                  /* Negative dentry: the name does not exist */
+    VFS_TYPE_FILE,
+    VFS_TYPE_DIRECTORY
+} vfs_type_t;
+
+struct vfs_mount;
+
+/* In-memory file or directory. Vnodes double as the dentry cache: each is
+ * hashed by (parent, name), and unreferenced vnodes stay cached until the
+ * pool runs short. */
+typedef struct vfs_vnode {
+    struct vfs_mount* mount;            /* Filesystem the vnode belongs to */
+    struct vfs_vnode* parent;           /* Holds a reference; NULL for a mount root */
+    struct vfs_vnode* mounted;          /* Root of the filesystem mounted here, or NULL */
+    vfs_type_t type;
+    uint32_t size;                      /* File size in bytes */
+    uint32_t ino;                       /* Backend identity (FAT32: first cluster) */
+    void* data;                         /* Backend private state */
+    uint32_t refcount;                  /* Users plus cached children; 0 = on the LRU */
+    uint32_t hash;
+    struct vfs_vnode* hash_next;
+    struct vfs_vnode* lru_prev;
+    struct vfs_vnode* lru_next;
+    char name[VFS_NAME_MAX + 1];
+} vfs_vnode_t;
+
+/* Directory entry returned by vfs_readdir */
+typedef struct {
+    char name[VFS_NAME_MAX + 1];
+    vfs_type_t type;
+    uint32_t size;
+    uint32_t ino;
+} vfs_dirent_t;
+
+/* File status */
+typedef struct {
+    vfs_type_t type;
+    uint32_t size;
+    uint32_t ino;
+    uint32_t mount;                     /* Mount table index */
+} vfs_stat_t;
+
+/* Backend operations. Vnodes passed to create, remove and rename already
+ * carry their parent and name; lookup fills in type, size, ino and data of
+ * a vnode that only has them, or returns VFS_ERROR_NOT_FOUND. Any entry
+ * may be NULL if the backend does not support it. */
+typedef struct {
+    vfs_result_t (*mount)(struct vfs_mount* mount, void* source, vfs_vnode_t* root);
+    void (*unmount)(struct vfs_mount* mount);
+    vfs_result_t (*lookup)(vfs_vnode_t* dir, vfs_vnode_t* node);
+    vfs_result_t (*create)(vfs_vnode_t* dir, vfs_vnode_t* node, vfs_type_t type);
+    vfs_result_t (*remove)(vfs_vnode_t* dir, vfs_vnode_t* node);
+    vfs_result_t (*rename)(vfs_vnode_t* node, vfs_vnode_t* new_dir, const char* new_name);
+    vfs_result_t (*open)(vfs_vnode_t* node, uint32_t flags, void** handle);
+    void (*close)(vfs_vnode_t* node, void* handle);
+    vfs_result_t (*read)(vfs_vnode_t* node, void* handle, uint32_t offset, void* buffer, uint32_t size,
+                         uint32_t* done);
+    vfs_result_t (*write)(vfs_vnode_t* node, void* handle, uint32_t offset, const void* buffer, uint32_t size,
+                          uint32_t* done);
+    vfs_result_t (*readdir)(vfs_vnode_t* dir, void* handle, uint32_t index, vfs_dirent_t* entry);
+    vfs_result_t (*truncate)(vfs_vnode_t* node, void* handle, uint32_t size);
+    vfs_result_t (*sync)(struct vfs_mount* mount, void* handle);
+    void (*release)(vfs_vnode_t* node);
+} vfs_ops_t;
+
+/* Filesystem type */
+typedef struct {
+    char name[VFS_FS_NAME_MAX + 1];
+    const vfs_ops_t* ops;
+    uint32_t flags;                     /* VFS_FS_* */
+} vfs_filesystem_t;
+
+/* Mount table entry */
+typedef struct vfs_mount {
+    bool in_use;
+    const vfs_filesystem_t* fs;
+    vfs_vnode_t* root;                  /* Root of the mounted filesystem */
+    vfs_vnode_t* covered;               /* Directory it is mounted on; NULL for "/" */
+    void* data;                         /* Backend private state */
+} vfs_mount_t;
+
+/* Open file description, shared by duplicated and inherited descriptors */
+typedef struct vfs_file {
+    vfs_vnode_t* node;
+    void* handle;                       /* Backend handle from ops->open */
+    uint32_t position;
+    uint32_t flags;
+    uint32_t refcount;
+} vfs_file_t;
+
+/* VFS statistics */
+typedef struct {
+    uint32_t vnodes;                    /* Vnode cache capacity */
+    uint32_t vnodes_in_use;
+    uint32_t lookups;
+    uint32_t cache_hits;
+    uint32_t negative_hits;
+    uint32_t reclaims;
+    uint32_t mounts;
+    uint32_t open_files;
+} vfs_stats_t;
+
+/* === Initialization and Mounting === */
+vfs_result_t vfs_initialize(void);
+vfs_result_t vfs_register_filesystem(const char* name, const vfs_ops_t* ops, uint32_t flags);
+vfs_result_t vfs_mount(const char* fs_name, void* source, const char* path);
+vfs_result_t vfs_unmount(const char* path);
+vfs_result_t vfs_sync(void);
+
+/* === File Descriptors === */
+vfs_result_t vfs_open(const char* path, uint32_t flags, int* fd);
+vfs_result_t vfs_close(int fd);
+vfs_result_t vfs_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read);
+vfs_result_t vfs_write(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written);
+vfs_result_t vfs_seek(int fd, int32_t offset, int origin, uint32_t* position);
+vfs_result_t vfs_readdir(int fd, vfs_dirent_t* entry);
+vfs_result_t vfs_fstat(int fd, vfs_stat_t* stat);
+vfs_result_t vfs_ftruncate(int fd, uint32_t size);
+vfs_result_t vfs_fsync(int fd);
+vfs_result_t vfs_dup(int fd, int* new_fd);
+
+/* === Path Operations === */
+vfs_result_t vfs_stat(const char* path, vfs_stat_t* stat);
+vfs_result_t vfs_mkdir(const char* path);
+vfs_result_t vfs_rmdir(const char* path);
+vfs_result_t vfs_unlink(const char* path);
+vfs_result_t vfs_rename(const char* old_path, const char* new_path);
+vfs_result_t vfs_chdir(const char* path);
+vfs_result_t vfs_getcwd(char* buffer, uint32_t size);
+
+/* === Process Hooks === */
+struct process;
+void vfs_process_start(struct process* child, struct process* parent);
+void vfs_process_fork(struct process* child, struct process* parent);
+void vfs_process_exit(struct process* process);
+
+/* === Backend Helpers === */
+vfs_result_t vfs_node_path(vfs_vnode_t* node, char* buffer, uint32_t size);
+void vfs_get_stats(vfs_stats_t* stats);
+const char* vfs_result_to_string(vfs_result_t result);
+
+#endif /* VFS_H */
@@ -25,6 +25,8 @@ typedef struct {
 /* Hardware interrupts (IRQ) */
 #define IRQ_TIMER                32
 #define IRQ_KEYBOARD             33
+#define IRQ_ATA_PRIMARY          46
+#define IRQ_ATA_SECONDARY        47
 
 /* Function prototypes */
 void interrupts_initialize(void);
@@ -37,6 +39,8 @@ void pic_display_status(void);
 /* Hardware interrupt handlers */
 void irq_handler_timer(void);
 void irq_handler_keyboard(void);
+void irq_handler_ata_primary(void);
+void irq_handler_ata_secondary(void);
 
 /* Exception handlers */
 void exception_handler_0(void);   /* Division by zero */
@@ -63,6 +67,8 @@ void exception_handler_19(void);  /* SIMD floating-point exception */
 /* C interrupt handlers */
 void c_irq_handler_timer(void);
 void c_irq_handler_keyboard(void);
+void c_irq_handler_ata_primary(void);
+void c_irq_handler_ata_secondary(void);
 void c_exception_handler(void* ctx);
 
 /* Interrupt statistics and debugging */
@@ -13,7 +13,12 @@
 #include "keyboard/keyboard.h"
 #include "process/process.h"
 #include "storage/hdd.h"
+#include "storage/block.h"
+#include "storage/ramdisk.h"
+#include "storage/partition.h"
 #include "storage/fat32.h"
+#include "fs/vfs.h"
+#include "fs/tmpfs.h"
 
 /* Kernel version information */
 #define KERNEL_VERSION_MAJOR 0
@@ -21,6 +26,10 @@
 #define KERNEL_VERSION_PATCH 0
 #define KERNEL_NAME "Simple OS"
 
+/* Boot-time storage benchmarks, run once interrupts are enabled.
+ * Build with -DKERNEL_BENCHMARK to enable them. */
+#define KERNEL_BENCHMARK_SECTORS 8192   /* 4MB per pass */
+
 /* Kernel main function */
 void kernel_main(void);
 
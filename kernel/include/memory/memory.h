@@ -26,10 +26,21 @@ uint32_t memory_detect_probe(void);
 bool memory_get_info(memory_info_t* info);
 void memory_print_info(const memory_info_t* info);
 
+/* Page allocator for memory above the kernel image */
+#define MEMORY_PAGE_SIZE        4096        /* Allocation granularity */
+#define MEMORY_POOL_START       0x200000    /* First page handed out (2MB) */
+#define MEMORY_POOL_MAX_PAGES   15872       /* Pool ends at 64MB at most */
+
+void memory_initialize(void);
+void* memory_alloc_pages(uint32_t page_count);
+void memory_free_pages(void* address, uint32_t page_count);
+uint32_t memory_get_free_pages(void);
+uint32_t memory_get_total_pages(void);
+
 /* Memory management constants */
 #define MEMORY_BASE_1MB     0x100000    /* 1MB boundary */
 #define MEMORY_KERNEL_START 0x1000      /* Kernel load address */
-#define MEMORY_STACK_TOP    0x90000     /* Stack top address */
+#define MEMORY_STACK_TOP    0x200000    /* Kernel stack top (stack uses 1MB-2MB) */
 
 /* CMOS register addresses */
 #define CMOS_ADDR_PORT      0x70
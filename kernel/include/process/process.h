@@ -24,6 +24,9 @@ typedef enum {
 /* Maximum number of processes */
 #define MAX_PROCESSES 32
 
+/* Maximum open file descriptors per process */
+#define PROCESS_MAX_FILES 16
+
 /* Process ID type */
 typedef uint32_t pid_t;
 
@@ -63,6 +66,10 @@ typedef struct process {
     struct process* next;           /* Next process in list */
     struct process* prev;           /* Previous process in list */
     
+    /* File system context */
+    struct vfs_vnode* cwd;          /* Working directory (NULL = root) */
+    struct vfs_file* files[PROCESS_MAX_FILES];  /* Open file descriptors */
+    
     /* Process name */
     char name[32];                  /* Process name */
 } process_t;
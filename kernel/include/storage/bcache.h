@@ -0,0 +1,85 @@
+/*
+ * Block Buffer Cache Header
+ * ChanUX Operating System
+ *
+ * Sector cache shared by all block devices, keyed by (device, LBA), with
+ * hash lookup, LRU replacement, reference counts and write-back of dirty
+ * sectors (on eviction, on sync, and from a background process).
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "../common/types.h"
+#include "block.h"
+
+/* Cache limits and write-back policy */
+#define BCACHE_MIN_BUFFERS              16
+#define BCACHE_MAX_BUFFERS              8192        /* 4MB of sector data */
+#define BCACHE_DEFAULT_BUFFERS          256
+#define BCACHE_WRITEBACK_BATCH          64          /* Max sectors per write-back I/O */
+#define BCACHE_WRITEBACK_INTERVAL_MS    1000        /* Background flusher period */
+#define BCACHE_WRITEBACK_AGE_MS         3000        /* Dirty data older than this is flushed */
+#define BCACHE_PREFETCH_MAX             128         /* Max sectors per readahead request */
+
+/* Cached sector */
+typedef struct bcache_buffer {
+    block_device_t* device;             /* Owning device (NULL = unused) */
+    uint32_t lba;                       /* Sector on the device */
+    uint8_t* data;                      /* BLOCK_SECTOR_SIZE bytes */
+    uint32_t refcount;                  /* Holders; referenced buffers are never evicted */
+    uint32_t dirty_since;               /* Timer tick when the buffer became dirty */
+    bool valid;                         /* data holds the sector contents */
+    bool dirty;                         /* data differs from the device */
+    bool pinned;                        /* Held in memory until unpinned (journalled metadata) */
+    struct bcache_buffer* hash_next;    /* Hash chain */
+    struct bcache_buffer* lru_prev;     /* LRU list (head = most recently used) */
+    struct bcache_buffer* lru_next;
+} bcache_buffer_t;
+
+/* Cache statistics */
+typedef struct {
+    uint32_t buffer_count;              /* Configured buffers */
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;                /* Write-back I/Os issued */
+    uint32_t sectors_written_back;
+    uint32_t dirty_buffers;             /* Currently dirty */
+    uint32_t prefetched;                /* Sectors inserted by readahead */
+    bool write_through;
+} bcache_stats_t;
+
+/* Setup */
+block_result_t bcache_initialize(uint32_t buffer_count, bool write_through);
+void bcache_start_writeback(void);
+
+/* Buffer access: bcache_get reads the sector on a miss, bcache_get_new
+ * does not (the caller overwrites the whole sector). Every successful
+ * get must be paired with bcache_release. */
+bcache_buffer_t* bcache_get(block_device_t* device, uint32_t lba);
+bcache_buffer_t* bcache_get_new(block_device_t* device, uint32_t lba);
+void bcache_release(bcache_buffer_t* buffer);
+block_result_t bcache_mark_dirty(bcache_buffer_t* buffer);
+
+/* Pinned buffers are kept in the cache and never written to the device,
+ * even in write-through mode, until they are unpinned */
+void bcache_pin(bcache_buffer_t* buffer);
+void bcache_unpin(bcache_buffer_t* buffer);
+
+/* Multi-sector transfers through the cache */
+block_result_t bcache_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer);
+block_result_t bcache_read_direct(block_device_t* device, uint32_t lba, uint32_t count, void* buffer);
+block_result_t bcache_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer);
+block_result_t bcache_write_direct(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer);
+
+/* Asynchronous readahead into the cache */
+block_result_t bcache_prefetch(block_device_t* device, uint32_t lba, uint32_t count);
+
+/* Maintenance (device NULL = all devices) */
+block_result_t bcache_sync(block_device_t* device);
+block_result_t bcache_writeback(uint32_t min_age_ms);
+block_result_t bcache_invalidate(block_device_t* device);
+void bcache_get_stats(bcache_stats_t* stats);
+
+#endif /* BCACHE_H */
@@ -0,0 +1,116 @@
+/*
+ * Block Device Layer Header
+ * ChanUX Operating System
+ *
+ * Common interface for sector-addressed storage (ATA drives, RAM disks,
+ * partitions) and a registry so file systems can mount any of them.
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "../common/types.h"
+#include "hdd.h"
+
+/* Block layer limits */
+#define BLOCK_SECTOR_SIZE       512
+#define BLOCK_MAX_DEVICES       24
+#define BLOCK_NAME_LENGTH       16
+#define BLOCK_BENCHMARK_CHUNK   16      /* Sectors per block_benchmark request */
+
+/* Block Operation Result */
+typedef enum {
+    BLOCK_SUCCESS = 0,
+    BLOCK_ERROR_INVALID_DEVICE,
+    BLOCK_ERROR_INVALID_PARAMETER,
+    BLOCK_ERROR_OUT_OF_RANGE,
+    BLOCK_ERROR_IO,
+    BLOCK_ERROR_NO_MEMORY,
+    BLOCK_ERROR_REGISTRY_FULL,
+    BLOCK_ERROR_NOT_SUPPORTED
+} block_result_t;
+
+/* Asynchronous request operations */
+typedef enum {
+    BLOCK_REQUEST_READ = 0,
+    BLOCK_REQUEST_WRITE,
+    BLOCK_REQUEST_FLUSH
+} block_request_op_t;
+
+struct block_device;
+
+/* Asynchronous block request (see block_submit) */
+typedef struct block_request {
+    /* Filled in by the caller */
+    block_request_op_t op;              /* Operation */
+    uint32_t lba;                       /* First sector (device relative) */
+    uint32_t sector_count;              /* Number of sectors */
+    void* buffer;                       /* Data buffer (sector_count * 512 bytes) */
+    void (*callback)(struct block_request* request);  /* Completion callback (may be NULL) */
+    void* context;                      /* Caller data for the callback */
+
+    /* Completion status */
+    volatile bool done;                 /* Set when the request has finished */
+    volatile block_result_t result;     /* Final result */
+
+    /* Block layer state */
+    struct block_device* device;        /* Device that is executing the request */
+    uint32_t lba_offset;                /* Partition starts to add to lba on that device */
+    hdd_request_t hdd;                  /* Backend request for ATA devices */
+} block_request_t;
+
+/* Operations implemented by each backend */
+typedef struct {
+    block_result_t (*read)(struct block_device* device, uint32_t lba, uint32_t count, void* buffer);
+    block_result_t (*write)(struct block_device* device, uint32_t lba, uint32_t count, const void* buffer);
+    block_result_t (*flush)(struct block_device* device);
+    block_result_t (*submit)(struct block_device* device, block_request_t* request);
+    block_result_t (*wait)(struct block_device* device, block_request_t* request);  /* NULL: completes in submit */
+} block_device_ops_t;
+
+/* Block Device */
+typedef struct block_device {
+    char name[BLOCK_NAME_LENGTH];       /* Registry name ("hda", "ram0", ...) */
+    uint32_t sector_count;              /* Size in sectors */
+    bool registered;                    /* Present in the registry */
+    const block_device_ops_t* ops;      /* Backend operations */
+    void* private_data;                 /* Backend state */
+
+    /* Partitions: range on the whole-disk device */
+    struct block_device* parent;        /* Whole-disk device (NULL for disks) */
+    uint32_t start_lba;                 /* First sector on the parent */
+
+    /* Statistics */
+    uint32_t read_operations;
+    uint32_t write_operations;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+} block_device_t;
+
+/* Registry */
+void block_initialize(void);
+block_result_t block_register(block_device_t* device);
+void block_unregister(block_device_t* device);
+block_device_t* block_find(const char* name);
+block_device_t* block_get_device(uint32_t index);
+uint32_t block_get_device_count(void);
+
+/* Synchronous I/O (bounds checked, device relative) */
+block_result_t block_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer);
+block_result_t block_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer);
+block_result_t block_flush(block_device_t* device);
+
+/* Asynchronous I/O */
+block_result_t block_submit(block_device_t* device, block_request_t* request);
+block_result_t block_wait(block_request_t* request);
+void block_complete_request(block_request_t* request, block_result_t result);
+
+/* Backends */
+block_device_t* block_create_partition(block_device_t* parent, const char* name,
+                                       uint32_t start_lba, uint32_t sector_count);
+
+/* Utility */
+const char* block_result_to_string(block_result_t result);
+void block_benchmark(block_device_t* device, uint32_t sector_count);
+
+#endif /* BLOCK_H */
@@ -10,6 +10,8 @@
 #define FAT32_H
 
 #include "../common/types.h"
+#include "block.h"
+#include "bcache.h"
 
 /* FAT32 Constants and Definitions */
 #define FAT32_SECTOR_SIZE           512
@@ -21,12 +23,44 @@
 #define FAT32_FILE_SYSTEM_TYPE      "FAT32   "
 #define FAT32_MAX_PATH_DEPTH        16
 #define FAT32_MAX_CLUSTER_SIZE      (32 * 1024)  /* 32KB max cluster */
+#define FAT32_READAHEAD_MIN         2            /* Initial readahead window (clusters) */
+#define FAT32_READAHEAD_MAX         32           /* Largest readahead window (clusters) */
+#define FAT32_DCACHE_ENTRIES        512          /* Cached name lookups */
+#define FAT32_DCACHE_BUCKETS        256          /* Hash buckets (power of two) */
+#define FAT32_DCACHE_NAME_MAX       48           /* Longer names are not cached */
+#define FAT32_DINDEX_MAX            8            /* Directories indexed at once */
+#define FAT32_DINDEX_MIN_RECORDS    128          /* Smaller directories are not indexed */
+#define FAT32_DINDEX_RESERVE_PAGES  256          /* Free pages left to the rest of the kernel */
+#define FAT32_DELALLOC_BUFFER_SIZE  (64 * 1024)  /* Unallocated data held per file */
+#define FAT32_DELALLOC_MAX_FILES    16           /* Files holding unallocated data at once */
+#define FAT32_MAX_OPEN_FILES        64           /* Open handles, files and directories alike */
+#define FAT32_FORMAT_ZERO_SECTORS   1024         /* Sectors per zero-fill write when formatting */
+#define FAT32_COPY_BUFFER_SIZE      (64 * 1024)  /* File copy chunk (one readahead request) */
+#define FAT32_FSCK_BATCH_SECTORS    128          /* FAT sectors per read during a check */
+#define FAT32_FSCK_QUEUE_SIZE       16384        /* Directories waiting to be scanned */
+#define FAT32_DEFRAG_STEP_MS        20           /* Defragmenter pause between entries */
+#define FAT32_DEFRAG_BUSY_MS        1000         /* Retry interval while files are open */
+#define FAT32_DEFRAG_PASS_MS        60000        /* Pause after a pass over the whole tree */
+#define FAT32_JOURNAL_NAME          "JOURNAL.SYS" /* Journal file in the root directory */
+#define FAT32_JOURNAL_SECTORS       2048         /* Default journal size (1MB) */
+#define FAT32_JOURNAL_MIN_SECTORS   256          /* Smallest usable journal */
+#define FAT32_JOURNAL_MAX_BLOCKS    124          /* Metadata sectors per transaction */
+#define FAT32_JOURNAL_COMMIT_MS     5000         /* Longest a metadata update waits for a commit */
+
+/* Long File Name Entries */
+#define FAT32_LFN_CHARS_PER_ENTRY   13           /* UCS-2 characters per LFN entry */
+#define FAT32_LFN_MAX_ENTRIES       20           /* LFN entries per name */
+#define FAT32_LFN_LAST_ENTRY        0x40         /* Order flag of the first stored entry */
+#define FAT32_LFN_ORDER_MASK        0x1F
+#define FAT32_LFN_MAX_TAIL          256          /* Highest numeric tail tried for aliases */
 
 /* FAT32 Special Cluster Values */
 #define FAT32_FREE_CLUSTER          0x00000000
 #define FAT32_BAD_CLUSTER           0x0FFFFFF7
 #define FAT32_EOC                   0x0FFFFFF8   /* End of Chain */
 #define FAT32_CLUSTER_MASK          0x0FFFFFFF   /* 28-bit cluster number */
+#define FAT32_CLEAN_SHUTDOWN        0x08000000   /* FAT[1]: volume was unmounted cleanly */
+#define FAT32_NO_IO_ERRORS          0x04000000   /* FAT[1]: no disk errors were seen */
 
 /* FAT32 File Attributes */
 #define FAT32_ATTR_READ_ONLY        0x01
@@ -118,6 +152,33 @@ typedef struct __attribute__((packed)) {
     uint32_t    file_size;              /* File size in bytes */
 } fat32_dir_entry_t;
 
+/* FAT32 Long File Name Entry (stored before the short entry, last part first) */
+typedef struct __attribute__((packed)) {
+    uint8_t     order;                  /* Sequence number, FAT32_LFN_LAST_ENTRY on the last part */
+    uint16_t    name1[5];               /* Characters 1-5 */
+    uint8_t     attributes;             /* Always FAT32_ATTR_LONG_NAME */
+    uint8_t     type;                   /* Always 0 */
+    uint8_t     checksum;               /* Checksum of the short name */
+    uint16_t    name2[6];               /* Characters 6-11 */
+    uint16_t    first_cluster_lo;       /* Always 0 */
+    uint16_t    name3[2];               /* Characters 12-13 */
+} fat32_lfn_entry_t;
+
+/* Contiguous run of a file's clusters */
+typedef struct {
+    uint32_t    file_cluster;           /* Index of the run's first cluster within the file */
+    uint32_t    disk_cluster;           /* First cluster on disk */
+    uint32_t    length;                 /* Clusters in the run */
+} fat32_extent_t;
+
+/* Per-file extent map (one page, built lazily from the FAT chain) */
+typedef struct {
+    uint32_t        count;              /* Extents recorded so far */
+    fat32_extent_t  extents[];          /* Sorted by file_cluster */
+} fat32_extent_map_t;
+
+#define FAT32_EXTENT_MAP_CAPACITY   ((4096 - sizeof(uint32_t)) / sizeof(fat32_extent_t))
+
 /* Enhanced File Handle Structure */
 typedef struct {
     bool        is_open;                /* File open status */
@@ -130,6 +191,7 @@ typedef struct {
     uint32_t    position;               /* Current position in file */
     uint32_t    size;                   /* File size */
     uint32_t    allocated_size;         /* Allocated size in bytes */
+    uint32_t    valid_size;             /* Bytes written; the rest of size reads as zeros */
     char        name[FAT32_MAX_FILENAME + 1];  /* Long filename */
     char        short_name[12];         /* 8.3 short name */
     
@@ -137,6 +199,18 @@ typedef struct {
     uint32_t    dir_entry_cluster;      /* Cluster containing directory entry */
     uint32_t    dir_entry_offset;       /* Offset of entry in cluster */
     
+    /* Cluster runs for seeking (NULL until first needed) */
+    fat32_extent_map_t* extent_map;
+    
+    /* Delayed allocation: data past allocated_size waits here for clusters */
+    uint8_t*    delalloc_buffer;        /* FAT32_DELALLOC_BUFFER_SIZE bytes (NULL = none) */
+    uint32_t    delalloc_clusters;      /* Clusters reserved for it */
+    
+    /* Sequential readahead */
+    uint32_t    readahead_position;     /* Where the next sequential read would start */
+    uint32_t    readahead_window;       /* Clusters to prefetch (0 = random access) */
+    uint32_t    readahead_issued;       /* First cluster index not yet prefetched */
+    
     /* Timestamps */
     uint16_t    creation_date;
     uint16_t    creation_time;
@@ -147,7 +221,7 @@ typedef struct {
 
 /* Enhanced Volume Information Structure */
 typedef struct {
-    uint8_t         drive;                      /* Drive number */
+    block_device_t* device;                     /* Mounted block device */
     bool            initialized;                /* Initialization status */
     bool            read_only;                  /* Read-only flag */
     uint32_t        total_sectors;              /* Total sectors */
@@ -158,6 +232,7 @@ typedef struct {
     uint32_t        total_clusters;             /* Total clusters */
     uint32_t        free_clusters;              /* Free clusters count */
     uint32_t        next_free_cluster;          /* Next free cluster hint */
+    uint32_t        reserved_clusters;          /* Promised to delayed allocations */
     uint32_t        bad_clusters;               /* Bad clusters count */
     uint8_t         sectors_per_cluster;        /* Sectors per cluster */
     uint32_t        fat_size;                   /* FAT size in sectors */
@@ -185,6 +260,74 @@ typedef struct {
     uint32_t        bad_sectors;
 } fat32_stats_t;
 
+/* Directory Entry Cache Statistics */
+typedef struct {
+    uint32_t        hits;                       /* Positive lookups answered */
+    uint32_t        negative_hits;              /* Missing names answered */
+    uint32_t        misses;                     /* Lookups that went to disk */
+    uint32_t        evictions;
+} fat32_dcache_stats_t;
+
+/* Format Options */
+typedef struct {
+    bool            quick;                      /* Clear metadata only, not the data area */
+} fat32_format_options_t;
+
+/* Format Report */
+typedef struct {
+    uint32_t        elapsed_ms;
+    uint32_t        sectors_written;
+    uint32_t        write_requests;
+} fat32_format_report_t;
+
+/* File System Check Report */
+typedef struct {
+    uint32_t        files;
+    uint32_t        directories;
+    uint32_t        clusters_in_use;
+    uint32_t        free_clusters;              /* Counted in the FAT */
+    uint32_t        bad_clusters;
+    uint32_t        lost_chains;                /* Allocated chains no entry refers to */
+    uint32_t        lost_clusters;
+    uint32_t        cross_links;                /* Clusters reached twice (shared or looping chains) */
+    uint32_t        bad_links;                  /* Links to free, bad or out-of-range clusters */
+    uint32_t        size_mismatches;            /* Chain length does not fit the file size */
+    bool            free_count_wrong;           /* Mounted free count disagreed with the FAT */
+    bool            complete;                   /* Every directory was scanned */
+    uint32_t        repaired;                   /* Changes written by a repair */
+    uint32_t        elapsed_ms;
+} fat32_fsck_report_t;
+
+/* Online Defragmenter Statistics */
+typedef struct {
+    uint32_t        passes;                     /* Complete walks of the directory tree */
+    uint32_t        files_examined;
+    uint32_t        files_moved;                /* Fragmented files made contiguous */
+    uint32_t        clusters_moved;
+    bool            running;
+} fat32_defrag_stats_t;
+
+/* Metadata Journal Statistics */
+typedef struct {
+    bool            active;
+    uint32_t        sectors;                    /* Size of the journal region */
+    uint32_t        used;                       /* Sectors of transactions not yet checkpointed */
+    uint32_t        pending;                    /* Metadata sectors waiting for the next commit */
+    uint32_t        transactions;               /* Committed since mount */
+    uint32_t        sectors_logged;
+    uint32_t        checkpoints;
+    uint32_t        replayed_transactions;      /* Recovered at mount */
+    uint32_t        replayed_sectors;
+} fat32_journal_stats_t;
+
+/* Position in a directory index lookup */
+typedef struct {
+    uint32_t        index;                      /* Directory index in use */
+    uint32_t        current;                    /* Record returned last */
+    uint32_t        next;                       /* Next record to examine */
+    uint32_t        hash;                       /* Name hash being looked up */
+} fat32_dindex_cursor_t;
+
 /* FAT32 Operation Results with Enhanced Error Codes */
 typedef enum {
     FAT32_SUCCESS = 0,
@@ -213,8 +356,10 @@ typedef enum {
     FAT32_ERROR_FILE_EXISTS,
     FAT32_ERROR_NOT_DIRECTORY,
     FAT32_ERROR_IS_DIRECTORY,
+    FAT32_ERROR_NOT_EMPTY,
     FAT32_ERROR_ALREADY_OPEN,
     FAT32_ERROR_NOT_OPEN,
+    FAT32_ERROR_TOO_MANY_OPEN,
     
     /* Space Management Errors */
     FAT32_ERROR_DISK_FULL,
@@ -248,14 +393,16 @@ typedef struct {
 /* Function Prototypes */
 
 /* === Core Initialization and Volume Management === */
-fat32_result_t fat32_initialize(uint8_t drive);
-fat32_result_t fat32_initialize_enhanced(uint8_t drive);
-fat32_result_t fat32_initialize_with_config(uint8_t drive, const fat32_cache_config_t* config);
+fat32_result_t fat32_initialize(block_device_t* device);
+fat32_result_t fat32_initialize_enhanced(block_device_t* device);
+fat32_result_t fat32_initialize_with_config(block_device_t* device, const fat32_cache_config_t* config);
 void fat32_shutdown(void);
 void fat32_shutdown_enhanced(void);
 fat32_result_t fat32_get_volume_info(fat32_volume_t* info);
-fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label);
-fat32_result_t fat32_check_filesystem(uint8_t drive);
+fat32_result_t fat32_format_drive(block_device_t* device, const char* volume_label);
+fat32_result_t fat32_format_drive_ex(block_device_t* device, const char* volume_label,
+                                     const fat32_format_options_t* options, fat32_format_report_t* report);
+fat32_result_t fat32_check_filesystem(block_device_t* device);
 
 /* === Enhanced File Operations === */
 fat32_result_t fat32_open_file(const char* path, fat32_file_t* file);
@@ -269,6 +416,7 @@ fat32_result_t fat32_seek_file_enhanced(fat32_file_t* file, uint32_t position);
 fat32_result_t fat32_tell_file(fat32_file_t* file, uint32_t* position);
 fat32_result_t fat32_flush_file(fat32_file_t* file);
 fat32_result_t fat32_truncate_file(fat32_file_t* file, uint32_t size);
+fat32_result_t fat32_preallocate_file(fat32_file_t* file, uint32_t size, bool set_size);
 
 /* === File Management === */
 fat32_result_t fat32_create_file(const char* path, fat32_file_t* file);
@@ -284,6 +432,7 @@ fat32_result_t fat32_open_directory(const char* path, fat32_file_t* dir);
 fat32_result_t fat32_create_directory(const char* path);
 fat32_result_t fat32_delete_directory(const char* path);
 fat32_result_t fat32_read_directory(fat32_file_t* dir, fat32_dir_entry_t* entry, char* long_name);
+fat32_result_t fat32_read_directory_batch(fat32_file_t* dir, fat32_dir_entry_t* entries, uint32_t max_entries, uint32_t* count);
 fat32_result_t fat32_get_current_directory(char* path, uint32_t size);
 fat32_result_t fat32_change_directory(const char* path);
 fat32_result_t fat32_list_directory(const char* path, fat32_dir_entry_t* entries, uint32_t max_entries, uint32_t* count);
@@ -302,6 +451,30 @@ fat32_result_t fat32_get_free_space(uint32_t* free_bytes);
 fat32_result_t fat32_get_total_space(uint32_t* total_bytes);
 fat32_result_t fat32_get_cluster_info(uint32_t* total_clusters, uint32_t* free_clusters, uint32_t* bad_clusters);
 fat32_result_t fat32_get_statistics(fat32_stats_t* stats);
+fat32_result_t fat32_get_file_extents(const char* path, uint32_t* extents);
+
+/* === Online Defragmentation === */
+fat32_result_t fat32_defrag_start(void);
+void fat32_defrag_stop(void);
+void fat32_defrag_reset(void);
+void fat32_defrag_get_stats(fat32_defrag_stats_t* stats);
+bool fat32_defrag_moving(void);
+
+/* === Metadata Journal === */
+fat32_result_t fat32_journal_create(uint32_t sectors);
+fat32_result_t fat32_journal_remove(void);
+fat32_result_t fat32_journal_commit(void);
+fat32_result_t fat32_journal_checkpoint(void);
+void fat32_journal_get_stats(fat32_journal_stats_t* stats);
+void fat32_journal_mount(void);
+void fat32_journal_unmount(void);
+void fat32_journal_note(bcache_buffer_t* buffer);
+void fat32_journal_data_write(uint32_t lba, uint32_t count);
+bool fat32_journal_protects(uint32_t first_cluster);
+bool fat32_journal_is_active(void);
+
+/* === VFS Backend === */
+void fat32_vfs_register(void);
 
 /* === Enhanced Internal Functions === */
 uint32_t fat32_cluster_to_lba(uint32_t cluster);
@@ -312,6 +485,51 @@ fat32_result_t fat32_allocate_cluster_enhanced(uint32_t* cluster);
 fat32_result_t fat32_allocate_cluster_chain(uint32_t count, uint32_t* first_cluster);
 fat32_result_t fat32_free_cluster_chain(uint32_t start_cluster);
 fat32_result_t fat32_extend_cluster_chain(uint32_t last_cluster, uint32_t count);
+fat32_result_t fat32_reserve_clusters(uint32_t count);
+void fat32_release_reserved_clusters(uint32_t count);
+fat32_result_t fat32_find_free_run(uint32_t count, uint32_t* start, uint32_t* length);
+fat32_result_t fat32_sync_fat(void);
+uint32_t fat32_open_file_count(void);
+bool fat32_try_lock(void);
+void fat32_lock(void);
+void fat32_unlock(void);
+fat32_result_t fat32_file_map_cluster(fat32_file_t* file, uint32_t cluster_index, uint32_t* cluster, uint32_t* contiguous);
+void fat32_file_release_extents(fat32_file_t* file);
+
+/* === Directory Entry Internals === */
+fat32_result_t fat32_dir_find_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry,
+                                    uint32_t* entry_cluster, uint32_t* entry_offset);
+fat32_result_t fat32_resolve_parent(const char* path, uint32_t* parent_cluster, char* name);
+fat32_result_t fat32_resolve_path(const char* path, fat32_dir_entry_t* entry, uint32_t* parent_cluster,
+                                  uint32_t* entry_cluster, uint32_t* entry_offset);
+fat32_result_t fat32_dir_read_entry(uint32_t entry_cluster, uint32_t entry_offset, fat32_dir_entry_t* entry);
+fat32_result_t fat32_dir_write_entry(uint32_t entry_cluster, uint32_t entry_offset, const fat32_dir_entry_t* entry);
+fat32_result_t fat32_dir_add_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry,
+                                   uint32_t* entry_cluster, uint32_t* entry_offset);
+fat32_result_t fat32_dir_remove_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry);
+
+/* === Directory Entry Cache === */
+void fat32_dcache_invalidate_all(void);
+void fat32_dcache_invalidate_directory(uint32_t dir_cluster);
+bool fat32_dcache_lookup(uint32_t dir_cluster, const char* name, bool* exists, fat32_dir_entry_t* entry,
+                         uint32_t* entry_cluster, uint32_t* entry_offset);
+void fat32_dcache_insert(uint32_t dir_cluster, const char* name, const fat32_dir_entry_t* entry,
+                         uint32_t entry_cluster, uint32_t entry_offset);
+void fat32_dcache_insert_negative(uint32_t dir_cluster, const char* name);
+void fat32_dcache_remove(uint32_t dir_cluster, const char* name);
+void fat32_dcache_update(uint32_t entry_cluster, uint32_t entry_offset, const fat32_dir_entry_t* entry);
+void fat32_dcache_get_stats(fat32_dcache_stats_t* stats);
+
+/* === Directory Index === */
+void fat32_dindex_invalidate_all(void);
+void fat32_dindex_invalidate(uint32_t dir_cluster);
+void fat32_dindex_build_begin(uint32_t dir_cluster);
+void fat32_dindex_build_add(uint32_t hash, uint32_t cluster, uint32_t offset, uint32_t slots);
+void fat32_dindex_build_end(bool complete);
+bool fat32_dindex_find(uint32_t dir_cluster, uint32_t hash, fat32_dindex_cursor_t* cursor);
+bool fat32_dindex_next(fat32_dindex_cursor_t* cursor, uint32_t* cluster, uint32_t* offset, uint32_t* slots);
+void fat32_dindex_forget(const fat32_dindex_cursor_t* cursor);
+void fat32_dindex_add(uint32_t dir_cluster, uint32_t hash, uint32_t cluster, uint32_t offset, uint32_t slots);
 
 /* === Cluster I/O Operations === */
 fat32_result_t fat32_read_cluster(uint32_t cluster, void* buffer);
@@ -333,6 +551,7 @@ const char* fat32_result_to_string(fat32_result_t result);
 fat32_result_t fat32_validate_cluster_chain(uint32_t start_cluster, uint32_t* chain_length);
 fat32_result_t fat32_check_filesystem_integrity(void);
 fat32_result_t fat32_repair_filesystem(bool fix_errors);
+fat32_result_t fat32_get_fsck_report(fat32_fsck_report_t* report);
 fat32_result_t fat32_scan_for_bad_clusters(uint32_t* bad_count);
 
 /* === Cache Management === */
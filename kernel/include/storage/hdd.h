@@ -35,9 +35,17 @@
 
 /* ATA Commands */
 #define ATA_CMD_READ_SECTORS    0x20    /* Read sectors */
+#define ATA_CMD_READ_SECTORS_EXT 0x24   /* Read sectors (LBA48) */
 #define ATA_CMD_WRITE_SECTORS   0x30    /* Write sectors */
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34  /* Write sectors (LBA48) */
 #define ATA_CMD_IDENTIFY        0xEC    /* Identify device */
 #define ATA_CMD_FLUSH_CACHE     0xE7    /* Flush cache */
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA    /* Flush cache (LBA48) */
+#define ATA_CMD_READ_MULTIPLE   0xC4    /* Read sectors, one DRQ block per interrupt */
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29  /* Read multiple (LBA48) */
+#define ATA_CMD_WRITE_MULTIPLE  0xC5    /* Write sectors, one DRQ block per interrupt */
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39 /* Write multiple (LBA48) */
+#define ATA_CMD_SET_MULTIPLE_MODE 0xC6  /* Set sectors per DRQ block */
 
 /* Status Register Bits */
 #define ATA_STATUS_ERR          0x01    /* Error occurred */
@@ -67,8 +75,22 @@
 /* Sector size */
 #define HDD_SECTOR_SIZE         512     /* Standard sector size */
 
-/* Maximum sectors per operation */
-#define HDD_MAX_SECTORS         256     /* Maximum sectors in one operation */
+/* Maximum sectors per command */
+#define HDD_MAX_SECTORS         256     /* Maximum sectors in one LBA28 command */
+#define HDD_MAX_SECTORS_LBA48   65536   /* Maximum sectors in one LBA48 command */
+
+/* Sectors per buffer in the double-buffered hdd_copy_sectors() pipeline */
+#define HDD_COPY_CHUNK          16
+
+/* Time without progress on the channel before a request times out */
+#define HDD_REQUEST_POLL_TIMEOUT 1000000    /* Polled mode (interrupts off): wait-loop iterations */
+#define HDD_REQUEST_TIMEOUT_MS   5000       /* Interrupt mode: milliseconds */
+
+/* Sectors read in each pass of hdd_benchmark() */
+#define HDD_BENCHMARK_CHUNK     16
+
+/* Sectors reachable with 28-bit addressing (LBAs 0 to 0x0FFFFFFF) */
+#define HDD_LBA28_SECTORS       0x10000000
 
 /* HDD Types */
 typedef enum {
@@ -83,12 +105,15 @@ typedef struct {
     hdd_type_t type;                    /* Drive type */
     uint16_t base_port;                 /* Base I/O port */
     uint8_t drive_select;               /* Drive selection byte */
-    uint32_t total_sectors;             /* Total number of sectors */
+    uint32_t total_sectors;             /* Total number of sectors (clamped to 32 bits) */
     uint32_t total_size_mb;             /* Total size in MB */
     char model[41];                     /* Model string (null-terminated) */
     char serial[21];                    /* Serial number (null-terminated) */
     char firmware[9];                   /* Firmware revision (null-terminated) */
     bool lba_supported;                 /* LBA addressing supported */
+    bool lba48_supported;               /* 48-bit LBA feature set supported */
+    uint8_t max_multiple_sectors;       /* Largest DRQ block the drive supports */
+    uint8_t multiple_sectors;           /* Current DRQ block size (0 = block mode off) */
     bool dma_supported;                 /* DMA transfer supported */
 } hdd_drive_info_t;
 
@@ -101,6 +126,11 @@ typedef struct {
     uint8_t drives_detected;            /* Number of drives detected */
 } hdd_controller_t;
 
+/* ATA channels (each hosts a master and a slave drive) */
+#define HDD_CHANNEL_PRIMARY     0
+#define HDD_CHANNEL_SECONDARY   1
+#define HDD_NUM_CHANNELS        2
+
 /* HDD Operation Result */
 typedef enum {
     HDD_SUCCESS = 0,
@@ -112,9 +142,53 @@ typedef enum {
     HDD_ERROR_UNSUPPORTED,
     HDD_ERROR_INVALID_DRIVE,
     HDD_ERROR_INVALID_SECTOR,
-    HDD_ERROR_BUFFER_NULL
+    HDD_ERROR_BUFFER_NULL,
+    HDD_ERROR_NO_MEMORY
 } hdd_result_t;
 
+/* Asynchronous request operations */
+typedef enum {
+    HDD_REQUEST_READ = 0,
+    HDD_REQUEST_WRITE,
+    HDD_REQUEST_FLUSH
+} hdd_request_op_t;
+
+/* Asynchronous I/O request
+ * The caller owns the memory and fills in the first block of fields; it
+ * must stay valid until done is set. The callback runs when the request
+ * completes, possibly from the channel's interrupt handler. */
+typedef struct hdd_request {
+    hdd_request_op_t op;                /* Operation */
+    uint8_t drive;                      /* HDD_PRIMARY_MASTER .. HDD_SECONDARY_SLAVE */
+    uint32_t lba;                       /* First sector */
+    uint32_t sector_count;              /* Sectors to transfer */
+    uint16_t* buffer;                   /* Data buffer */
+    void (*callback)(struct hdd_request* request); /* Completion callback (optional) */
+    void* context;                      /* Caller data for the callback */
+    
+    /* Completion status */
+    volatile bool done;                 /* Set once the request has finished */
+    volatile hdd_result_t result;       /* Final result */
+    
+    /* Driver state */
+    uint32_t sectors_done;              /* Sectors transferred so far */
+    uint32_t command_lba;               /* First sector of the current command */
+    uint32_t command_sectors;           /* Sectors in the current command */
+    uint32_t command_done;              /* Sectors of the current command transferred */
+    bool flushing;                      /* Write finished, waiting for cache flush */
+    struct hdd_request* next;           /* Next request in the channel queue */
+} hdd_request_t;
+
+/* Per-channel request queue */
+typedef struct {
+    uint16_t base_port;                 /* Command block base port */
+    hdd_request_t* volatile head;       /* Active request (front of queue) */
+    hdd_request_t* tail;                /* Last queued request */
+    volatile uint32_t irq_count;        /* Interrupts received */
+    volatile uint32_t progress;         /* Bumped on every block transferred or request finished */
+    uint32_t requests_completed;        /* Requests finished on this channel */
+} hdd_channel_t;
+
 /* Function prototypes */
 
 /* Initialization and detection */
@@ -126,9 +200,25 @@ void hdd_display_info(void);
 hdd_result_t hdd_identify_drive(uint16_t base_port, uint8_t drive_select, hdd_drive_info_t* info);
 void hdd_parse_identify_data(uint16_t* identify_data, hdd_drive_info_t* info);
 
-/* Low-level I/O operations */
-hdd_result_t hdd_read_sectors(uint8_t drive, uint32_t lba, uint8_t sector_count, uint16_t* buffer);
-hdd_result_t hdd_write_sectors(uint8_t drive, uint32_t lba, uint8_t sector_count, uint16_t* buffer);
+/* Low-level I/O operations
+ * sector_count may exceed the per-command limit; the request is split into
+ * commands of up to HDD_MAX_SECTORS_LBA48 (LBA48) or HDD_MAX_SECTORS (LBA28). */
+hdd_result_t hdd_read_sectors(uint8_t drive, uint32_t lba, uint32_t sector_count, uint16_t* buffer);
+hdd_result_t hdd_write_sectors(uint8_t drive, uint32_t lba, uint32_t sector_count, uint16_t* buffer);
+hdd_result_t hdd_flush_cache(uint8_t drive);
+
+/* Asynchronous I/O (per-channel queues; transfers on the two channels overlap) */
+hdd_result_t hdd_submit_request(hdd_request_t* request);
+hdd_result_t hdd_wait_request(hdd_request_t* request);
+bool hdd_cancel_request(hdd_request_t* request, hdd_result_t result);
+void hdd_irq_handler(uint8_t channel);
+
+/* Copy sectors between drives, overlapping the read and write channels */
+hdd_result_t hdd_copy_sectors(uint8_t src_drive, uint32_t src_lba,
+                              uint8_t dst_drive, uint32_t dst_lba, uint32_t sector_count);
+
+/* Block mode (READ/WRITE MULTIPLE) control */
+hdd_result_t hdd_set_multiple_mode(uint8_t drive, uint8_t sectors_per_block);
 
 /* High-level operations */
 hdd_result_t hdd_read_sector(uint8_t drive, uint32_t lba, void* buffer);
@@ -137,6 +227,9 @@ hdd_result_t hdd_write_sector(uint8_t drive, uint32_t lba, const void* buffer);
 /* Get drive size */
 hdd_result_t hdd_get_drive_size(uint8_t drive, uint32_t* total_sectors);
 
+/* Sequential read throughput, with and without block mode */
+void hdd_benchmark(uint8_t drive, uint32_t sector_count);
+
 /* Utility functions */
 bool hdd_wait_ready(uint16_t base_port);
 bool hdd_wait_drq(uint16_t base_port);
@@ -0,0 +1,102 @@
+/*
+ * Partition Table Header
+ * ChanUX Operating System
+ *
+ * MBR and GPT parsing. Every partition found is registered as a block
+ * device named after its disk ("hda1", "hda2", ...).
+ */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "../common/types.h"
+#include "block.h"
+
+#define PARTITION_MAX_ENTRIES       12
+
+/* MBR layout */
+#define MBR_PARTITION_TABLE_OFFSET  446
+#define MBR_PARTITION_COUNT         4
+#define MBR_SIGNATURE               0xAA55
+
+/* MBR partition types */
+#define MBR_TYPE_EMPTY              0x00
+#define MBR_TYPE_EXTENDED_CHS       0x05
+#define MBR_TYPE_FAT32_CHS          0x0B
+#define MBR_TYPE_FAT32_LBA          0x0C
+#define MBR_TYPE_EXTENDED_LBA       0x0F
+#define MBR_TYPE_RAW_DATA           0xDA
+#define MBR_TYPE_GPT_PROTECTIVE     0xEE
+
+/* GPT layout */
+#define GPT_HEADER_LBA              1
+#define GPT_SIGNATURE               "EFI PART"
+#define GPT_MIN_ENTRY_SIZE          128
+
+/* MBR partition entry */
+typedef struct __attribute__((packed)) {
+    uint8_t     status;                 /* 0x80 = bootable */
+    uint8_t     chs_first[3];           /* CHS of first sector (unused) */
+    uint8_t     type;                   /* Partition type */
+    uint8_t     chs_last[3];            /* CHS of last sector (unused) */
+    uint32_t    first_lba;              /* First sector */
+    uint32_t    sector_count;           /* Number of sectors */
+} mbr_partition_entry_t;
+
+/* GPT header (LBA 1) */
+typedef struct __attribute__((packed)) {
+    char        signature[8];           /* "EFI PART" */
+    uint32_t    revision;
+    uint32_t    header_size;
+    uint32_t    header_crc32;           /* CRC32 of header_size bytes, this field zeroed */
+    uint32_t    reserved;
+    uint64_t    current_lba;
+    uint64_t    backup_lba;
+    uint64_t    first_usable_lba;
+    uint64_t    last_usable_lba;
+    uint8_t     disk_guid[16];
+    uint64_t    partition_entry_lba;    /* First sector of the entry array */
+    uint32_t    num_partition_entries;
+    uint32_t    partition_entry_size;
+    uint32_t    partition_entries_crc32;
+} gpt_header_t;
+
+/* GPT partition entry (first 128 bytes) */
+typedef struct __attribute__((packed)) {
+    uint8_t     type_guid[16];          /* All zero = unused */
+    uint8_t     unique_guid[16];
+    uint64_t    first_lba;
+    uint64_t    last_lba;               /* Inclusive */
+    uint64_t    attributes;
+    uint16_t    name[36];               /* UTF-16LE */
+} gpt_partition_entry_t;
+
+/* Partition scheme */
+typedef enum {
+    PARTITION_SCHEME_NONE = 0,
+    PARTITION_SCHEME_MBR,
+    PARTITION_SCHEME_GPT
+} partition_scheme_t;
+
+/* Registered partition */
+typedef struct {
+    block_device_t* device;             /* Partition block device */
+    block_device_t* disk;               /* Whole-disk device */
+    partition_scheme_t scheme;          /* Table the entry came from */
+    uint8_t number;                     /* 1-based index in the table */
+    uint8_t mbr_type;                   /* MBR type byte (0 for GPT) */
+    uint8_t type_guid[16];              /* GPT type GUID (zero for MBR) */
+    bool bootable;                      /* MBR active flag */
+} partition_info_t;
+
+/* Scan a disk's partition table and register its partitions */
+uint32_t partition_scan(block_device_t* disk);
+
+/* Scan every whole-disk device in the registry */
+uint32_t partition_scan_all(void);
+
+/* Registered partitions */
+const partition_info_t* partition_get_info(uint32_t index);
+uint32_t partition_get_count(void);
+
+#endif /* PARTITION_H */
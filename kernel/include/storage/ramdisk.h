@@ -0,0 +1,23 @@
+/*
+ * RAM Disk Header
+ * ChanUX Operating System
+ *
+ * Memory-backed block devices for file system tests and for measuring
+ * file system CPU cost without disk latency.
+ */
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "../common/types.h"
+#include "block.h"
+
+#define RAMDISK_MAX_DEVICES     4
+
+/* Create a zero-filled RAM disk and register it as name (e.g. "ram0") */
+block_device_t* ramdisk_create(const char* name, uint32_t sector_count);
+
+/* Unregister a RAM disk and release its memory */
+void ramdisk_destroy(block_device_t* device);
+
+#endif /* RAMDISK_H */
@@ -13,6 +13,12 @@
 #define SYS_KILL        6
 #define SYS_WAITPID     7
 #define SYS_EXEC        8
+#define SYS_OPEN        9
+#define SYS_CLOSE       10
+#define SYS_READ        11
+#define SYS_WRITE       12
+#define SYS_SEEK        13
+#define SYS_CHDIR       14
 
 /* System call interface */
 void syscalls_init(void);
@@ -27,6 +33,12 @@ void sys_yield(void);
 int sys_kill(uint32_t pid, int signal);
 int sys_waitpid(uint32_t pid);
 int sys_exec(const char* path, char* const argv[]);
+int sys_open(const char* path, uint32_t flags);
+int sys_close(int fd);
+int sys_read(int fd, void* buffer, uint32_t size);
+int sys_write(int fd, const void* buffer, uint32_t size);
+int sys_seek(int fd, int32_t offset, int origin);
+int sys_chdir(const char* path);
 
 /* Helper functions */
 void setup_syscall_interrupt(void);
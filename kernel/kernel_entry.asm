@@ -9,6 +9,8 @@
 [EXTERN kernel_main]   ; C 함수 kernel_main을 외부 참조로 선언
                        ; 링커가 kernel.c에서 정의된 kernel_main 함수와 연결해줌
                        ; EXTERN: 다른 오브젝트 파일에 정의된 심볼을 참조
+[EXTERN __bss_start]   ; kernel.ld에서 정의된 BSS 시작/끝 주소
+[EXTERN __bss_end]
 
 ; === 전역 심볼 선언 ===
 ; 링커가 이 주소를 찾을 수 있도록 전역 심볼로 선언
@@ -30,12 +32,24 @@ _start:
     
     ; === 2단계: 커널용 스택 설정 ===
     ; C 함수 호출과 지역 변수를 위한 스택 포인터 초기화
-    ; 2단계 부트로더에서 설정한 스택(0x90000)과 같은 위치 사용
-    mov esp, 0x90000              ; ESP = 0x90000 (576KB 위치)
+    ; BSS가 0x90000 근처까지 커졌으므로 1MB-2MB 영역을 커널 스택으로 사용
+    ; (A20은 2단계 부트로더에서 활성화됨, 2MB 이상은 페이지 풀)
+    mov esp, 0x200000             ; ESP = 0x200000 (2MB 위치)
                                    ; 스택은 높은 주소에서 낮은 주소로 자라므로
                                    ; 이 위치에서 아래쪽으로 스택이 확장됨
                                    ; 충분한 스택 공간 확보 (커널 함수 호출용)
     
+    ; === 2-1단계: BSS 영역 0으로 초기화 ===
+    ; 부트로더는 고정된 섹터 수만큼 읽으므로 커널 이미지 뒤의 디스크 내용이
+    ; BSS 영역에 들어올 수 있음 - C 코드 실행 전에 0으로 채움
+    cld
+    xor eax, eax
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    shr ecx, 2                     ; BSS는 4바이트 정렬 (kernel.ld)
+    rep stosd
+    
     ; === 3단계: C 커널 메인 함수 호출 ===
     ; 어셈블리에서 C 언어로 제어권 이양
     ; 이후 모든 커널 로직은 C 언어로 구현됨 (더 복잡한 기능 구현 용이)
@@ -98,6 +98,18 @@ void timer_heartbeat_callback(void) {
     }
 }
 
+/* Pick the device to mount: the first partition holding FAT32, else the whole primary disk */
+static block_device_t* kernel_find_root_device(void) {
+    for (uint32_t i = 0; i < partition_get_count(); i++) {
+        const partition_info_t* info = partition_get_info(i);
+        if (fat32_check_filesystem(info->device) == FAT32_SUCCESS) {
+            return info->device;
+        }
+    }
+    
+    return block_find("hda");
+}
+
 /* Initialize kernel subsystems */
 void kernel_initialize(void) {
     /* Initialize terminal first - this includes VGA initialization */
@@ -109,6 +121,10 @@ void kernel_initialize(void) {
     /* Test basic terminal functionality */
     terminal_writestring("Terminal initialized...\n");
     
+    /* Set up the page pool above the kernel */
+    memory_initialize();
+    terminal_writestring("Memory pool initialized...\n");
+    
     /* Initialize FPU before interrupts */
     fpu_initialize();
     terminal_writestring("FPU initialized...\n");
@@ -142,9 +158,37 @@ void kernel_initialize(void) {
     hdd_initialize();
     terminal_writestring("HDD initialized...\n");
     
-    /* Initialize FAT32 file system on primary master */
-    fat32_initialize(HDD_PRIMARY_MASTER);
-    terminal_writestring("FAT32 file system initialized on primary master HDD...\n");
+    /* Register detected drives as block devices */
+    block_initialize();
+    terminal_writestring("Block devices registered...\n");
+    
+    /* Expose MBR/GPT partitions as block devices */
+    partition_scan_all();
+    terminal_writestring("Partition tables scanned...\n");
+    
+    /* Initialize FAT32 file system on the first FAT32 partition */
+    block_device_t* root_device = kernel_find_root_device();
+    fat32_initialize(root_device);
+    terminal_writestring("FAT32 file system initialized on ");
+    terminal_writestring(root_device ? root_device->name : "(none)");
+    terminal_writestring("...\n");
+    
+    /* Put the FAT32 volume at the root of the VFS namespace */
+    vfs_initialize();
+    fat32_vfs_register();
+    tmpfs_register();
+    if (vfs_mount("fat32", root_device, "/") == VFS_SUCCESS) {
+        terminal_writestring("VFS root mounted...\n");
+    } else {
+        /* No disk: keep a usable, memory-only namespace */
+        vfs_mount("tmpfs", NULL, "/");
+    }
+    
+    /* Scratch files stay in memory */
+    vfs_mkdir("/tmp");
+    if (vfs_mount("tmpfs", NULL, "/tmp") == VFS_SUCCESS) {
+        terminal_writestring("tmpfs mounted on /tmp...\n");
+    }
     
     /* Set default color scheme */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -173,6 +217,20 @@ void kernel_main(void) {
     terminal_writeline("Kernel initialized successfully!");
     terminal_writeline("Interrupts enabled. System ready.");
     
+#ifdef KERNEL_BENCHMARK
+    /* Storage benchmarks need the timer running */
+    hdd_benchmark(HDD_PRIMARY_MASTER, KERNEL_BENCHMARK_SECTORS);
+    
+    /* Same volume through the block layer on a RAM disk, without ATA */
+    block_device_t* bench_disk = ramdisk_create("bench0", KERNEL_BENCHMARK_SECTORS);
+    if (bench_disk) {
+        block_benchmark(bench_disk, KERNEL_BENCHMARK_SECTORS);
+        ramdisk_destroy(bench_disk);
+    } else {
+        terminal_writeline("Block benchmark: RAM disk allocation failed");
+    }
+#endif
+    
     /* Start context switching test */
     process_test_context_switching();
     
@@ -232,3 +232,18 @@ int string_to_int(const char* str) {
     
     return result * sign;
 }
+
+/* CRC-32 (IEEE 802.3), continuing from a previous value (start with 0) */
+uint32_t crc32(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    
+    return ~crc;
+}
@@ -0,0 +1,616 @@
+/*
+ * tmpfs - RAM-backed filesystem
+ * ChanUX Operating System
+ *
+ * A tree of nodes kept entirely in memory, for scratch files that never
+ * need to reach the disk. File data lives in pages from the kernel page
+ * allocator, found through a per-file page table that grows by doubling,
+ * so appending and random access are both O(1). Directories hash their
+ * entries into one page of buckets and also keep them in creation order
+ * for readdir. Each open directory has its own cursor into that order,
+ * which removing an entry moves past it.
+ *
+ * Each mount has a size limit in pages that covers file data, page
+ * tables, bucket pages and nodes. Nodes are carved from pages shared by
+ * all mounts; those pages are kept for reuse rather than returned.
+ */
+
+#include "../../include/fs/tmpfs.h"
+#include "../../include/fs/vfs.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+#define TMPFS_DIR_BUCKETS       (MEMORY_PAGE_SIZE / sizeof(void*))
+#define TMPFS_TABLE_SLOTS       (MEMORY_PAGE_SIZE / sizeof(void*))  /* Page table entries per page */
+
+struct tmpfs_dir_handle;
+
+typedef struct tmpfs_node {
+    vfs_type_t type;
+    uint32_t ino;
+    uint32_t size;
+    uint32_t hash;
+    struct tmpfs_node* parent;
+    struct tmpfs_node* hash_next;       /* Next in the parent's bucket */
+    struct tmpfs_node* prev;            /* Parent's entries in creation order */
+    struct tmpfs_node* next;
+
+    /* Files */
+    uint8_t** pages;                    /* Page table; NULL until data is written */
+    uint32_t table_slots;               /* Capacity of the page table */
+    uint32_t page_count;                /* Data pages allocated */
+
+    /* Directories */
+    struct tmpfs_node** buckets;        /* One page; NULL while empty */
+    struct tmpfs_node* first;
+    struct tmpfs_node* last;
+    uint32_t entries;
+    struct tmpfs_dir_handle* handles;   /* Open handles listing this directory */
+
+    char name[VFS_NAME_MAX + 1];
+} tmpfs_node_t;
+
+/* Open directory: the listing position of one vfs_open */
+typedef struct tmpfs_dir_handle {
+    tmpfs_node_t* dir;
+    tmpfs_node_t* cursor;               /* Entry readdir returns next; NULL at the end */
+    bool started;                       /* cursor is set (the first readdir starts at dir->first) */
+    struct tmpfs_dir_handle* next;      /* In the directory's handle list, or the free list */
+} tmpfs_dir_handle_t;
+
+/* One mounted instance */
+typedef struct {
+    bool in_use;
+    tmpfs_node_t* root;
+    uint32_t max_pages;
+    uint32_t pages_used;                /* Data, page table and bucket pages */
+    uint32_t nodes;
+    uint32_t next_ino;
+} tmpfs_fs_t;
+
+static tmpfs_fs_t tmpfs_instances[TMPFS_MAX_MOUNTS];
+static tmpfs_node_t* tmpfs_free_nodes = NULL;       /* Linked through next */
+static tmpfs_dir_handle_t* tmpfs_free_handles = NULL;
+
+/* ========================================================================
+ * Space Accounting and Nodes
+ * ======================================================================== */
+
+static uint32_t tmpfs_node_pages(uint32_t nodes) {
+    return (nodes * sizeof(tmpfs_node_t) + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+}
+
+static bool tmpfs_fits(const tmpfs_fs_t* fs, uint32_t pages, uint32_t nodes) {
+    return fs->pages_used + pages + tmpfs_node_pages(fs->nodes + nodes) <= fs->max_pages;
+}
+
+/* Allocate pages charged to fs */
+static void* tmpfs_alloc_pages(tmpfs_fs_t* fs, uint32_t count) {
+    void* pages;
+
+    if (!tmpfs_fits(fs, count, 0)) {
+        return NULL;
+    }
+    pages = memory_alloc_pages(count);
+    if (pages) {
+        fs->pages_used += count;
+    }
+    return pages;
+}
+
+static void tmpfs_free_pages(tmpfs_fs_t* fs, void* pages, uint32_t count) {
+    memory_free_pages(pages, count);
+    fs->pages_used -= count;
+}
+
+static tmpfs_node_t* tmpfs_node_alloc(tmpfs_fs_t* fs, vfs_type_t type, const char* name) {
+    tmpfs_node_t* node;
+
+    if (!tmpfs_fits(fs, 0, 1)) {
+        return NULL;
+    }
+    if (tmpfs_free_nodes == NULL) {
+        tmpfs_node_t* slab = (tmpfs_node_t*)memory_alloc_pages(1);
+        if (slab == NULL) {
+            return NULL;
+        }
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE / sizeof(tmpfs_node_t); i++) {
+            slab[i].next = tmpfs_free_nodes;
+            tmpfs_free_nodes = &slab[i];
+        }
+    }
+
+    node = tmpfs_free_nodes;
+    tmpfs_free_nodes = node->next;
+    memset(node, 0, sizeof(tmpfs_node_t));
+    node->type = type;
+    node->ino = fs->next_ino++;
+    strcpy(node->name, name);
+    fs->nodes++;
+    return node;
+}
+
+/* Release a node that is no longer linked, with its data */
+static void tmpfs_node_free(tmpfs_fs_t* fs, tmpfs_node_t* node) {
+    for (uint32_t i = 0; i < node->page_count; i++) {
+        tmpfs_free_pages(fs, node->pages[i], 1);
+    }
+    if (node->pages) {
+        tmpfs_free_pages(fs, node->pages, node->table_slots / TMPFS_TABLE_SLOTS);
+    }
+    if (node->buckets) {
+        tmpfs_free_pages(fs, node->buckets, 1);
+    }
+
+    node->type = VFS_TYPE_NONE;
+    node->next = tmpfs_free_nodes;
+    tmpfs_free_nodes = node;
+    fs->nodes--;
+}
+
+/* ========================================================================
+ * Directories
+ * ======================================================================== */
+
+static uint32_t tmpfs_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static tmpfs_node_t* tmpfs_dir_find(const tmpfs_node_t* dir, const char* name) {
+    uint32_t hash = tmpfs_hash(name);
+
+    if (dir->buckets == NULL) {
+        return NULL;
+    }
+    for (tmpfs_node_t* node = dir->buckets[hash % TMPFS_DIR_BUCKETS]; node; node = node->hash_next) {
+        if (node->hash == hash && strcmp(node->name, name) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/* Make sure dir can take an entry; the bucket page comes with the first */
+static bool tmpfs_dir_prepare(tmpfs_fs_t* fs, tmpfs_node_t* dir) {
+    if (dir->buckets == NULL) {
+        dir->buckets = (tmpfs_node_t**)tmpfs_alloc_pages(fs, 1);
+        if (dir->buckets == NULL) {
+            return false;
+        }
+        memset(dir->buckets, 0, MEMORY_PAGE_SIZE);
+    }
+    return true;
+}
+
+static void tmpfs_dir_link(tmpfs_node_t* dir, tmpfs_node_t* node) {
+    uint32_t bucket;
+
+    node->hash = tmpfs_hash(node->name);
+    bucket = node->hash % TMPFS_DIR_BUCKETS;
+    node->hash_next = dir->buckets[bucket];
+    dir->buckets[bucket] = node;
+
+    node->parent = dir;
+    node->next = NULL;
+    node->prev = dir->last;
+    if (dir->last) {
+        dir->last->next = node;
+    } else {
+        dir->first = node;
+    }
+    dir->last = node;
+    dir->entries++;
+}
+
+static void tmpfs_dir_unlink(tmpfs_node_t* node) {
+    tmpfs_node_t* dir = node->parent;
+    tmpfs_node_t** link = &dir->buckets[node->hash % TMPFS_DIR_BUCKETS];
+
+    while (*link && *link != node) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = node->hash_next;
+    }
+
+    /* Listings that would return this entry next go on to the one after */
+    for (tmpfs_dir_handle_t* handle = dir->handles; handle; handle = handle->next) {
+        if (handle->cursor == node) {
+            handle->cursor = node->next;
+        }
+    }
+
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        dir->first = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        dir->last = node->prev;
+    }
+    node->parent = NULL;
+    node->hash_next = node->prev = node->next = NULL;
+    dir->entries--;
+}
+
+/* Handles come from pages shared by all mounts, like nodes */
+static tmpfs_dir_handle_t* tmpfs_dir_open(tmpfs_node_t* dir) {
+    tmpfs_dir_handle_t* handle;
+
+    if (tmpfs_free_handles == NULL) {
+        tmpfs_dir_handle_t* slab = (tmpfs_dir_handle_t*)memory_alloc_pages(1);
+        if (slab == NULL) {
+            return NULL;
+        }
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE / sizeof(tmpfs_dir_handle_t); i++) {
+            slab[i].next = tmpfs_free_handles;
+            tmpfs_free_handles = &slab[i];
+        }
+    }
+
+    handle = tmpfs_free_handles;
+    tmpfs_free_handles = handle->next;
+    handle->dir = dir;
+    handle->cursor = NULL;
+    handle->started = false;
+    handle->next = dir->handles;
+    dir->handles = handle;
+    return handle;
+}
+
+static void tmpfs_dir_close(tmpfs_dir_handle_t* handle) {
+    tmpfs_dir_handle_t** link = &handle->dir->handles;
+
+    while (*link && *link != handle) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = handle->next;
+    }
+    handle->next = tmpfs_free_handles;
+    tmpfs_free_handles = handle;
+}
+
+/* ========================================================================
+ * File Data
+ * ======================================================================== */
+
+/* Grow the page table to hold at least count pages, doubling its size */
+static bool tmpfs_file_grow_table(tmpfs_fs_t* fs, tmpfs_node_t* node, uint32_t count) {
+    uint32_t slots = node->table_slots ? node->table_slots : TMPFS_TABLE_SLOTS;
+    uint8_t** table;
+
+    while (slots < count) {
+        slots *= 2;
+    }
+    if (slots == node->table_slots) {
+        return true;
+    }
+
+    table = (uint8_t**)tmpfs_alloc_pages(fs, slots / TMPFS_TABLE_SLOTS);
+    if (table == NULL) {
+        return false;
+    }
+    if (node->pages) {
+        memcpy(table, node->pages, node->page_count * sizeof(uint8_t*));
+        tmpfs_free_pages(fs, node->pages, node->table_slots / TMPFS_TABLE_SLOTS);
+    }
+    node->pages = table;
+    node->table_slots = slots;
+    return true;
+}
+
+/* Back the file with zeroed pages up to count */
+static vfs_result_t tmpfs_file_reserve(tmpfs_fs_t* fs, tmpfs_node_t* node, uint32_t count) {
+    if (count <= node->page_count) {
+        return VFS_SUCCESS;
+    }
+    if (!tmpfs_file_grow_table(fs, node, count)) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    while (node->page_count < count) {
+        uint8_t* page = (uint8_t*)tmpfs_alloc_pages(fs, 1);
+        if (page == NULL) {
+            return VFS_ERROR_NO_SPACE;
+        }
+        memset(page, 0, MEMORY_PAGE_SIZE);
+        node->pages[node->page_count++] = page;
+    }
+    return VFS_SUCCESS;
+}
+
+/* Set the size; bytes past the end of a file are always kept zero */
+static vfs_result_t tmpfs_file_resize(tmpfs_fs_t* fs, tmpfs_node_t* node, uint32_t size) {
+    uint32_t count = (size + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    vfs_result_t result;
+
+    if (size > node->size) {
+        result = tmpfs_file_reserve(fs, node, count);
+        if (result == VFS_SUCCESS) {
+            node->size = size;
+        }
+        return result;
+    }
+
+    while (node->page_count > count) {
+        tmpfs_free_pages(fs, node->pages[--node->page_count], 1);
+    }
+    if (size % MEMORY_PAGE_SIZE) {
+        memset(&node->pages[count - 1][size % MEMORY_PAGE_SIZE], 0, MEMORY_PAGE_SIZE - size % MEMORY_PAGE_SIZE);
+    }
+    if (node->page_count == 0 && node->pages) {
+        tmpfs_free_pages(fs, node->pages, node->table_slots / TMPFS_TABLE_SLOTS);
+        node->pages = NULL;
+        node->table_slots = 0;
+    }
+    node->size = size;
+    return VFS_SUCCESS;
+}
+
+/* ========================================================================
+ * VFS Operations
+ * ======================================================================== */
+
+static void tmpfs_fill(vfs_vnode_t* vnode, tmpfs_node_t* node) {
+    vnode->type = node->type;
+    vnode->size = node->size;
+    vnode->ino = node->ino;
+    vnode->data = node;
+}
+
+static vfs_result_t tmpfs_mount(vfs_mount_t* mount, void* source, vfs_vnode_t* root) {
+    const tmpfs_options_t* options = (const tmpfs_options_t*)source;
+    tmpfs_fs_t* fs = NULL;
+
+    for (uint32_t i = 0; i < TMPFS_MAX_MOUNTS && fs == NULL; i++) {
+        if (!tmpfs_instances[i].in_use) {
+            fs = &tmpfs_instances[i];
+        }
+    }
+    if (fs == NULL) {
+        return VFS_ERROR_BUSY;
+    }
+
+    memset(fs, 0, sizeof(tmpfs_fs_t));
+    fs->max_pages = (options && options->max_pages) ? options->max_pages
+                                                    : memory_get_free_pages() / TMPFS_DEFAULT_SHARE;
+    fs->next_ino = 1;
+    fs->root = tmpfs_node_alloc(fs, VFS_TYPE_DIRECTORY, "");
+    if (fs->root == NULL) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    fs->in_use = true;
+    mount->data = fs;
+    tmpfs_fill(root, fs->root);
+    return VFS_SUCCESS;
+}
+
+/* Free the whole tree, leaves first */
+static void tmpfs_unmount(vfs_mount_t* mount) {
+    tmpfs_fs_t* fs = (tmpfs_fs_t*)mount->data;
+    tmpfs_node_t* node = fs->root;
+
+    while (node) {
+        if (node->first) {
+            node = node->first;
+            continue;
+        }
+
+        tmpfs_node_t* parent = node->parent;
+        if (parent) {
+            tmpfs_dir_unlink(node);
+        }
+        tmpfs_node_free(fs, node);
+        node = parent;
+    }
+    fs->in_use = false;
+}
+
+static vfs_result_t tmpfs_lookup(vfs_vnode_t* dir, vfs_vnode_t* vnode) {
+    tmpfs_node_t* node = tmpfs_dir_find((tmpfs_node_t*)dir->data, vnode->name);
+
+    if (node == NULL) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    tmpfs_fill(vnode, node);
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t tmpfs_create(vfs_vnode_t* dir, vfs_vnode_t* vnode, vfs_type_t type) {
+    tmpfs_fs_t* fs = (tmpfs_fs_t*)dir->mount->data;
+    tmpfs_node_t* parent = (tmpfs_node_t*)dir->data;
+    tmpfs_node_t* node;
+
+    if (tmpfs_dir_find(parent, vnode->name)) {
+        return VFS_ERROR_EXISTS;
+    }
+    if (!tmpfs_dir_prepare(fs, parent)) {
+        return VFS_ERROR_NO_SPACE;
+    }
+    node = tmpfs_node_alloc(fs, type, vnode->name);
+    if (node == NULL) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    tmpfs_dir_link(parent, node);
+    tmpfs_fill(vnode, node);
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t tmpfs_remove(vfs_vnode_t* dir, vfs_vnode_t* vnode) {
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->data;
+
+    (void)dir;
+    if (node->type == VFS_TYPE_DIRECTORY && node->entries != 0) {
+        return VFS_ERROR_NOT_EMPTY;
+    }
+    if (node->type == VFS_TYPE_DIRECTORY && node->handles != NULL) {
+        return VFS_ERROR_BUSY;
+    }
+    tmpfs_dir_unlink(node);
+    tmpfs_node_free((tmpfs_fs_t*)vnode->mount->data, node);
+    vnode->data = NULL;
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t tmpfs_rename(vfs_vnode_t* vnode, vfs_vnode_t* new_dir, const char* new_name) {
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->data;
+    tmpfs_node_t* parent = (tmpfs_node_t*)new_dir->data;
+
+    if (tmpfs_dir_find(parent, new_name)) {
+        return VFS_ERROR_EXISTS;
+    }
+    if (!tmpfs_dir_prepare((tmpfs_fs_t*)vnode->mount->data, parent)) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    tmpfs_dir_unlink(node);
+    strcpy(node->name, new_name);
+    tmpfs_dir_link(parent, node);
+    return VFS_SUCCESS;
+}
+
+/* Open files need no state of their own; the node is the handle. Open
+ * directories get a handle holding their listing position. */
+static vfs_result_t tmpfs_open(vfs_vnode_t* vnode, uint32_t flags, void** handle) {
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->data;
+
+    (void)flags;
+    if (node->type == VFS_TYPE_DIRECTORY) {
+        *handle = tmpfs_dir_open(node);
+        return *handle ? VFS_SUCCESS : VFS_ERROR_NO_MEMORY;
+    }
+    *handle = node;
+    return VFS_SUCCESS;
+}
+
+static void tmpfs_close(vfs_vnode_t* vnode, void* handle) {
+    if (vnode->type == VFS_TYPE_DIRECTORY) {
+        tmpfs_dir_close((tmpfs_dir_handle_t*)handle);
+    }
+}
+
+static vfs_result_t tmpfs_read(vfs_vnode_t* vnode, void* handle, uint32_t offset, void* buffer, uint32_t size,
+                               uint32_t* done) {
+    tmpfs_node_t* node = (tmpfs_node_t*)handle;
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t copied = 0;
+
+    (void)vnode;
+    if (offset >= node->size) {
+        *done = 0;
+        return VFS_SUCCESS;
+    }
+    if (size > node->size - offset) {
+        size = node->size - offset;
+    }
+
+    while (copied < size) {
+        uint32_t in_page = (offset + copied) % MEMORY_PAGE_SIZE;
+        uint32_t chunk = MEMORY_PAGE_SIZE - in_page;
+
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        memcpy(&out[copied], &node->pages[(offset + copied) / MEMORY_PAGE_SIZE][in_page], chunk);
+        copied += chunk;
+    }
+
+    *done = copied;
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t tmpfs_write(vfs_vnode_t* vnode, void* handle, uint32_t offset, const void* buffer,
+                                uint32_t size, uint32_t* done) {
+    tmpfs_fs_t* fs = (tmpfs_fs_t*)vnode->mount->data;
+    tmpfs_node_t* node = (tmpfs_node_t*)handle;
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t end = offset + size;
+    uint32_t copied = 0;
+    vfs_result_t result;
+
+    *done = 0;
+    if (end < offset) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    result = tmpfs_file_reserve(fs, node, (end + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+
+    while (copied < size) {
+        uint32_t in_page = (offset + copied) % MEMORY_PAGE_SIZE;
+        uint32_t chunk = MEMORY_PAGE_SIZE - in_page;
+
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        memcpy(&node->pages[(offset + copied) / MEMORY_PAGE_SIZE][in_page], &in[copied], chunk);
+        copied += chunk;
+    }
+
+    if (end > node->size) {
+        node->size = end;
+    }
+    *done = copied;
+    return VFS_SUCCESS;
+}
+
+/* The handle walks the directory in order, so index is not needed */
+static vfs_result_t tmpfs_readdir(vfs_vnode_t* vnode, void* handle, uint32_t index, vfs_dirent_t* entry) {
+    tmpfs_dir_handle_t* listing = (tmpfs_dir_handle_t*)handle;
+    tmpfs_node_t* node;
+
+    (void)vnode;
+    (void)index;
+    if (!listing->started) {
+        listing->cursor = listing->dir->first;
+        listing->started = true;
+    }
+    node = listing->cursor;
+    if (node == NULL) {
+        return VFS_ERROR_EOF;
+    }
+    listing->cursor = node->next;
+
+    strcpy(entry->name, node->name);
+    entry->type = node->type;
+    entry->size = node->size;
+    entry->ino = node->ino;
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t tmpfs_truncate(vfs_vnode_t* vnode, void* handle, uint32_t size) {
+    return tmpfs_file_resize((tmpfs_fs_t*)vnode->mount->data, (tmpfs_node_t*)handle, size);
+}
+
+static const vfs_ops_t tmpfs_ops = {
+    .mount = tmpfs_mount,
+    .unmount = tmpfs_unmount,
+    .lookup = tmpfs_lookup,
+    .create = tmpfs_create,
+    .remove = tmpfs_remove,
+    .rename = tmpfs_rename,
+    .open = tmpfs_open,
+    .close = tmpfs_close,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .readdir = tmpfs_readdir,
+    .truncate = tmpfs_truncate,
+    .sync = NULL,
+    .release = NULL
+};
+
+/* Register the "tmpfs" filesystem type with the VFS */
+void tmpfs_register(void) {
+    vfs_register_filesystem("tmpfs", &tmpfs_ops, 0);
+}
@@ -0,0 +1,1573 @@
+/*
+ * Virtual File System
+ * ChanUX Operating System
+ *
+ * One namespace over every mounted filesystem. Backends register a
+ * vfs_ops_t table; the VFS owns everything above it: path walking, the
+ * mount table, the vnode cache, open file descriptions and per-process
+ * working directories and descriptor tables.
+ *
+ * The vnode cache is also the dentry cache. Every vnode is hashed by its
+ * parent and name, failed lookups are kept as negative vnodes, and a vnode
+ * nobody references stays cached on an LRU list until the pool runs out.
+ * A cached vnode holds a reference on its parent, so directories are only
+ * reclaimed after their children.
+ *
+ * Every entry point runs under one VFS lock, so backends see one
+ * operation at a time and may block inside it.
+ */
+
+#include "../../include/fs/vfs.h"
+#include "../../include/process/process.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+static bool vfs_initialized = false;
+static vfs_filesystem_t vfs_filesystems[VFS_MAX_FILESYSTEMS];
+static uint32_t vfs_filesystem_count = 0;
+static vfs_mount_t vfs_mounts[VFS_MAX_MOUNTS];
+static vfs_file_t vfs_files[VFS_MAX_OPEN_FILES];
+static vfs_vnode_t* vfs_root = NULL;            /* Root of the "/" mount */
+
+/* Vnode cache */
+static vfs_vnode_t* vfs_vnodes = NULL;
+static uint32_t vfs_vnode_count = 0;
+static vfs_vnode_t* vfs_free_vnodes = NULL;     /* Linked through hash_next */
+static vfs_vnode_t* vfs_hash[VFS_HASH_BUCKETS];
+static vfs_vnode_t* vfs_lru_head = NULL;        /* Least recently released */
+static vfs_vnode_t* vfs_lru_tail = NULL;
+
+/* File system context of the kernel itself, used outside any process */
+static vfs_vnode_t* vfs_kernel_cwd = NULL;
+static vfs_file_t* vfs_kernel_files[PROCESS_MAX_FILES];
+
+static vfs_stats_t vfs_stats;
+
+/* ========================================================================
+ * Locking
+ * ======================================================================== */
+
+/* One lock over the namespace, the vnode cache and the open file table.
+ * Backends may yield, so without it another process could take the same
+ * free vfs_files slot or vnode, or unlink a vnode from the hash or LRU
+ * lists half way through a walk. Taken before any backend lock. */
+static volatile bool vfs_locked = false;
+
+static bool vfs_try_lock(void) {
+    uint32_t flags;
+    bool acquired;
+
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    acquired = !vfs_locked;
+    if (acquired) {
+        vfs_locked = true;
+    }
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+    return acquired;
+}
+
+static void vfs_lock(void) {
+    while (!vfs_try_lock()) {
+        if (get_current_process()) {
+            process_yield();
+        }
+    }
+}
+
+static void vfs_unlock(void) {
+    vfs_locked = false;
+}
+
+/* ========================================================================
+ * Vnode Cache
+ * ======================================================================== */
+
+static char vfs_fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/* Hash names case-folded so one hash serves both kinds of filesystem */
+static uint32_t vfs_hash_name(const vfs_vnode_t* parent, const char* name) {
+    uint32_t hash = (uint32_t)parent * 2654435761u;
+
+    while (*name) {
+        hash = (hash ^ (uint8_t)vfs_fold(*name++)) * 16777619u;
+    }
+    return hash;
+}
+
+static bool vfs_name_equal(const vfs_mount_t* mount, const char* a, const char* b) {
+    if (!(mount->fs->flags & VFS_FS_CASE_INSENSITIVE)) {
+        return strcmp(a, b) == 0;
+    }
+    while (*a && vfs_fold(*a) == vfs_fold(*b)) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void vfs_lru_remove(vfs_vnode_t* node) {
+    if (node->lru_prev) {
+        node->lru_prev->lru_next = node->lru_next;
+    } else {
+        vfs_lru_head = node->lru_next;
+    }
+    if (node->lru_next) {
+        node->lru_next->lru_prev = node->lru_prev;
+    } else {
+        vfs_lru_tail = node->lru_prev;
+    }
+    node->lru_prev = NULL;
+    node->lru_next = NULL;
+}
+
+static void vfs_lru_append(vfs_vnode_t* node) {
+    node->lru_next = NULL;
+    node->lru_prev = vfs_lru_tail;
+    if (vfs_lru_tail) {
+        vfs_lru_tail->lru_next = node;
+    } else {
+        vfs_lru_head = node;
+    }
+    vfs_lru_tail = node;
+}
+
+static void vfs_hash_insert(vfs_vnode_t* node) {
+    uint32_t bucket = node->hash & (VFS_HASH_BUCKETS - 1);
+
+    node->hash_next = vfs_hash[bucket];
+    vfs_hash[bucket] = node;
+}
+
+static void vfs_hash_remove(vfs_vnode_t* node) {
+    vfs_vnode_t** link = &vfs_hash[node->hash & (VFS_HASH_BUCKETS - 1)];
+
+    while (*link) {
+        if (*link == node) {
+            *link = node->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    node->hash_next = NULL;
+}
+
+static vfs_vnode_t* vfs_hash_find(vfs_vnode_t* parent, const char* name, uint32_t hash) {
+    for (vfs_vnode_t* node = vfs_hash[hash & (VFS_HASH_BUCKETS - 1)]; node; node = node->hash_next) {
+        if (node->hash == hash && node->parent == parent && vfs_name_equal(parent->mount, node->name, name)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void vfs_vnode_get(vfs_vnode_t* node) {
+    if (node->refcount++ == 0 && node->parent) {
+        vfs_lru_remove(node);
+    }
+}
+
+static void vfs_vnode_put(vfs_vnode_t* node);
+
+/* Drop a vnode from the cache: unhash it, let the backend release it and
+ * give back its parent reference */
+static void vfs_vnode_destroy(vfs_vnode_t* node) {
+    vfs_vnode_t* parent = node->parent;
+
+    if (parent) {
+        vfs_hash_remove(node);
+    }
+    if (node->type != VFS_TYPE_NONE && node->mount->fs->ops->release) {
+        node->mount->fs->ops->release(node);
+    }
+    node->type = VFS_TYPE_NONE;
+    node->parent = NULL;
+    node->hash_next = vfs_free_vnodes;
+    vfs_free_vnodes = node;
+    vfs_stats.vnodes_in_use--;
+
+    if (parent) {
+        vfs_vnode_put(parent);
+    }
+}
+
+/* Mount roots are owned by the mount table and never sit on the LRU */
+static void vfs_vnode_put(vfs_vnode_t* node) {
+    if (node == NULL || node->refcount == 0) {
+        return;
+    }
+    if (--node->refcount == 0 && node->parent) {
+        vfs_lru_append(node);
+    }
+}
+
+/* Take a vnode from the free list, reclaiming the oldest unreferenced one
+ * if the pool is exhausted */
+static vfs_vnode_t* vfs_vnode_alloc(void) {
+    vfs_vnode_t* node;
+
+    if (vfs_free_vnodes == NULL && vfs_lru_head != NULL) {
+        node = vfs_lru_head;
+        vfs_lru_remove(node);
+        vfs_vnode_destroy(node);
+        vfs_stats.reclaims++;
+    }
+
+    node = vfs_free_vnodes;
+    if (node == NULL) {
+        return NULL;
+    }
+    vfs_free_vnodes = node->hash_next;
+
+    memset(node, 0, sizeof(vfs_vnode_t));
+    node->refcount = 1;
+    vfs_stats.vnodes_in_use++;
+    return node;
+}
+
+/* New vnode for name in dir, holding a reference on dir; not yet hashed */
+static vfs_vnode_t* vfs_vnode_new(vfs_vnode_t* dir, const char* name) {
+    vfs_vnode_t* node = vfs_vnode_alloc();
+
+    if (node == NULL) {
+        return NULL;
+    }
+    node->mount = dir->mount;
+    node->parent = dir;
+    vfs_vnode_get(dir);
+    strcpy(node->name, name);
+    node->hash = vfs_hash_name(dir, name);
+    return node;
+}
+
+/* Reclaim every unreferenced cached vnode that matches; repeated until
+ * nothing changes, since freeing a child can release its parent */
+static void vfs_vnode_purge(vfs_mount_t* mount, vfs_vnode_t* parent) {
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+        for (uint32_t i = 0; i < vfs_vnode_count; i++) {
+            vfs_vnode_t* node = &vfs_vnodes[i];
+
+            if (node->parent == NULL || node->refcount != 0) {
+                continue;
+            }
+            if ((mount && node->mount == mount) || (parent && node->parent == parent)) {
+                vfs_lru_remove(node);
+                vfs_vnode_destroy(node);
+                progress = true;
+            }
+        }
+    }
+}
+
+/* Turn a removed vnode into a negative entry */
+static void vfs_vnode_forget(vfs_vnode_t* node) {
+    if (node->mount->fs->ops->release) {
+        node->mount->fs->ops->release(node);
+    }
+    node->type = VFS_TYPE_NONE;
+    node->size = 0;
+    node->ino = 0;
+    node->data = NULL;
+}
+
+/* Drop a cached negative entry for name in dir before creating it */
+static void vfs_vnode_drop_negative(vfs_vnode_t* dir, const char* name) {
+    vfs_vnode_t* node = vfs_hash_find(dir, name, vfs_hash_name(dir, name));
+
+    if (node && node->type == VFS_TYPE_NONE && node->refcount == 0) {
+        vfs_lru_remove(node);
+        vfs_vnode_destroy(node);
+    }
+}
+
+/* ========================================================================
+ * Path Walking
+ * ======================================================================== */
+
+static vfs_vnode_t** vfs_cwd_slot(void) {
+    return scheduler.current_process ? &scheduler.current_process->cwd : &vfs_kernel_cwd;
+}
+
+static vfs_file_t** vfs_fd_table(void) {
+    return scheduler.current_process ? scheduler.current_process->files : vfs_kernel_files;
+}
+
+static bool vfs_is_dot(const char* name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+/* Follow mounts stacked on a vnode; the reference moves along */
+static vfs_vnode_t* vfs_cross_mounts(vfs_vnode_t* node) {
+    while (node->mounted) {
+        vfs_vnode_t* root = node->mounted;
+        vfs_vnode_get(root);
+        vfs_vnode_put(node);
+        node = root;
+    }
+    return node;
+}
+
+/* ".." of a directory; a mount root goes up through the vnode it covers */
+static vfs_vnode_t* vfs_dotdot(vfs_vnode_t* node) {
+    while (node->parent == NULL && node->mount->covered) {
+        node = node->mount->covered;
+    }
+    return node->parent ? node->parent : node;
+}
+
+/* Look up one name in a directory. Returns a referenced vnode. */
+static vfs_result_t vfs_lookup(vfs_vnode_t* dir, const char* name, vfs_vnode_t** result) {
+    vfs_vnode_t* node;
+    vfs_result_t status;
+    uint32_t hash;
+
+    if (dir->type != VFS_TYPE_DIRECTORY) {
+        return VFS_ERROR_NOT_DIRECTORY;
+    }
+    if (strlen(name) > VFS_NAME_MAX) {
+        return VFS_ERROR_NAME_TOO_LONG;
+    }
+
+    if (name[0] == '\0' || strcmp(name, ".") == 0) {
+        node = dir;
+        vfs_vnode_get(node);
+        *result = node;
+        return VFS_SUCCESS;
+    }
+    if (strcmp(name, "..") == 0) {
+        node = vfs_dotdot(dir);
+        vfs_vnode_get(node);
+        *result = node;
+        return VFS_SUCCESS;
+    }
+
+    vfs_stats.lookups++;
+    hash = vfs_hash_name(dir, name);
+    node = vfs_hash_find(dir, name, hash);
+    if (node) {
+        if (node->type == VFS_TYPE_NONE) {
+            vfs_stats.negative_hits++;
+            return VFS_ERROR_NOT_FOUND;
+        }
+        vfs_stats.cache_hits++;
+        vfs_vnode_get(node);
+        *result = vfs_cross_mounts(node);
+        return VFS_SUCCESS;
+    }
+
+    node = vfs_vnode_new(dir, name);
+    if (node == NULL) {
+        return VFS_ERROR_NO_MEMORY;
+    }
+    status = dir->mount->fs->ops->lookup(dir, node);
+    if (status == VFS_ERROR_NOT_FOUND) {
+        node->type = VFS_TYPE_NONE;
+    } else if (status != VFS_SUCCESS) {
+        node->refcount = 0;
+        node->type = VFS_TYPE_NONE;
+        vfs_vnode_destroy(node);
+        return status;
+    }
+
+    vfs_hash_insert(node);
+    if (status != VFS_SUCCESS) {
+        vfs_vnode_put(node);
+        return status;
+    }
+    *result = vfs_cross_mounts(node);
+    return VFS_SUCCESS;
+}
+
+/* Walk a path. With name set, the walk stops before the last component,
+ * which is copied to name, and returns its directory. Returns a
+ * referenced vnode. */
+static vfs_result_t vfs_walk(const char* path, vfs_vnode_t** result, char* name) {
+    char component[VFS_NAME_MAX + 1];
+    vfs_vnode_t* node;
+    vfs_result_t status;
+
+    if (!vfs_initialized) {
+        return VFS_ERROR_NOT_INITIALIZED;
+    }
+    if (path == NULL || result == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    if (vfs_root == NULL) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    if (strlen(path) >= VFS_PATH_MAX) {
+        return VFS_ERROR_NAME_TOO_LONG;
+    }
+
+    node = (*path == '/' || *vfs_cwd_slot() == NULL) ? vfs_root : *vfs_cwd_slot();
+    vfs_vnode_get(node);
+
+    while (true) {
+        uint32_t length = 0;
+
+        while (*path == '/') {
+            path++;
+        }
+        while (path[length] && path[length] != '/') {
+            length++;
+        }
+        if (length > VFS_NAME_MAX) {
+            vfs_vnode_put(node);
+            return VFS_ERROR_NAME_TOO_LONG;
+        }
+        memcpy(component, path, length);
+        component[length] = '\0';
+        path += length;
+        while (*path == '/') {
+            path++;
+        }
+
+        /* Last component: hand it back when the parent was asked for */
+        if (*path == '\0' && name) {
+            if (node->type != VFS_TYPE_DIRECTORY) {
+                vfs_vnode_put(node);
+                return VFS_ERROR_NOT_DIRECTORY;
+            }
+            strcpy(name, component);
+            *result = node;
+            return VFS_SUCCESS;
+        }
+
+        if (length > 0) {
+            vfs_vnode_t* next;
+
+            status = vfs_lookup(node, component, &next);
+            vfs_vnode_put(node);
+            if (status != VFS_SUCCESS) {
+                return status;
+            }
+            node = next;
+        }
+
+        if (*path == '\0') {
+            *result = node;
+            return VFS_SUCCESS;
+        }
+    }
+}
+
+/* Append the path of node below stop (exclusive) to buffer, back to front */
+static vfs_result_t vfs_build_path(vfs_vnode_t* node, bool cross_mounts, char* buffer, uint32_t size) {
+    uint32_t length = 0;
+    uint32_t position;
+    vfs_vnode_t* walk;
+
+    if (node == NULL || buffer == NULL || size < 2) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (walk = node; ; walk = walk->parent) {
+        while (cross_mounts && walk->parent == NULL && walk->mount->covered) {
+            walk = walk->mount->covered;
+        }
+        if (walk->parent == NULL) {
+            break;
+        }
+        length += strlen(walk->name) + 1;
+    }
+    if (length == 0) {
+        strcpy(buffer, "/");
+        return VFS_SUCCESS;
+    }
+    if (length >= size) {
+        return VFS_ERROR_NAME_TOO_LONG;
+    }
+
+    position = length;
+    buffer[position] = '\0';
+    for (walk = node; ; walk = walk->parent) {
+        uint32_t part;
+
+        while (cross_mounts && walk->parent == NULL && walk->mount->covered) {
+            walk = walk->mount->covered;
+        }
+        if (walk->parent == NULL) {
+            break;
+        }
+        part = strlen(walk->name);
+        position -= part;
+        memcpy(&buffer[position], walk->name, part);
+        buffer[--position] = '/';
+    }
+    return VFS_SUCCESS;
+}
+
+/* Path of a vnode relative to the root of its own filesystem */
+vfs_result_t vfs_node_path(vfs_vnode_t* node, char* buffer, uint32_t size) {
+    return vfs_build_path(node, false, buffer, size);
+}
+
+/* ========================================================================
+ * Initialization and Mounting
+ * ======================================================================== */
+
+/* Initialize the VFS and allocate the vnode cache */
+vfs_result_t vfs_initialize(void) {
+    if (vfs_initialized) {
+        return VFS_SUCCESS;
+    }
+
+    vfs_vnodes = (vfs_vnode_t*)memory_alloc_pages(VFS_VNODE_PAGES);
+    if (vfs_vnodes == NULL) {
+        return VFS_ERROR_NO_MEMORY;
+    }
+    vfs_vnode_count = VFS_VNODE_PAGES * MEMORY_PAGE_SIZE / sizeof(vfs_vnode_t);
+    memset(vfs_vnodes, 0, VFS_VNODE_PAGES * MEMORY_PAGE_SIZE);
+
+    vfs_free_vnodes = NULL;
+    for (uint32_t i = vfs_vnode_count; i > 0; i--) {
+        vfs_vnodes[i - 1].hash_next = vfs_free_vnodes;
+        vfs_free_vnodes = &vfs_vnodes[i - 1];
+    }
+
+    memset(vfs_hash, 0, sizeof(vfs_hash));
+    memset(vfs_mounts, 0, sizeof(vfs_mounts));
+    memset(vfs_files, 0, sizeof(vfs_files));
+    memset(vfs_kernel_files, 0, sizeof(vfs_kernel_files));
+    memset(&vfs_stats, 0, sizeof(vfs_stats));
+    vfs_stats.vnodes = vfs_vnode_count;
+    vfs_lru_head = vfs_lru_tail = NULL;
+    vfs_root = NULL;
+    vfs_kernel_cwd = NULL;
+
+    vfs_initialized = true;
+    return VFS_SUCCESS;
+}
+
+/* Make a filesystem type available to vfs_mount */
+vfs_result_t vfs_register_filesystem(const char* name, const vfs_ops_t* ops, uint32_t flags) {
+    if (name == NULL || ops == NULL || ops->mount == NULL || ops->lookup == NULL ||
+        strlen(name) > VFS_FS_NAME_MAX) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (uint32_t i = 0; i < vfs_filesystem_count; i++) {
+        if (strcmp(vfs_filesystems[i].name, name) == 0) {
+            return VFS_ERROR_EXISTS;
+        }
+    }
+    if (vfs_filesystem_count == VFS_MAX_FILESYSTEMS) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    strcpy(vfs_filesystems[vfs_filesystem_count].name, name);
+    vfs_filesystems[vfs_filesystem_count].ops = ops;
+    vfs_filesystems[vfs_filesystem_count].flags = flags;
+    vfs_filesystem_count++;
+    return VFS_SUCCESS;
+}
+
+/* Mount a filesystem of type fs_name on the directory at path. The first
+ * mount must be "/". source is handed to the backend unchanged. */
+static vfs_result_t vfs_mount_locked(const char* fs_name, void* source, const char* path) {
+    const vfs_filesystem_t* fs = NULL;
+    vfs_mount_t* mount = NULL;
+    vfs_vnode_t* covered = NULL;
+    vfs_vnode_t* root;
+    vfs_result_t result;
+
+    if (!vfs_initialized) {
+        return VFS_ERROR_NOT_INITIALIZED;
+    }
+    if (fs_name == NULL || path == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (uint32_t i = 0; i < vfs_filesystem_count; i++) {
+        if (strcmp(vfs_filesystems[i].name, fs_name) == 0) {
+            fs = &vfs_filesystems[i];
+        }
+    }
+    if (fs == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS && mount == NULL; i++) {
+        if (!vfs_mounts[i].in_use) {
+            mount = &vfs_mounts[i];
+        }
+    }
+    if (mount == NULL) {
+        return VFS_ERROR_NO_SPACE;
+    }
+
+    if (vfs_root == NULL) {
+        if (strcmp(path, "/") != 0) {
+            return VFS_ERROR_NOT_FOUND;
+        }
+    } else {
+        result = vfs_walk(path, &covered, NULL);
+        if (result != VFS_SUCCESS) {
+            return result;
+        }
+        if (covered->type != VFS_TYPE_DIRECTORY) {
+            vfs_vnode_put(covered);
+            return VFS_ERROR_NOT_DIRECTORY;
+        }
+        /* The walk crossed any mount here, so covered is a mount root */
+        if (covered->parent == NULL) {
+            vfs_vnode_put(covered);
+            return VFS_ERROR_BUSY;
+        }
+    }
+
+    root = vfs_vnode_alloc();
+    if (root == NULL) {
+        vfs_vnode_put(covered);
+        return VFS_ERROR_NO_MEMORY;
+    }
+    memset(mount, 0, sizeof(vfs_mount_t));
+    mount->fs = fs;
+    mount->root = root;
+    mount->covered = covered;
+    root->mount = mount;
+    root->type = VFS_TYPE_DIRECTORY;
+
+    result = fs->ops->mount(mount, source, root);
+    if (result != VFS_SUCCESS) {
+        root->type = VFS_TYPE_NONE;
+        root->refcount = 0;
+        vfs_vnode_destroy(root);
+        vfs_vnode_put(covered);
+        return result;
+    }
+
+    /* The mount keeps its reference on covered */
+    mount->in_use = true;
+    if (covered) {
+        covered->mounted = root;
+    } else {
+        vfs_root = root;
+    }
+    vfs_stats.mounts++;
+    return VFS_SUCCESS;
+}
+
+/* Unmount the filesystem whose root is at path. Fails with busy while any
+ * of its vnodes are referenced or another filesystem is mounted on it. */
+static vfs_result_t vfs_unmount_locked(const char* path) {
+    vfs_vnode_t* root;
+    vfs_mount_t* mount;
+    vfs_result_t result;
+
+    result = vfs_walk(path, &root, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    mount = root->mount;
+    vfs_vnode_put(root);
+    if (root->parent != NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mounts[i].in_use && vfs_mounts[i].covered && vfs_mounts[i].covered->mount == mount) {
+            return VFS_ERROR_BUSY;
+        }
+    }
+
+    vfs_vnode_purge(mount, NULL);
+    if (root->refcount != 1) {
+        return VFS_ERROR_BUSY;
+    }
+
+    if (mount->fs->ops->sync) {
+        mount->fs->ops->sync(mount, NULL);
+    }
+    if (mount->fs->ops->unmount) {
+        mount->fs->ops->unmount(mount);
+    }
+
+    if (mount->covered) {
+        mount->covered->mounted = NULL;
+        vfs_vnode_put(mount->covered);
+    } else {
+        vfs_root = NULL;
+    }
+    root->refcount = 0;
+    vfs_vnode_destroy(root);
+    mount->in_use = false;
+    vfs_stats.mounts--;
+    return VFS_SUCCESS;
+}
+
+/* Write back every mounted filesystem */
+static vfs_result_t vfs_sync_locked(void) {
+    vfs_result_t result = VFS_SUCCESS;
+
+    if (!vfs_initialized) {
+        return VFS_ERROR_NOT_INITIALIZED;
+    }
+
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = &vfs_mounts[i];
+
+        if (mount->in_use && mount->fs->ops->sync) {
+            vfs_result_t status = mount->fs->ops->sync(mount, NULL);
+            if (status != VFS_SUCCESS) {
+                result = status;
+            }
+        }
+    }
+    return result;
+}
+
+/* ========================================================================
+ * File Descriptors
+ * ======================================================================== */
+
+static vfs_file_t* vfs_fd_get(int fd) {
+    if (!vfs_initialized || fd < 0 || fd >= PROCESS_MAX_FILES) {
+        return NULL;
+    }
+    return vfs_fd_table()[fd];
+}
+
+static void vfs_file_release(vfs_file_t* file) {
+    if (--file->refcount > 0) {
+        return;
+    }
+    if (file->node->mount->fs->ops->close) {
+        file->node->mount->fs->ops->close(file->node, file->handle);
+    }
+    vfs_vnode_put(file->node);
+    file->node = NULL;
+    file->handle = NULL;
+    vfs_stats.open_files--;
+}
+
+/* Create name in dir. Returns a referenced vnode. */
+static vfs_result_t vfs_create(vfs_vnode_t* dir, const char* name, vfs_type_t type, vfs_vnode_t** result) {
+    const vfs_ops_t* ops = dir->mount->fs->ops;
+    vfs_vnode_t* node;
+    vfs_result_t status;
+
+    if (ops->create == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+    if (name[0] == '\0' || vfs_is_dot(name)) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    vfs_vnode_drop_negative(dir, name);
+    node = vfs_vnode_new(dir, name);
+    if (node == NULL) {
+        return VFS_ERROR_NO_MEMORY;
+    }
+    node->type = type;
+
+    status = ops->create(dir, node, type);
+    if (status != VFS_SUCCESS) {
+        node->type = VFS_TYPE_NONE;
+        node->refcount = 0;
+        vfs_vnode_destroy(node);
+        return status;
+    }
+    vfs_hash_insert(node);
+    *result = node;
+    return VFS_SUCCESS;
+}
+
+/* Open path and return a descriptor in fd */
+static vfs_result_t vfs_open_locked(const char* path, uint32_t flags, int* fd) {
+    char name[VFS_NAME_MAX + 1];
+    vfs_file_t** table = vfs_fd_table();
+    vfs_file_t* file = NULL;
+    vfs_vnode_t* dir;
+    vfs_vnode_t* node;
+    const vfs_ops_t* ops;
+    bool writable = (flags & (VFS_O_WRITE | VFS_O_APPEND)) != 0;
+    int slot = -1;
+    vfs_result_t result;
+
+    if (fd == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    result = vfs_walk(path, &dir, name);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    result = vfs_lookup(dir, name, &node);
+    if (result == VFS_ERROR_NOT_FOUND && (flags & VFS_O_CREATE)) {
+        result = vfs_create(dir, name, VFS_TYPE_FILE, &node);
+    } else if (result == VFS_SUCCESS && (flags & VFS_O_CREATE) && (flags & VFS_O_EXCLUSIVE)) {
+        vfs_vnode_put(node);
+        result = VFS_ERROR_EXISTS;
+    }
+    vfs_vnode_put(dir);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+
+    if (node->type == VFS_TYPE_DIRECTORY && writable) {
+        result = VFS_ERROR_IS_DIRECTORY;
+    } else if (node->type != VFS_TYPE_DIRECTORY && (flags & VFS_O_DIRECTORY)) {
+        result = VFS_ERROR_NOT_DIRECTORY;
+    }
+
+    for (int i = 0; i < PROCESS_MAX_FILES && slot < 0; i++) {
+        if (table[i] == NULL) {
+            slot = i;
+        }
+    }
+    for (uint32_t i = 0; i < VFS_MAX_OPEN_FILES && file == NULL; i++) {
+        if (vfs_files[i].refcount == 0) {
+            file = &vfs_files[i];
+        }
+    }
+    if (result == VFS_SUCCESS && (slot < 0 || file == NULL)) {
+        result = VFS_ERROR_TOO_MANY_OPEN;
+    }
+    if (result != VFS_SUCCESS) {
+        vfs_vnode_put(node);
+        return result;
+    }
+
+    /* Creation and truncation are done here, once for every backend */
+    ops = node->mount->fs->ops;
+    memset(file, 0, sizeof(vfs_file_t));
+    if (ops->open) {
+        result = ops->open(node, flags & ~(VFS_O_CREATE | VFS_O_EXCLUSIVE | VFS_O_TRUNCATE), &file->handle);
+    }
+    if (result == VFS_SUCCESS && (flags & VFS_O_TRUNCATE) && writable && node->size != 0) {
+        result = ops->truncate ? ops->truncate(node, file->handle, 0) : VFS_ERROR_NOT_SUPPORTED;
+        if (result == VFS_SUCCESS) {
+            node->size = 0;
+        } else if (ops->close) {
+            ops->close(node, file->handle);
+        }
+    }
+    if (result != VFS_SUCCESS) {
+        vfs_vnode_put(node);
+        return result;
+    }
+
+    file->node = node;
+    file->flags = flags;
+    file->refcount = 1;
+    table[slot] = file;
+    vfs_stats.open_files++;
+    *fd = slot;
+    return VFS_SUCCESS;
+}
+
+/* Close a descriptor */
+static vfs_result_t vfs_close_locked(int fd) {
+    vfs_file_t* file = vfs_fd_get(fd);
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    vfs_fd_table()[fd] = NULL;
+    vfs_file_release(file);
+    return VFS_SUCCESS;
+}
+
+/* Read from the current position */
+static vfs_result_t vfs_read_locked(int fd, void* buffer, uint32_t size, uint32_t* bytes_read) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    uint32_t done = 0;
+    vfs_result_t result;
+
+    if (bytes_read) {
+        *bytes_read = 0;
+    }
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (buffer == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    if (file->node->type == VFS_TYPE_DIRECTORY) {
+        return VFS_ERROR_IS_DIRECTORY;
+    }
+    if (!(file->flags & VFS_O_READ)) {
+        return VFS_ERROR_ACCESS_DENIED;
+    }
+    if (file->node->mount->fs->ops->read == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+    if (file->position >= file->node->size || size == 0) {
+        return VFS_SUCCESS;
+    }
+
+    result = file->node->mount->fs->ops->read(file->node, file->handle, file->position, buffer, size, &done);
+    file->position += done;
+    if (bytes_read) {
+        *bytes_read = done;
+    }
+    return result;
+}
+
+/* Write at the current position, or at the end for append descriptors */
+static vfs_result_t vfs_write_locked(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    uint32_t done = 0;
+    vfs_result_t result;
+
+    if (bytes_written) {
+        *bytes_written = 0;
+    }
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (buffer == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    if (!(file->flags & (VFS_O_WRITE | VFS_O_APPEND))) {
+        return VFS_ERROR_ACCESS_DENIED;
+    }
+    if (file->node->mount->fs->ops->write == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+    if (size == 0) {
+        return VFS_SUCCESS;
+    }
+
+    if (file->flags & VFS_O_APPEND) {
+        file->position = file->node->size;
+    }
+    result = file->node->mount->fs->ops->write(file->node, file->handle, file->position, buffer, size, &done);
+    file->position += done;
+    if (file->position > file->node->size) {
+        file->node->size = file->position;
+    }
+    if (bytes_written) {
+        *bytes_written = done;
+    }
+    return result;
+}
+
+/* Move the position; it may go past the end of the file */
+static vfs_result_t vfs_seek_locked(int fd, int32_t offset, int origin, uint32_t* position) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    int64_t base;
+    int64_t target;
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+
+    /* Positions and sizes use the full 32 bits, so work in 64 */
+    switch (origin) {
+        case VFS_SEEK_SET: base = 0; break;
+        case VFS_SEEK_CUR: base = file->position; break;
+        case VFS_SEEK_END: base = file->node->size; break;
+        default: return VFS_ERROR_INVALID_PARAMETER;
+    }
+    target = base + offset;
+    if (target < 0 || target > 0xFFFFFFFF) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    file->position = (uint32_t)target;
+    if (position) {
+        *position = file->position;
+    }
+    return VFS_SUCCESS;
+}
+
+/* Read the next entry of a directory descriptor; "." and ".." are skipped.
+ * Returns VFS_ERROR_EOF after the last entry. */
+static vfs_result_t vfs_readdir_locked(int fd, vfs_dirent_t* entry) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    vfs_result_t result;
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (entry == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    if (file->node->type != VFS_TYPE_DIRECTORY) {
+        return VFS_ERROR_NOT_DIRECTORY;
+    }
+    if (file->node->mount->fs->ops->readdir == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+
+    do {
+        result = file->node->mount->fs->ops->readdir(file->node, file->handle, file->position, entry);
+        if (result != VFS_SUCCESS) {
+            return result;
+        }
+        file->position++;
+    } while (vfs_is_dot(entry->name));
+
+    return VFS_SUCCESS;
+}
+
+static void vfs_fill_stat(const vfs_vnode_t* node, vfs_stat_t* stat) {
+    stat->type = node->type;
+    stat->size = node->size;
+    stat->ino = node->ino;
+    stat->mount = (uint32_t)(node->mount - vfs_mounts);
+}
+
+/* Status of an open descriptor */
+static vfs_result_t vfs_fstat_locked(int fd, vfs_stat_t* stat) {
+    vfs_file_t* file = vfs_fd_get(fd);
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (stat == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    vfs_fill_stat(file->node, stat);
+    return VFS_SUCCESS;
+}
+
+/* Set the size of a file open for writing */
+static vfs_result_t vfs_ftruncate_locked(int fd, uint32_t size) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    vfs_result_t result;
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (!(file->flags & (VFS_O_WRITE | VFS_O_APPEND))) {
+        return VFS_ERROR_ACCESS_DENIED;
+    }
+    if (file->node->mount->fs->ops->truncate == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+
+    result = file->node->mount->fs->ops->truncate(file->node, file->handle, size);
+    if (result == VFS_SUCCESS) {
+        file->node->size = size;
+    }
+    return result;
+}
+
+/* Write back a file's data and metadata */
+static vfs_result_t vfs_fsync_locked(int fd) {
+    vfs_file_t* file = vfs_fd_get(fd);
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (file->node->mount->fs->ops->sync == NULL) {
+        return VFS_SUCCESS;
+    }
+    return file->node->mount->fs->ops->sync(file->node->mount, file->handle);
+}
+
+/* Duplicate a descriptor; both share one position */
+static vfs_result_t vfs_dup_locked(int fd, int* new_fd) {
+    vfs_file_t* file = vfs_fd_get(fd);
+    vfs_file_t** table = vfs_fd_table();
+
+    if (file == NULL) {
+        return VFS_ERROR_BAD_DESCRIPTOR;
+    }
+    if (new_fd == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+
+    for (int i = 0; i < PROCESS_MAX_FILES; i++) {
+        if (table[i] == NULL) {
+            table[i] = file;
+            file->refcount++;
+            *new_fd = i;
+            return VFS_SUCCESS;
+        }
+    }
+    return VFS_ERROR_TOO_MANY_OPEN;
+}
+
+/* ========================================================================
+ * Path Operations
+ * ======================================================================== */
+
+/* Status of the file or directory at path */
+static vfs_result_t vfs_stat_locked(const char* path, vfs_stat_t* stat) {
+    vfs_vnode_t* node;
+    vfs_result_t result;
+
+    if (stat == NULL) {
+        return VFS_ERROR_INVALID_PARAMETER;
+    }
+    result = vfs_walk(path, &node, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    vfs_fill_stat(node, stat);
+    vfs_vnode_put(node);
+    return VFS_SUCCESS;
+}
+
+/* Create a directory */
+static vfs_result_t vfs_mkdir_locked(const char* path) {
+    char name[VFS_NAME_MAX + 1];
+    vfs_vnode_t* dir;
+    vfs_vnode_t* node;
+    vfs_result_t result;
+
+    result = vfs_walk(path, &dir, name);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    result = vfs_lookup(dir, name, &node);
+    if (result == VFS_SUCCESS) {
+        vfs_vnode_put(node);
+        result = VFS_ERROR_EXISTS;
+    } else if (result == VFS_ERROR_NOT_FOUND) {
+        result = vfs_create(dir, name, VFS_TYPE_DIRECTORY, &node);
+        if (result == VFS_SUCCESS) {
+            vfs_vnode_put(node);
+        }
+    }
+    vfs_vnode_put(dir);
+    return result;
+}
+
+/* Remove node, which the caller holds, and leave a negative entry */
+static vfs_result_t vfs_remove(vfs_vnode_t* node) {
+    const vfs_ops_t* ops = node->mount->fs->ops;
+    vfs_result_t result;
+
+    if (node->parent == NULL || node->mounted) {
+        return VFS_ERROR_BUSY;
+    }
+    if (ops->remove == NULL) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+
+    /* Cached children pin a directory; anyone else using it makes it busy */
+    if (node->type == VFS_TYPE_DIRECTORY) {
+        vfs_vnode_purge(NULL, node);
+    }
+    if (node->refcount != 1) {
+        return VFS_ERROR_BUSY;
+    }
+
+    result = ops->remove(node->parent, node);
+    if (result == VFS_SUCCESS) {
+        vfs_vnode_forget(node);
+    }
+    return result;
+}
+
+/* Remove an empty directory */
+static vfs_result_t vfs_rmdir_locked(const char* path) {
+    vfs_vnode_t* node;
+    vfs_result_t result;
+
+    result = vfs_walk(path, &node, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    if (node->type != VFS_TYPE_DIRECTORY) {
+        result = VFS_ERROR_NOT_DIRECTORY;
+    } else {
+        result = vfs_remove(node);
+    }
+    vfs_vnode_put(node);
+    return result;
+}
+
+/* Remove a file; open files are busy */
+static vfs_result_t vfs_unlink_locked(const char* path) {
+    vfs_vnode_t* node;
+    vfs_result_t result;
+
+    result = vfs_walk(path, &node, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    if (node->type == VFS_TYPE_DIRECTORY) {
+        result = VFS_ERROR_IS_DIRECTORY;
+    } else {
+        result = vfs_remove(node);
+    }
+    vfs_vnode_put(node);
+    return result;
+}
+
+/* Rename or move within one filesystem; the target must not exist */
+static vfs_result_t vfs_rename_locked(const char* old_path, const char* new_path) {
+    char name[VFS_NAME_MAX + 1];
+    vfs_vnode_t* node;
+    vfs_vnode_t* dir;
+    vfs_vnode_t* target;
+    vfs_result_t result;
+
+    result = vfs_walk(old_path, &node, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    result = vfs_walk(new_path, &dir, name);
+    if (result != VFS_SUCCESS) {
+        vfs_vnode_put(node);
+        return result;
+    }
+
+    if (name[0] == '\0' || vfs_is_dot(name)) {
+        result = VFS_ERROR_INVALID_PARAMETER;
+    } else if (node->parent == NULL || node->mounted) {
+        result = VFS_ERROR_BUSY;
+    } else if (dir->mount != node->mount) {
+        result = VFS_ERROR_CROSS_DEVICE;
+    } else if (node->mount->fs->ops->rename == NULL) {
+        result = VFS_ERROR_NOT_SUPPORTED;
+    } else {
+        result = vfs_lookup(dir, name, &target);
+        if (result == VFS_SUCCESS) {
+            vfs_vnode_put(target);
+            result = VFS_ERROR_EXISTS;
+        } else if (result == VFS_ERROR_NOT_FOUND) {
+            result = VFS_SUCCESS;
+        }
+    }
+
+    /* A directory cannot move below itself */
+    for (vfs_vnode_t* walk = dir; result == VFS_SUCCESS && walk; walk = walk->parent) {
+        if (walk == node) {
+            result = VFS_ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    if (result == VFS_SUCCESS) {
+        result = node->mount->fs->ops->rename(node, dir, name);
+    }
+    if (result == VFS_SUCCESS) {
+        vfs_vnode_t* old_parent = node->parent;
+
+        vfs_vnode_drop_negative(dir, name);
+        vfs_hash_remove(node);
+        vfs_vnode_get(dir);
+        node->parent = dir;
+        strcpy(node->name, name);
+        node->hash = vfs_hash_name(dir, name);
+        vfs_hash_insert(node);
+        vfs_vnode_put(old_parent);
+    }
+
+    vfs_vnode_put(dir);
+    vfs_vnode_put(node);
+    return result;
+}
+
+/* Change the working directory of the current process */
+static vfs_result_t vfs_chdir_locked(const char* path) {
+    vfs_vnode_t** cwd = vfs_cwd_slot();
+    vfs_vnode_t* node;
+    vfs_result_t result;
+
+    result = vfs_walk(path, &node, NULL);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    if (node->type != VFS_TYPE_DIRECTORY) {
+        vfs_vnode_put(node);
+        return VFS_ERROR_NOT_DIRECTORY;
+    }
+
+    vfs_vnode_put(*cwd);
+    *cwd = node;
+    return VFS_SUCCESS;
+}
+
+/* Absolute path of the working directory */
+static vfs_result_t vfs_getcwd_locked(char* buffer, uint32_t size) {
+    vfs_vnode_t* cwd = *vfs_cwd_slot();
+
+    if (!vfs_initialized) {
+        return VFS_ERROR_NOT_INITIALIZED;
+    }
+    if (cwd == NULL) {
+        if (buffer == NULL || size < 2) {
+            return VFS_ERROR_INVALID_PARAMETER;
+        }
+        strcpy(buffer, "/");
+        return VFS_SUCCESS;
+    }
+    return vfs_build_path(cwd, true, buffer, size);
+}
+
+/* ========================================================================
+ * Process Hooks
+ * ======================================================================== */
+
+/* A new process starts in its parent's working directory */
+static void vfs_process_start_locked(struct process* child, struct process* parent) {
+    child->cwd = parent ? parent->cwd : vfs_kernel_cwd;
+    if (child->cwd) {
+        vfs_vnode_get(child->cwd);
+    }
+    memset(child->files, 0, sizeof(child->files));
+}
+
+/* A forked process shares its parent's open files */
+static void vfs_process_fork_locked(struct process* child, struct process* parent) {
+    for (int i = 0; i < PROCESS_MAX_FILES; i++) {
+        child->files[i] = parent->files[i];
+        if (child->files[i]) {
+            child->files[i]->refcount++;
+        }
+    }
+}
+
+/* Close everything a process still has open */
+static void vfs_process_exit_locked(struct process* process) {
+    for (int i = 0; i < PROCESS_MAX_FILES; i++) {
+        if (process->files[i]) {
+            vfs_file_release(process->files[i]);
+            process->files[i] = NULL;
+        }
+    }
+    vfs_vnode_put(process->cwd);
+    process->cwd = NULL;
+}
+
+/* ========================================================================
+ * Entry Points
+ * ======================================================================== */
+
+/* Each under the VFS lock; backends are only called with it held */
+
+vfs_result_t vfs_mount(const char* fs_name, void* source, const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_mount_locked(fs_name, source, path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_unmount(const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_unmount_locked(path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_sync(void) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_sync_locked();
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_open(const char* path, uint32_t flags, int* fd) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_open_locked(path, flags, fd);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_close(int fd) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_close_locked(fd);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_read(int fd, void* buffer, uint32_t size, uint32_t* bytes_read) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_read_locked(fd, buffer, size, bytes_read);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_write(int fd, const void* buffer, uint32_t size, uint32_t* bytes_written) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_write_locked(fd, buffer, size, bytes_written);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_seek(int fd, int32_t offset, int origin, uint32_t* position) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_seek_locked(fd, offset, origin, position);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_readdir(int fd, vfs_dirent_t* entry) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_readdir_locked(fd, entry);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_fstat(int fd, vfs_stat_t* stat) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_fstat_locked(fd, stat);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_ftruncate(int fd, uint32_t size) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_ftruncate_locked(fd, size);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_fsync(int fd) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_fsync_locked(fd);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_dup(int fd, int* new_fd) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_dup_locked(fd, new_fd);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_stat(const char* path, vfs_stat_t* stat) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_stat_locked(path, stat);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_mkdir(const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_mkdir_locked(path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_rmdir(const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_rmdir_locked(path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_unlink(const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_unlink_locked(path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_rename(const char* old_path, const char* new_path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_rename_locked(old_path, new_path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_chdir(const char* path) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_chdir_locked(path);
+    vfs_unlock();
+    return result;
+}
+
+vfs_result_t vfs_getcwd(char* buffer, uint32_t size) {
+    vfs_result_t result;
+
+    vfs_lock();
+    result = vfs_getcwd_locked(buffer, size);
+    vfs_unlock();
+    return result;
+}
+
+void vfs_process_start(struct process* child, struct process* parent) {
+    vfs_lock();
+    vfs_process_start_locked(child, parent);
+    vfs_unlock();
+}
+
+void vfs_process_fork(struct process* child, struct process* parent) {
+    vfs_lock();
+    vfs_process_fork_locked(child, parent);
+    vfs_unlock();
+}
+
+void vfs_process_exit(struct process* process) {
+    vfs_lock();
+    vfs_process_exit_locked(process);
+    vfs_unlock();
+}
+
+/* ========================================================================
+ * Statistics
+ * ======================================================================== */
+
+void vfs_get_stats(vfs_stats_t* stats) {
+    if (stats) {
+        *stats = vfs_stats;
+    }
+}
+
+const char* vfs_result_to_string(vfs_result_t result) {
+    switch (result) {
+        case VFS_SUCCESS: return "Success";
+        case VFS_ERROR_NOT_INITIALIZED: return "VFS not initialized";
+        case VFS_ERROR_INVALID_PARAMETER: return "Invalid parameter";
+        case VFS_ERROR_NOT_FOUND: return "No such file or directory";
+        case VFS_ERROR_EXISTS: return "File exists";
+        case VFS_ERROR_NOT_DIRECTORY: return "Not a directory";
+        case VFS_ERROR_IS_DIRECTORY: return "Is a directory";
+        case VFS_ERROR_NOT_EMPTY: return "Directory not empty";
+        case VFS_ERROR_BUSY: return "Resource busy";
+        case VFS_ERROR_CROSS_DEVICE: return "Cross-device link";
+        case VFS_ERROR_NAME_TOO_LONG: return "Name too long";
+        case VFS_ERROR_NO_SPACE: return "No space left";
+        case VFS_ERROR_NO_MEMORY: return "Out of memory";
+        case VFS_ERROR_TOO_MANY_OPEN: return "Too many open files";
+        case VFS_ERROR_BAD_DESCRIPTOR: return "Bad file descriptor";
+        case VFS_ERROR_ACCESS_DENIED: return "Access denied";
+        case VFS_ERROR_READ_ONLY: return "Read-only file system";
+        case VFS_ERROR_NOT_SUPPORTED: return "Operation not supported";
+        case VFS_ERROR_IO: return "I/O error";
+        case VFS_ERROR_EOF: return "End of file";
+        default: return "Unknown error";
+    }
+}
@@ -65,6 +65,8 @@ void interrupts_initialize(void) {
     /* Set hardware interrupt handlers (32+) */
     idt_set_gate(32, (uint32_t)irq_handler_timer, 0x08, IDT_TYPE_INTERRUPT_GATE);
     idt_set_gate(33, (uint32_t)irq_handler_keyboard, 0x08, IDT_TYPE_INTERRUPT_GATE);
+    idt_set_gate(IRQ_ATA_PRIMARY, (uint32_t)irq_handler_ata_primary, 0x08, IDT_TYPE_INTERRUPT_GATE);
+    idt_set_gate(IRQ_ATA_SECONDARY, (uint32_t)irq_handler_ata_secondary, 0x08, IDT_TYPE_INTERRUPT_GATE);
     
     /* Load IDT */
     idt_load();
@@ -73,7 +75,7 @@ void interrupts_initialize(void) {
     pic_initialize();
     
     terminal_writeline("IDT initialized successfully!");
-    terminal_writeline("Exception handlers (0-14) and IRQ handlers (32-33) installed.");
+    terminal_writeline("Exception handlers (0-14) and IRQ handlers (32-33, 46-47) installed.");
 }
 
 /* PIC ports */
@@ -122,12 +124,12 @@ void pic_initialize(void) {
     /* Mask pattern: 11111000 = 0xF8 (bits 0,1,2 = 0 for enabled IRQs) */
     __asm_outb(PIC1_DATA, 0xF8);
     
-    /* Slave PIC: Mask all interrupts for now */
-    /* Mask pattern: 11111111 = 0xFF (all IRQs disabled) */
-    __asm_outb(PIC2_DATA, 0xFF);
+    /* Slave PIC: Enable primary (IRQ 14) and secondary (IRQ 15) ATA channels */
+    /* Mask pattern: 00111111 = 0x3F (bits 6,7 = 0 for enabled IRQs) */
+    __asm_outb(PIC2_DATA, 0x3F);
     
     terminal_writeline("PIC initialized successfully!");
-    terminal_writeline("IRQ 0 (Timer) and IRQ 1 (Keyboard) enabled.");
+    terminal_writeline("IRQ 0 (Timer), IRQ 1 (Keyboard) and IRQ 14/15 (ATA) enabled.");
 }
 
 /* Check and display PIC mask status */
@@ -3,11 +3,15 @@
 ; External C handler function declarations
 extern c_irq_handler_timer
 extern c_irq_handler_keyboard
+extern c_irq_handler_ata_primary
+extern c_irq_handler_ata_secondary
 extern c_exception_handler
 
 ; IRQ handler global declarations
 global irq_handler_timer
 global irq_handler_keyboard
+global irq_handler_ata_primary
+global irq_handler_ata_secondary
 global exception_handler_common
 
 ; Exception handlers (0-31)
@@ -93,6 +97,14 @@ irq_handler_timer:
 irq_handler_keyboard:
     IRQ_HANDLER_COMMON c_irq_handler_keyboard
 
+; Primary ATA channel IRQ handler (IRQ14 -> INT 46)
+irq_handler_ata_primary:
+    IRQ_HANDLER_COMMON c_irq_handler_ata_primary
+
+; Secondary ATA channel IRQ handler (IRQ15 -> INT 47)
+irq_handler_ata_secondary:
+    IRQ_HANDLER_COMMON c_irq_handler_ata_secondary
+
 ; Exception handlers
 EXCEPTION_HANDLER 0, 0   ; Division by zero
 EXCEPTION_HANDLER 1, 0   ; Debug
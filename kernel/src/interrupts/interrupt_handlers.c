@@ -5,6 +5,7 @@
 #include "../../include/process/process.h"
 #include "../../include/timer/pit.h"
 #include "../../include/terminal/terminal.h"
+#include "../../include/storage/hdd.h"
 
 /* Interrupt statistics for debugging */
 static uint32_t timer_interrupt_count = 0;
@@ -118,6 +119,29 @@ void c_irq_handler_keyboard(void) {
     send_eoi(33);
 }
 
+/* Primary ATA channel interrupt handler */
+void c_irq_handler_ata_primary(void) {
+    /* Service the channel; reading its status also acknowledges the drive */
+    hdd_irq_handler(HDD_CHANNEL_PRIMARY);
+    
+    /* Send EOI to PIC */
+    send_eoi(IRQ_ATA_PRIMARY);
+}
+
+/* Secondary ATA channel interrupt handler */
+void c_irq_handler_ata_secondary(void) {
+    /* Check for spurious interrupt (IRQ 15 shares the slave PIC's spurious vector) */
+    if (is_spurious_irq(IRQ_ATA_SECONDARY)) {
+        spurious_interrupt_count++;
+        return;
+    }
+    
+    hdd_irq_handler(HDD_CHANNEL_SECONDARY);
+    
+    /* Send EOI to PIC */
+    send_eoi(IRQ_ATA_SECONDARY);
+}
+
 /* Exception handler */
 void c_exception_handler(void* context) {
     exception_context_t* ctx = (exception_context_t*)context;
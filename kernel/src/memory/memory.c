@@ -3,6 +3,11 @@
 #include "../../include/terminal/terminal.h"
 #include "../../include/common/utils.h"
 
+/* Page allocator state: one bit per page from MEMORY_POOL_START, set = used */
+static uint32_t memory_page_bitmap[MEMORY_POOL_MAX_PAGES / 32];
+static uint32_t memory_total_pages = 0;
+static uint32_t memory_free_page_count = 0;
+
 /* Read from CMOS to detect memory size */
 uint32_t memory_detect_cmos(void) {
     uint32_t total_memory = 0;
@@ -153,3 +158,88 @@ void memory_print_info(const memory_info_t* info) {
     terminal_writestring(num_str);
     terminal_writestring(" MB)\n");
 }
+
+/* Size the page pool from detected memory; pages beyond the end stay marked used */
+void memory_initialize(void) {
+    memory_info_t info;
+    uint32_t end = MEMORY_POOL_START;
+    
+    if (memory_get_info(&info)) {
+        end = info.total_mb * 1024 * 1024;
+    }
+    
+    memory_total_pages = end > MEMORY_POOL_START ? (end - MEMORY_POOL_START) / MEMORY_PAGE_SIZE : 0;
+    if (memory_total_pages > MEMORY_POOL_MAX_PAGES) {
+        memory_total_pages = MEMORY_POOL_MAX_PAGES;
+    }
+    
+    memset(memory_page_bitmap, 0xFF, sizeof(memory_page_bitmap));
+    for (uint32_t page = 0; page < memory_total_pages; page++) {
+        memory_page_bitmap[page / 32] &= ~(1u << (page % 32));
+    }
+    memory_free_page_count = memory_total_pages;
+}
+
+/* Allocate physically contiguous pages (first fit); returns NULL when none fit */
+void* memory_alloc_pages(uint32_t page_count) {
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    
+    if (page_count == 0 || page_count > memory_free_page_count) {
+        return NULL;
+    }
+    
+    for (uint32_t page = 0; page < memory_total_pages; page++) {
+        /* Skip fully used words quickly while no run is in progress */
+        if (run_length == 0 && (page % 32) == 0 && memory_page_bitmap[page / 32] == 0xFFFFFFFF) {
+            page += 31;
+            continue;
+        }
+        
+        if (memory_page_bitmap[page / 32] & (1u << (page % 32))) {
+            run_length = 0;
+            continue;
+        }
+        
+        if (run_length == 0) {
+            run_start = page;
+        }
+        
+        if (++run_length == page_count) {
+            for (uint32_t i = run_start; i < run_start + page_count; i++) {
+                memory_page_bitmap[i / 32] |= 1u << (i % 32);
+            }
+            memory_free_page_count -= page_count;
+            return (void*)(MEMORY_POOL_START + run_start * MEMORY_PAGE_SIZE);
+        }
+    }
+    
+    return NULL;
+}
+
+/* Return pages obtained from memory_alloc_pages() */
+void memory_free_pages(void* address, uint32_t page_count) {
+    uint32_t first;
+    
+    if (!address || (uint32_t)address < MEMORY_POOL_START) {
+        return;
+    }
+    
+    first = ((uint32_t)address - MEMORY_POOL_START) / MEMORY_PAGE_SIZE;
+    for (uint32_t page = first; page < first + page_count && page < memory_total_pages; page++) {
+        if (memory_page_bitmap[page / 32] & (1u << (page % 32))) {
+            memory_page_bitmap[page / 32] &= ~(1u << (page % 32));
+            memory_free_page_count++;
+        }
+    }
+}
+
+/* Number of unallocated pages in the pool */
+uint32_t memory_get_free_pages(void) {
+    return memory_free_page_count;
+}
+
+/* Number of pages managed by the pool */
+uint32_t memory_get_total_pages(void) {
+    return memory_total_pages;
+}
@@ -5,6 +5,7 @@
 #include "../../include/memory/memory.h"
 #include "../../include/vga/vga.h"
 #include "../../include/syscalls/syscalls.h"
+#include "../../include/fs/vfs.h"
 
 /* Global process table */
 static process_t process_table[MAX_PROCESSES];
@@ -123,10 +124,14 @@ process_t* process_create(const char* name, void (*entry_point)(void), process_p
     strncpy(process->name, name, 31);
     process->name[31] = '\0';
     
+    /* Inherit the working directory */
+    vfs_process_start(process, scheduler.current_process);
+    
     /* Allocate stack */
     process->stack_size = 4096; /* 4KB stack */
     process->stack_base = (uint32_t)process_allocate_memory(process, process->stack_size);
     if (!process->stack_base) {
+        vfs_process_exit(process);
         process_slots_used[slot] = false;
         terminal_writeline("Error: Failed to allocate stack for process");
         return NULL;
@@ -200,6 +205,9 @@ process_t* process_fork(process_t* parent) {
     /* Copy parent's register state */
     memcpy(&child->regs, &parent->regs, sizeof(process_regs_t));
     
+    /* Share the parent's open files */
+    vfs_process_fork(child, parent);
+    
     /* Child process returns 0 from fork */
     child->regs.eax = 0;
     
@@ -308,6 +316,9 @@ static void process_cleanup(process_t* process) {
         process_free_memory(process, (void*)process->heap_base);
     }
     
+    /* Close open files and release the working directory */
+    vfs_process_exit(process);
+    
     /* Mark slot as free */
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (&process_table[i] == process) {
@@ -0,0 +1,777 @@
+/*
+ * Block Buffer Cache
+ * ChanUX Operating System
+ *
+ * One pool of sector buffers for every block device. Buffers are found
+ * through a hash of (device, LBA) and replaced in LRU order; dirty
+ * buffers are written back in runs of adjacent sectors.
+ */
+
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/process/process.h"
+#include "../../include/timer/pit.h"
+#include "../../include/common/utils.h"
+
+/* Cache state */
+static bcache_buffer_t* bcache_buffers = NULL;     /* Buffer descriptors */
+static bcache_buffer_t** bcache_hash = NULL;       /* Hash buckets */
+static uint32_t bcache_hash_mask = 0;
+static uint8_t* bcache_staging = NULL;             /* Write-back run buffer */
+static void* bcache_memory = NULL;                 /* Pages backing all of the above */
+static uint32_t bcache_memory_pages = 0;
+static bcache_buffer_t* bcache_lru_head = NULL;
+static bcache_buffer_t* bcache_lru_tail = NULL;
+static bcache_stats_t bcache_stats;
+static process_t* bcache_writeback_task = NULL;
+
+/* Outstanding readahead: one asynchronous read into a staging buffer,
+ * copied into cache buffers once it has completed */
+static block_request_t bcache_prefetch_request;
+static uint8_t* bcache_prefetch_buffer = NULL;
+static block_device_t* bcache_prefetch_device = NULL;   /* NULL = none pending */
+static uint32_t bcache_prefetch_lba = 0;
+static uint32_t bcache_prefetch_count = 0;
+
+/* Serializes cache users (kernel paths and the write-back process) */
+static volatile bool bcache_locked = false;
+
+static bool bcache_try_lock(void) {
+    uint32_t flags;
+    bool acquired;
+
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    acquired = !bcache_locked;
+    if (acquired) {
+        bcache_locked = true;
+    }
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+    return acquired;
+}
+
+static void bcache_lock(void) {
+    while (!bcache_try_lock()) {
+        if (get_current_process()) {
+            process_yield();
+        }
+    }
+}
+
+static void bcache_unlock(void) {
+    bcache_locked = false;
+}
+
+/* Hash of (device, LBA) */
+static uint32_t bcache_hash_index(block_device_t* device, uint32_t lba) {
+    return (((uint32_t)device >> 4) ^ (lba * 2654435761u)) & bcache_hash_mask;
+}
+
+static bcache_buffer_t* bcache_lookup(block_device_t* device, uint32_t lba) {
+    bcache_buffer_t* buffer = bcache_hash[bcache_hash_index(device, lba)];
+
+    while (buffer) {
+        if (buffer->device == device && buffer->lba == lba) {
+            return buffer;
+        }
+        buffer = buffer->hash_next;
+    }
+    return NULL;
+}
+
+static void bcache_hash_remove(bcache_buffer_t* buffer) {
+    bcache_buffer_t** link = &bcache_hash[bcache_hash_index(buffer->device, buffer->lba)];
+
+    while (*link) {
+        if (*link == buffer) {
+            *link = buffer->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    buffer->hash_next = NULL;
+}
+
+static void bcache_lru_unlink(bcache_buffer_t* buffer) {
+    if (buffer->lru_prev) {
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    } else {
+        bcache_lru_head = buffer->lru_next;
+    }
+    if (buffer->lru_next) {
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    } else {
+        bcache_lru_tail = buffer->lru_prev;
+    }
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+/* Move a buffer to the most-recently-used end */
+static void bcache_touch(bcache_buffer_t* buffer) {
+    if (bcache_lru_head == buffer) {
+        return;
+    }
+    bcache_lru_unlink(buffer);
+    buffer->lru_next = bcache_lru_head;
+    if (bcache_lru_head) {
+        bcache_lru_head->lru_prev = buffer;
+    }
+    bcache_lru_head = buffer;
+    if (!bcache_lru_tail) {
+        bcache_lru_tail = buffer;
+    }
+}
+
+/* Move a buffer to the least-recently-used end (reused first) */
+static void bcache_demote(bcache_buffer_t* buffer) {
+    if (bcache_lru_tail == buffer) {
+        return;
+    }
+    bcache_lru_unlink(buffer);
+    buffer->lru_prev = bcache_lru_tail;
+    if (bcache_lru_tail) {
+        bcache_lru_tail->lru_next = buffer;
+    }
+    bcache_lru_tail = buffer;
+    if (!bcache_lru_head) {
+        bcache_lru_head = buffer;
+    }
+}
+
+static void bcache_set_clean(bcache_buffer_t* buffer) {
+    if (buffer->dirty) {
+        buffer->dirty = false;
+        bcache_stats.dirty_buffers--;
+    }
+}
+
+/* Write a dirty buffer together with the dirty sectors adjacent to it */
+static block_result_t bcache_flush_run(bcache_buffer_t* buffer) {
+    static bcache_buffer_t* run[BCACHE_WRITEBACK_BATCH];
+    block_device_t* device = buffer->device;
+    uint32_t first = buffer->lba;
+    uint32_t count = 0;
+    block_result_t result;
+
+    /* Extend backwards, then forwards, over dirty unpinned neighbours */
+    while (first > 0 && buffer->lba - first + 1 < BCACHE_WRITEBACK_BATCH) {
+        bcache_buffer_t* previous = bcache_lookup(device, first - 1);
+        if (!previous || !previous->dirty || previous->pinned) {
+            break;
+        }
+        first--;
+    }
+
+    for (uint32_t lba = first; count < BCACHE_WRITEBACK_BATCH; lba++) {
+        bcache_buffer_t* next = bcache_lookup(device, lba);
+        if (!next || !next->dirty || next->pinned) {
+            break;
+        }
+        run[count] = next;
+        memcpy(bcache_staging + count * BLOCK_SECTOR_SIZE, next->data, BLOCK_SECTOR_SIZE);
+        count++;
+    }
+
+    result = block_write(device, first, count, bcache_staging);
+    if (result != BLOCK_SUCCESS) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_set_clean(run[i]);
+    }
+    bcache_stats.writebacks++;
+    bcache_stats.sectors_written_back += count;
+    return BLOCK_SUCCESS;
+}
+
+/* Take the least recently used unreferenced buffer and detach it from its
+ * old sector, writing it back first if dirty. NULL if every buffer is held. */
+static bcache_buffer_t* bcache_take_victim(void) {
+    bcache_buffer_t* buffer = bcache_lru_tail;
+
+    while (buffer && buffer->refcount > 0) {
+        buffer = buffer->lru_prev;
+    }
+    if (!buffer) {
+        return NULL;
+    }
+
+    if (buffer->dirty && bcache_flush_run(buffer) != BLOCK_SUCCESS) {
+        return NULL;
+    }
+
+    if (buffer->device) {
+        bcache_hash_remove(buffer);
+        bcache_stats.evictions++;
+    }
+    buffer->device = NULL;
+    buffer->valid = false;
+    return buffer;
+}
+
+/* Attach a detached buffer to (device, lba) */
+static void bcache_assign(bcache_buffer_t* buffer, block_device_t* device, uint32_t lba) {
+    uint32_t index = bcache_hash_index(device, lba);
+
+    buffer->device = device;
+    buffer->lba = lba;
+    buffer->hash_next = bcache_hash[index];
+    bcache_hash[index] = buffer;
+    bcache_touch(buffer);
+}
+
+/* Drop a buffer's identity (it must be clean and unreferenced) */
+static void bcache_discard(bcache_buffer_t* buffer) {
+    bcache_hash_remove(buffer);
+    buffer->device = NULL;
+    buffer->valid = false;
+    bcache_demote(buffer);
+}
+
+/* Retire the outstanding readahead. Completed data is inserted for
+ * sectors that are not cached yet (a cached copy is as new or newer).
+ * With wait clear, a request still in flight is left alone. */
+static void bcache_prefetch_collect(bool wait) {
+    block_device_t* device = bcache_prefetch_device;
+
+    if (!device || (!wait && !bcache_prefetch_request.done)) {
+        return;
+    }
+
+    if (block_wait(&bcache_prefetch_request) == BLOCK_SUCCESS) {
+        for (uint32_t i = 0; i < bcache_prefetch_count; i++) {
+            if (bcache_lookup(device, bcache_prefetch_lba + i)) {
+                continue;
+            }
+            bcache_buffer_t* buffer = bcache_take_victim();
+            if (!buffer) {
+                break;
+            }
+            bcache_assign(buffer, device, bcache_prefetch_lba + i);
+            memcpy(buffer->data, bcache_prefetch_buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+            buffer->valid = true;
+            bcache_stats.prefetched++;
+        }
+    }
+    bcache_prefetch_device = NULL;
+}
+
+/* Collect the readahead if it covers any of [lba, lba + count) on device,
+ * waiting for it if necessary; otherwise collect it only if it is done */
+static void bcache_prefetch_check(block_device_t* device, uint32_t lba, uint32_t count) {
+    bool overlaps = bcache_prefetch_device &&
+                    (device == NULL ||
+                     (device == bcache_prefetch_device &&
+                      lba < bcache_prefetch_lba + bcache_prefetch_count &&
+                      bcache_prefetch_lba < lba + count));
+
+    bcache_prefetch_collect(overlaps);
+}
+
+static block_result_t bcache_sync_locked(block_device_t* device, uint32_t min_age_ticks) {
+    uint32_t now = timer_get_ticks();
+
+    for (uint32_t i = 0; i < bcache_stats.buffer_count; i++) {
+        bcache_buffer_t* buffer = &bcache_buffers[i];
+
+        if (!buffer->dirty || buffer->pinned || (device && buffer->device != device) ||
+            now - buffer->dirty_since < min_age_ticks) {
+            continue;
+        }
+
+        block_result_t result = bcache_flush_run(buffer);
+        if (result != BLOCK_SUCCESS) {
+            return result;
+        }
+    }
+    return BLOCK_SUCCESS;
+}
+
+/* Allocate the buffer pool; an existing pool is written back and replaced */
+block_result_t bcache_initialize(uint32_t buffer_count, bool write_through) {
+    uint32_t buckets = 1;
+    uint32_t bytes;
+    uint8_t* memory;
+
+    if (buffer_count < BCACHE_MIN_BUFFERS) {
+        buffer_count = BCACHE_MIN_BUFFERS;
+    }
+    if (buffer_count > BCACHE_MAX_BUFFERS) {
+        buffer_count = BCACHE_MAX_BUFFERS;
+    }
+    while (buckets < buffer_count) {
+        buckets <<= 1;
+    }
+
+    bcache_lock();
+
+    if (bcache_memory) {
+        bcache_prefetch_collect(true);
+        for (uint32_t i = 0; i < bcache_stats.buffer_count; i++) {
+            if (bcache_buffers[i].refcount > 0) {
+                bcache_unlock();
+                return BLOCK_ERROR_INVALID_PARAMETER;  /* Still in use */
+            }
+        }
+        block_result_t result = bcache_sync_locked(NULL, 0);
+        if (result != BLOCK_SUCCESS) {
+            bcache_unlock();
+            return result;
+        }
+        memory_free_pages(bcache_memory, bcache_memory_pages);
+        bcache_memory = NULL;
+    }
+
+    /* Layout: sector data, staging buffer, readahead buffer, descriptors, hash buckets */
+    bytes = buffer_count * BLOCK_SECTOR_SIZE + BCACHE_WRITEBACK_BATCH * BLOCK_SECTOR_SIZE +
+            BCACHE_PREFETCH_MAX * BLOCK_SECTOR_SIZE +
+            buffer_count * sizeof(bcache_buffer_t) + buckets * sizeof(bcache_buffer_t*);
+    bcache_memory_pages = (bytes + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    bcache_memory = memory_alloc_pages(bcache_memory_pages);
+    if (!bcache_memory) {
+        memset(&bcache_stats, 0, sizeof(bcache_stats));
+        bcache_unlock();
+        return BLOCK_ERROR_NO_MEMORY;
+    }
+    memset(bcache_memory, 0, bcache_memory_pages * MEMORY_PAGE_SIZE);
+
+    memory = (uint8_t*)bcache_memory;
+    uint8_t* data = memory;
+    bcache_staging = data + buffer_count * BLOCK_SECTOR_SIZE;
+    bcache_prefetch_buffer = bcache_staging + BCACHE_WRITEBACK_BATCH * BLOCK_SECTOR_SIZE;
+    bcache_buffers = (bcache_buffer_t*)(bcache_prefetch_buffer + BCACHE_PREFETCH_MAX * BLOCK_SECTOR_SIZE);
+    bcache_hash = (bcache_buffer_t**)(bcache_buffers + buffer_count);
+    bcache_hash_mask = buckets - 1;
+
+    bcache_lru_head = NULL;
+    bcache_lru_tail = NULL;
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        bcache_buffers[i].data = data + i * BLOCK_SECTOR_SIZE;
+        bcache_demote(&bcache_buffers[i]);
+    }
+
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+    bcache_stats.buffer_count = buffer_count;
+    bcache_stats.write_through = write_through;
+
+    bcache_unlock();
+    return BLOCK_SUCCESS;
+}
+
+/* Background write-back: flush sectors that have been dirty for a while */
+static void bcache_writeback_process(void) {
+    uint32_t flags;
+
+    while (1) {
+        /* process_sleep moves us to the sleeping queue; switch away
+         * directly, since process_yield would put us back on the ready
+         * queue as well. No tick may preempt us in between. */
+        __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+        process_sleep(get_current_process(), BCACHE_WRITEBACK_INTERVAL_MS);
+        scheduler_switch_process();
+        if (flags & 0x200) {
+            __asm__ volatile("sti" : : : "memory");
+        }
+
+        /* Skip a round rather than wait behind a foreground user */
+        if (bcache_try_lock()) {
+            if (bcache_memory) {
+                bcache_sync_locked(NULL, BCACHE_WRITEBACK_AGE_MS * timer_frequency / 1000);
+            }
+            bcache_unlock();
+        }
+    }
+}
+
+/* Start the background write-back process (once) */
+void bcache_start_writeback(void) {
+    if (!bcache_writeback_task) {
+        bcache_writeback_task = process_create("bcache_flush", bcache_writeback_process, PROCESS_PRIORITY_LOW);
+    }
+}
+
+static bcache_buffer_t* bcache_get_common(block_device_t* device, uint32_t lba, bool fill) {
+    bcache_buffer_t* buffer;
+
+    if (!device || !bcache_memory || lba >= device->sector_count) {
+        return NULL;
+    }
+
+    bcache_lock();
+    bcache_prefetch_check(device, lba, 1);
+
+    buffer = bcache_lookup(device, lba);
+    if (buffer) {
+        bcache_stats.hits++;
+    } else {
+        bcache_stats.misses++;
+        buffer = bcache_take_victim();
+        if (!buffer) {
+            bcache_unlock();
+            return NULL;
+        }
+        bcache_assign(buffer, device, lba);
+    }
+
+    if (!buffer->valid) {
+        if (fill && block_read(device, lba, 1, buffer->data) != BLOCK_SUCCESS) {
+            bcache_discard(buffer);
+            bcache_unlock();
+            return NULL;
+        }
+        buffer->valid = true;  /* Without fill, the caller overwrites the sector */
+    }
+
+    buffer->refcount++;
+    bcache_touch(buffer);
+    bcache_unlock();
+    return buffer;
+}
+
+/* Get a sector, reading it on a miss */
+bcache_buffer_t* bcache_get(block_device_t* device, uint32_t lba) {
+    return bcache_get_common(device, lba, true);
+}
+
+/* Get a buffer for a sector the caller will overwrite completely */
+bcache_buffer_t* bcache_get_new(block_device_t* device, uint32_t lba) {
+    return bcache_get_common(device, lba, false);
+}
+
+/* Drop a reference obtained from bcache_get/bcache_get_new */
+void bcache_release(bcache_buffer_t* buffer) {
+    if (buffer && buffer->refcount > 0) {
+        buffer->refcount--;
+    }
+}
+
+/* Record that a buffer was modified (written immediately in write-through
+ * mode, unless pinned) */
+block_result_t bcache_mark_dirty(bcache_buffer_t* buffer) {
+    block_result_t result = BLOCK_SUCCESS;
+
+    if (!buffer || !buffer->device) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    bcache_lock();
+    if (bcache_stats.write_through && !buffer->pinned) {
+        result = block_write(buffer->device, buffer->lba, 1, buffer->data);
+    } else if (!buffer->dirty) {
+        buffer->dirty = true;
+        buffer->dirty_since = timer_get_ticks();
+        bcache_stats.dirty_buffers++;
+    }
+    bcache_unlock();
+    return result;
+}
+
+/* Keep a buffer's contents off the device until bcache_unpin. The pin
+ * holds a reference of its own, so the buffer cannot be evicted. */
+void bcache_pin(bcache_buffer_t* buffer) {
+    if (!buffer || !buffer->device) {
+        return;
+    }
+
+    bcache_lock();
+    if (!buffer->pinned) {
+        buffer->pinned = true;
+        buffer->refcount++;
+    }
+    bcache_unlock();
+}
+
+/* Let a pinned buffer be written back again; in write-through mode a
+ * dirty buffer is written now */
+void bcache_unpin(bcache_buffer_t* buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    bcache_lock();
+    if (buffer->pinned) {
+        buffer->pinned = false;
+        buffer->refcount--;
+        if (bcache_stats.write_through && buffer->dirty &&
+            block_write(buffer->device, buffer->lba, 1, buffer->data) == BLOCK_SUCCESS) {
+            bcache_set_clean(buffer);
+        }
+    }
+    bcache_unlock();
+}
+
+/* Read sectors; cached sectors are copied, each run of misses is read with
+ * one I/O and, if keep is set, copied into the cache */
+static block_result_t bcache_read_common(block_device_t* device, uint32_t lba, uint32_t count, void* buffer, bool keep) {
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t i = 0;
+
+    if (!bcache_memory) {
+        return block_read(device, lba, count, buffer);
+    }
+    if (!device || !buffer) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    bcache_lock();
+    bcache_prefetch_check(device, lba, count);
+
+    while (i < count) {
+        bcache_buffer_t* cached = bcache_lookup(device, lba + i);
+        uint32_t run = 1;
+
+        if (cached && cached->valid) {
+            memcpy(out + i * BLOCK_SECTOR_SIZE, cached->data, BLOCK_SECTOR_SIZE);
+            bcache_touch(cached);
+            bcache_stats.hits++;
+            i++;
+            continue;
+        }
+
+        while (i + run < count) {
+            bcache_buffer_t* next = bcache_lookup(device, lba + i + run);
+            if (next && next->valid) {
+                break;
+            }
+            run++;
+        }
+        bcache_stats.misses += run;
+
+        block_result_t result = block_read(device, lba + i, run, out + i * BLOCK_SECTOR_SIZE);
+        if (result != BLOCK_SUCCESS) {
+            bcache_unlock();
+            return result;
+        }
+
+        /* Keep copies of what was read */
+        for (uint32_t j = 0; keep && j < run; j++) {
+            bcache_buffer_t* copy = bcache_lookup(device, lba + i + j);
+            if (!copy) {
+                copy = bcache_take_victim();
+                if (!copy) {
+                    break;
+                }
+                bcache_assign(copy, device, lba + i + j);
+            }
+            memcpy(copy->data, out + (i + j) * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+            copy->valid = true;
+            bcache_touch(copy);
+        }
+        i += run;
+    }
+
+    bcache_unlock();
+    return BLOCK_SUCCESS;
+}
+
+/* Read sectors, keeping copies in the cache */
+block_result_t bcache_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    return bcache_read_common(device, lba, count, buffer, true);
+}
+
+/* Read sectors without filling the cache: misses go straight from the
+ * device into the caller's buffer. Cached (possibly dirty) sectors are
+ * still honoured. For large transfers that would only evict useful data. */
+block_result_t bcache_read_direct(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    return bcache_read_common(device, lba, count, buffer, false);
+}
+
+/* Write sectors straight to the device, refreshing any cached copies.
+ * For data that is written once and rarely read back. */
+block_result_t bcache_write_direct(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    const uint8_t* in = (const uint8_t*)buffer;
+    block_result_t result;
+
+    if (!bcache_memory) {
+        return block_write(device, lba, count, buffer);
+    }
+
+    bcache_lock();
+    bcache_prefetch_check(device, lba, count);
+    result = block_write(device, lba, count, buffer);
+    if (result == BLOCK_SUCCESS) {
+        for (uint32_t i = 0; i < count; i++) {
+            bcache_buffer_t* cached = bcache_lookup(device, lba + i);
+            if (cached) {
+                memcpy(cached->data, in + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+                cached->valid = true;
+                bcache_set_clean(cached);
+            }
+        }
+    }
+    bcache_unlock();
+    return result;
+}
+
+/* Write sectors. Write-back mode keeps them dirty in the cache; write-through
+ * mode and writes too large to cache go straight to the device and refresh
+ * any cached copies. */
+block_result_t bcache_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    const uint8_t* in = (const uint8_t*)buffer;
+    block_result_t result = BLOCK_SUCCESS;
+
+    if (!bcache_memory) {
+        return block_write(device, lba, count, buffer);
+    }
+    if (!device || !buffer || count == 0 || lba >= device->sector_count || count > device->sector_count - lba) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    if (bcache_stats.write_through || count > bcache_stats.buffer_count / 2) {
+        return bcache_write_direct(device, lba, count, buffer);
+    }
+
+    bcache_lock();
+    bcache_prefetch_check(device, lba, count);
+
+    for (uint32_t i = 0; i < count && result == BLOCK_SUCCESS; i++) {
+        bcache_buffer_t* cached = bcache_lookup(device, lba + i);
+
+        if (!cached) {
+            cached = bcache_take_victim();
+            if (!cached) {
+                /* Every buffer is held: write this sector directly */
+                result = block_write(device, lba + i, 1, in + i * BLOCK_SECTOR_SIZE);
+                continue;
+            }
+            bcache_assign(cached, device, lba + i);
+        }
+
+        memcpy(cached->data, in + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        cached->valid = true;
+        if (!cached->dirty) {
+            cached->dirty = true;
+            cached->dirty_since = timer_get_ticks();
+            bcache_stats.dirty_buffers++;
+        }
+        bcache_touch(cached);
+    }
+
+    bcache_unlock();
+    return result;
+}
+
+/* Start reading sectors into the cache in the background. Sectors already
+ * cached at the front of the range are skipped and the read stops at the
+ * next cached one. Only one readahead is in flight at a time; returns
+ * BLOCK_ERROR_NOT_SUPPORTED while the previous one is still running. */
+block_result_t bcache_prefetch(block_device_t* device, uint32_t lba, uint32_t count) {
+    uint32_t limit;
+    block_result_t result;
+
+    if (!bcache_memory || !device || lba >= device->sector_count) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    bcache_lock();
+
+    bcache_prefetch_collect(false);
+    if (bcache_prefetch_device) {
+        bcache_unlock();
+        return BLOCK_ERROR_NOT_SUPPORTED;
+    }
+
+    /* Keep readahead from flushing more than a quarter of the cache */
+    limit = bcache_stats.buffer_count / 4;
+    if (limit > BCACHE_PREFETCH_MAX) {
+        limit = BCACHE_PREFETCH_MAX;
+    }
+    if (count > limit) {
+        count = limit;
+    }
+    if (count > device->sector_count - lba) {
+        count = device->sector_count - lba;
+    }
+
+    while (count > 0 && bcache_lookup(device, lba)) {
+        lba++;
+        count--;
+    }
+    for (uint32_t i = 1; i < count; i++) {
+        if (bcache_lookup(device, lba + i)) {
+            count = i;
+            break;
+        }
+    }
+    if (count == 0) {
+        bcache_unlock();
+        return BLOCK_SUCCESS;
+    }
+
+    memset(&bcache_prefetch_request, 0, sizeof(bcache_prefetch_request));
+    bcache_prefetch_request.op = BLOCK_REQUEST_READ;
+    bcache_prefetch_request.lba = lba;
+    bcache_prefetch_request.sector_count = count;
+    bcache_prefetch_request.buffer = bcache_prefetch_buffer;
+
+    result = block_submit(device, &bcache_prefetch_request);
+    if (result == BLOCK_SUCCESS) {
+        bcache_prefetch_device = device;
+        bcache_prefetch_lba = lba;
+        bcache_prefetch_count = count;
+    }
+
+    bcache_unlock();
+    return result;
+}
+
+/* Write back every dirty buffer of a device (NULL = all devices) */
+block_result_t bcache_sync(block_device_t* device) {
+    block_result_t result;
+
+    if (!bcache_memory) {
+        return BLOCK_SUCCESS;
+    }
+
+    bcache_lock();
+    result = bcache_sync_locked(device, 0);
+    bcache_unlock();
+    return result;
+}
+
+/* Write back buffers dirty for at least min_age_ms */
+block_result_t bcache_writeback(uint32_t min_age_ms) {
+    block_result_t result;
+
+    if (!bcache_memory) {
+        return BLOCK_SUCCESS;
+    }
+
+    bcache_lock();
+    result = bcache_sync_locked(NULL, min_age_ms * timer_frequency / 1000);
+    bcache_unlock();
+    return result;
+}
+
+/* Write back and forget a device's sectors, e.g. after it was written
+ * behind the cache's back. Referenced buffers are kept. */
+block_result_t bcache_invalidate(block_device_t* device) {
+    block_result_t result;
+
+    if (!bcache_memory) {
+        return BLOCK_SUCCESS;
+    }
+
+    bcache_lock();
+    bcache_prefetch_check(device, 0, 0xFFFFFFFF);
+    result = bcache_sync_locked(device, 0);
+    if (result == BLOCK_SUCCESS) {
+        for (uint32_t i = 0; i < bcache_stats.buffer_count; i++) {
+            bcache_buffer_t* buffer = &bcache_buffers[i];
+            if (buffer->device && (!device || buffer->device == device) && buffer->refcount == 0) {
+                bcache_discard(buffer);
+            }
+        }
+    }
+    bcache_unlock();
+    return result;
+}
+
+void bcache_get_stats(bcache_stats_t* stats) {
+    if (stats) {
+        memcpy(stats, &bcache_stats, sizeof(bcache_stats_t));
+    }
+}
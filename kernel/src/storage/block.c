@@ -0,0 +1,489 @@
+/*
+ * Block Device Layer
+ * ChanUX Operating System
+ *
+ * Device registry, bounds-checked I/O wrappers and the ATA and partition
+ * backends. RAM disks live in ramdisk.c.
+ */
+
+#include "../../include/storage/block.h"
+#include "../../include/storage/hdd.h"
+#include "../../include/common/utils.h"
+#include "../../include/memory/memory.h"
+#include "../../include/terminal/terminal.h"
+#include "../../include/timer/pit.h"
+
+/* Registered devices */
+static block_device_t* block_devices[BLOCK_MAX_DEVICES];
+static uint32_t block_device_count = 0;
+
+/* ATA backend: one device per drive, private_data points at the drive number */
+static block_device_t block_ata_devices[4];
+static uint8_t block_ata_drive_numbers[4];
+
+static block_result_t block_dispatch(block_device_t* device, block_request_t* request);
+
+/* Partition backend pool */
+#define BLOCK_MAX_PARTITIONS    12
+static block_device_t block_partitions[BLOCK_MAX_PARTITIONS];
+
+/* Map an ATA result onto the block layer */
+static block_result_t block_from_hdd_result(hdd_result_t result) {
+    switch (result) {
+        case HDD_SUCCESS:
+            return BLOCK_SUCCESS;
+        case HDD_ERROR_INVALID_DRIVE:
+            return BLOCK_ERROR_INVALID_DEVICE;
+        case HDD_ERROR_INVALID_SECTOR:
+            return BLOCK_ERROR_OUT_OF_RANGE;
+        case HDD_ERROR_BUFFER_NULL:
+            return BLOCK_ERROR_INVALID_PARAMETER;
+        case HDD_ERROR_NO_MEMORY:
+            return BLOCK_ERROR_NO_MEMORY;
+        default:
+            return BLOCK_ERROR_IO;
+    }
+}
+
+/* Check a transfer against the device size */
+static block_result_t block_check_range(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    if (!device || !device->ops) {
+        return BLOCK_ERROR_INVALID_DEVICE;
+    }
+    if (!buffer || count == 0) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+    if (lba >= device->sector_count || count > device->sector_count - lba) {
+        return BLOCK_ERROR_OUT_OF_RANGE;
+    }
+    return BLOCK_SUCCESS;
+}
+
+/* === ATA backend === */
+
+static uint8_t block_ata_drive(block_device_t* device) {
+    return *(uint8_t*)device->private_data;
+}
+
+static block_result_t block_ata_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    return block_from_hdd_result(hdd_read_sectors(block_ata_drive(device), lba, count, (uint16_t*)buffer));
+}
+
+static block_result_t block_ata_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    return block_from_hdd_result(hdd_write_sectors(block_ata_drive(device), lba, count, (uint16_t*)buffer));
+}
+
+static block_result_t block_ata_flush(block_device_t* device) {
+    return block_from_hdd_result(hdd_flush_cache(block_ata_drive(device)));
+}
+
+/* Runs in interrupt context when the ATA request finishes */
+static void block_ata_complete(hdd_request_t* hdd_request) {
+    block_complete_request((block_request_t*)hdd_request->context, block_from_hdd_result(hdd_request->result));
+}
+
+static block_result_t block_ata_submit(block_device_t* device, block_request_t* request) {
+    hdd_request_t* hdd_request = &request->hdd;
+    hdd_result_t result;
+
+    memset(hdd_request, 0, sizeof(hdd_request_t));
+    hdd_request->drive = block_ata_drive(device);
+    hdd_request->lba = request->lba + request->lba_offset;
+    hdd_request->sector_count = request->sector_count;
+    hdd_request->buffer = (uint16_t*)request->buffer;
+    hdd_request->callback = block_ata_complete;
+    hdd_request->context = request;
+
+    switch (request->op) {
+        case BLOCK_REQUEST_READ:  hdd_request->op = HDD_REQUEST_READ;  break;
+        case BLOCK_REQUEST_WRITE: hdd_request->op = HDD_REQUEST_WRITE; break;
+        default:                  hdd_request->op = HDD_REQUEST_FLUSH; break;
+    }
+
+    /* A rejected request never reaches the queue, so no callback runs */
+    result = hdd_submit_request(hdd_request);
+    if (result != HDD_SUCCESS) {
+        block_complete_request(request, block_from_hdd_result(result));
+    }
+    return BLOCK_SUCCESS;
+}
+
+static block_result_t block_ata_wait(block_device_t* device, block_request_t* request) {
+    (void)device;
+
+    /* The block request is completed only through block_ata_complete, once
+     * the ATA request is off its channel: by the channel, or by cancelling
+     * it on timeout. Failing it earlier would let the channel write into a
+     * released request later. */
+    while (!request->done) {
+        if (hdd_wait_request(&request->hdd) == HDD_ERROR_TIMEOUT && !request->done) {
+            hdd_cancel_request(&request->hdd, HDD_ERROR_TIMEOUT);
+        }
+    }
+    return request->result;
+}
+
+static const block_device_ops_t block_ata_ops = {
+    block_ata_read,
+    block_ata_write,
+    block_ata_flush,
+    block_ata_submit,
+    block_ata_wait
+};
+
+/* === Partition backend: a window onto the parent device ===
+ * I/O goes straight to the parent's backend: the range was checked against
+ * the partition, which lies inside the parent, and statistics are counted
+ * on the partition only. */
+
+static block_result_t block_partition_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    return device->parent->ops->read(device->parent, device->start_lba + lba, count, buffer);
+}
+
+static block_result_t block_partition_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    return device->parent->ops->write(device->parent, device->start_lba + lba, count, buffer);
+}
+
+static block_result_t block_partition_flush(block_device_t* device) {
+    return block_flush(device->parent);
+}
+
+/* The caller's lba is left alone; the parent adds lba_offset */
+static block_result_t block_partition_submit(block_device_t* device, block_request_t* request) {
+    request->lba_offset += device->start_lba;
+    request->device = device->parent;
+    return block_dispatch(device->parent, request);
+}
+
+static const block_device_ops_t block_partition_ops = {
+    block_partition_read,
+    block_partition_write,
+    block_partition_flush,
+    block_partition_submit,
+    NULL
+};
+
+/* Create and register a partition device covering part of parent */
+block_device_t* block_create_partition(block_device_t* parent, const char* name,
+                                       uint32_t start_lba, uint32_t sector_count) {
+    block_device_t* device = NULL;
+
+    if (!parent || !name || sector_count == 0 ||
+        start_lba >= parent->sector_count || sector_count > parent->sector_count - start_lba) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < BLOCK_MAX_PARTITIONS; i++) {
+        if (!block_partitions[i].registered) {
+            device = &block_partitions[i];
+            break;
+        }
+    }
+    if (!device) {
+        return NULL;
+    }
+
+    memset(device, 0, sizeof(block_device_t));
+    strncpy(device->name, name, BLOCK_NAME_LENGTH - 1);
+    device->sector_count = sector_count;
+    device->ops = &block_partition_ops;
+    device->parent = parent;
+    device->start_lba = start_lba;
+
+    if (block_register(device) != BLOCK_SUCCESS) {
+        return NULL;
+    }
+    return device;
+}
+
+/* === Registry === */
+
+/* Reset the registry and register every detected ATA drive (hda..hdd) */
+void block_initialize(void) {
+    uint32_t sector_count;
+
+    memset(block_devices, 0, sizeof(block_devices));
+    block_device_count = 0;
+    memset(block_partitions, 0, sizeof(block_partitions));
+
+    for (uint8_t drive = HDD_PRIMARY_MASTER; drive <= HDD_SECONDARY_SLAVE; drive++) {
+        block_device_t* device = &block_ata_devices[drive];
+
+        memset(device, 0, sizeof(block_device_t));
+        if (hdd_get_drive_size(drive, &sector_count) != HDD_SUCCESS || sector_count == 0) {
+            continue;
+        }
+
+        block_ata_drive_numbers[drive] = drive;
+        strcpy(device->name, "hda");
+        device->name[2] = 'a' + drive;
+        device->sector_count = sector_count;
+        device->ops = &block_ata_ops;
+        device->private_data = &block_ata_drive_numbers[drive];
+        block_register(device);
+    }
+}
+
+/* Add a device to the registry; names must be unique */
+block_result_t block_register(block_device_t* device) {
+    if (!device || !device->ops || device->name[0] == '\0' || block_find(device->name)) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+    if (block_device_count >= BLOCK_MAX_DEVICES) {
+        return BLOCK_ERROR_REGISTRY_FULL;
+    }
+
+    block_devices[block_device_count++] = device;
+    device->registered = true;
+    return BLOCK_SUCCESS;
+}
+
+/* Remove a device from the registry */
+void block_unregister(block_device_t* device) {
+    for (uint32_t i = 0; i < block_device_count; i++) {
+        if (block_devices[i] == device) {
+            block_devices[i] = block_devices[--block_device_count];
+            block_devices[block_device_count] = NULL;
+            device->registered = false;
+            return;
+        }
+    }
+}
+
+/* Look up a device by name */
+block_device_t* block_find(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < block_device_count; i++) {
+        if (strcmp(block_devices[i]->name, name) == 0) {
+            return block_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Device by registry index (NULL past the end) */
+block_device_t* block_get_device(uint32_t index) {
+    return index < block_device_count ? block_devices[index] : NULL;
+}
+
+uint32_t block_get_device_count(void) {
+    return block_device_count;
+}
+
+/* === I/O === */
+
+block_result_t block_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    block_result_t result = block_check_range(device, lba, count, buffer);
+    if (result != BLOCK_SUCCESS) {
+        return result;
+    }
+
+    device->read_operations++;
+    device->sectors_read += count;
+    return device->ops->read(device, lba, count, buffer);
+}
+
+block_result_t block_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    block_result_t result = block_check_range(device, lba, count, buffer);
+    if (result != BLOCK_SUCCESS) {
+        return result;
+    }
+
+    device->write_operations++;
+    device->sectors_written += count;
+    return device->ops->write(device, lba, count, buffer);
+}
+
+block_result_t block_flush(block_device_t* device) {
+    if (!device || !device->ops) {
+        return BLOCK_ERROR_INVALID_DEVICE;
+    }
+    return device->ops->flush ? device->ops->flush(device) : BLOCK_SUCCESS;
+}
+
+/* Mark a request finished and run its callback */
+void block_complete_request(block_request_t* request, block_result_t result) {
+    request->result = result;
+    request->done = true;
+    if (request->callback) {
+        request->callback(request);
+    }
+}
+
+/* Start an asynchronous request; the result is reported through
+ * request->done/result and the callback. Backends without a submit
+ * operation complete the request synchronously. */
+block_result_t block_submit(block_device_t* device, block_request_t* request) {
+    block_result_t result = BLOCK_SUCCESS;
+
+    if (!request) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    request->done = false;
+    request->device = device;
+    request->lba_offset = 0;
+
+    if (!device || !device->ops) {
+        result = BLOCK_ERROR_INVALID_DEVICE;
+    } else if (request->op != BLOCK_REQUEST_FLUSH) {
+        result = block_check_range(device, request->lba, request->sector_count, request->buffer);
+    }
+    if (result != BLOCK_SUCCESS) {
+        block_complete_request(request, result);
+        return result;
+    }
+
+    if (request->op == BLOCK_REQUEST_READ) {
+        device->read_operations++;
+        device->sectors_read += request->sector_count;
+    } else if (request->op == BLOCK_REQUEST_WRITE) {
+        device->write_operations++;
+        device->sectors_written += request->sector_count;
+    }
+
+    return block_dispatch(device, request);
+}
+
+/* Hand a checked request to the backend; without a submit op it runs now */
+static block_result_t block_dispatch(block_device_t* device, block_request_t* request) {
+    uint32_t lba = request->lba + request->lba_offset;
+    block_result_t result;
+
+    if (device->ops->submit) {
+        return device->ops->submit(device, request);
+    }
+
+    switch (request->op) {
+        case BLOCK_REQUEST_READ:
+            result = device->ops->read(device, lba, request->sector_count, request->buffer);
+            break;
+        case BLOCK_REQUEST_WRITE:
+            result = device->ops->write(device, lba, request->sector_count, request->buffer);
+            break;
+        default:
+            result = block_flush(device);
+            break;
+    }
+    block_complete_request(request, result);
+    return BLOCK_SUCCESS;
+}
+
+/* Wait for a submitted request and return its result */
+block_result_t block_wait(block_request_t* request) {
+    if (!request) {
+        return BLOCK_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!request->done && request->device && request->device->ops->wait) {
+        return request->device->ops->wait(request->device, request);
+    }
+
+    while (!request->done) {
+        __asm__ volatile("pause");
+    }
+    return request->result;
+}
+
+/* Time one sequential pass through the block layer, in milliseconds */
+static uint32_t block_benchmark_pass(block_device_t* device, uint32_t sector_count, uint8_t* buffer,
+                                     bool write) {
+    uint32_t start = timer_get_ticks();
+    uint32_t lba;
+
+    for (lba = 0; lba < sector_count; lba += BLOCK_BENCHMARK_CHUNK) {
+        uint32_t count = sector_count - lba;
+        block_result_t result;
+
+        if (count > BLOCK_BENCHMARK_CHUNK) {
+            count = BLOCK_BENCHMARK_CHUNK;
+        }
+        result = write ? block_write(device, lba, count, buffer) : block_read(device, lba, count, buffer);
+        if (result != BLOCK_SUCCESS) {
+            return 0;
+        }
+    }
+
+    return ((timer_get_ticks() - start) * 1000) / timer_frequency;
+}
+
+/* Print throughput for a finished pass */
+static void block_benchmark_report(const char* label, uint32_t sector_count, uint32_t elapsed_ms) {
+    char num_str[16];
+    uint32_t kb_per_sec;
+
+    terminal_writestring(label);
+    if (elapsed_ms == 0) {
+        terminal_writeline("too fast to measure (or I/O failed)");
+        return;
+    }
+
+    kb_per_sec = ((sector_count / 2) * 1000) / elapsed_ms;
+    int_to_string(kb_per_sec / 1024, num_str);
+    terminal_writestring(num_str);
+    terminal_writestring(".");
+    int_to_string(((kb_per_sec % 1024) * 10) / 1024, num_str);
+    terminal_writestring(num_str);
+    terminal_writestring(" MB/s (");
+    int_to_string(elapsed_ms, num_str);
+    terminal_writestring(num_str);
+    terminal_writeline(" ms)");
+}
+
+/* Sequential write then read benchmark through the block layer.
+ * Overwrites the device, so run it on a RAM disk to measure the layer's
+ * own cost without ATA. Needs the timer interrupt running. */
+void block_benchmark(block_device_t* device, uint32_t sector_count) {
+    uint32_t pages = (BLOCK_BENCHMARK_CHUNK * BLOCK_SECTOR_SIZE + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    uint8_t* buffer;
+    uint32_t elapsed_ms;
+    char num_str[16];
+
+    if (!device || !device->ops || timer_frequency == 0) {
+        terminal_writeline("Block benchmark: device or timer not available");
+        return;
+    }
+
+    buffer = (uint8_t*)memory_alloc_pages(pages);
+    if (!buffer) {
+        terminal_writeline("Block benchmark: out of memory");
+        return;
+    }
+
+    if (sector_count > device->sector_count) {
+        sector_count = device->sector_count;
+    }
+
+    terminal_writestring("\n=== Block Benchmark: ");
+    terminal_writestring(device->name);
+    terminal_writestring(", ");
+    int_to_string(sector_count / 2, num_str);
+    terminal_writestring(num_str);
+    terminal_writeline(" KB sequential ===");
+
+    elapsed_ms = block_benchmark_pass(device, sector_count, buffer, true);
+    block_benchmark_report("Write: ", sector_count, elapsed_ms);
+
+    elapsed_ms = block_benchmark_pass(device, sector_count, buffer, false);
+    block_benchmark_report("Read:  ", sector_count, elapsed_ms);
+
+    memory_free_pages(buffer, pages);
+}
+
+/* Get block result as string */
+const char* block_result_to_string(block_result_t result) {
+    switch (result) {
+        case BLOCK_SUCCESS:                 return "Success";
+        case BLOCK_ERROR_INVALID_DEVICE:    return "Invalid device";
+        case BLOCK_ERROR_INVALID_PARAMETER: return "Invalid parameter";
+        case BLOCK_ERROR_OUT_OF_RANGE:      return "Sector out of range";
+        case BLOCK_ERROR_IO:                return "I/O error";
+        case BLOCK_ERROR_NO_MEMORY:         return "Out of memory";
+        case BLOCK_ERROR_REGISTRY_FULL:     return "Device registry full";
+        case BLOCK_ERROR_NOT_SUPPORTED:     return "Not supported";
+        default:                            return "Unknown error";
+    }
+}
@@ -7,35 +7,98 @@
 
 #include "../../include/common/types.h"
 #include "../../include/storage/fat32.h"
-#include "../../include/storage/hdd.h"
+#include "../../include/storage/block.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/timer/pit.h"
+#include "../../include/process/process.h"
 #include "../../include/common/utils.h"
 
 /* Global volume state */
 fat32_volume_t fat32_volume = {0};
 uint32_t fat32_current_directory = 0;
 
+/* Volume lock: serializes the VFS backend and the defragmenter */
+static volatile bool fat32_locked = false;
+
+bool fat32_try_lock(void) {
+    uint32_t flags;
+    bool acquired;
+    
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    acquired = !fat32_locked;
+    if (acquired) {
+        fat32_locked = true;
+    }
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+    return acquired;
+}
+
+void fat32_lock(void) {
+    while (!fat32_try_lock()) {
+        if (get_current_process()) {
+            process_yield();
+        }
+    }
+}
+
+void fat32_unlock(void) {
+    fat32_locked = false;
+}
+
 /* Enhanced error handling and validation */
 #define FAT32_VALIDATE_CLUSTER(cluster) \
     ((cluster) >= 2 && (cluster) < (fat32_volume.total_clusters + 2) && (cluster) < FAT32_EOC)
 
-/* Enhanced cluster cache for better performance */
-static struct {
-    uint32_t cluster;
-    uint8_t data[FAT32_SECTOR_SIZE * 8];  /* Max cluster size */
-    bool dirty;
-    bool valid;
-} cluster_cache = {0};
-
-/* FAT sector cache for improved performance */
-static struct {
-    uint32_t sector;
-    uint8_t data[FAT32_SECTOR_SIZE];
-    bool dirty;
-    bool valid;
-} fat_cache = {0};
-
-/* Enhanced buffer management */
-static uint8_t fat32_sector_buffer[FAT32_SECTOR_SIZE] __attribute__((aligned(4)));
+/* Cache configuration; sizes the shared block buffer cache at mount time */
+static fat32_cache_config_t fat32_cache_config = {
+    true,       /* enable_fat_cache */
+    true,       /* enable_cluster_cache */
+    true,       /* enable_dir_cache */
+    64,         /* fat_cache_size (sectors) */
+    32,         /* cluster_cache_size (clusters) */
+    32,         /* dir_cache_size (sectors) */
+    false       /* write_through */
+};
+
+/* FAT table cache: link updates go to the primary FAT in the buffer cache
+ * and mark the FAT sector in this bitmap; the mirror FATs are brought up to
+ * date in one batch at sync time. Without a bitmap (single FAT or no
+ * memory) every mirror is updated with the primary. */
+#define FAT32_FAT_SYNC_BATCH        16          /* Sectors per mirror write */
+
+static uint32_t* fat32_fat_dirty_map = NULL;
+static uint32_t fat32_fat_dirty_pages = 0;
+static uint32_t fat32_fat_dirty_count = 0;
+static uint8_t* fat32_fat_sync_buffer = NULL;     /* Follows the bitmap in the same pages */
+
+/* Free-cluster bitmap built from the FAT at mount: bit N set = cluster N
+ * is free. Allocation scans it a word at a time; without it (no memory)
+ * the allocators fall back to scanning the FAT. */
+#define FAT32_FREE_MAP_READ_SECTORS 64          /* FAT sectors per read while building */
+
+static uint32_t* fat32_free_map = NULL;
+static uint32_t fat32_free_map_pages = 0;
+static uint32_t fat32_free_map_words = 0;
+static bool fat32_free_map_pending = false;     /* Build on first allocation */
+
+static inline uint32_t fat32_bit_scan_forward(uint32_t value) {
+    uint32_t index;
+    __asm__("bsf %1, %0" : "=r"(index) : "rm"(value));
+    return index;
+}
+
+static inline void fat32_free_map_update(uint32_t cluster, bool free) {
+    if (fat32_free_map) {
+        if (free) {
+            fat32_free_map[cluster / 32] |= 1u << (cluster % 32);
+        } else {
+            fat32_free_map[cluster / 32] &= ~(1u << (cluster % 32));
+        }
+    }
+}
 
 /* Convert cluster number to LBA */
 uint32_t fat32_cluster_to_lba(uint32_t cluster) {
@@ -59,24 +122,13 @@ uint32_t fat32_get_next_cluster(uint32_t cluster) {
     fat_sector = fat32_volume.fat_begin_lba + (fat_offset / FAT32_SECTOR_SIZE);
     ent_offset = fat_offset % FAT32_SECTOR_SIZE;
     
-    /* Use FAT cache if available */
-    if (fat_cache.valid && fat_cache.sector == fat_sector) {
-        next_cluster = *((uint32_t*)&fat_cache.data[ent_offset]) & FAT32_CLUSTER_MASK;
-    } else {
-        /* Read the FAT sector */
-        if (hdd_read_sector(fat32_volume.drive, fat_sector, fat32_sector_buffer) != HDD_SUCCESS) {
-            return FAT32_EOC;  /* Error reading FAT */
-        }
-        
-        /* Extract the cluster value */
-        next_cluster = *((uint32_t*)&fat32_sector_buffer[ent_offset]) & FAT32_CLUSTER_MASK;
-        
-        /* Update cache */
-        fat_cache.sector = fat_sector;
-        memcpy(fat_cache.data, fat32_sector_buffer, FAT32_SECTOR_SIZE);
-        fat_cache.valid = true;
-        fat_cache.dirty = false;
+    /* Read the FAT sector through the buffer cache */
+    bcache_buffer_t* buffer = bcache_get(fat32_volume.device, fat_sector);
+    if (!buffer) {
+        return FAT32_EOC;  /* Error reading FAT */
     }
+    next_cluster = *((uint32_t*)&buffer->data[ent_offset]) & FAT32_CLUSTER_MASK;
+    bcache_release(buffer);
     
     /* Check if it's end of chain */
     if (next_cluster >= FAT32_EOC) {
@@ -97,48 +149,388 @@ fat32_result_t fat32_set_next_cluster(uint32_t cluster, uint32_t next_cluster) {
     
     /* Calculate position in FAT */
     fat_offset = cluster * 4;  /* 4 bytes per entry in FAT32 */
-    fat_sector = fat32_volume.fat_begin_lba + (fat_offset / FAT32_SECTOR_SIZE);
     ent_offset = fat_offset % FAT32_SECTOR_SIZE;
     
-    /* Read the FAT sector if not cached */
-    if (!fat_cache.valid || fat_cache.sector != fat_sector) {
-        if (hdd_read_sector(fat32_volume.drive, fat_sector, fat32_sector_buffer) != HDD_SUCCESS) {
-            return FAT32_ERROR_READ_FAILED;
+    /* Update the primary FAT; mirrors follow at sync time if tracked */
+    uint8_t copies = fat32_fat_dirty_map ? 1 : fat32_volume.num_fats;
+    
+    /* Update the entry in each FAT copy; the buffer cache writes them back */
+    for (uint8_t i = 0; i < copies; i++) {
+        fat_sector = fat32_volume.fat_begin_lba + (i * fat32_volume.fat_size) + 
+                     (fat_offset / FAT32_SECTOR_SIZE);
+        
+        bcache_buffer_t* buffer = bcache_get(fat32_volume.device, fat_sector);
+        if (!buffer) {
+            if (i == 0) {
+                return FAT32_ERROR_READ_FAILED;
+            }
+            continue;  /* The primary FAT was updated */
+        }
+        fat32_journal_note(buffer);
+        
+        /* Keep the free map and free count in step with the primary FAT */
+        if (i == 0 && cluster >= 2) {
+            bool was_free = (*((uint32_t*)&buffer->data[ent_offset]) & FAT32_CLUSTER_MASK) == FAT32_FREE_CLUSTER;
+            bool now_free = (next_cluster & FAT32_CLUSTER_MASK) == FAT32_FREE_CLUSTER;
+            
+            if (was_free != now_free) {
+                fat32_free_map_update(cluster, now_free);
+                if (fat32_volume.free_clusters != 0xFFFFFFFF) {
+                    if (now_free) {
+                        fat32_volume.free_clusters++;
+                    } else if (fat32_volume.free_clusters > 0) {
+                        fat32_volume.free_clusters--;
+                    }
+                }
+            }
+        }
+        
+        /* Preserve top 4 bits which are reserved */
+        value = (*((uint32_t*)&buffer->data[ent_offset]) & 0xF0000000) | 
+                (next_cluster & FAT32_CLUSTER_MASK);
+        *((uint32_t*)&buffer->data[ent_offset]) = value;
+        
+        block_result_t result = bcache_mark_dirty(buffer);
+        bcache_release(buffer);
+        if (result != BLOCK_SUCCESS && i == 0) {
+            return FAT32_ERROR_WRITE_FAILED;
         }
-        memcpy(fat_cache.data, fat32_sector_buffer, FAT32_SECTOR_SIZE);
-        fat_cache.sector = fat_sector;
-        fat_cache.valid = true;
-        fat_cache.dirty = false;
     }
     
-    /* Preserve top 4 bits which are reserved */
-    value = (*((uint32_t*)&fat_cache.data[ent_offset]) & 0xF0000000) | 
-            (next_cluster & FAT32_CLUSTER_MASK);
+    if (fat32_fat_dirty_map) {
+        uint32_t index = fat_offset / FAT32_SECTOR_SIZE;
+        uint32_t bit = 1u << (index % 32);
+        if (!(fat32_fat_dirty_map[index / 32] & bit)) {
+            fat32_fat_dirty_map[index / 32] |= bit;
+            fat32_fat_dirty_count++;
+        }
+    }
     
-    /* Update the cluster value */
-    *((uint32_t*)&fat_cache.data[ent_offset]) = value;
-    fat_cache.dirty = true;
+    return FAT32_SUCCESS;
+}
+
+/* Copy dirty primary FAT sectors to every mirror FAT, in runs of adjacent sectors */
+fat32_result_t fat32_sync_fat(void) {
+    uint32_t index = 0;
     
-    /* Write through cache immediately for reliability */
-    memcpy(fat32_sector_buffer, fat_cache.data, FAT32_SECTOR_SIZE);
-    if (hdd_write_sector(fat32_volume.drive, fat_sector, fat32_sector_buffer) != HDD_SUCCESS) {
-        return FAT32_ERROR_WRITE_FAILED;
+    if (!fat32_fat_dirty_map || fat32_fat_dirty_count == 0) {
+        return FAT32_SUCCESS;
     }
-    fat_cache.dirty = false;
     
-    /* If we have multiple FATs, update all of them */
-    for (uint8_t i = 1; i < fat32_volume.num_fats; i++) {
-        uint32_t alt_fat_sector = fat32_volume.fat_begin_lba + (i * fat32_volume.fat_size) + 
-                                 (fat_offset / FAT32_SECTOR_SIZE);
+    while (index < fat32_volume.fat_size) {
+        uint32_t run = 0;
+        
+        /* Skip clean words quickly */
+        if ((index % 32) == 0 && fat32_fat_dirty_map[index / 32] == 0) {
+            index += 32;
+            continue;
+        }
         
-        if (hdd_write_sector(fat32_volume.drive, alt_fat_sector, fat32_sector_buffer) != HDD_SUCCESS) {
-            /* Continue anyway since the primary FAT was updated */
+        while (index + run < fat32_volume.fat_size && run < FAT32_FAT_SYNC_BATCH &&
+               (fat32_fat_dirty_map[(index + run) / 32] & (1u << ((index + run) % 32)))) {
+            run++;
         }
+        if (run == 0) {
+            index++;
+            continue;
+        }
+        
+        /* Primary sectors are normally still cached */
+        if (bcache_read(fat32_volume.device, fat32_volume.fat_begin_lba + index, run,
+                        fat32_fat_sync_buffer) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+        
+        /* Mirrors are only read by repair tools; don't let them occupy the cache */
+        for (uint8_t i = 1; i < fat32_volume.num_fats; i++) {
+            uint32_t mirror_lba = fat32_volume.fat_begin_lba + (i * fat32_volume.fat_size) + index;
+            if (bcache_write_direct(fat32_volume.device, mirror_lba, run,
+                                    fat32_fat_sync_buffer) != BLOCK_SUCCESS) {
+                return FAT32_ERROR_WRITE_FAILED;
+            }
+        }
+        
+        for (uint32_t i = 0; i < run; i++, index++) {
+            fat32_fat_dirty_map[index / 32] &= ~(1u << (index % 32));
+        }
+        fat32_fat_dirty_count -= run;
     }
     
     return FAT32_SUCCESS;
 }
 
+/* Read the whole FAT once, in large sequential reads, into the free-cluster
+ * bitmap; the exact free count replaces the FSInfo hint */
+static void fat32_free_map_build(void) {
+    uint32_t cluster_limit = fat32_volume.total_clusters + 2;
+    uint32_t fat_sectors = (cluster_limit * 4 + FAT32_SECTOR_SIZE - 1) / FAT32_SECTOR_SIZE;
+    uint32_t read_pages = (FAT32_FREE_MAP_READ_SECTORS * FAT32_SECTOR_SIZE) / MEMORY_PAGE_SIZE;
+    uint32_t free_count = 0;
+    uint32_t cluster = 0;
+    uint32_t* entries;
+    
+    fat32_free_map_pending = false;
+    if (fat32_free_map) {
+        memory_free_pages(fat32_free_map, fat32_free_map_pages);
+        fat32_free_map = NULL;
+    }
+    
+    fat32_free_map_words = (cluster_limit + 31) / 32;
+    fat32_free_map_pages = (fat32_free_map_words * 4 + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    fat32_free_map = (uint32_t*)memory_alloc_pages(fat32_free_map_pages);
+    if (!fat32_free_map) {
+        return;
+    }
+    memset(fat32_free_map, 0, fat32_free_map_pages * MEMORY_PAGE_SIZE);
+    
+    entries = (uint32_t*)memory_alloc_pages(read_pages);
+    if (!entries) {
+        memory_free_pages(fat32_free_map, fat32_free_map_pages);
+        fat32_free_map = NULL;
+        return;
+    }
+    
+    /* Read around the cache, but see FAT sectors that are dirty in it */
+    for (uint32_t sector = 0; sector < fat_sectors; sector += FAT32_FREE_MAP_READ_SECTORS) {
+        uint32_t count = fat_sectors - sector;
+        if (count > FAT32_FREE_MAP_READ_SECTORS) {
+            count = FAT32_FREE_MAP_READ_SECTORS;
+        }
+        
+        if (bcache_read_direct(fat32_volume.device, fat32_volume.fat_begin_lba + sector, count, entries) != BLOCK_SUCCESS) {
+            memory_free_pages(entries, read_pages);
+            memory_free_pages(fat32_free_map, fat32_free_map_pages);
+            fat32_free_map = NULL;
+            return;
+        }
+        
+        for (uint32_t i = 0; i < count * (FAT32_SECTOR_SIZE / 4) && cluster < cluster_limit; i++, cluster++) {
+            if (cluster >= 2 && (entries[i] & FAT32_CLUSTER_MASK) == FAT32_FREE_CLUSTER) {
+                fat32_free_map[cluster / 32] |= 1u << (cluster % 32);
+                free_count++;
+            }
+        }
+    }
+    
+    memory_free_pages(entries, read_pages);
+    fat32_volume.free_clusters = free_count;
+}
+
+/* Next run of free clusters at or after from (bitmap only) */
+static bool fat32_free_map_next_run(uint32_t from, uint32_t* run_start, uint32_t* run_length) {
+    uint32_t word = from / 32;
+    uint32_t bits;
+    uint32_t start, end;
+    
+    if (!fat32_free_map || from >= fat32_volume.total_clusters + 2) {
+        return false;
+    }
+    
+    /* First free bit */
+    bits = fat32_free_map[word] & ~((1u << (from % 32)) - 1);
+    while (!bits) {
+        if (++word >= fat32_free_map_words) {
+            return false;
+        }
+        bits = fat32_free_map[word];
+    }
+    start = word * 32 + fat32_bit_scan_forward(bits);
+    
+    /* First used bit after it (bits past the last cluster are never set) */
+    bits = ~fat32_free_map[word] & ~((1u << (start % 32)) - 1);
+    while (!bits) {
+        if (++word >= fat32_free_map_words) {
+            break;
+        }
+        bits = ~fat32_free_map[word];
+    }
+    end = bits ? word * 32 + fat32_bit_scan_forward(bits) : fat32_free_map_words * 32;
+    
+    *run_start = start;
+    *run_length = end - start;
+    return true;
+}
+
+/* Smallest free run holding count clusters, or the largest run if none does */
+static bool fat32_free_map_best_fit(uint32_t count, uint32_t* run_start, uint32_t* run_length) {
+    uint32_t best_start = 0, best_length = 0;
+    bool best_fits = false;
+    uint32_t start, length;
+    uint32_t cluster = 2;
+    
+    while (fat32_free_map_next_run(cluster, &start, &length)) {
+        if (length >= count) {
+            if (!best_fits || length < best_length) {
+                best_start = start;
+                best_length = length;
+                best_fits = true;
+                if (length == count) {
+                    break;  /* Exact fit */
+                }
+            }
+        } else if (!best_fits && length > best_length) {
+            best_start = start;
+            best_length = length;
+        }
+        cluster = start + length;
+    }
+    
+    *run_start = best_start;
+    *run_length = best_length;
+    return best_length != 0;
+}
+
+/* Find a free cluster at or after start, wrapping around */
+static fat32_result_t fat32_find_free_cluster(uint32_t start, uint32_t* cluster) {
+    uint32_t cluster_limit = fat32_volume.total_clusters + 2;
+    
+    if (fat32_free_map_pending) {
+        fat32_free_map_build();
+    }
+    
+    if (start < 2 || start >= cluster_limit) {
+        start = 2;
+    }
+    
+    if (fat32_free_map) {
+        uint32_t word = start / 32;
+        uint32_t bits = fat32_free_map[word] & ~((1u << (start % 32)) - 1);
+        
+        /* From the hint to the end, then from the beginning back to the hint */
+        for (uint32_t scanned = 0; scanned <= fat32_free_map_words; scanned++) {
+            if (bits) {
+                *cluster = word * 32 + fat32_bit_scan_forward(bits);
+                return FAT32_SUCCESS;
+            }
+            if (++word >= fat32_free_map_words) {
+                word = 0;
+            }
+            bits = fat32_free_map[word];
+        }
+        return FAT32_ERROR_DISK_FULL;
+    }
+    
+    /* No bitmap: scan the FAT sector by sector through the buffer cache */
+    uint32_t current_cluster = start;
+    uint32_t clusters_searched = 0;
+    
+    while (clusters_searched < fat32_volume.total_clusters) {
+        uint32_t fat_offset = current_cluster * 4;
+        uint32_t fat_sector = fat32_volume.fat_begin_lba + (fat_offset / FAT32_SECTOR_SIZE);
+        uint32_t sector_offset = fat_offset % FAT32_SECTOR_SIZE;
+        
+        bcache_buffer_t* buffer = bcache_get(fat32_volume.device, fat_sector);
+        if (!buffer) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+        
+        /* Check the remaining clusters in this sector */
+        uint32_t entries_in_sector = (FAT32_SECTOR_SIZE - sector_offset) / 4;
+        for (uint32_t i = 0; i < entries_in_sector && current_cluster < cluster_limit; i++) {
+            uint32_t entry_value = *((uint32_t*)&buffer->data[sector_offset + (i * 4)]) & FAT32_CLUSTER_MASK;
+            
+            if (entry_value == FAT32_FREE_CLUSTER) {
+                bcache_release(buffer);
+                *cluster = current_cluster;
+                return FAT32_SUCCESS;
+            }
+            
+            current_cluster++;
+            clusters_searched++;
+        }
+        bcache_release(buffer);
+        
+        /* Wrap around */
+        if (current_cluster >= cluster_limit) {
+            current_cluster = 2;
+        }
+    }
+    
+    return FAT32_ERROR_DISK_FULL;
+}
+
+/* Read or update the clean-shutdown bit kept in FAT[1] of every FAT copy.
+ * Updates go straight to the disk so they are ordered with the rest. */
+static bool fat32_volume_is_clean(void) {
+    uint32_t entries[FAT32_SECTOR_SIZE / 4];
+    
+    if (bcache_read(fat32_volume.device, fat32_volume.fat_begin_lba, 1, entries) != BLOCK_SUCCESS) {
+        return false;
+    }
+    return (entries[1] & FAT32_CLEAN_SHUTDOWN) != 0;
+}
+
+static void fat32_volume_set_clean(bool clean) {
+    uint32_t entries[FAT32_SECTOR_SIZE / 4];
+    
+    if (fat32_volume.read_only) {
+        return;
+    }
+    
+    for (uint8_t i = 0; i < fat32_volume.num_fats; i++) {
+        uint32_t lba = fat32_volume.fat_begin_lba + i * fat32_volume.fat_size;
+        
+        if (bcache_read(fat32_volume.device, lba, 1, entries) != BLOCK_SUCCESS) {
+            continue;
+        }
+        if (((entries[1] & FAT32_CLEAN_SHUTDOWN) != 0) == clean) {
+            continue;
+        }
+        entries[1] = clean ? (entries[1] | FAT32_CLEAN_SHUTDOWN) : (entries[1] & ~FAT32_CLEAN_SHUTDOWN);
+        bcache_write_direct(fat32_volume.device, lba, 1, entries);
+    }
+}
+
+/* Set up FAT tracking for the mounted volume: the mirror dirty bitmap and
+ * the free-cluster bitmap. After a clean unmount the FSInfo counts are
+ * exact, so mount trusts them and leaves the FAT scan for the bitmap to
+ * the first allocation; otherwise the FAT is scanned now to recount. */
+static void fat32_fat_table_setup(void) {
+    uint32_t bytes = ((fat32_volume.fat_size + 31) / 32) * 4;
+    
+    if (fat32_volume_is_clean() && fat32_volume.free_clusters <= fat32_volume.total_clusters) {
+        fat32_free_map_pending = true;
+    } else {
+        fat32_volume.free_clusters = 0xFFFFFFFF;
+        fat32_free_map_build();
+    }
+    
+    /* Until unmount, a crash leaves the volume marked unclean */
+    fat32_volume_set_clean(false);
+    
+    fat32_fat_dirty_count = 0;
+    if (fat32_volume.num_fats < 2) {
+        return;
+    }
+    
+    bytes = (bytes + MEMORY_PAGE_SIZE - 1) & ~(MEMORY_PAGE_SIZE - 1);
+    fat32_fat_dirty_pages = (bytes + FAT32_FAT_SYNC_BATCH * FAT32_SECTOR_SIZE) / MEMORY_PAGE_SIZE;
+    fat32_fat_dirty_map = (uint32_t*)memory_alloc_pages(fat32_fat_dirty_pages);
+    if (fat32_fat_dirty_map) {
+        memset(fat32_fat_dirty_map, 0, bytes);
+        fat32_fat_sync_buffer = (uint8_t*)fat32_fat_dirty_map + bytes;
+    }
+}
+
+/* Bring the mirrors up to date and drop mirror tracking */
+static void fat32_fat_table_release(void) {
+    if (fat32_fat_dirty_map) {
+        fat32_sync_fat();
+        memory_free_pages(fat32_fat_dirty_map, fat32_fat_dirty_pages);
+        fat32_fat_dirty_map = NULL;
+        fat32_fat_sync_buffer = NULL;
+        fat32_fat_dirty_pages = 0;
+    }
+    fat32_fat_dirty_count = 0;
+    
+    if (fat32_free_map) {
+        memory_free_pages(fat32_free_map, fat32_free_map_pages);
+        fat32_free_map = NULL;
+        fat32_free_map_pages = 0;
+    }
+    fat32_free_map_pending = false;
+}
+
 /* Convert filename to 8.3 format */
 void fat32_filename_to_83(const char* filename, char* shortname) {
     int i, j;
@@ -278,11 +670,8 @@ fat32_result_t fat32_read_cluster(uint32_t cluster, void* buffer) {
     
     uint32_t lba = fat32_cluster_to_lba(cluster);
     
-    for (uint8_t i = 0; i < fat32_volume.sectors_per_cluster; i++) {
-        if (hdd_read_sector(fat32_volume.drive, lba + i, 
-                           (uint8_t*)buffer + (i * FAT32_SECTOR_SIZE)) != HDD_SUCCESS) {
-            return FAT32_ERROR_READ_FAILED;
-        }
+    if (bcache_read(fat32_volume.device, lba, fat32_volume.sectors_per_cluster, buffer) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_READ_FAILED;
     }
     
     return FAT32_SUCCESS;
@@ -296,29 +685,37 @@ fat32_result_t fat32_write_cluster(uint32_t cluster, const void* buffer) {
     
     uint32_t lba = fat32_cluster_to_lba(cluster);
     
-    for (uint8_t i = 0; i < fat32_volume.sectors_per_cluster; i++) {
-        if (hdd_write_sector(fat32_volume.drive, lba + i, 
-                            (const uint8_t*)buffer + (i * FAT32_SECTOR_SIZE)) != HDD_SUCCESS) {
-            return FAT32_ERROR_WRITE_FAILED;
-        }
+    fat32_journal_data_write(lba, fat32_volume.sectors_per_cluster);
+    if (bcache_write(fat32_volume.device, lba, fat32_volume.sectors_per_cluster, buffer) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
     }
     
     return FAT32_SUCCESS;
 }
 
 /* Initialize the FAT32 file system */
-fat32_result_t fat32_initialize(uint8_t drive) {
-    /* Check if the drive is valid */
-    if (drive > HDD_SECONDARY_SLAVE) {
+fat32_result_t fat32_initialize(block_device_t* device) {
+    /* Check if the device is valid */
+    if (device == NULL) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
+    /* Finish with the previously mounted volume's journal and FAT */
+    fat32_journal_unmount();
+    fat32_fat_table_release();
+    
     /* Clear volume information */
     memset(&fat32_volume, 0, sizeof(fat32_volume_t));
-    fat32_volume.drive = drive;
+    fat32_volume.device = device;
+    
+    /* Drop anything cached from an earlier mount of this device */
+    bcache_invalidate(device);
+    fat32_dcache_invalidate_all();
+    fat32_dindex_invalidate_all();
+    fat32_defrag_reset();
     
     /* Read the boot sector */
-    if (hdd_read_sector(drive, 0, &fat32_volume.boot_sector) != HDD_SUCCESS) {
+    if (block_read(device, 0, 1, &fat32_volume.boot_sector) != BLOCK_SUCCESS) {
         return FAT32_ERROR_READ_FAILED;
     }
     
@@ -359,20 +756,19 @@ fat32_result_t fat32_initialize(uint8_t drive) {
     memcpy(fat32_volume.volume_label, fat32_volume.boot_sector.volume_label, 11);
     fat32_volume.volume_label[11] = '\0';
     
-    /* Initialize caches */
-    memset(&cluster_cache, 0, sizeof(cluster_cache));
-    memset(&fat_cache, 0, sizeof(fat_cache));
-    
     /* Try to read the FSInfo sector */
+    fat32_volume.free_clusters = 0xFFFFFFFF; /* Unknown */
     if (fat32_volume.boot_sector.fs_info != 0) {
         fat32_fsinfo_t fsinfo;
-        if (hdd_read_sector(drive, fat32_volume.boot_sector.fs_info, &fsinfo) == HDD_SUCCESS) {
+        if (block_read(device, fat32_volume.boot_sector.fs_info, 1, &fsinfo) == BLOCK_SUCCESS) {
             /* Validate FSInfo signatures */
             if (fsinfo.lead_signature == 0x41615252 && 
                 fsinfo.structure_signature == 0x61417272 &&
                 fsinfo.trail_signature == 0xAA550000) {
                 
-                fat32_volume.free_clusters = fsinfo.free_cluster_count;
+                if (fsinfo.free_cluster_count <= fat32_volume.total_clusters) {
+                    fat32_volume.free_clusters = fsinfo.free_cluster_count;
+                }
                 fat32_volume.next_free_cluster = fsinfo.next_free_cluster;
                 
                 if (fat32_volume.next_free_cluster < 2 || 
@@ -394,14 +790,22 @@ fat32_result_t fat32_initialize(uint8_t drive) {
     /* Set current directory to root */
     fat32_current_directory = fat32_volume.root_dir_first_cluster;
     
-    return FAT32_SUCCESS;
+    /* Size the buffer cache for this volume */
+    fat32_result_t result = fat32_configure_cache(&fat32_cache_config);
+    
+    /* Recover metadata from the journal before the FAT is scanned */
+    fat32_journal_mount();
+    
+    /* Free-space accounting and mirror tracking */
+    fat32_fat_table_setup();
+    
+    return result;
 }
 
 /* Allocate a new cluster */
 fat32_result_t fat32_allocate_cluster(uint32_t* cluster) {
-    uint32_t current_cluster = fat32_volume.next_free_cluster;
-    uint32_t start_cluster = current_cluster;
-    bool found = false;
+    uint32_t current_cluster;
+    fat32_result_t result;
     
     if (!fat32_volume.initialized) {
         return FAT32_ERROR_NOT_INITIALIZED;
@@ -412,28 +816,12 @@ fat32_result_t fat32_allocate_cluster(uint32_t* cluster) {
     }
     
     /* Start searching from the next_free_cluster hint */
-    while (!found) {
-        /* Check if this cluster is free */
-        if (fat32_get_next_cluster(current_cluster) == FAT32_FREE_CLUSTER) {
-            found = true;
-            break;
-        }
-        
-        /* Move to the next cluster */
-        current_cluster++;
-        
-        /* Wrap around if we reach the end */
-        if (current_cluster >= fat32_volume.total_clusters + 2) {
-            current_cluster = 2;  /* First valid cluster number */
-        }
-        
-        /* If we've checked all clusters and found none, the disk is full */
-        if (current_cluster == start_cluster) {
-            return FAT32_ERROR_DISK_FULL;
-        }
+    result = fat32_find_free_cluster(fat32_volume.next_free_cluster, &current_cluster);
+    if (result != FAT32_SUCCESS) {
+        return result;
     }
     
-    /* Mark the cluster as end-of-chain */
+    /* Mark the cluster as end-of-chain (this also updates the free count) */
     if (fat32_set_next_cluster(current_cluster, FAT32_EOC) != FAT32_SUCCESS) {
         return FAT32_ERROR_WRITE_FAILED;
     }
@@ -444,11 +832,6 @@ fat32_result_t fat32_allocate_cluster(uint32_t* cluster) {
         fat32_volume.next_free_cluster = 2;
     }
     
-    /* Update free cluster count */
-    if (fat32_volume.free_clusters > 0) {
-        fat32_volume.free_clusters--;
-    }
-    
     *cluster = current_cluster;
     return FAT32_SUCCESS;
 }
@@ -484,9 +867,199 @@ fat32_result_t fat32_free_cluster_chain(uint32_t start_cluster) {
         }
     }
     
-    /* Update free cluster count */
-    fat32_volume.free_clusters += freed_count;
+    return FAT32_SUCCESS;
+}
+
+/* Return the first count clusters of a run claimed by fat32_claim_run */
+static void fat32_release_run(uint32_t start, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        fat32_set_next_cluster(start + i, FAT32_FREE_CLUSTER);
+    }
+}
+
+/* Link clusters start..start+length-1 into a chain ending in EOC and, if
+ * tail is non-zero, append it to tail. On failure nothing of the run stays
+ * claimed, so the caller only has to undo runs that succeeded earlier. */
+static fat32_result_t fat32_claim_run(uint32_t start, uint32_t length, uint32_t tail) {
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t next = (i + 1 < length) ? start + i + 1 : FAT32_EOC;
+        if (fat32_set_next_cluster(start + i, next) != FAT32_SUCCESS) {
+            fat32_release_run(start, i);
+            return FAT32_ERROR_WRITE_FAILED;
+        }
+    }
+    
+    if (tail != 0 && fat32_set_next_cluster(tail, start) != FAT32_SUCCESS) {
+        fat32_release_run(start, length);
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    
+    return FAT32_SUCCESS;
+}
+
+/* Allocate count clusters in as few contiguous runs as possible: first the
+ * run directly after tail (when extending), then best-fit runs. The new
+ * clusters are appended to tail if it is non-zero. */
+static fat32_result_t fat32_allocate_runs(uint32_t count, uint32_t tail, uint32_t* first_cluster) {
+    uint32_t remaining = count;
+    uint32_t last = tail;
+    uint32_t first = 0;
+    uint32_t start, length;
+    fat32_result_t result = FAT32_SUCCESS;
+    
+    /* Clusters promised to delayed allocations are not available */
+    if (fat32_volume.free_clusters != 0xFFFFFFFF &&
+        fat32_volume.free_clusters < fat32_volume.reserved_clusters + count) {
+        return FAT32_ERROR_DISK_FULL;
+    }
+    
+    if (fat32_free_map_pending) {
+        fat32_free_map_build();
+    }
+    
+    /* Grow in place when the clusters after the tail are free */
+    if (tail != 0 && fat32_free_map_next_run(tail + 1, &start, &length) && start == tail + 1) {
+        if (length > remaining) {
+            length = remaining;
+        }
+        result = fat32_claim_run(start, length, last);
+        if (result == FAT32_SUCCESS) {
+            first = start;
+            last = start + length - 1;
+            remaining -= length;
+        }
+    }
+    
+    while (remaining > 0 && result == FAT32_SUCCESS) {
+        if (fat32_free_map) {
+            if (!fat32_free_map_best_fit(remaining, &start, &length)) {
+                result = FAT32_ERROR_DISK_FULL;
+                break;
+            }
+            if (length > remaining) {
+                length = remaining;
+            }
+        } else {
+            /* No bitmap: one cluster at a time, continuing from the hint */
+            result = fat32_find_free_cluster(last ? last + 1 : fat32_volume.next_free_cluster, &start);
+            if (result != FAT32_SUCCESS) {
+                break;
+            }
+            length = 1;
+        }
+        
+        result = fat32_claim_run(start, length, last);
+        if (result == FAT32_SUCCESS) {
+            if (first == 0) {
+                first = start;
+            }
+            last = start + length - 1;
+            remaining -= length;
+        }
+    }
+    
+    if (result != FAT32_SUCCESS) {
+        /* Give back the runs linked so far; a failed claim has already
+         * released its own partial run */
+        if (first != 0) {
+            if (tail != 0) {
+                fat32_set_next_cluster(tail, FAT32_EOC);
+            }
+            fat32_free_cluster_chain(first);
+        }
+        return result;
+    }
+    
+    fat32_volume.next_free_cluster = last + 1;
+    if (fat32_volume.next_free_cluster >= fat32_volume.total_clusters + 2) {
+        fat32_volume.next_free_cluster = 2;
+    }
+    
+    if (first_cluster) {
+        *first_cluster = first;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Allocate a new chain of count clusters, contiguous where free space allows */
+fat32_result_t fat32_allocate_cluster_chain(uint32_t count, uint32_t* first_cluster) {
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+    
+    if (count == 0 || first_cluster == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    return fat32_allocate_runs(count, 0, first_cluster);
+}
+
+/* Append count clusters to the chain containing last_cluster, continuing
+ * it contiguously where possible */
+fat32_result_t fat32_extend_cluster_chain(uint32_t last_cluster, uint32_t count) {
+    uint32_t steps = 0;
+    
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+    
+    if (!FAT32_VALIDATE_CLUSTER(last_cluster) || count == 0) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    /* Find the real end of the chain */
+    for (uint32_t next = fat32_get_next_cluster(last_cluster); !FAT32_IS_EOC(next);
+         next = fat32_get_next_cluster(last_cluster)) {
+        if (!FAT32_VALIDATE_CLUSTER(next) || ++steps > fat32_volume.total_clusters) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+        last_cluster = next;
+    }
+    
+    return fat32_allocate_runs(count, last_cluster, NULL);
+}
+
+/* Promise count clusters to a delayed allocation without choosing them */
+fat32_result_t fat32_reserve_clusters(uint32_t count) {
+    if (fat32_volume.free_clusters == 0xFFFFFFFF && fat32_free_map_pending) {
+        fat32_free_map_build();
+    }
+    
+    if (fat32_volume.free_clusters != 0xFFFFFFFF &&
+        fat32_volume.free_clusters < fat32_volume.reserved_clusters + count) {
+        return FAT32_ERROR_DISK_FULL;
+    }
+    
+    fat32_volume.reserved_clusters += count;
+    return FAT32_SUCCESS;
+}
+
+/* Return a promise, before the clusters are allocated or when the data is dropped */
+void fat32_release_reserved_clusters(uint32_t count) {
+    if (count > fat32_volume.reserved_clusters) {
+        count = fat32_volume.reserved_clusters;
+    }
+    fat32_volume.reserved_clusters -= count;
+}
+
+/* Smallest free run holding count clusters, or the largest one if none
+ * does (length < count). Needs the free-cluster bitmap. */
+fat32_result_t fat32_find_free_run(uint32_t count, uint32_t* start, uint32_t* length) {
+    if (start == NULL || length == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    if (fat32_free_map_pending) {
+        fat32_free_map_build();
+    }
+    if (!fat32_free_map) {
+        return FAT32_ERROR_NOT_SUPPORTED;
+    }
     
+    if (!fat32_free_map_best_fit(count, start, length)) {
+        *start = 0;
+        *length = 0;
+    }
     return FAT32_SUCCESS;
 }
 
@@ -507,24 +1080,28 @@ void fat32_shutdown(void) {
         return;
     }
     
-    /* Flush caches */
-    if (fat_cache.valid && fat_cache.dirty) {
-        hdd_write_sector(fat32_volume.drive, fat_cache.sector, fat_cache.data);
-    }
+    /* Put journalled metadata in place and empty the journal */
+    fat32_journal_unmount();
     
     /* Update FSInfo sector if available */
     if (fat32_volume.boot_sector.fs_info != 0) {
         fat32_fsinfo_t fsinfo;
-        if (hdd_read_sector(fat32_volume.drive, fat32_volume.boot_sector.fs_info, &fsinfo) == HDD_SUCCESS) {
+        if (bcache_read(fat32_volume.device, fat32_volume.boot_sector.fs_info, 1, &fsinfo) == BLOCK_SUCCESS) {
             /* Update free cluster count and next free cluster hint */
             fsinfo.free_cluster_count = fat32_volume.free_clusters;
             fsinfo.next_free_cluster = fat32_volume.next_free_cluster;
             
             /* Write back the FSInfo sector */
-            hdd_write_sector(fat32_volume.drive, fat32_volume.boot_sector.fs_info, &fsinfo);
+            bcache_write(fat32_volume.device, fat32_volume.boot_sector.fs_info, 1, &fsinfo);
         }
     }
     
+    /* Flush caches, then record the clean unmount */
+    fat32_fat_table_release();
+    if (bcache_sync(fat32_volume.device) == BLOCK_SUCCESS) {
+        fat32_volume_set_clean(true);
+    }
+    
     /* Mark as uninitialized */
     fat32_volume.initialized = false;
 }
@@ -549,11 +1126,6 @@ fat32_result_t fat32_get_volume_info(fat32_volume_t* info) {
 
 /* Enhanced cluster allocation with better free space tracking */
 fat32_result_t fat32_allocate_cluster_enhanced(uint32_t* cluster) {
-    uint32_t current_cluster = fat32_volume.next_free_cluster;
-    uint32_t start_cluster = current_cluster;
-    bool found = false;
-    uint32_t clusters_searched = 0;
-    
     if (!fat32_volume.initialized) {
         return FAT32_ERROR_NOT_INITIALIZED;
     }
@@ -562,70 +1134,18 @@ fat32_result_t fat32_allocate_cluster_enhanced(uint32_t* cluster) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
-    /* Enhanced search algorithm - batch FAT sector reads */
-    while (!found && clusters_searched < fat32_volume.total_clusters) {
-        uint32_t fat_offset = current_cluster * 4;
-        uint32_t fat_sector = fat32_volume.fat_begin_lba + (fat_offset / FAT32_SECTOR_SIZE);
-        uint32_t sector_offset = fat_offset % FAT32_SECTOR_SIZE;
-        
-        /* Use FAT cache for better performance */
-        if (!fat_cache.valid || fat_cache.sector != fat_sector) {
-            /* Flush dirty cache first */
-            if (fat_cache.valid && fat_cache.dirty) {
-                if (hdd_write_sector(fat32_volume.drive, fat_cache.sector, fat_cache.data) != HDD_SUCCESS) {
-                    return FAT32_ERROR_WRITE_FAILED;
-                }
-                fat_cache.dirty = false;
-            }
-            
-            /* Load new sector */
-            if (hdd_read_sector(fat32_volume.drive, fat_sector, fat_cache.data) != HDD_SUCCESS) {
-                fat_cache.valid = false;
-                return FAT32_ERROR_READ_FAILED;
-            }
-            fat_cache.sector = fat_sector;
-            fat_cache.valid = true;
-        }
-        
-        /* Check multiple clusters in the current sector */
-        uint32_t entries_in_sector = (FAT32_SECTOR_SIZE - sector_offset) / 4;
-        for (uint32_t i = 0; i < entries_in_sector && current_cluster < fat32_volume.total_clusters + 2; i++) {
-            uint32_t entry_value = *((uint32_t*)&fat_cache.data[sector_offset + (i * 4)]) & FAT32_CLUSTER_MASK;
-            
-            if (entry_value == FAT32_FREE_CLUSTER) {
-                found = true;
-                *cluster = current_cluster;
-                break;
-            }
-            
-            current_cluster++;
-            clusters_searched++;
-        }
-        
-        /* Wrap around if necessary */
-        if (!found && current_cluster >= fat32_volume.total_clusters + 2) {
-            current_cluster = 2;
-            if (current_cluster == start_cluster) {
-                break; /* Full circle - disk is full */
-            }
-        }
-    }
-    
-    if (!found) {
-        return FAT32_ERROR_DISK_FULL;
+    /* Bitmap (or batched FAT sector) search from the hint */
+    fat32_result_t result = fat32_find_free_cluster(fat32_volume.next_free_cluster, cluster);
+    if (result != FAT32_SUCCESS) {
+        return result;
     }
     
     /* Mark the cluster as allocated (EOC) */
-    fat32_result_t result = fat32_set_next_cluster(*cluster, FAT32_EOC);
+    result = fat32_set_next_cluster(*cluster, FAT32_EOC);
     if (result != FAT32_SUCCESS) {
         return result;
     }
     
-    /* Update free cluster tracking */
-    if (fat32_volume.free_clusters > 0) {
-        fat32_volume.free_clusters--;
-    }
-    
     /* Update next free cluster hint - look ahead */
     fat32_volume.next_free_cluster = *cluster + 1;
     if (fat32_volume.next_free_cluster >= fat32_volume.total_clusters + 2) {
@@ -635,63 +1155,22 @@ fat32_result_t fat32_allocate_cluster_enhanced(uint32_t* cluster) {
     return FAT32_SUCCESS;
 }
 
-/* Enhanced cluster reading with caching */
+/* Cluster read through the block buffer cache */
 fat32_result_t fat32_read_cluster_cached(uint32_t cluster, void* buffer) {
-    if (!FAT32_VALIDATE_CLUSTER(cluster)) {
-        return FAT32_ERROR_INVALID_CLUSTER;
-    }
-    
-    /* Check cache first */
-    if (cluster_cache.valid && cluster_cache.cluster == cluster) {
-        memcpy(buffer, cluster_cache.data, 
-               fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE);
-        return FAT32_SUCCESS;
-    }
+    fat32_result_t result = fat32_read_cluster(cluster, buffer);
+    bcache_stats_t stats;
     
-    /* Calculate LBA and read cluster */
-    uint32_t lba = fat32_cluster_to_lba(cluster);
-    
-    for (uint8_t i = 0; i < fat32_volume.sectors_per_cluster; i++) {
-        if (hdd_read_sector(fat32_volume.drive, lba + i, 
-                           (uint8_t*)buffer + (i * FAT32_SECTOR_SIZE)) != HDD_SUCCESS) {
-            return FAT32_ERROR_READ_FAILED;
-        }
-    }
+    /* Mirror the shared cache counters into the volume */
+    bcache_get_stats(&stats);
+    fat32_volume.cache_hits = stats.hits;
+    fat32_volume.cache_misses = stats.misses;
     
-    /* Update cache */
-    cluster_cache.cluster = cluster;
-    memcpy(cluster_cache.data, buffer, 
-           fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE);
-    cluster_cache.valid = true;
-    cluster_cache.dirty = false;
-    
-    return FAT32_SUCCESS;
+    return result;
 }
 
-/* Enhanced cluster writing with write-through caching */
+/* Cluster write through the block buffer cache (write-back unless configured otherwise) */
 fat32_result_t fat32_write_cluster_cached(uint32_t cluster, const void* buffer) {
-    if (!FAT32_VALIDATE_CLUSTER(cluster)) {
-        return FAT32_ERROR_INVALID_CLUSTER;
-    }
-    
-    /* Calculate LBA and write cluster */
-    uint32_t lba = fat32_cluster_to_lba(cluster);
-    
-    for (uint8_t i = 0; i < fat32_volume.sectors_per_cluster; i++) {
-        if (hdd_write_sector(fat32_volume.drive, lba + i, 
-                            (const uint8_t*)buffer + (i * FAT32_SECTOR_SIZE)) != HDD_SUCCESS) {
-            return FAT32_ERROR_WRITE_FAILED;
-        }
-    }
-    
-    /* Update cache if this cluster is cached */
-    if (cluster_cache.valid && cluster_cache.cluster == cluster) {
-        memcpy(cluster_cache.data, buffer, 
-               fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE);
-        cluster_cache.dirty = false;
-    }
-    
-    return FAT32_SUCCESS;
+    return fat32_write_cluster(cluster, buffer);
 }
 
 /* Enhanced path validation and parsing */
@@ -755,7 +1234,115 @@ fat32_result_t fat32_parse_path_enhanced(const char* path, char components[][12]
     return FAT32_SUCCESS;
 }
 
-/* Enhanced seek operation with better cluster chain traversal */
+/* Map a cluster index within a file to its disk cluster, extending the
+ * file's extent map from the FAT as far as needed. contiguous (optional)
+ * receives how many clusters from there on are known to be adjacent. */
+fat32_result_t fat32_file_map_cluster(fat32_file_t* file, uint32_t cluster_index, uint32_t* cluster, uint32_t* contiguous) {
+    fat32_extent_map_t* map;
+    fat32_extent_t* last;
+    uint32_t current;
+    uint32_t index;
+    
+    if (file == NULL || cluster == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    if (!FAT32_VALIDATE_CLUSTER(file->first_cluster)) {
+        return FAT32_ERROR_EOF;
+    }
+    
+    map = file->extent_map;
+    if (!map) {
+        map = (fat32_extent_map_t*)memory_alloc_pages(1);
+        if (map) {
+            map->count = 0;
+            file->extent_map = map;
+        }
+    }
+    
+    /* No memory for a map: walk the chain */
+    if (!map) {
+        current = file->first_cluster;
+        index = 0;
+        goto walk;
+    }
+    
+    if (map->count == 0) {
+        map->extents[0].file_cluster = 0;
+        map->extents[0].disk_cluster = file->first_cluster;
+        map->extents[0].length = 1;
+        map->count = 1;
+    }
+    
+    /* Extend the map from the FAT until it covers cluster_index */
+    last = &map->extents[map->count - 1];
+    while (cluster_index >= last->file_cluster + last->length) {
+        uint32_t end = last->disk_cluster + last->length - 1;
+        uint32_t next = fat32_get_next_cluster(end);
+        
+        if (FAT32_IS_EOC(next) || !FAT32_VALIDATE_CLUSTER(next)) {
+            return FAT32_ERROR_EOF;
+        }
+        
+        if (next == end + 1) {
+            last->length++;
+        } else if (map->count < FAT32_EXTENT_MAP_CAPACITY) {
+            fat32_extent_t* extent = &map->extents[map->count++];
+            extent->file_cluster = last->file_cluster + last->length;
+            extent->disk_cluster = next;
+            extent->length = 1;
+            last = extent;
+        } else {
+            /* Map full: walk the rest of the way without recording */
+            current = next;
+            index = last->file_cluster + last->length;
+            goto walk;
+        }
+    }
+    
+    /* Binary search for the extent holding cluster_index */
+    uint32_t low = 0;
+    uint32_t high = map->count - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (map->extents[middle].file_cluster <= cluster_index) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    
+    fat32_extent_t* extent = &map->extents[low];
+    *cluster = extent->disk_cluster + (cluster_index - extent->file_cluster);
+    if (contiguous) {
+        *contiguous = extent->length - (cluster_index - extent->file_cluster);
+    }
+    return FAT32_SUCCESS;
+    
+walk:
+    while (index < cluster_index) {
+        current = fat32_get_next_cluster(current);
+        if (FAT32_IS_EOC(current) || !FAT32_VALIDATE_CLUSTER(current)) {
+            return FAT32_ERROR_EOF;
+        }
+        index++;
+    }
+    *cluster = current;
+    if (contiguous) {
+        *contiguous = 1;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Drop a file's extent map (after its chain was rewritten, or on close) */
+void fat32_file_release_extents(fat32_file_t* file) {
+    if (file && file->extent_map) {
+        memory_free_pages(file->extent_map, 1);
+        file->extent_map = NULL;
+    }
+}
+
+/* Enhanced seek operation with extent map lookup */
 fat32_result_t fat32_seek_file_enhanced(fat32_file_t* file, uint32_t position) {
     if (!fat32_volume.initialized) {
         return FAT32_ERROR_NOT_INITIALIZED;
@@ -777,32 +1364,21 @@ fat32_result_t fat32_seek_file_enhanced(fat32_file_t* file, uint32_t position) {
     uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
     uint32_t target_cluster_index = position / bytes_per_cluster;
     uint32_t current_cluster_index = file->position / bytes_per_cluster;
+    uint32_t cluster;
     
-    /* Optimize: if seeking within the same cluster, just update position */
-    if (target_cluster_index == current_cluster_index) {
+    /* Same cluster, or past the allocated clusters (delayed data has no
+     * cluster yet): just update the position */
+    if (target_cluster_index == current_cluster_index || position >= file->allocated_size) {
         file->position = position;
         return FAT32_SUCCESS;
     }
     
-    /* If seeking backwards or to beginning, start from first cluster */
-    if (target_cluster_index < current_cluster_index || file->position == 0) {
-        file->current_cluster = file->first_cluster;
-        current_cluster_index = 0;
-    }
-    
-    /* Follow cluster chain to target */
-    while (current_cluster_index < target_cluster_index && 
-           file->current_cluster != FAT32_EOC && 
-           FAT32_VALIDATE_CLUSTER(file->current_cluster)) {
-        file->current_cluster = fat32_get_next_cluster(file->current_cluster);
-        current_cluster_index++;
-    }
-    
-    if (current_cluster_index != target_cluster_index || 
-        file->current_cluster == FAT32_EOC) {
+    /* Look the target up in the file's extent map */
+    if (fat32_file_map_cluster(file, target_cluster_index, &cluster, NULL) != FAT32_SUCCESS) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
+    file->current_cluster = cluster;
     file->position = position;
     return FAT32_SUCCESS;
 }
@@ -861,8 +1437,10 @@ const char* fat32_result_to_string(fat32_result_t result) {
         case FAT32_ERROR_FILE_EXISTS: return "File exists";
         case FAT32_ERROR_NOT_DIRECTORY: return "Not a directory";
         case FAT32_ERROR_IS_DIRECTORY: return "Is a directory";
+        case FAT32_ERROR_NOT_EMPTY: return "Directory not empty";
         case FAT32_ERROR_ALREADY_OPEN: return "Already open";
         case FAT32_ERROR_NOT_OPEN: return "Not open";
+        case FAT32_ERROR_TOO_MANY_OPEN: return "Too many open files";
         case FAT32_ERROR_DISK_FULL: return "Disk full";
         case FAT32_ERROR_NO_FREE_CLUSTER: return "No free cluster";
         case FAT32_ERROR_CLUSTER_CHAIN_BROKEN: return "Cluster chain broken";
@@ -886,8 +1464,25 @@ fat32_result_t fat32_get_free_space(uint32_t* free_bytes) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
+    /* The count is kept current from mount on; only a failed FAT scan
+     * leaves it unknown */
+    if (fat32_volume.free_clusters == 0xFFFFFFFF) {
+        fat32_free_map_build();
+        if (fat32_volume.free_clusters == 0xFFFFFFFF) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+    }
+    
+    /* Reserved clusters are spoken for; saturate rather than wrap on
+     * volumes with more than 4GB free */
     uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
-    *free_bytes = fat32_volume.free_clusters * bytes_per_cluster;
+    uint32_t available = fat32_volume.free_clusters > fat32_volume.reserved_clusters ?
+                         fat32_volume.free_clusters - fat32_volume.reserved_clusters : 0;
+    if (available > 0xFFFFFFFF / bytes_per_cluster) {
+        *free_bytes = 0xFFFFFFFF;
+    } else {
+        *free_bytes = available * bytes_per_cluster;
+    }
     
     return FAT32_SUCCESS;
 }
@@ -908,17 +1503,17 @@ fat32_result_t fat32_get_total_space(uint32_t* total_bytes) {
     return FAT32_SUCCESS;
 }
 
-/* Check if drive has valid FAT32 filesystem */
-fat32_result_t fat32_check_filesystem(uint8_t drive) {
+/* Check if a block device has a valid FAT32 filesystem */
+fat32_result_t fat32_check_filesystem(block_device_t* device) {
     fat32_boot_sector_t boot_sector;
     
-    /* Check if the drive is valid */
-    if (drive > HDD_SECONDARY_SLAVE) {
+    /* Check if the device is valid */
+    if (device == NULL) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
     /* Read the boot sector */
-    if (hdd_read_sector(drive, 0, &boot_sector) != HDD_SUCCESS) {
+    if (block_read(device, 0, 1, &boot_sector) != BLOCK_SUCCESS) {
         return FAT32_ERROR_READ_FAILED;
     }
     
@@ -941,13 +1536,19 @@ fat32_result_t fat32_clear_cluster(uint32_t cluster) {
         return FAT32_ERROR_INVALID_CLUSTER;
     }
     
-    static uint8_t zero_buffer[FAT32_SECTOR_SIZE];
-    memset(zero_buffer, 0, FAT32_SECTOR_SIZE);
-    
     uint32_t lba = fat32_cluster_to_lba(cluster);
     
+    /* Zero the sectors in the cache; no need to read them first */
     for (uint8_t i = 0; i < fat32_volume.sectors_per_cluster; i++) {
-        if (hdd_write_sector(fat32_volume.drive, lba + i, zero_buffer) != HDD_SUCCESS) {
+        bcache_buffer_t* buffer = bcache_get_new(fat32_volume.device, lba + i);
+        if (!buffer) {
+            return FAT32_ERROR_WRITE_FAILED;
+        }
+        fat32_journal_note(buffer);
+        memset(buffer->data, 0, FAT32_SECTOR_SIZE);
+        block_result_t result = bcache_mark_dirty(buffer);
+        bcache_release(buffer);
+        if (result != BLOCK_SUCCESS) {
             return FAT32_ERROR_WRITE_FAILED;
         }
     }
@@ -956,22 +1557,28 @@ fat32_result_t fat32_clear_cluster(uint32_t cluster) {
 }
 
 /* Enhanced initialization with better error recovery */
-fat32_result_t fat32_initialize_enhanced(uint8_t drive) {
-    /* Validate drive parameter */
-    if (drive > HDD_SECONDARY_SLAVE) {
+fat32_result_t fat32_initialize_enhanced(block_device_t* device) {
+    /* Validate device parameter */
+    if (device == NULL) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
-    /* Initialize caches */
-    memset(&cluster_cache, 0, sizeof(cluster_cache));
-    memset(&fat_cache, 0, sizeof(fat_cache));
+    /* Finish with the previously mounted volume's journal and FAT */
+    fat32_journal_unmount();
+    fat32_fat_table_release();
     
     /* Clear volume information */
     memset(&fat32_volume, 0, sizeof(fat32_volume_t));
-    fat32_volume.drive = drive;
+    fat32_volume.device = device;
+    
+    /* Drop anything cached from an earlier mount of this device */
+    bcache_invalidate(device);
+    fat32_dcache_invalidate_all();
+    fat32_dindex_invalidate_all();
+    fat32_defrag_reset();
     
     /* Read and validate boot sector */
-    if (hdd_read_sector(drive, 0, &fat32_volume.boot_sector) != HDD_SUCCESS) {
+    if (block_read(device, 0, 1, &fat32_volume.boot_sector) != BLOCK_SUCCESS) {
         return FAT32_ERROR_READ_FAILED;
     }
     
@@ -1030,7 +1637,7 @@ fat32_result_t fat32_initialize_enhanced(uint8_t drive) {
         fat32_volume.boot_sector.fs_info < fat32_volume.boot_sector.reserved_sectors) {
         
         fat32_fsinfo_t fsinfo;
-        if (hdd_read_sector(drive, fat32_volume.boot_sector.fs_info, &fsinfo) == HDD_SUCCESS) {
+        if (block_read(device, fat32_volume.boot_sector.fs_info, 1, &fsinfo) == BLOCK_SUCCESS) {
             if (fsinfo.lead_signature == 0x41615252 && 
                 fsinfo.structure_signature == 0x61417272 &&
                 fsinfo.trail_signature == 0xAA550000) {
@@ -1061,7 +1668,20 @@ fat32_result_t fat32_initialize_enhanced(uint8_t drive) {
     fat32_volume.initialized = true;
     fat32_current_directory = fat32_volume.root_dir_first_cluster;
     
-    return FAT32_SUCCESS;
+    fat32_result_t result = fat32_configure_cache(&fat32_cache_config);
+    fat32_journal_mount();
+    fat32_fat_table_setup();
+    return result;
+}
+
+/* Mount with an explicit cache configuration */
+fat32_result_t fat32_initialize_with_config(block_device_t* device, const fat32_cache_config_t* config) {
+    if (config == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    fat32_cache_config = *config;
+    return fat32_initialize_enhanced(device);
 }
 
 /* Enhanced shutdown with proper cache flushing */
@@ -1070,47 +1690,93 @@ void fat32_shutdown_enhanced(void) {
         return;
     }
     
-    /* Flush all caches */
-    if (fat_cache.valid && fat_cache.dirty) {
-        hdd_write_sector(fat32_volume.drive, fat_cache.sector, fat_cache.data);
-    }
-    
-    if (cluster_cache.valid && cluster_cache.dirty) {
-        fat32_write_cluster_cached(cluster_cache.cluster, cluster_cache.data);
-    }
+    fat32_journal_unmount();
     
     /* Update FSInfo sector */
     if (fat32_volume.boot_sector.fs_info != 0) {
         fat32_fsinfo_t fsinfo;
-        if (hdd_read_sector(fat32_volume.drive, fat32_volume.boot_sector.fs_info, &fsinfo) == HDD_SUCCESS) {
+        if (bcache_read(fat32_volume.device, fat32_volume.boot_sector.fs_info, 1, &fsinfo) == BLOCK_SUCCESS) {
             if (fsinfo.lead_signature == 0x41615252 && 
                 fsinfo.structure_signature == 0x61417272 &&
                 fsinfo.trail_signature == 0xAA550000) {
                 
                 fsinfo.free_cluster_count = fat32_volume.free_clusters;
                 fsinfo.next_free_cluster = fat32_volume.next_free_cluster;
-                hdd_write_sector(fat32_volume.drive, fat32_volume.boot_sector.fs_info, &fsinfo);
+                bcache_write(fat32_volume.device, fat32_volume.boot_sector.fs_info, 1, &fsinfo);
             }
         }
     }
     
-    /* Clear caches and volume info */
-    memset(&cluster_cache, 0, sizeof(cluster_cache));
-    memset(&fat_cache, 0, sizeof(fat_cache));
+    /* Flush all caches, then record the clean unmount */
+    fat32_fat_table_release();
+    if (bcache_sync(fat32_volume.device) == BLOCK_SUCCESS) {
+        fat32_volume_set_clean(true);
+    }
+    
     fat32_volume.initialized = false;
 }
 
-/* Format drive as FAT32 (full implementation) */
-fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label) {
-    if (drive > HDD_SECONDARY_SLAVE) {
+/* Write sectors during format, counting them for the report */
+static fat32_result_t fat32_format_write(block_device_t* device, uint32_t lba, uint32_t count,
+                                         const void* buffer, fat32_format_report_t* report) {
+    if (block_write(device, lba, count, buffer) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    report->sectors_written += count;
+    report->write_requests++;
+    return FAT32_SUCCESS;
+}
+
+/* Zero count sectors from lba in writes as large as the zero buffer */
+static fat32_result_t fat32_format_zero(block_device_t* device, uint32_t lba, uint32_t count,
+                                        const uint8_t* zero, uint32_t zero_sectors,
+                                        fat32_format_report_t* report) {
+    while (count > 0) {
+        uint32_t chunk = count < zero_sectors ? count : zero_sectors;
+        fat32_result_t result = fat32_format_write(device, lba, chunk, zero, report);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        lba += chunk;
+        count -= chunk;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Format a block device as FAT32, clearing the whole device */
+fat32_result_t fat32_format_drive(block_device_t* device, const char* volume_label) {
+    return fat32_format_drive_ex(device, volume_label, NULL, NULL);
+}
+
+/* Format a block device as FAT32. Every region is cleared with the largest
+ * writes the zero buffer allows; quick mode clears only the reserved area,
+ * the FATs and the root directory and leaves the data area as it is. */
+fat32_result_t fat32_format_drive_ex(block_device_t* device, const char* volume_label,
+                                     const fat32_format_options_t* options, fat32_format_report_t* report) {
+    fat32_format_report_t local_report;
+    uint32_t start_ticks = timer_get_ticks();
+    
+    if (device == NULL) {
         return FAT32_ERROR_INVALID_PARAMETER;
     }
     
-    /* Get drive size first */
-    uint32_t total_sectors;
-    if (hdd_get_drive_size(drive, &total_sectors) != HDD_SUCCESS) {
-        return FAT32_ERROR_DRIVE_NOT_READY;
+    if (report == NULL) {
+        report = &local_report;
     }
+    memset(report, 0, sizeof(fat32_format_report_t));
+    
+    /* Format writes go straight to the device; drop stale cached sectors
+     * (a journal on this device must let go of its pinned ones first) */
+    if (fat32_volume.initialized && fat32_volume.device == device) {
+        fat32_journal_unmount();
+    }
+    bcache_invalidate(device);
+    fat32_dcache_invalidate_all();
+    fat32_dindex_invalidate_all();
+    fat32_defrag_reset();
+    
+    /* Get device size first */
+    uint32_t total_sectors = device->sector_count;
     
     /* Validate minimum size for FAT32 (at least 65536 clusters) */
     if (total_sectors < 65536 * 8) { /* Assuming 8 sectors per cluster minimum */
@@ -1174,7 +1840,7 @@ fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label) {
     boot_sector.sectors_per_fat_16 = 0;    /* 0 for FAT32 */
     boot_sector.sectors_per_track = 63;    /* Standard value */
     boot_sector.num_heads = 255;           /* Standard value */
-    boot_sector.hidden_sectors = 0;
+    boot_sector.hidden_sectors = device->start_lba;  /* Partition offset on the disk */
     boot_sector.total_sectors_32 = total_sectors;
     
     /* FAT32 Extended BPB */
@@ -1208,14 +1874,36 @@ fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label) {
     /* Boot signature */
     boot_sector.signature = FAT32_SIGNATURE;
     
-    /* Write boot sector */
-    if (hdd_write_sector(drive, 0, &boot_sector) != HDD_SUCCESS) {
-        return FAT32_ERROR_WRITE_FAILED;
+    /* One shared zero buffer; settle for a smaller one if memory is short */
+    uint32_t zero_pages = FAT32_FORMAT_ZERO_SECTORS * FAT32_SECTOR_SIZE / MEMORY_PAGE_SIZE;
+    uint8_t* zero = NULL;
+    while (zero_pages > 0 && (zero = (uint8_t*)memory_alloc_pages(zero_pages)) == NULL) {
+        zero_pages /= 2;
     }
+    if (zero == NULL) {
+        return FAT32_ERROR_OUT_OF_MEMORY;
+    }
+    memset(zero, 0, zero_pages * MEMORY_PAGE_SIZE);
+    uint32_t zero_sectors = zero_pages * MEMORY_PAGE_SIZE / FAT32_SECTOR_SIZE;
     
-    /* Write backup boot sector */
-    if (hdd_write_sector(drive, 6, &boot_sector) != HDD_SUCCESS) {
-        return FAT32_ERROR_WRITE_FAILED;
+    /* Reserved sectors, both FATs and the root cluster lie back to back:
+     * clear them (and in a full format the data area) in one sweep, then
+     * write the few sectors that are not zero */
+    uint32_t root_lba = reserved_sectors + (num_fats * fat_sectors);
+    uint32_t clear_end = (options && options->quick) ? root_lba + sectors_per_cluster : total_sectors;
+    fat32_result_t result = fat32_format_zero(device, 2, clear_end - 2, zero, zero_sectors, report);
+    memory_free_pages(zero, zero_pages);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    
+    /* Boot sector and its backup */
+    result = fat32_format_write(device, 0, 1, &boot_sector, report);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_format_write(device, 6, 1, &boot_sector, report);
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;
     }
     
     /* Create FSInfo sector */
@@ -1228,63 +1916,35 @@ fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label) {
     fsinfo.next_free_cluster = 3;             /* First free after root */
     fsinfo.trail_signature = 0xAA550000;
     
-    /* Write FSInfo sector */
-    if (hdd_write_sector(drive, 1, &fsinfo) != HDD_SUCCESS) {
-        return FAT32_ERROR_WRITE_FAILED;
-    }
-    
-    /* Write backup FSInfo sector */
-    if (hdd_write_sector(drive, 7, &fsinfo) != HDD_SUCCESS) {
-        return FAT32_ERROR_WRITE_FAILED;
+    /* FSInfo sector and its backup */
+    result = fat32_format_write(device, 1, 1, &fsinfo, report);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_format_write(device, 7, 1, &fsinfo, report);
     }
-    
-    /* Clear reserved sectors */
-    uint8_t zero_sector[FAT32_SECTOR_SIZE];
-    memset(zero_sector, 0, FAT32_SECTOR_SIZE);
-    
-    for (uint32_t i = 2; i < reserved_sectors; i++) {
-        if (i != 6 && i != 7) { /* Skip backup sectors */
-            if (hdd_write_sector(drive, i, zero_sector) != HDD_SUCCESS) {
-                return FAT32_ERROR_WRITE_FAILED;
-            }
-        }
+    if (result != FAT32_SUCCESS) {
+        return result;
     }
     
-    /* Initialize FAT tables */
-    uint8_t fat_sector[FAT32_SECTOR_SIZE];
-    memset(fat_sector, 0, FAT32_SECTOR_SIZE);
+    /* First sector of each FAT holds the reserved entries and the root chain */
+    uint8_t sector[FAT32_SECTOR_SIZE];
+    memset(sector, 0, FAT32_SECTOR_SIZE);
     
-    /* First FAT sector with special entries */
-    uint32_t* fat_entries_ptr = (uint32_t*)fat_sector;
+    uint32_t* fat_entries_ptr = (uint32_t*)sector;
     fat_entries_ptr[0] = 0x0FFFFFF8; /* Media descriptor in lower 8 bits */
-    fat_entries_ptr[1] = 0x0FFFFFFF; /* End of chain */
+    fat_entries_ptr[1] = 0x0FFFFFFF; /* End of chain, clean volume */
     fat_entries_ptr[2] = 0x0FFFFFFF; /* Root directory (end of chain) */
     
-    /* Write first sector of each FAT */
     for (uint8_t fat_num = 0; fat_num < num_fats; fat_num++) {
-        uint32_t fat_start = reserved_sectors + (fat_num * fat_sectors);
-        
-        /* Write first sector with special entries */
-        if (hdd_write_sector(drive, fat_start, fat_sector) != HDD_SUCCESS) {
-            return FAT32_ERROR_WRITE_FAILED;
-        }
-        
-        /* Clear rest of FAT */
-        memset(fat_sector, 0, FAT32_SECTOR_SIZE);
-        for (uint32_t sector = 1; sector < fat_sectors; sector++) {
-            if (hdd_write_sector(drive, fat_start + sector, fat_sector) != HDD_SUCCESS) {
-                return FAT32_ERROR_WRITE_FAILED;
-            }
+        result = fat32_format_write(device, reserved_sectors + (fat_num * fat_sectors), 1, sector, report);
+        if (result != FAT32_SUCCESS) {
+            return result;
         }
     }
     
-    /* Create root directory */
-    uint8_t root_cluster[FAT32_SECTOR_SIZE * sectors_per_cluster];
-    memset(root_cluster, 0, sizeof(root_cluster));
-    
-    /* Add volume label entry if provided */
+    /* Volume label entry in the root directory, if one was given */
     if (volume_label && strlen(volume_label) > 0) {
-        fat32_dir_entry_t* vol_entry = (fat32_dir_entry_t*)root_cluster;
+        fat32_dir_entry_t* vol_entry = (fat32_dir_entry_t*)sector;
+        memset(sector, 0, FAT32_SECTOR_SIZE);
         
         /* Prepare volume label */
         char vol_label[11];
@@ -1311,34 +1971,22 @@ fat32_result_t fat32_format_drive(uint8_t drive, const char* volume_label) {
         vol_entry->last_access_date = vol_entry->creation_date;
         vol_entry->write_date = vol_entry->creation_date;
         vol_entry->write_time = vol_entry->creation_time;
-    }
-    
-    /* Write root directory cluster */
-    uint32_t root_lba = reserved_sectors + (num_fats * fat_sectors);
-    for (uint8_t i = 0; i < sectors_per_cluster; i++) {
-        if (hdd_write_sector(drive, root_lba + i, 
-                            root_cluster + (i * FAT32_SECTOR_SIZE)) != HDD_SUCCESS) {
-            return FAT32_ERROR_WRITE_FAILED;
+        
+        result = fat32_format_write(device, root_lba, 1, sector, report);
+        if (result != FAT32_SUCCESS) {
+            return result;
         }
     }
     
-    /* Clear remaining data area */
-    uint32_t data_start = root_lba + sectors_per_cluster;
-    uint32_t remaining_sectors = total_sectors - data_start;
-    
-    /* Clear in batches for efficiency */
-    uint32_t batch_size = 64; /* Clear 64 sectors at a time */
-    for (uint32_t sector = 0; sector < remaining_sectors; sector += batch_size) {
-        uint32_t sectors_to_clear = (remaining_sectors - sector < batch_size) ? 
-                                   (remaining_sectors - sector) : batch_size;
-        
-        for (uint32_t i = 0; i < sectors_to_clear; i++) {
-            if (hdd_write_sector(drive, data_start + sector + i, zero_sector) != HDD_SUCCESS) {
-                /* Continue on error - not critical for basic functionality */
-            }
-        }
+    /* One device flush at the end rather than per write */
+    if (block_flush(device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
     }
     
+    uint32_t ticks = timer_get_ticks() - start_ticks;
+    if (timer_frequency > 0) {
+        report->elapsed_ms = (ticks / timer_frequency) * 1000 + (ticks % timer_frequency) * 1000 / timer_frequency;
+    }
     return FAT32_SUCCESS;
 }
 
@@ -1364,4 +2012,119 @@ void fat32_dos_date_to_date(uint16_t dos_date, uint16_t* year, uint8_t* month, u
     if (year) *year = ((dos_date >> 9) & 0x7F) + 1980;
     if (month) *month = (dos_date >> 5) & 0x0F;
     if (day) *day = dos_date & 0x1F;
-}
\ No newline at end of file
+}
+
+/* ========== CACHE MANAGEMENT ========== */
+
+/* Size the shared block buffer cache from a cache configuration */
+fat32_result_t fat32_configure_cache(const fat32_cache_config_t* config) {
+    bcache_stats_t stats;
+    uint32_t sectors_per_cluster;
+    uint32_t buffers = 0;
+    
+    if (config == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    
+    sectors_per_cluster = fat32_volume.initialized ? fat32_volume.sectors_per_cluster : 8;
+    
+    if (config->enable_fat_cache) {
+        buffers += config->fat_cache_size;
+    }
+    if (config->enable_cluster_cache) {
+        buffers += config->cluster_cache_size * sectors_per_cluster;
+    }
+    if (config->enable_dir_cache) {
+        buffers += config->dir_cache_size;
+    }
+    
+    if (buffers < BCACHE_MIN_BUFFERS) {
+        buffers = BCACHE_MIN_BUFFERS;
+    }
+    if (buffers > BCACHE_MAX_BUFFERS) {
+        buffers = BCACHE_MAX_BUFFERS;
+    }
+    
+    /* Keep the existing cache (and its contents) if nothing changed */
+    bcache_get_stats(&stats);
+    if (stats.buffer_count != buffers || stats.write_through != config->write_through) {
+        /* The cache cannot be replaced while the journal pins sectors */
+        if (fat32_journal_commit() != FAT32_SUCCESS) {
+            return FAT32_ERROR_WRITE_FAILED;
+        }
+        if (bcache_initialize(buffers, config->write_through) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    
+    if (!config->write_through) {
+        bcache_start_writeback();
+    }
+    
+    fat32_cache_config = *config;
+    return FAT32_SUCCESS;
+}
+
+/* Write every dirty cached sector of the volume to disk */
+fat32_result_t fat32_flush_all_caches(void) {
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+    
+    /* With a journal, a commit makes the metadata safe; writing it in
+     * place is left to write-back and the next checkpoint */
+    if (fat32_journal_is_active()) {
+        return fat32_journal_commit();
+    }
+    
+    /* Mirror FATs first so primary and mirrors reach the disk together */
+    fat32_result_t result = fat32_sync_fat();
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    
+    if (bcache_sync(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    
+    return FAT32_SUCCESS;
+}
+
+/* Flush and drop all cached sectors of the volume */
+fat32_result_t fat32_invalidate_cache(void) {
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+    
+    fat32_result_t result = fat32_journal_checkpoint();
+    if (result == FAT32_SUCCESS) {
+        result = fat32_sync_fat();
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    
+    if (bcache_invalidate(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    fat32_dcache_invalidate_all();
+    fat32_dindex_invalidate_all();
+    fat32_defrag_reset();
+    
+    return FAT32_SUCCESS;
+}
+
+/* Cache counters (shared by all volumes on the block cache) */
+fat32_result_t fat32_get_cache_stats(uint32_t* hits, uint32_t* misses, uint32_t* dirty_entries) {
+    bcache_stats_t stats;
+    
+    bcache_get_stats(&stats);
+    fat32_volume.cache_hits = stats.hits;
+    fat32_volume.cache_misses = stats.misses;
+    
+    if (hits) *hits = stats.hits;
+    if (misses) *misses = stats.misses;
+    if (dirty_entries) *dirty_entries = stats.dirty_buffers;
+    
+    return FAT32_SUCCESS;
+}
@@ -0,0 +1,266 @@
+/*
+ * FAT32 Directory Entry Cache
+ * ChanUX Operating System
+ *
+ * Remembers the result of name lookups, keyed by (directory cluster, name):
+ * positive entries hold a copy of the directory entry and its location,
+ * negative entries record names that do not exist. Names are compared
+ * case-insensitively, so a file looked up by its long name and by its
+ * short alias occupies two entries. Replacement uses a clock hand with a
+ * referenced bit per entry.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_DCACHE_NONE       0xFFFF
+
+/* Cached lookup */
+typedef struct {
+    uint32_t dir_cluster;               /* First cluster of the directory */
+    char name[FAT32_DCACHE_NAME_MAX];   /* Lookup name, lower case */
+    bool used;
+    bool negative;                      /* Name is known not to exist */
+    bool referenced;                    /* Clock bit */
+    uint16_t hash_next;                 /* Index of next entry in bucket */
+    uint32_t entry_cluster;             /* Location of the directory entry */
+    uint32_t entry_offset;
+    fat32_dir_entry_t entry;            /* Copy of the directory entry */
+} fat32_dcache_entry_t;
+
+static fat32_dcache_entry_t* fat32_dcache = NULL;
+static uint16_t* fat32_dcache_buckets = NULL;
+static uint32_t fat32_dcache_pages = 0;
+static uint32_t fat32_dcache_hand = 0;
+static fat32_dcache_stats_t fat32_dcache_stats;
+
+/* Fold a name into its cache key; names too long to cache are rejected */
+static bool fat32_dcache_key(const char* name, char* key) {
+    uint32_t i;
+
+    for (i = 0; name[i] != '\0'; i++) {
+        if (i + 1 >= FAT32_DCACHE_NAME_MAX) {
+            return false;
+        }
+        key[i] = (name[i] >= 'A' && name[i] <= 'Z') ? (char)(name[i] - 'A' + 'a') : name[i];
+    }
+    key[i] = '\0';
+    return true;
+}
+
+static uint32_t fat32_dcache_hash(uint32_t dir_cluster, const char* key) {
+    uint32_t hash = 2166136261u ^ dir_cluster;
+
+    while (*key) {
+        hash = (hash ^ (uint8_t)*key++) * 16777619u;
+    }
+    return hash & (FAT32_DCACHE_BUCKETS - 1);
+}
+
+static fat32_dcache_entry_t* fat32_dcache_find(uint32_t dir_cluster, const char* key) {
+    uint16_t index = fat32_dcache_buckets[fat32_dcache_hash(dir_cluster, key)];
+
+    while (index != FAT32_DCACHE_NONE) {
+        fat32_dcache_entry_t* slot = &fat32_dcache[index];
+        if (slot->dir_cluster == dir_cluster && strcmp(slot->name, key) == 0) {
+            return slot;
+        }
+        index = slot->hash_next;
+    }
+    return NULL;
+}
+
+static void fat32_dcache_unlink(fat32_dcache_entry_t* slot) {
+    uint16_t* link = &fat32_dcache_buckets[fat32_dcache_hash(slot->dir_cluster, slot->name)];
+    uint16_t index = (uint16_t)(slot - fat32_dcache);
+
+    while (*link != FAT32_DCACHE_NONE) {
+        if (*link == index) {
+            *link = slot->hash_next;
+            break;
+        }
+        link = &fat32_dcache[*link].hash_next;
+    }
+    slot->used = false;
+}
+
+/* Pick a slot: a free one, or the first unreferenced one under the clock hand */
+static fat32_dcache_entry_t* fat32_dcache_victim(void) {
+    while (1) {
+        fat32_dcache_entry_t* slot = &fat32_dcache[fat32_dcache_hand];
+        fat32_dcache_hand = (fat32_dcache_hand + 1) % FAT32_DCACHE_ENTRIES;
+
+        if (!slot->used) {
+            return slot;
+        }
+        if (!slot->referenced) {
+            fat32_dcache_unlink(slot);
+            fat32_dcache_stats.evictions++;
+            return slot;
+        }
+        slot->referenced = false;
+    }
+}
+
+static fat32_dcache_entry_t* fat32_dcache_store(uint32_t dir_cluster, const char* key) {
+    fat32_dcache_entry_t* slot = fat32_dcache_find(dir_cluster, key);
+
+    if (!slot) {
+        uint32_t bucket = fat32_dcache_hash(dir_cluster, key);
+
+        slot = fat32_dcache_victim();
+        slot->dir_cluster = dir_cluster;
+        strcpy(slot->name, key);
+        slot->used = true;
+        slot->hash_next = fat32_dcache_buckets[bucket];
+        fat32_dcache_buckets[bucket] = (uint16_t)(slot - fat32_dcache);
+    }
+    slot->referenced = true;
+    return slot;
+}
+
+/* Drop every cached lookup (mount, format) and allocate the table on first use */
+void fat32_dcache_invalidate_all(void) {
+    if (!fat32_dcache) {
+        uint32_t bytes = FAT32_DCACHE_ENTRIES * sizeof(fat32_dcache_entry_t) +
+                         FAT32_DCACHE_BUCKETS * sizeof(uint16_t);
+        fat32_dcache_pages = (bytes + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+        fat32_dcache = (fat32_dcache_entry_t*)memory_alloc_pages(fat32_dcache_pages);
+        if (!fat32_dcache) {
+            return;  /* Lookups simply go to disk */
+        }
+        fat32_dcache_buckets = (uint16_t*)(fat32_dcache + FAT32_DCACHE_ENTRIES);
+    }
+
+    memset(fat32_dcache, 0, FAT32_DCACHE_ENTRIES * sizeof(fat32_dcache_entry_t));
+    for (uint32_t i = 0; i < FAT32_DCACHE_BUCKETS; i++) {
+        fat32_dcache_buckets[i] = FAT32_DCACHE_NONE;
+    }
+    fat32_dcache_hand = 0;
+    memset(&fat32_dcache_stats, 0, sizeof(fat32_dcache_stats));
+}
+
+/* Drop all lookups inside one directory (its clusters are being freed) */
+void fat32_dcache_invalidate_directory(uint32_t dir_cluster) {
+    if (!fat32_dcache) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < FAT32_DCACHE_ENTRIES; i++) {
+        if (fat32_dcache[i].used && fat32_dcache[i].dir_cluster == dir_cluster) {
+            fat32_dcache_unlink(&fat32_dcache[i]);
+        }
+    }
+}
+
+/* Look a name up. Returns false if the cache knows nothing about it;
+ * otherwise *exists tells whether the name exists, and for existing names
+ * the entry and its location are filled in. */
+bool fat32_dcache_lookup(uint32_t dir_cluster, const char* name, bool* exists, fat32_dir_entry_t* entry,
+                         uint32_t* entry_cluster, uint32_t* entry_offset) {
+    char key[FAT32_DCACHE_NAME_MAX];
+    fat32_dcache_entry_t* slot;
+
+    if (!fat32_dcache || !fat32_dcache_key(name, key)) {
+        return false;
+    }
+
+    slot = fat32_dcache_find(dir_cluster, key);
+    if (!slot) {
+        fat32_dcache_stats.misses++;
+        return false;
+    }
+
+    slot->referenced = true;
+    if (slot->negative) {
+        fat32_dcache_stats.negative_hits++;
+        *exists = false;
+        return true;
+    }
+
+    fat32_dcache_stats.hits++;
+    *exists = true;
+    if (entry) {
+        *entry = slot->entry;
+    }
+    if (entry_cluster) {
+        *entry_cluster = slot->entry_cluster;
+    }
+    if (entry_offset) {
+        *entry_offset = slot->entry_offset;
+    }
+    return true;
+}
+
+/* Remember where a name lives */
+void fat32_dcache_insert(uint32_t dir_cluster, const char* name, const fat32_dir_entry_t* entry,
+                         uint32_t entry_cluster, uint32_t entry_offset) {
+    char key[FAT32_DCACHE_NAME_MAX];
+
+    if (!fat32_dcache || !fat32_dcache_key(name, key)) {
+        return;
+    }
+
+    fat32_dcache_entry_t* slot = fat32_dcache_store(dir_cluster, key);
+    slot->negative = false;
+    slot->entry = *entry;
+    slot->entry_cluster = entry_cluster;
+    slot->entry_offset = entry_offset;
+}
+
+/* Remember that a name does not exist */
+void fat32_dcache_insert_negative(uint32_t dir_cluster, const char* name) {
+    char key[FAT32_DCACHE_NAME_MAX];
+
+    if (!fat32_dcache || !fat32_dcache_key(name, key)) {
+        return;
+    }
+
+    fat32_dcache_entry_t* slot = fat32_dcache_store(dir_cluster, key);
+    slot->negative = true;
+}
+
+/* Forget one name (rename target, removed entry) */
+void fat32_dcache_remove(uint32_t dir_cluster, const char* name) {
+    char key[FAT32_DCACHE_NAME_MAX];
+
+    if (!fat32_dcache || !fat32_dcache_key(name, key)) {
+        return;
+    }
+
+    fat32_dcache_entry_t* slot = fat32_dcache_find(dir_cluster, key);
+    if (slot) {
+        fat32_dcache_unlink(slot);
+    }
+}
+
+/* A directory entry was rewritten on disk: refresh the cached copies, or
+ * drop them if the slot was deleted or now holds a different file. The
+ * caller re-inserts renamed entries under their new name. */
+void fat32_dcache_update(uint32_t entry_cluster, uint32_t entry_offset, const fat32_dir_entry_t* entry) {
+    if (!fat32_dcache) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < FAT32_DCACHE_ENTRIES; i++) {
+        fat32_dcache_entry_t* slot = &fat32_dcache[i];
+
+        if (!slot->used || slot->negative ||
+            slot->entry_cluster != entry_cluster || slot->entry_offset != entry_offset) {
+            continue;
+        }
+
+        if (memcmp(slot->entry.name, entry->name, 11) == 0) {
+            slot->entry = *entry;
+        } else {
+            fat32_dcache_unlink(slot);
+        }
+    }
+}
+
+void fat32_dcache_get_stats(fat32_dcache_stats_t* stats) {
+    if (stats) {
+        *stats = fat32_dcache_stats;
+    }
+}
@@ -0,0 +1,366 @@
+/*
+ * FAT32 Fragmentation Report and Online Defragmenter
+ * ChanUX Operating System
+ *
+ * fat32_get_statistics walks the directory tree and counts the extents of
+ * every file. The defragmenter walks the tree the same way from a
+ * low-priority process, one entry per step, and moves each fragmented file
+ * into a contiguous free run. A move is ordered so that a crash at any
+ * point leaves the file intact: the new run is allocated and filled, the
+ * FAT and data are flushed, the directory entry is switched over and
+ * flushed, and only then is the old chain freed. A crash in between can
+ * only leak the clusters of one chain.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/process/process.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_DEFRAG_IDLE_MS        1000        /* Poll interval while stopped */
+
+/* Position in one directory of the tree walk */
+typedef struct {
+    uint32_t cluster;
+    uint32_t offset;
+} fat32_tree_level_t;
+
+/* Depth-first walk over every file and directory on the volume */
+typedef struct {
+    fat32_tree_level_t levels[FAT32_MAX_PATH_DEPTH];
+    uint32_t depth;                     /* Levels in use; 0 = walk over */
+} fat32_tree_walk_t;
+
+static process_t* fat32_defrag_task = NULL;
+static volatile bool fat32_defrag_enabled = false;
+static volatile bool fat32_defrag_restart = false;
+static volatile bool fat32_defrag_in_move = false;  /* A file move may have the lock dropped */
+static fat32_defrag_stats_t fat32_defrag_stats;
+
+static void fat32_tree_begin(fat32_tree_walk_t* walk) {
+    walk->levels[0].cluster = fat32_volume.root_dir_first_cluster;
+    walk->levels[0].offset = 0;
+    walk->depth = 1;
+}
+
+/* Step to the next file or directory; false once the whole tree was seen.
+ * Directories deeper than FAT32_MAX_PATH_DEPTH are reported but not entered. */
+static bool fat32_tree_next(fat32_tree_walk_t* walk, fat32_dir_entry_t* entry,
+                            uint32_t* entry_cluster, uint32_t* entry_offset) {
+    uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
+
+    while (walk->depth > 0) {
+        fat32_tree_level_t* level = &walk->levels[walk->depth - 1];
+        uint32_t cluster = level->cluster;
+        uint32_t offset = level->offset;
+        uint8_t first;
+
+        if (!FAT32_VALIDATE_CLUSTER(cluster) ||
+            fat32_dir_read_entry(cluster, offset, entry) != FAT32_SUCCESS) {
+            walk->depth--;
+            continue;
+        }
+
+        level->offset += FAT32_DIR_ENTRY_SIZE;
+        if (level->offset == bytes_per_cluster) {
+            level->cluster = fat32_get_next_cluster(cluster);
+            level->offset = 0;
+        }
+
+        first = (uint8_t)entry->name[0];
+        if (first == 0x00) {
+            walk->depth--;  /* End of directory */
+            continue;
+        }
+        if (first == 0xE5 || entry->name[0] == '.' ||
+            (entry->attributes & FAT32_ATTR_LONG_NAME_MASK) == FAT32_ATTR_LONG_NAME ||
+            (entry->attributes & FAT32_ATTR_VOLUME_ID)) {
+            continue;
+        }
+
+        if ((entry->attributes & FAT32_ATTR_DIRECTORY) && walk->depth < FAT32_MAX_PATH_DEPTH) {
+            uint32_t child = fat32_get_first_cluster(entry);
+            if (FAT32_VALIDATE_CLUSTER(child)) {
+                walk->levels[walk->depth].cluster = child;
+                walk->levels[walk->depth].offset = 0;
+                walk->depth++;
+            }
+        }
+
+        *entry_cluster = cluster;
+        *entry_offset = offset;
+        return true;
+    }
+    return false;
+}
+
+/* Count the contiguous runs of a chain; its length goes to clusters */
+static uint32_t fat32_chain_extents(uint32_t first, uint32_t* clusters) {
+    uint32_t extents = 0, length = 0;
+    uint32_t cluster = first;
+
+    while (FAT32_VALIDATE_CLUSTER(cluster) && length <= fat32_volume.total_clusters) {
+        uint32_t next = fat32_get_next_cluster(cluster);
+
+        length++;
+        if (next != cluster + 1) {
+            extents++;
+        }
+        cluster = next;
+    }
+
+    if (clusters) {
+        *clusters = length;
+    }
+    return extents;
+}
+
+/* Walk every file: counts, average size, fragmentation, largest free run */
+fat32_result_t fat32_get_statistics(fat32_stats_t* stats) {
+    fat32_tree_walk_t walk;
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+    uint32_t start, length;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (stats == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(fat32_stats_t));
+
+    fat32_tree_begin(&walk);
+    while (fat32_tree_next(&walk, &entry, &entry_cluster, &entry_offset)) {
+        if (entry.attributes & FAT32_ATTR_DIRECTORY) {
+            stats->total_directories++;
+            continue;
+        }
+
+        /* Running mean, so that no 64-bit total is needed */
+        stats->total_files++;
+        if (entry.file_size >= stats->average_file_size) {
+            stats->average_file_size += (entry.file_size - stats->average_file_size) / stats->total_files;
+        } else {
+            stats->average_file_size -= (stats->average_file_size - entry.file_size) / stats->total_files;
+        }
+
+        if (fat32_chain_extents(fat32_get_first_cluster(&entry), NULL) > 1) {
+            stats->fragmented_files++;
+        }
+    }
+
+    if (stats->total_files > 0) {
+        stats->fragmentation_ratio = (float)stats->fragmented_files / (float)stats->total_files;
+    }
+
+    if (fat32_find_free_run(0xFFFFFFFF, &start, &length) == FAT32_SUCCESS) {
+        uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
+        stats->largest_free_space = length > 0xFFFFFFFF / bytes_per_cluster ?
+                                    0xFFFFFFFF : length * bytes_per_cluster;
+    }
+    stats->bad_sectors = fat32_volume.bad_clusters * fat32_volume.sectors_per_cluster;
+
+    return FAT32_SUCCESS;
+}
+
+/* Number of contiguous runs a file's data is stored in (0 = empty) */
+fat32_result_t fat32_get_file_extents(const char* path, uint32_t* extents) {
+    fat32_dir_entry_t entry;
+    fat32_result_t result;
+
+    if (path == NULL || extents == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_resolve_path(path, &entry, NULL, NULL, NULL);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    *extents = fat32_chain_extents(fat32_get_first_cluster(&entry), NULL);
+    return FAT32_SUCCESS;
+}
+
+/* Move a fragmented file into one contiguous run. Called with the volume
+ * lock held; the lock is dropped while the data is copied, and the move is
+ * abandoned, and the new run freed, if the file changes meanwhile. */
+static fat32_result_t fat32_defrag_file(const fat32_dir_entry_t* entry, uint32_t entry_cluster,
+                                        uint32_t entry_offset, uint8_t* buffer) {
+    uint32_t old_first = fat32_get_first_cluster(entry);
+    uint32_t writes = fat32_volume.write_operations;
+    uint32_t count, start, length, new_first, cluster, next;
+    bool copied;
+    fat32_dir_entry_t current;
+    fat32_result_t result;
+
+    if (fat32_chain_extents(old_first, &count) <= 1) {
+        return FAT32_SUCCESS;
+    }
+
+    /* Only worth it if a single run can hold the whole file */
+    result = fat32_find_free_run(count, &start, &length);
+    if (result != FAT32_SUCCESS || length < count) {
+        return FAT32_ERROR_DISK_FULL;
+    }
+    result = fat32_allocate_cluster_chain(count, &new_first);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (fat32_chain_extents(new_first, NULL) != 1) {
+        fat32_free_cluster_chain(new_first);
+        return FAT32_ERROR_DISK_FULL;
+    }
+
+    /* Copy the data without the lock; nothing else can reach the new run */
+    cluster = old_first;
+    for (uint32_t i = 0; i < count; i++) {
+        fat32_journal_data_write(fat32_cluster_to_lba(new_first + i), fat32_volume.sectors_per_cluster);
+        next = fat32_get_next_cluster(cluster);
+        fat32_unlock();
+
+        copied = bcache_read_direct(fat32_volume.device, fat32_cluster_to_lba(cluster),
+                                    fat32_volume.sectors_per_cluster, buffer) == BLOCK_SUCCESS &&
+                 bcache_write_direct(fat32_volume.device, fat32_cluster_to_lba(new_first + i),
+                                     fat32_volume.sectors_per_cluster, buffer) == BLOCK_SUCCESS;
+
+        fat32_lock();
+        if (!copied) {
+            fat32_free_cluster_chain(new_first);
+            return FAT32_ERROR_WRITE_FAILED;
+        }
+        cluster = next;
+    }
+
+    /* Put the new run on disk */
+    result = fat32_flush_all_caches();
+
+    /* Switch the entry over only if nothing was opened or written meanwhile */
+    if (result == FAT32_SUCCESS) {
+        result = fat32_dir_read_entry(entry_cluster, entry_offset, &current);
+    }
+    if (result != FAT32_SUCCESS || fat32_open_file_count() > 0 ||
+        fat32_volume.write_operations != writes ||
+        memcmp(&current, entry, sizeof(fat32_dir_entry_t)) != 0) {
+        fat32_free_cluster_chain(new_first);
+        return result;
+    }
+
+    fat32_set_first_cluster(&current, new_first);
+    result = fat32_dir_write_entry(entry_cluster, entry_offset, &current);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_flush_all_caches();
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;  /* The entry may point either way; keep both chains */
+    }
+
+    fat32_defrag_stats.files_moved++;
+    fat32_defrag_stats.clusters_moved += count;
+    return fat32_free_cluster_chain(old_first);
+}
+
+/* One entry per step, under the volume lock; the walk pauses while any
+ * file is open, since an open handle holds the cluster numbers the move
+ * would change */
+static void fat32_defrag_process(void) {
+    fat32_tree_walk_t walk;
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+    uint32_t pages = FAT32_MAX_CLUSTER_SIZE / MEMORY_PAGE_SIZE;
+    uint8_t* buffer = (uint8_t*)memory_alloc_pages(pages);
+    uint32_t flags;
+
+    walk.depth = 0;
+
+    while (1) {
+        uint32_t pause = FAT32_DEFRAG_STEP_MS;
+
+        fat32_lock();
+
+        if (fat32_defrag_restart) {
+            fat32_defrag_restart = false;
+            walk.depth = 0;
+        }
+
+        if (!buffer || !fat32_defrag_enabled || !fat32_volume.initialized || fat32_volume.read_only) {
+            pause = FAT32_DEFRAG_IDLE_MS;
+        } else if (fat32_open_file_count() > 0) {
+            pause = FAT32_DEFRAG_BUSY_MS;
+        } else {
+            if (walk.depth == 0) {
+                fat32_tree_begin(&walk);
+            }
+            if (fat32_tree_next(&walk, &entry, &entry_cluster, &entry_offset)) {
+                if (!(entry.attributes & FAT32_ATTR_DIRECTORY)) {
+                    fat32_defrag_stats.files_examined++;
+                    fat32_defrag_in_move = true;
+                    fat32_defrag_file(&entry, entry_cluster, entry_offset, buffer);
+                    fat32_defrag_in_move = false;
+                }
+            } else {
+                fat32_defrag_stats.passes++;
+                pause = FAT32_DEFRAG_PASS_MS;
+            }
+        }
+
+        fat32_unlock();
+
+        /* Sleep and switch away without a tick in between; process_yield
+         * would also put us back on the ready queue */
+        __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+        process_sleep(get_current_process(), pause);
+        scheduler_switch_process();
+        if (flags & 0x200) {
+            __asm__ volatile("sti" : : : "memory");
+        }
+    }
+}
+
+/* Start defragmenting the mounted volume in the background */
+fat32_result_t fat32_defrag_start(void) {
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    if (!fat32_defrag_task) {
+        fat32_defrag_task = process_create("fat32_defrag", fat32_defrag_process, PROCESS_PRIORITY_LOW);
+        if (!fat32_defrag_task) {
+            return FAT32_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    fat32_defrag_enabled = true;
+    fat32_defrag_stats.running = true;
+    return FAT32_SUCCESS;
+}
+
+/* Stop after the current step; the process idles until started again */
+void fat32_defrag_stop(void) {
+    fat32_defrag_enabled = false;
+    fat32_defrag_stats.running = false;
+}
+
+/* The volume changed under the walk (mount, format): start over */
+void fat32_defrag_reset(void) {
+    fat32_defrag_restart = true;
+}
+
+void fat32_defrag_get_stats(fat32_defrag_stats_t* stats) {
+    if (stats) {
+        *stats = fat32_defrag_stats;
+    }
+}
+
+/* Whether a file is half moved: its new run is allocated but not yet
+ * reachable from the directory tree */
+bool fat32_defrag_moving(void) {
+    return fat32_defrag_in_move;
+}
@@ -0,0 +1,307 @@
+/*
+ * FAT32 Directory Index
+ * ChanUX Operating System
+ *
+ * In-memory hash index for large directories. Each name of an entry (its
+ * long name and its short name) gets a record pointing at the first slot
+ * of that name, so a lookup only reads the candidates whose name hash
+ * matches. Records narrow the search and callers verify candidates on
+ * disk; an index is complete, so a name it does not list does not exist.
+ * Indexes are built while a directory is walked, kept current as entries
+ * are added, and dropped in LRU order when the table is full or free
+ * memory runs low.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_DINDEX_NONE       0xFFFFFFFF
+
+/* One name of a directory entry */
+typedef struct {
+    uint32_t hash;                      /* Hash of the folded name */
+    uint32_t cluster;                   /* First slot of the name */
+    uint16_t offset;
+    uint8_t slots;                      /* LFN fragments before the short entry (0 = short name) */
+    uint8_t live;                       /* Cleared when the slot no longer holds the name */
+    uint32_t next;                      /* Next record in the bucket */
+} fat32_dindex_record_t;
+
+/* Index of one directory */
+typedef struct {
+    uint32_t dir_cluster;               /* First cluster of the directory (0 = being built) */
+    uint32_t last_used;                 /* LRU stamp */
+    fat32_dindex_record_t* records;     /* NULL = slot unused; buckets follow the records */
+    uint32_t* buckets;
+    uint32_t pages;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t bucket_mask;
+} fat32_dindex_t;
+
+static fat32_dindex_t fat32_dindex[FAT32_DINDEX_MAX];
+static uint32_t fat32_dindex_clock = 0;
+
+/* Index being built by the current directory walk. Records are staged
+ * until the directory turns out to be large enough to be worth indexing. */
+static uint32_t fat32_dindex_building = 0;
+static fat32_dindex_t* fat32_dindex_target = NULL;
+static fat32_dindex_record_t fat32_dindex_staging[FAT32_DINDEX_MIN_RECORDS];
+static uint32_t fat32_dindex_staged = 0;
+
+static void fat32_dindex_release(fat32_dindex_t* index) {
+    if (index->records) {
+        memory_free_pages(index->records, index->pages);
+    }
+    memset(index, 0, sizeof(fat32_dindex_t));
+}
+
+static fat32_dindex_t* fat32_dindex_lookup(uint32_t dir_cluster) {
+    for (uint32_t i = 0; i < FAT32_DINDEX_MAX; i++) {
+        if (fat32_dindex[i].records && fat32_dindex[i].dir_cluster == dir_cluster) {
+            return &fat32_dindex[i];
+        }
+    }
+    return NULL;
+}
+
+/* Drop the least recently used index other than keep */
+static bool fat32_dindex_evict(const fat32_dindex_t* keep) {
+    fat32_dindex_t* victim = NULL;
+
+    for (uint32_t i = 0; i < FAT32_DINDEX_MAX; i++) {
+        fat32_dindex_t* index = &fat32_dindex[i];
+        if (index == keep || !index->records || index->dir_cluster == 0) {
+            continue;
+        }
+        if (!victim || index->last_used < victim->last_used) {
+            victim = index;
+        }
+    }
+
+    if (!victim) {
+        return false;
+    }
+    fat32_dindex_release(victim);
+    return true;
+}
+
+static void fat32_dindex_link(fat32_dindex_t* index, uint32_t record) {
+    uint32_t bucket = index->records[record].hash & index->bucket_mask;
+
+    index->records[record].next = index->buckets[bucket];
+    index->buckets[bucket] = record;
+}
+
+/* Move an index to storage for capacity records (a power of two). Other
+ * indexes are evicted while memory is short. */
+static bool fat32_dindex_resize(fat32_dindex_t* index, uint32_t capacity) {
+    uint32_t buckets = capacity / 2;
+    uint32_t bytes = capacity * sizeof(fat32_dindex_record_t) + buckets * sizeof(uint32_t);
+    uint32_t pages = (bytes + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    fat32_dindex_record_t* records;
+
+    while (1) {
+        records = NULL;
+        if (memory_get_free_pages() >= pages + FAT32_DINDEX_RESERVE_PAGES) {
+            records = (fat32_dindex_record_t*)memory_alloc_pages(pages);
+        }
+        if (records) {
+            break;
+        }
+        if (!fat32_dindex_evict(index)) {
+            return false;
+        }
+    }
+
+    if (index->records) {
+        memcpy(records, index->records, index->count * sizeof(fat32_dindex_record_t));
+        memory_free_pages(index->records, index->pages);
+    }
+
+    index->records = records;
+    index->buckets = (uint32_t*)(records + capacity);
+    index->pages = pages;
+    index->capacity = capacity;
+    index->bucket_mask = buckets - 1;
+
+    memset(index->buckets, 0xFF, buckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < index->count; i++) {
+        fat32_dindex_link(index, i);
+    }
+    return true;
+}
+
+static bool fat32_dindex_append(fat32_dindex_t* index, const fat32_dindex_record_t* record) {
+    if (index->count == index->capacity && !fat32_dindex_resize(index, index->capacity * 2)) {
+        return false;
+    }
+
+    index->records[index->count] = *record;
+    fat32_dindex_link(index, index->count);
+    index->count++;
+    return true;
+}
+
+/* Take a free table slot, evicting the least recently used index if needed */
+static fat32_dindex_t* fat32_dindex_claim(void) {
+    while (1) {
+        for (uint32_t i = 0; i < FAT32_DINDEX_MAX; i++) {
+            if (!fat32_dindex[i].records) {
+                return &fat32_dindex[i];
+            }
+        }
+        if (!fat32_dindex_evict(NULL)) {
+            return NULL;
+        }
+    }
+}
+
+/* Drop every index (mount, format) */
+void fat32_dindex_invalidate_all(void) {
+    for (uint32_t i = 0; i < FAT32_DINDEX_MAX; i++) {
+        fat32_dindex_release(&fat32_dindex[i]);
+    }
+    fat32_dindex_building = 0;
+    fat32_dindex_target = NULL;
+}
+
+/* Drop the index of one directory */
+void fat32_dindex_invalidate(uint32_t dir_cluster) {
+    fat32_dindex_t* index = fat32_dindex_lookup(dir_cluster);
+
+    if (index) {
+        fat32_dindex_release(index);
+    }
+}
+
+/* Start collecting the names of a directory that is about to be walked */
+void fat32_dindex_build_begin(uint32_t dir_cluster) {
+    fat32_dindex_invalidate(dir_cluster);
+    fat32_dindex_building = dir_cluster;
+    fat32_dindex_target = NULL;
+    fat32_dindex_staged = 0;
+}
+
+void fat32_dindex_build_add(uint32_t hash, uint32_t cluster, uint32_t offset, uint32_t slots) {
+    fat32_dindex_record_t record;
+
+    if (!fat32_dindex_building) {
+        return;
+    }
+
+    record.hash = hash;
+    record.cluster = cluster;
+    record.offset = (uint16_t)offset;
+    record.slots = (uint8_t)slots;
+    record.live = 1;
+    record.next = FAT32_DINDEX_NONE;
+
+    if (!fat32_dindex_target) {
+        if (fat32_dindex_staged < FAT32_DINDEX_MIN_RECORDS) {
+            fat32_dindex_staging[fat32_dindex_staged++] = record;
+            return;
+        }
+
+        /* Large directory: move the staged records into a real index */
+        fat32_dindex_target = fat32_dindex_claim();
+        if (!fat32_dindex_target || !fat32_dindex_resize(fat32_dindex_target, FAT32_DINDEX_MIN_RECORDS * 2)) {
+            if (fat32_dindex_target) {
+                fat32_dindex_release(fat32_dindex_target);
+            }
+            fat32_dindex_target = NULL;
+            fat32_dindex_building = 0;
+            return;
+        }
+        for (uint32_t i = 0; i < fat32_dindex_staged; i++) {
+            fat32_dindex_append(fat32_dindex_target, &fat32_dindex_staging[i]);
+        }
+    }
+
+    if (!fat32_dindex_append(fat32_dindex_target, &record)) {
+        fat32_dindex_release(fat32_dindex_target);
+        fat32_dindex_target = NULL;
+        fat32_dindex_building = 0;
+    }
+}
+
+/* Finish a walk; the index is only kept if the walk saw every entry */
+void fat32_dindex_build_end(bool complete) {
+    if (fat32_dindex_target) {
+        if (complete && fat32_dindex_building) {
+            fat32_dindex_target->dir_cluster = fat32_dindex_building;
+            fat32_dindex_target->last_used = ++fat32_dindex_clock;
+        } else {
+            fat32_dindex_release(fat32_dindex_target);
+        }
+    }
+
+    fat32_dindex_building = 0;
+    fat32_dindex_target = NULL;
+    fat32_dindex_staged = 0;
+}
+
+/* Start a lookup; returns false if the directory has no index */
+bool fat32_dindex_find(uint32_t dir_cluster, uint32_t hash, fat32_dindex_cursor_t* cursor) {
+    fat32_dindex_t* index = fat32_dindex_lookup(dir_cluster);
+
+    if (!index) {
+        return false;
+    }
+
+    index->last_used = ++fat32_dindex_clock;
+    cursor->index = (uint32_t)(index - fat32_dindex);
+    cursor->current = FAT32_DINDEX_NONE;
+    cursor->next = index->buckets[hash & index->bucket_mask];
+    cursor->hash = hash;
+    return true;
+}
+
+/* Next candidate: the first slot of a name with the looked-up hash */
+bool fat32_dindex_next(fat32_dindex_cursor_t* cursor, uint32_t* cluster, uint32_t* offset, uint32_t* slots) {
+    fat32_dindex_t* index = &fat32_dindex[cursor->index];
+
+    while (cursor->next != FAT32_DINDEX_NONE) {
+        fat32_dindex_record_t* record = &index->records[cursor->next];
+
+        cursor->current = cursor->next;
+        cursor->next = record->next;
+        if (record->live && record->hash == cursor->hash) {
+            *cluster = record->cluster;
+            *offset = record->offset;
+            *slots = record->slots;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The candidate returned last no longer holds a name */
+void fat32_dindex_forget(const fat32_dindex_cursor_t* cursor) {
+    if (cursor->current != FAT32_DINDEX_NONE) {
+        fat32_dindex[cursor->index].records[cursor->current].live = 0;
+    }
+}
+
+/* Record a name added to an indexed directory */
+void fat32_dindex_add(uint32_t dir_cluster, uint32_t hash, uint32_t cluster, uint32_t offset, uint32_t slots) {
+    fat32_dindex_t* index = fat32_dindex_lookup(dir_cluster);
+    fat32_dindex_record_t record;
+
+    if (!index) {
+        return;
+    }
+
+    record.hash = hash;
+    record.cluster = cluster;
+    record.offset = (uint16_t)offset;
+    record.slots = (uint8_t)slots;
+    record.live = 1;
+    record.next = FAT32_DINDEX_NONE;
+
+    /* An index missing a name would report it as absent */
+    if (!fat32_dindex_append(index, &record)) {
+        fat32_dindex_release(index);
+    }
+}
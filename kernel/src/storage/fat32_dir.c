@@ -0,0 +1,1328 @@
+/*
+ * FAT32 Directory Entries
+ * ChanUX Operating System
+ *
+ * Directory scanning, path resolution and directory entry updates. All
+ * directory sectors are accessed through the block buffer cache. Long
+ * file names are assembled from their LFN fragments while a directory is
+ * walked, so each directory sector is read once per scan.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_ENTRIES_PER_SECTOR    (FAT32_SECTOR_SIZE / FAT32_DIR_ENTRY_SIZE)
+#define FAT32_ENTRY_END             0x00        /* First byte: no more entries */
+#define FAT32_ENTRY_DELETED         0xE5        /* First byte: free slot */
+#define FAT32_LFN_BUFFER_SIZE       (FAT32_LFN_MAX_ENTRIES * FAT32_LFN_CHARS_PER_ENTRY + 1)
+#define FAT32_DIR_MAX_SLOTS         (FAT32_LFN_MAX_ENTRIES + 1)
+
+/* Long name being assembled while scanning a directory */
+typedef struct {
+    char name[FAT32_LFN_BUFFER_SIZE];
+    uint8_t checksum;                   /* Short name checksum carried by the fragments */
+    uint8_t expected;                   /* Order of the next fragment */
+    bool complete;                      /* All fragments seen; a short entry must follow */
+    uint8_t slots;                      /* Fragments in the name */
+    uint32_t start_cluster;             /* Location of the first fragment */
+    uint32_t start_offset;
+} fat32_lfn_state_t;
+
+/* Directory slot handed to a walk visitor */
+typedef struct {
+    const fat32_dir_entry_t* entry;
+    const char* long_name;              /* Validated long name of a short entry, or NULL */
+    uint32_t cluster;                   /* Location of the slot */
+    uint32_t offset;
+    uint32_t lfn_cluster;               /* First fragment of long_name */
+    uint32_t lfn_offset;
+    uint32_t lfn_slots;
+} fat32_dir_slot_t;
+
+/* Called for every slot of a directory, free ones included. Returns false
+ * to stop the walk. */
+typedef bool (*fat32_dir_visitor_t)(void* context, const fat32_dir_slot_t* slot);
+
+/* State for fat32_dir_find_entry */
+typedef struct {
+    const char* name;
+    char short_name[12];                /* 8.3 form of name */
+    bool has_short;                     /* short_name renders name exactly */
+    bool build;                         /* Walk the whole directory to index it */
+    bool found;
+    fat32_dir_entry_t entry;
+    uint32_t cluster;
+    uint32_t offset;
+    uint32_t lfn_cluster;               /* First fragment of the matched name's long name */
+    uint32_t lfn_offset;
+    uint32_t lfn_slots;                 /* 0 = no long name */
+} fat32_find_context_t;
+
+/* State for directory listing */
+typedef struct {
+    fat32_dir_entry_t* entries;
+    char* long_name;                    /* Name of the single entry, if wanted */
+    uint32_t max_entries;
+    uint32_t count;
+    uint32_t slots;                     /* Slots consumed */
+    bool end;                           /* Reached the end-of-directory marker */
+} fat32_list_context_t;
+
+/* State for fat32_dir_add_entry */
+typedef struct {
+    uint32_t needed;                    /* LFN slots plus the short entry */
+    uint32_t run;                       /* Consecutive free slots collected so far */
+    uint32_t clusters[FAT32_DIR_MAX_SLOTS];
+    uint32_t offsets[FAT32_DIR_MAX_SLOTS];
+    bool end_seen;                      /* Passed the end-of-directory marker */
+    bool check_alias;                   /* Collect short names that collide with basis */
+    char basis[12];                     /* Short name the alias is derived from */
+    bool basis_taken;
+    uint32_t tails[FAT32_LFN_MAX_TAIL / 32];   /* Numeric tails in use */
+} fat32_add_context_t;
+
+static bool fat32_name_is_dot(const char* name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+static char fat32_fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/* Hash of a name folded to lower case (FNV-1a) */
+static uint32_t fat32_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash = (hash ^ (uint8_t)fat32_fold(*name++)) * 16777619u;
+    }
+    return hash;
+}
+
+/* Hash of the displayed form ("NAME.EXT") of a short entry */
+static uint32_t fat32_short_hash(const fat32_dir_entry_t* entry) {
+    char display[13];
+
+    fat32_83_to_filename(entry, display);
+    return fat32_name_hash(display);
+}
+
+/* Case-insensitive name comparison */
+static bool fat32_name_equal(const char* a, const char* b) {
+    while (*a && fat32_fold(*a) == fat32_fold(*b)) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Check a path component against the long name rules */
+static bool fat32_long_name_valid(const char* name) {
+    bool visible = false;
+
+    if (fat32_name_is_dot(name)) {
+        return true;
+    }
+    for (const char* p = name; *p; p++) {
+        if ((uint8_t)*p < 0x20 || *p == '"' || *p == '*' || *p == '/' || *p == ':' ||
+            *p == '<' || *p == '>' || *p == '?' || *p == '\\' || *p == '|') {
+            return false;
+        }
+        if (*p != '.' && *p != ' ') {
+            visible = true;
+        }
+    }
+    return visible;
+}
+
+/* Map one character into the short name character set */
+static char fat32_short_char(char c, bool* exact) {
+    if (c >= 'a' && c <= 'z') {
+        return (char)(c - 'a' + 'A');
+    }
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '$' || c == '%' || c == '\'' ||
+        c == '-' || c == '_' || c == '@' || c == '~' || c == '`' || c == '!' || c == '(' ||
+        c == ')' || c == '{' || c == '}' || c == '^' || c == '#' || c == '&') {
+        return c;
+    }
+    *exact = false;
+    return '_';
+}
+
+/* Build the 8.3 form of a name. Returns true if it renders the name exactly
+ * (ignoring case); otherwise short_name is the basis for a numbered alias. */
+static bool fat32_name_to_short(const char* name, char* short_name) {
+    const char* dot = NULL;
+    bool exact = true;
+    uint32_t i, j;
+
+    memset(short_name, ' ', 11);
+    short_name[11] = '\0';
+
+    if (fat32_name_is_dot(name)) {
+        memcpy(short_name, name, strlen(name));
+        return true;
+    }
+
+    for (i = 0; name[i]; i++) {
+        if (name[i] == '.') {
+            dot = &name[i];
+        }
+    }
+    if (dot == name) {
+        dot = NULL;                     /* ".profile" has no extension */
+    }
+
+    for (i = 0, j = 0; name[i] && &name[i] != dot; i++) {
+        if (name[i] == ' ' || name[i] == '.') {
+            exact = false;
+            continue;
+        }
+        if (j == FAT32_SFN_NAME_SIZE) {
+            exact = false;
+            break;
+        }
+        short_name[j++] = fat32_short_char(name[i], &exact);
+    }
+    if (j == 0) {
+        exact = false;
+    }
+
+    if (dot) {
+        for (i = 1, j = FAT32_SFN_NAME_SIZE; dot[i]; i++) {
+            if (dot[i] == ' ') {
+                exact = false;
+                continue;
+            }
+            if (j == FAT32_SFN_NAME_SIZE + FAT32_SFN_EXT_SIZE) {
+                exact = false;
+                break;
+            }
+            short_name[j++] = fat32_short_char(dot[i], &exact);
+        }
+        if (j == FAT32_SFN_NAME_SIZE) {
+            exact = false;              /* Trailing dot */
+        }
+    }
+
+    return exact;
+}
+
+static void fat32_lfn_reset(fat32_lfn_state_t* lfn) {
+    lfn->expected = 0;
+    lfn->complete = false;
+}
+
+/* Add one LFN fragment. Fragments must arrive in descending order under one
+ * checksum; anything else drops the partial name as orphaned. */
+static void fat32_lfn_feed(fat32_lfn_state_t* lfn, const fat32_lfn_entry_t* part) {
+    uint8_t order = part->order & FAT32_LFN_ORDER_MASK;
+    char* out;
+
+    if (order == 0 || order > FAT32_LFN_MAX_ENTRIES) {
+        fat32_lfn_reset(lfn);
+        return;
+    }
+
+    if (part->order & FAT32_LFN_LAST_ENTRY) {
+        lfn->checksum = part->checksum;
+        lfn->name[order * FAT32_LFN_CHARS_PER_ENTRY] = '\0';
+    } else if (order != lfn->expected || part->checksum != lfn->checksum) {
+        fat32_lfn_reset(lfn);
+        return;
+    }
+
+    out = &lfn->name[(order - 1) * FAT32_LFN_CHARS_PER_ENTRY];
+    for (uint32_t i = 0; i < FAT32_LFN_CHARS_PER_ENTRY; i++) {
+        uint16_t c = i < 5 ? part->name1[i] : (i < 11 ? part->name2[i - 5] : part->name3[i - 11]);
+
+        if (c == 0x0000) {
+            out[i] = '\0';
+            break;
+        }
+        out[i] = c < 0x80 ? (char)c : '?';
+    }
+
+    lfn->expected = order - 1;
+    lfn->complete = (order == 1);
+}
+
+/* Claim the pending long name for a short entry; it belongs to the entry
+ * only if every fragment was seen and the checksum matches */
+static const char* fat32_lfn_finish(fat32_lfn_state_t* lfn, const fat32_dir_entry_t* entry) {
+    bool valid = lfn->complete && lfn->checksum == fat32_calculate_checksum(entry->name);
+
+    fat32_lfn_reset(lfn);
+    return (valid && lfn->name[0] != '\0') ? lfn->name : NULL;
+}
+
+/* Entry that names a file or directory (not free, LFN or volume label) */
+static bool fat32_dir_is_named(const fat32_dir_entry_t* slot) {
+    uint8_t first = (uint8_t)slot->name[0];
+
+    return first != FAT32_ENTRY_END && first != FAT32_ENTRY_DELETED &&
+           (slot->attributes & FAT32_ATTR_LONG_NAME_MASK) != FAT32_ATTR_LONG_NAME &&
+           !(slot->attributes & FAT32_ATTR_VOLUME_ID);
+}
+
+/* Visit the slots of a directory in one pass, assembling long names as
+ * their fragments go by. The walk starts offset bytes into start_cluster;
+ * an offset at the end of the cluster starts at the next one. Returns
+ * FAT32_SUCCESS if the visitor stopped the walk and FAT32_ERROR_NOT_FOUND
+ * at the end of the chain, whose last cluster is stored in last_cluster. */
+static fat32_result_t fat32_dir_walk(uint32_t start_cluster, uint32_t offset, fat32_dir_visitor_t visit,
+                                     void* context, uint32_t* last_cluster) {
+    fat32_lfn_state_t lfn;
+    fat32_dir_slot_t slot;
+    uint32_t cluster = start_cluster;
+    uint32_t first_sector = offset / FAT32_SECTOR_SIZE;
+    uint32_t first_entry = (offset % FAT32_SECTOR_SIZE) / FAT32_DIR_ENTRY_SIZE;
+    uint32_t visited = 0;
+
+    fat32_lfn_reset(&lfn);
+
+    while (FAT32_VALIDATE_CLUSTER(cluster)) {
+        uint32_t lba = fat32_cluster_to_lba(cluster);
+
+        for (uint32_t sector = first_sector; sector < fat32_volume.sectors_per_cluster; sector++) {
+            bcache_buffer_t* buffer = bcache_get(fat32_volume.device, lba + sector);
+            if (!buffer) {
+                return FAT32_ERROR_READ_FAILED;
+            }
+
+            fat32_dir_entry_t* entries = (fat32_dir_entry_t*)buffer->data;
+            for (uint32_t i = first_entry; i < FAT32_ENTRIES_PER_SECTOR; i++) {
+                const fat32_dir_entry_t* entry = &entries[i];
+                uint8_t first = (uint8_t)entry->name[0];
+
+                slot.entry = entry;
+                slot.long_name = NULL;
+                slot.cluster = cluster;
+                slot.offset = sector * FAT32_SECTOR_SIZE + i * FAT32_DIR_ENTRY_SIZE;
+
+                if (first == FAT32_ENTRY_END || first == FAT32_ENTRY_DELETED) {
+                    fat32_lfn_reset(&lfn);
+                } else if ((entry->attributes & FAT32_ATTR_LONG_NAME_MASK) == FAT32_ATTR_LONG_NAME) {
+                    const fat32_lfn_entry_t* part = (const fat32_lfn_entry_t*)entry;
+                    if (part->order & FAT32_LFN_LAST_ENTRY) {
+                        lfn.slots = part->order & FAT32_LFN_ORDER_MASK;
+                        lfn.start_cluster = cluster;
+                        lfn.start_offset = slot.offset;
+                    }
+                    fat32_lfn_feed(&lfn, part);
+                } else if (entry->attributes & FAT32_ATTR_VOLUME_ID) {
+                    fat32_lfn_reset(&lfn);
+                } else {
+                    slot.long_name = fat32_lfn_finish(&lfn, entry);
+                    slot.lfn_cluster = lfn.start_cluster;
+                    slot.lfn_offset = lfn.start_offset;
+                    slot.lfn_slots = lfn.slots;
+                }
+
+                if (!visit(context, &slot)) {
+                    bcache_release(buffer);
+                    return FAT32_SUCCESS;
+                }
+            }
+            bcache_release(buffer);
+            first_entry = 0;
+        }
+        first_sector = 0;
+
+        if (last_cluster) {
+            *last_cluster = cluster;
+        }
+
+        /* Guard against looping chains */
+        if (++visited > fat32_volume.total_clusters) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+        cluster = fat32_get_next_cluster(cluster);
+    }
+
+    return FAT32_ERROR_NOT_FOUND;
+}
+
+/* Compare a named entry with the name being looked up */
+static bool fat32_find_matches(const fat32_find_context_t* find, const fat32_dir_entry_t* entry,
+                               const char* long_name) {
+    return (find->has_short && memcmp(entry->name, find->short_name, 11) == 0) ||
+           (long_name && fat32_name_equal(long_name, find->name));
+}
+
+static bool fat32_find_visit(void* context, const fat32_dir_slot_t* slot) {
+    fat32_find_context_t* find = (fat32_find_context_t*)context;
+
+    if ((uint8_t)slot->entry->name[0] == FAT32_ENTRY_END) {
+        return false;
+    }
+    if (!fat32_dir_is_named(slot->entry)) {
+        return true;
+    }
+
+    if (find->build) {
+        fat32_dindex_build_add(fat32_short_hash(slot->entry), slot->cluster, slot->offset, 0);
+        if (slot->long_name) {
+            fat32_dindex_build_add(fat32_name_hash(slot->long_name), slot->lfn_cluster, slot->lfn_offset,
+                                   slot->lfn_slots);
+        }
+    }
+
+    if (!find->found && fat32_find_matches(find, slot->entry, slot->long_name)) {
+        find->found = true;
+        find->entry = *slot->entry;
+        find->cluster = slot->cluster;
+        find->offset = slot->offset;
+        find->lfn_cluster = slot->lfn_cluster;
+        find->lfn_offset = slot->lfn_offset;
+        find->lfn_slots = slot->long_name ? slot->lfn_slots : 0;
+        return find->build;
+    }
+    return true;
+}
+
+/* Step to the next directory slot; false at the end of the chain */
+static bool fat32_dir_next_slot(uint32_t* cluster, uint32_t* offset) {
+    *offset += FAT32_DIR_ENTRY_SIZE;
+    if (*offset == fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE) {
+        *cluster = fat32_get_next_cluster(*cluster);
+        *offset = 0;
+    }
+    return FAT32_VALIDATE_CLUSTER(*cluster);
+}
+
+/* Check an index candidate on disk. It is the first slot of a name: the
+ * short entry itself (slots 0) or the first of slots LFN fragments. Returns
+ * FAT32_SUCCESS on a match, FAT32_ERROR_NOT_FOUND if the slots hold some
+ * other name and FAT32_ERROR_CORRUPTED_FS if they hold no name any more. */
+static fat32_result_t fat32_dir_verify(fat32_find_context_t* find, uint32_t cluster, uint32_t offset,
+                                       uint32_t slots) {
+    fat32_lfn_state_t lfn;
+    fat32_dir_entry_t entry;
+    const char* long_name = NULL;
+    uint32_t first_cluster = cluster, first_offset = offset;
+    fat32_result_t result;
+
+    fat32_lfn_reset(&lfn);
+
+    for (uint32_t i = 0; i < slots; i++) {
+        result = fat32_dir_read_entry(cluster, offset, &entry);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        if ((uint8_t)entry.name[0] == FAT32_ENTRY_END || (uint8_t)entry.name[0] == FAT32_ENTRY_DELETED ||
+            (entry.attributes & FAT32_ATTR_LONG_NAME_MASK) != FAT32_ATTR_LONG_NAME) {
+            return FAT32_ERROR_CORRUPTED_FS;
+        }
+        fat32_lfn_feed(&lfn, (const fat32_lfn_entry_t*)&entry);
+        if (!fat32_dir_next_slot(&cluster, &offset)) {
+            return FAT32_ERROR_CORRUPTED_FS;
+        }
+    }
+
+    result = fat32_dir_read_entry(cluster, offset, &entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (!fat32_dir_is_named(&entry)) {
+        return FAT32_ERROR_CORRUPTED_FS;
+    }
+    if (slots > 0) {
+        long_name = fat32_lfn_finish(&lfn, &entry);
+        if (!long_name) {
+            return FAT32_ERROR_CORRUPTED_FS;
+        }
+    }
+
+    if (!fat32_find_matches(find, &entry, long_name)) {
+        return FAT32_ERROR_NOT_FOUND;
+    }
+    find->found = true;
+    find->entry = entry;
+    find->cluster = cluster;
+    find->offset = offset;
+    find->lfn_cluster = first_cluster;
+    find->lfn_offset = first_offset;
+    find->lfn_slots = slots;
+    return FAT32_SUCCESS;
+}
+
+/* Look a name up in a directory's index. Returns false if the directory
+ * has no index; otherwise find->found tells whether the name exists. */
+static bool fat32_dir_find_indexed(uint32_t dir_cluster, fat32_find_context_t* find) {
+    fat32_dindex_cursor_t cursor;
+    uint32_t cluster, offset, slots;
+
+    if (!fat32_dindex_find(dir_cluster, fat32_name_hash(find->name), &cursor)) {
+        return false;
+    }
+
+    while (fat32_dindex_next(&cursor, &cluster, &offset, &slots)) {
+        fat32_result_t result = fat32_dir_verify(find, cluster, offset, slots);
+
+        if (result == FAT32_SUCCESS) {
+            return true;
+        }
+        if (result == FAT32_ERROR_CORRUPTED_FS) {
+            fat32_dindex_forget(&cursor);
+        } else if (result != FAT32_ERROR_NOT_FOUND) {
+            /* Could not check a candidate: fall back to a walk */
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Search a directory for a name, matching long names and short names
+ * without regard to case; the entry and its location are returned.
+ * Results, including misses, are remembered in the directory entry cache.
+ * Large directories are indexed on their first walk so that later lookups
+ * only read the slots whose name hash matches. */
+fat32_result_t fat32_dir_find_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry,
+                                    uint32_t* entry_cluster, uint32_t* entry_offset) {
+    fat32_find_context_t find;
+    fat32_result_t result;
+    bool exists;
+
+    if (fat32_dcache_lookup(dir_cluster, name, &exists, entry, entry_cluster, entry_offset)) {
+        return exists ? FAT32_SUCCESS : FAT32_ERROR_NOT_FOUND;
+    }
+
+    find.name = name;
+    find.has_short = fat32_name_to_short(name, find.short_name);
+    find.found = false;
+    find.build = false;
+
+    if (!fat32_dir_find_indexed(dir_cluster, &find)) {
+        find.found = false;
+        find.build = true;
+        fat32_dindex_build_begin(dir_cluster);
+        result = fat32_dir_walk(dir_cluster, 0, fat32_find_visit, &find, NULL);
+        fat32_dindex_build_end(result == FAT32_SUCCESS || result == FAT32_ERROR_NOT_FOUND);
+        if (result != FAT32_SUCCESS && result != FAT32_ERROR_NOT_FOUND) {
+            return result;
+        }
+    }
+
+    if (!find.found) {
+        fat32_dcache_insert_negative(dir_cluster, name);
+        return FAT32_ERROR_NOT_FOUND;
+    }
+
+    fat32_dcache_insert(dir_cluster, name, &find.entry, find.cluster, find.offset);
+    if (entry) {
+        *entry = find.entry;
+    }
+    if (entry_cluster) {
+        *entry_cluster = find.cluster;
+    }
+    if (entry_offset) {
+        *entry_offset = find.offset;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Walk a path to the directory that holds its last component. The last
+ * component is returned in name (FAT32_MAX_FILENAME + 1 bytes). */
+fat32_result_t fat32_resolve_parent(const char* path, uint32_t* parent_cluster, char* name) {
+    char component[FAT32_MAX_FILENAME + 1];
+    uint32_t cluster;
+    uint32_t length = 0;
+    int depth = 0;
+
+    if (path == NULL || parent_cluster == NULL || name == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    cluster = (*path == '/' || *path == '\\') ? fat32_volume.root_dir_first_cluster : fat32_current_directory;
+    name[0] = '\0';
+
+    while (1) {
+        char c = *path;
+
+        if (c != '/' && c != '\\' && c != '\0') {
+            if (length >= FAT32_MAX_FILENAME) {
+                return FAT32_ERROR_INVALID_FILENAME;
+            }
+            component[length++] = c;
+            path++;
+            continue;
+        }
+
+        /* End of a component: descend into the previous one first */
+        if (length > 0) {
+            component[length] = '\0';
+            length = 0;
+
+            /* "." names the directory we are already in */
+            if (strcmp(component, ".") == 0) {
+                goto next;
+            }
+
+            /* The root has no ".." entry; ".." of the root is the root */
+            if (strcmp(name, "..") == 0 && cluster == fat32_volume.root_dir_first_cluster) {
+                name[0] = '\0';
+            }
+
+            if (name[0] != '\0') {
+                fat32_dir_entry_t entry;
+                fat32_result_t result = fat32_dir_find_entry(cluster, name, &entry, NULL, NULL);
+                if (result != FAT32_SUCCESS) {
+                    return result == FAT32_ERROR_NOT_FOUND ? FAT32_ERROR_INVALID_PATH : result;
+                }
+                if (!(entry.attributes & FAT32_ATTR_DIRECTORY)) {
+                    return FAT32_ERROR_NOT_DIRECTORY;
+                }
+
+                /* ".." of a first-level directory points at cluster 0 (the root) */
+                cluster = fat32_get_first_cluster(&entry);
+                if (cluster == 0) {
+                    cluster = fat32_volume.root_dir_first_cluster;
+                }
+                if (++depth > FAT32_MAX_PATH_DEPTH) {
+                    return FAT32_ERROR_INVALID_PATH;
+                }
+            }
+
+            if (!fat32_long_name_valid(component)) {
+                return FAT32_ERROR_INVALID_FILENAME;
+            }
+            strcpy(name, component);
+        }
+
+next:
+        if (c == '\0') {
+            break;
+        }
+        path++;
+    }
+
+    *parent_cluster = cluster;
+    return FAT32_SUCCESS;
+}
+
+/* Resolve a path to its directory entry. The root directory has no entry;
+ * it is reported as a directory entry with entry_cluster 0. */
+fat32_result_t fat32_resolve_path(const char* path, fat32_dir_entry_t* entry, uint32_t* parent_cluster,
+                                  uint32_t* entry_cluster, uint32_t* entry_offset) {
+    char name[FAT32_MAX_FILENAME + 1];
+    uint32_t parent;
+    fat32_dir_entry_t found;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    result = fat32_resolve_parent(path, &parent, name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    /* ".." of the root is the root itself */
+    if (strcmp(name, "..") == 0 && parent == fat32_volume.root_dir_first_cluster) {
+        name[0] = '\0';
+    }
+
+    /* Empty path or "/" refers to the starting directory itself */
+    if (name[0] == '\0') {
+        memset(&found, 0, sizeof(found));
+        memset(found.name, ' ', 11);
+        found.attributes = FAT32_ATTR_DIRECTORY;
+        fat32_set_first_cluster(&found, parent);
+        if (entry) {
+            *entry = found;
+        }
+        if (parent_cluster) {
+            *parent_cluster = parent;
+        }
+        if (entry_cluster) {
+            *entry_cluster = 0;
+        }
+        if (entry_offset) {
+            *entry_offset = 0;
+        }
+        return FAT32_SUCCESS;
+    }
+
+    result = fat32_dir_find_entry(parent, name, &found, entry_cluster, entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    /* A ".." entry that points at the root stores cluster 0 */
+    if ((found.attributes & FAT32_ATTR_DIRECTORY) && fat32_get_first_cluster(&found) == 0) {
+        fat32_set_first_cluster(&found, fat32_volume.root_dir_first_cluster);
+    }
+
+    if (entry) {
+        *entry = found;
+    }
+    if (parent_cluster) {
+        *parent_cluster = parent;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Read the directory entry at a location */
+fat32_result_t fat32_dir_read_entry(uint32_t entry_cluster, uint32_t entry_offset, fat32_dir_entry_t* entry) {
+    if (!FAT32_VALIDATE_CLUSTER(entry_cluster) || entry == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    bcache_buffer_t* buffer = bcache_get(fat32_volume.device,
+                                         fat32_cluster_to_lba(entry_cluster) + entry_offset / FAT32_SECTOR_SIZE);
+    if (!buffer) {
+        return FAT32_ERROR_READ_FAILED;
+    }
+    memcpy(entry, &buffer->data[entry_offset % FAT32_SECTOR_SIZE], sizeof(fat32_dir_entry_t));
+    bcache_release(buffer);
+
+    return FAT32_SUCCESS;
+}
+
+/* Store 32 bytes at a directory slot without touching the entry cache */
+static fat32_result_t fat32_dir_write_slot(uint32_t cluster, uint32_t offset, const void* data) {
+    bcache_buffer_t* buffer = bcache_get(fat32_volume.device,
+                                         fat32_cluster_to_lba(cluster) + offset / FAT32_SECTOR_SIZE);
+    if (!buffer) {
+        return FAT32_ERROR_READ_FAILED;
+    }
+    fat32_journal_note(buffer);
+    memcpy(&buffer->data[offset % FAT32_SECTOR_SIZE], data, FAT32_DIR_ENTRY_SIZE);
+    block_result_t result = bcache_mark_dirty(buffer);
+    bcache_release(buffer);
+
+    return result == BLOCK_SUCCESS ? FAT32_SUCCESS : FAT32_ERROR_WRITE_FAILED;
+}
+
+/* Overwrite the directory entry at a location */
+fat32_result_t fat32_dir_write_entry(uint32_t entry_cluster, uint32_t entry_offset, const fat32_dir_entry_t* entry) {
+    fat32_dir_entry_t old;
+
+    if (!FAT32_VALIDATE_CLUSTER(entry_cluster) || entry == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    /* A name appearing in place is unknown to the directory indexes, and
+     * which directory holds this slot is not known here */
+    if (fat32_dir_read_entry(entry_cluster, entry_offset, &old) == FAT32_SUCCESS &&
+        memcmp(old.name, entry->name, 11) != 0 && fat32_dir_is_named(entry)) {
+        fat32_dindex_invalidate_all();
+    }
+
+    fat32_result_t result = fat32_dir_write_slot(entry_cluster, entry_offset, entry);
+    fat32_dcache_update(entry_cluster, entry_offset, entry);
+
+    return result;
+}
+
+/* Note a short name that may collide with the alias basis: either the
+ * basis itself or the basis with a "~N" tail */
+static void fat32_alias_note(fat32_add_context_t* add, const fat32_dir_entry_t* slot) {
+    uint32_t basis_length = 0;
+    uint32_t tilde, digits = 0, tail = 0;
+
+    if (memcmp(slot->ext, &add->basis[FAT32_SFN_NAME_SIZE], FAT32_SFN_EXT_SIZE) != 0) {
+        return;
+    }
+    if (memcmp(slot->name, add->basis, FAT32_SFN_NAME_SIZE) == 0) {
+        add->basis_taken = true;
+        return;
+    }
+
+    for (tilde = 0; tilde < FAT32_SFN_NAME_SIZE && slot->name[tilde] != '~'; tilde++);
+    if (tilde == FAT32_SFN_NAME_SIZE) {
+        return;
+    }
+    for (uint32_t i = tilde + 1; i < FAT32_SFN_NAME_SIZE && slot->name[i] != ' '; i++) {
+        if (slot->name[i] < '0' || slot->name[i] > '9') {
+            return;
+        }
+        tail = tail * 10 + (uint32_t)(slot->name[i] - '0');
+        digits++;
+    }
+    while (basis_length < FAT32_SFN_NAME_SIZE && add->basis[basis_length] != ' ') {
+        basis_length++;
+    }
+    if (basis_length > FAT32_SFN_NAME_SIZE - 1 - digits) {
+        basis_length = FAT32_SFN_NAME_SIZE - 1 - digits;
+    }
+
+    if (digits > 0 && tilde == basis_length && memcmp(slot->name, add->basis, tilde) == 0 &&
+        tail < FAT32_LFN_MAX_TAIL) {
+        add->tails[tail / 32] |= 1u << (tail % 32);
+    }
+}
+
+static bool fat32_add_visit(void* context, const fat32_dir_slot_t* slot) {
+    fat32_add_context_t* add = (fat32_add_context_t*)context;
+    uint8_t first = (uint8_t)slot->entry->name[0];
+
+    if (first == FAT32_ENTRY_END) {
+        add->end_seen = true;
+    }
+
+    if (first == FAT32_ENTRY_END || first == FAT32_ENTRY_DELETED) {
+        if (add->run < add->needed) {
+            add->clusters[add->run] = slot->cluster;
+            add->offsets[add->run] = slot->offset;
+            add->run++;
+        }
+    } else {
+        if (add->run < add->needed) {
+            add->run = 0;
+        }
+        if (add->check_alias && fat32_dir_is_named(slot->entry)) {
+            fat32_alias_note(add, slot->entry);
+        }
+    }
+
+    /* Alias checks need every short name, i.e. a walk to the end marker */
+    return !(add->run == add->needed && (add->end_seen || !add->check_alias));
+}
+
+/* Pick a short name: the basis if it renders the name and is free,
+ * otherwise the basis with the lowest unused "~N" tail */
+static fat32_result_t fat32_alias_choose(fat32_add_context_t* add, bool exact, char* short_name) {
+    uint32_t basis_length = 0;
+
+    memcpy(short_name, add->basis, 12);
+    if (exact && !add->basis_taken) {
+        return FAT32_SUCCESS;
+    }
+
+    while (basis_length < FAT32_SFN_NAME_SIZE && add->basis[basis_length] != ' ') {
+        basis_length++;
+    }
+
+    for (uint32_t tail = 1; tail < FAT32_LFN_MAX_TAIL; tail++) {
+        char digits[8];
+        uint32_t count = 0, keep;
+
+        if (add->tails[tail / 32] & (1u << (tail % 32))) {
+            continue;
+        }
+
+        for (uint32_t value = tail; value > 0; value /= 10) {
+            digits[count++] = (char)('0' + value % 10);
+        }
+        keep = basis_length < FAT32_SFN_NAME_SIZE - 1 - count ? basis_length : FAT32_SFN_NAME_SIZE - 1 - count;
+
+        memset(short_name, ' ', FAT32_SFN_NAME_SIZE);
+        memcpy(short_name, add->basis, keep);
+        short_name[keep] = '~';
+        for (uint32_t i = 0; i < count; i++) {
+            short_name[keep + 1 + i] = digits[count - 1 - i];
+        }
+        return FAT32_SUCCESS;
+    }
+
+    return FAT32_ERROR_FILE_EXISTS;
+}
+
+/* Fill in one LFN fragment (order counts from 1 at the start of the name) */
+static void fat32_lfn_build(fat32_lfn_entry_t* part, const char* name, uint32_t length,
+                            uint8_t order, bool last, uint8_t checksum) {
+    memset(part, 0, sizeof(*part));
+    part->order = order | (last ? FAT32_LFN_LAST_ENTRY : 0);
+    part->attributes = FAT32_ATTR_LONG_NAME;
+    part->checksum = checksum;
+
+    for (uint32_t i = 0; i < FAT32_LFN_CHARS_PER_ENTRY; i++) {
+        uint32_t position = (order - 1) * FAT32_LFN_CHARS_PER_ENTRY + i;
+        uint16_t c = position < length ? (uint8_t)name[position] : (position == length ? 0x0000 : 0xFFFF);
+
+        if (i < 5) {
+            part->name1[i] = c;
+        } else if (i < 11) {
+            part->name2[i - 5] = c;
+        } else {
+            part->name3[i - 11] = c;
+        }
+    }
+}
+
+/* Store an entry under a name in the first run of free slots big enough
+ * for it, growing the directory by zeroed clusters when none is. Names
+ * that are not plain upper case 8.3 get LFN entries and a generated short
+ * alias, which is written back into entry->name. Free slots and alias
+ * collisions are both collected in a single walk of the directory. */
+fat32_result_t fat32_dir_add_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry,
+                                   uint32_t* entry_cluster, uint32_t* entry_offset) {
+    fat32_add_context_t add;
+    char short_name[12];
+    uint32_t length, lfn_count = 0;
+    uint32_t last_cluster = dir_cluster;
+    bool exact, lower = false;
+    fat32_result_t result;
+
+    if (name == NULL || entry == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    if (!fat32_long_name_valid(name) || fat32_name_is_dot(name)) {
+        return FAT32_ERROR_INVALID_FILENAME;
+    }
+
+    length = strlen(name);
+    for (uint32_t i = 0; i < length; i++) {
+        if (name[i] >= 'a' && name[i] <= 'z') {
+            lower = true;
+        }
+    }
+
+    memset(&add, 0, sizeof(add));
+    exact = fat32_name_to_short(name, add.basis);
+    if (!exact || lower) {
+        lfn_count = (length + FAT32_LFN_CHARS_PER_ENTRY - 1) / FAT32_LFN_CHARS_PER_ENTRY;
+        add.check_alias = true;
+    }
+    add.needed = lfn_count + 1;
+
+    result = fat32_dir_walk(dir_cluster, 0, fat32_add_visit, &add, &last_cluster);
+    if (result != FAT32_SUCCESS && result != FAT32_ERROR_NOT_FOUND) {
+        return result;
+    }
+
+    /* Not enough room: append cleared clusters and continue the run into them */
+    while (add.run < add.needed) {
+        uint32_t cluster;
+
+        result = fat32_extend_cluster_chain(last_cluster, 1);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        cluster = fat32_get_next_cluster(last_cluster);
+        result = fat32_clear_cluster(cluster);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+
+        uint32_t slots = fat32_volume.sectors_per_cluster * FAT32_ENTRIES_PER_SECTOR;
+        for (uint32_t i = 0; i < slots && add.run < add.needed; i++) {
+            add.clusters[add.run] = cluster;
+            add.offsets[add.run] = i * FAT32_DIR_ENTRY_SIZE;
+            add.run++;
+        }
+        last_cluster = cluster;
+    }
+
+    result = fat32_alias_choose(&add, exact, short_name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    memcpy(entry->name, short_name, 11);
+
+    /* Long name fragments go first, last part first */
+    uint8_t checksum = fat32_calculate_checksum(entry->name);
+    for (uint32_t i = 0; i < lfn_count; i++) {
+        fat32_lfn_entry_t part;
+        uint8_t order = (uint8_t)(lfn_count - i);
+
+        fat32_lfn_build(&part, name, length, order, i == 0, checksum);
+        result = fat32_dir_write_slot(add.clusters[i], add.offsets[i], &part);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    result = fat32_dir_write_slot(add.clusters[lfn_count], add.offsets[lfn_count], entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    /* The alias may have been looked up (and missed) before */
+    if (lfn_count > 0) {
+        char alias[13];
+        fat32_83_to_filename(entry, alias);
+        fat32_dcache_remove(dir_cluster, alias);
+    }
+    fat32_dcache_insert(dir_cluster, name, entry, add.clusters[lfn_count], add.offsets[lfn_count]);
+
+    fat32_dindex_add(dir_cluster, fat32_short_hash(entry), add.clusters[lfn_count], add.offsets[lfn_count], 0);
+    if (lfn_count > 0) {
+        fat32_dindex_add(dir_cluster, fat32_name_hash(name), add.clusters[0], add.offsets[0], lfn_count);
+    }
+
+    if (entry_cluster) {
+        *entry_cluster = add.clusters[lfn_count];
+    }
+    if (entry_offset) {
+        *entry_offset = add.offsets[lfn_count];
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Delete the entry stored under a name: its LFN fragments and short entry
+ * are marked free. The removed entry is returned so the caller can release
+ * its clusters. */
+fat32_result_t fat32_dir_remove_entry(uint32_t dir_cluster, const char* name, fat32_dir_entry_t* entry) {
+    fat32_find_context_t find;
+    fat32_dir_entry_t slot;
+    uint32_t cluster, offset;
+    fat32_result_t result;
+
+    if (name == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    /* Walk rather than ask the caches: the long name's slots are needed too */
+    memset(&find, 0, sizeof(find));
+    find.name = name;
+    find.has_short = fat32_name_to_short(name, find.short_name);
+    result = fat32_dir_walk(dir_cluster, 0, fat32_find_visit, &find, NULL);
+    if (result != FAT32_SUCCESS && result != FAT32_ERROR_NOT_FOUND) {
+        return result;
+    }
+    if (!find.found) {
+        return FAT32_ERROR_NOT_FOUND;
+    }
+
+    cluster = find.lfn_cluster;
+    offset = find.lfn_offset;
+    for (uint32_t i = 0; i < find.lfn_slots; i++) {
+        result = fat32_dir_read_entry(cluster, offset, &slot);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        slot.name[0] = (char)FAT32_ENTRY_DELETED;
+        result = fat32_dir_write_slot(cluster, offset, &slot);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        if (!fat32_dir_next_slot(&cluster, &offset)) {
+            return FAT32_ERROR_CORRUPTED_FS;
+        }
+    }
+
+    /* Drops the cached lookups of both names; index records fail
+     * verification and are forgotten when next met */
+    slot = find.entry;
+    slot.name[0] = (char)FAT32_ENTRY_DELETED;
+    result = fat32_dir_write_entry(find.cluster, find.offset, &slot);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    fat32_dcache_insert_negative(dir_cluster, name);
+
+    if (entry) {
+        *entry = find.entry;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Check whether a path names an existing file or directory */
+fat32_result_t fat32_file_exists(const char* path, bool* exists) {
+    fat32_result_t result;
+
+    if (path == NULL || exists == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_resolve_path(path, NULL, NULL, NULL, NULL);
+    if (result == FAT32_ERROR_NOT_FOUND || result == FAT32_ERROR_INVALID_PATH) {
+        *exists = false;
+        return FAT32_SUCCESS;
+    }
+    *exists = (result == FAT32_SUCCESS);
+    return result;
+}
+
+/* Return the directory entry of a path */
+fat32_result_t fat32_get_file_info(const char* path, fat32_dir_entry_t* info) {
+    if (path == NULL || info == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    return fat32_resolve_path(path, info, NULL, NULL, NULL);
+}
+
+static bool fat32_list_visit(void* context, const fat32_dir_slot_t* slot) {
+    fat32_list_context_t* list = (fat32_list_context_t*)context;
+
+    if ((uint8_t)slot->entry->name[0] == FAT32_ENTRY_END) {
+        list->end = true;
+        return false;
+    }
+
+    list->slots++;
+    if (!fat32_dir_is_named(slot->entry)) {
+        return true;
+    }
+
+    if (list->entries) {
+        list->entries[list->count] = *slot->entry;
+    }
+    if (list->long_name) {
+        if (slot->long_name) {
+            strcpy(list->long_name, slot->long_name);
+        } else {
+            fat32_83_to_filename(slot->entry, list->long_name);
+        }
+    }
+    list->count++;
+    return list->count < list->max_entries;
+}
+
+/* Read the next entries of an open directory, continuing where the last
+ * read stopped. The handle keeps the cluster and byte position of the
+ * next slot, so batches never rescan from the start. */
+static fat32_result_t fat32_dir_list(fat32_file_t* dir, fat32_list_context_t* list) {
+    uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
+    uint32_t offset;
+    fat32_result_t result;
+
+    if (dir == NULL || !dir->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+    if (!dir->is_directory) {
+        return FAT32_ERROR_NOT_DIRECTORY;
+    }
+    offset = dir->position % bytes_per_cluster;
+
+    list->count = 0;
+    list->slots = 0;
+    list->end = false;
+    if (!FAT32_VALIDATE_CLUSTER(dir->current_cluster) || list->max_entries == 0) {
+        return FAT32_SUCCESS;
+    }
+
+    result = fat32_dir_walk(dir->current_cluster, offset, fat32_list_visit, list, NULL);
+    if (result != FAT32_SUCCESS && result != FAT32_ERROR_NOT_FOUND) {
+        return result;
+    }
+
+    /* Advance the handle past the consumed slots */
+    dir->position += list->slots * FAT32_DIR_ENTRY_SIZE;
+    offset += list->slots * FAT32_DIR_ENTRY_SIZE;
+    while (offset >= bytes_per_cluster && FAT32_VALIDATE_CLUSTER(dir->current_cluster)) {
+        dir->current_cluster = fat32_get_next_cluster(dir->current_cluster);
+        offset -= bytes_per_cluster;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Open a directory for reading its entries */
+fat32_result_t fat32_open_directory(const char* path, fat32_file_t* dir) {
+    fat32_result_t result = fat32_open_file_ex(path, dir, FAT32_MODE_READ);
+
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (!dir->is_directory) {
+        fat32_close_file(dir);
+        return FAT32_ERROR_NOT_DIRECTORY;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Read the next entry of an open directory and its long (or 8.3) name */
+fat32_result_t fat32_read_directory(fat32_file_t* dir, fat32_dir_entry_t* entry, char* long_name) {
+    fat32_list_context_t list;
+    fat32_result_t result;
+
+    if (entry == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    list.entries = entry;
+    list.long_name = long_name;
+    list.max_entries = 1;
+    result = fat32_dir_list(dir, &list);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    return list.count == 1 ? FAT32_SUCCESS : FAT32_ERROR_EOF;
+}
+
+/* Read up to max_entries further entries of an open directory; a count of
+ * 0 means the end was reached */
+fat32_result_t fat32_read_directory_batch(fat32_file_t* dir, fat32_dir_entry_t* entries, uint32_t max_entries,
+                                          uint32_t* count) {
+    fat32_list_context_t list;
+    fat32_result_t result;
+
+    if (entries == NULL || count == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    list.entries = entries;
+    list.long_name = NULL;
+    list.max_entries = max_entries;
+    result = fat32_dir_list(dir, &list);
+    *count = list.count;
+    return result;
+}
+
+/* List the first entries of a directory; use fat32_open_directory and
+ * fat32_read_directory_batch to continue past max_entries */
+fat32_result_t fat32_list_directory(const char* path, fat32_dir_entry_t* entries, uint32_t max_entries, uint32_t* count) {
+    fat32_file_t dir;
+    fat32_result_t result;
+
+    if (path == NULL || entries == NULL || count == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_open_directory(path, &dir);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    result = fat32_read_directory_batch(&dir, entries, max_entries, count);
+    fat32_close_file(&dir);
+    return result;
+}
+
+/* "." or ".." short entry of a subdirectory */
+static bool fat32_dir_is_dot_entry(const fat32_dir_entry_t* entry) {
+    return entry->name[0] == '.' && (entry->name[1] == ' ' || (entry->name[1] == '.' && entry->name[2] == ' '));
+}
+
+static bool fat32_empty_visit(void* context, const fat32_dir_slot_t* slot) {
+    bool* empty = (bool*)context;
+
+    if ((uint8_t)slot->entry->name[0] == FAT32_ENTRY_END) {
+        return false;
+    }
+    if (fat32_dir_is_named(slot->entry) && !fat32_dir_is_dot_entry(slot->entry)) {
+        *empty = false;
+        return false;
+    }
+    return true;
+}
+
+/* Create an empty directory: one cleared cluster holding "." and ".." */
+fat32_result_t fat32_create_directory(const char* path) {
+    char name[FAT32_MAX_FILENAME + 1];
+    fat32_dir_entry_t entry, dot;
+    uint32_t parent_cluster, entry_cluster, entry_offset, cluster;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    result = fat32_resolve_path(path, &entry, &parent_cluster, &entry_cluster, &entry_offset);
+    if (result == FAT32_SUCCESS) {
+        return FAT32_ERROR_FILE_EXISTS;
+    }
+    if (result != FAT32_ERROR_NOT_FOUND) {
+        return result;
+    }
+    result = fat32_resolve_parent(path, &parent_cluster, name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    result = fat32_allocate_cluster_chain(1, &cluster);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    result = fat32_clear_cluster(cluster);
+
+    /* ".." of a directory in the root refers to cluster 0 */
+    memset(&dot, 0, sizeof(dot));
+    memset(dot.name, ' ', FAT32_SFN_NAME_SIZE);
+    memset(dot.ext, ' ', FAT32_SFN_EXT_SIZE);
+    dot.name[0] = '.';
+    dot.attributes = FAT32_ATTR_DIRECTORY;
+    fat32_set_first_cluster(&dot, cluster);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_dir_write_slot(cluster, 0, &dot);
+    }
+    dot.name[1] = '.';
+    fat32_set_first_cluster(&dot, parent_cluster == fat32_volume.root_dir_first_cluster ? 0 : parent_cluster);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_dir_write_slot(cluster, FAT32_DIR_ENTRY_SIZE, &dot);
+    }
+
+    if (result == FAT32_SUCCESS) {
+        memset(&entry, 0, sizeof(entry));
+        entry.attributes = FAT32_ATTR_DIRECTORY;
+        fat32_set_first_cluster(&entry, cluster);
+        result = fat32_dir_add_entry(parent_cluster, name, &entry, &entry_cluster, &entry_offset);
+    }
+    if (result != FAT32_SUCCESS) {
+        fat32_free_cluster_chain(cluster);
+        return result;
+    }
+
+    fat32_volume.write_operations++;
+    return FAT32_SUCCESS;
+}
+
+/* Remove an empty directory and free its clusters */
+fat32_result_t fat32_delete_directory(const char* path) {
+    char name[FAT32_MAX_FILENAME + 1];
+    fat32_dir_entry_t entry;
+    uint32_t parent_cluster, entry_cluster, entry_offset, first;
+    bool empty = true;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    result = fat32_resolve_path(path, &entry, &parent_cluster, &entry_cluster, &entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (entry_cluster == 0 || (entry.attributes & FAT32_ATTR_READ_ONLY)) {
+        return FAT32_ERROR_ACCESS_DENIED;  /* Root directory or protected */
+    }
+    if (!(entry.attributes & FAT32_ATTR_DIRECTORY)) {
+        return FAT32_ERROR_NOT_DIRECTORY;
+    }
+
+    first = fat32_get_first_cluster(&entry);
+    if (FAT32_VALIDATE_CLUSTER(first)) {
+        result = fat32_dir_walk(first, 0, fat32_empty_visit, &empty, NULL);
+        if (result != FAT32_SUCCESS && result != FAT32_ERROR_NOT_FOUND) {
+            return result;
+        }
+    }
+    if (!empty) {
+        return FAT32_ERROR_NOT_EMPTY;
+    }
+
+    result = fat32_resolve_parent(path, &parent_cluster, name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (fat32_name_is_dot(name)) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    result = fat32_dir_remove_entry(parent_cluster, name, &entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    fat32_dcache_invalidate_directory(first);
+    fat32_dindex_invalidate(first);
+    if (fat32_current_directory == first) {
+        fat32_current_directory = fat32_volume.root_dir_first_cluster;
+    }
+
+    fat32_volume.write_operations++;
+    if (FAT32_VALIDATE_CLUSTER(first)) {
+        return fat32_free_cluster_chain(first);
+    }
+    return FAT32_SUCCESS;
+}
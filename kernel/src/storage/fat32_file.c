@@ -0,0 +1,1319 @@
+/*
+ * FAT32 File Operations
+ * ChanUX Operating System
+ *
+ * Open, read, write, seek and close. Whole clusters that are aligned with
+ * the transfer move directly between the caller's buffer and the disk in
+ * one request per contiguous run; only partial head and tail clusters go
+ * through the block buffer cache.
+ *
+ * Allocation is delayed: data written past the file's clusters waits in a
+ * per-handle buffer, backed only by a reservation against the free count,
+ * and gets its clusters as a single run at flush or close. The buffer is
+ * keyed by file rather than by disk sector because the data has no sector
+ * yet. A file deleted while its data is still waiting never reaches the FAT.
+ *
+ * Preallocated clusters are not zeroed. Each handle tracks how much of the
+ * file has been written (valid_size); reads past it return zeros, and the
+ * gap is only zeroed on disk when the size is recorded at flush or close.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_DELALLOC_PAGES    (FAT32_DELALLOC_BUFFER_SIZE / MEMORY_PAGE_SIZE)
+
+/* Handles holding delayed data, so that a delete can drop it */
+static fat32_file_t* fat32_delalloc_files[FAT32_DELALLOC_MAX_FILES];
+
+/* Open handles, files and directories alike, so that a rename can point
+ * every handle of the file at its new directory entry */
+static fat32_file_t* fat32_open_files[FAT32_MAX_OPEN_FILES];
+static uint32_t fat32_open_handles = 0;
+
+static void fat32_open_register(fat32_file_t* file) {
+    for (uint32_t i = 0; i < FAT32_MAX_OPEN_FILES; i++) {
+        if (fat32_open_files[i] == NULL) {
+            fat32_open_files[i] = file;
+            fat32_open_handles++;
+            return;
+        }
+    }
+}
+
+static void fat32_open_unregister(fat32_file_t* file) {
+    for (uint32_t i = 0; i < FAT32_MAX_OPEN_FILES; i++) {
+        if (fat32_open_files[i] == file) {
+            fat32_open_files[i] = NULL;
+            fat32_open_handles--;
+            return;
+        }
+    }
+}
+
+static uint32_t fat32_bytes_per_cluster(void) {
+    return fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
+}
+
+/* Copy part of one cluster through the cache. A NULL data pointer on
+ * write stores zeros. */
+static fat32_result_t fat32_file_partial_io(uint32_t cluster, uint32_t offset, uint8_t* data,
+                                            uint32_t length, bool write) {
+    uint32_t lba = fat32_cluster_to_lba(cluster) + offset / FAT32_SECTOR_SIZE;
+    uint32_t sector_offset = offset % FAT32_SECTOR_SIZE;
+
+    if (write) {
+        fat32_journal_data_write(lba, (sector_offset + length + FAT32_SECTOR_SIZE - 1) / FAT32_SECTOR_SIZE);
+    }
+
+    while (length > 0) {
+        uint32_t chunk = FAT32_SECTOR_SIZE - sector_offset;
+        bcache_buffer_t* buffer;
+
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        /* A sector that is overwritten completely need not be read first */
+        buffer = (write && chunk == FAT32_SECTOR_SIZE) ?
+                 bcache_get_new(fat32_volume.device, lba) :
+                 bcache_get(fat32_volume.device, lba);
+        if (!buffer) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+
+        if (write) {
+            if (data) {
+                memcpy(&buffer->data[sector_offset], data, chunk);
+            } else {
+                memset(&buffer->data[sector_offset], 0, chunk);
+            }
+            block_result_t result = bcache_mark_dirty(buffer);
+            bcache_release(buffer);
+            if (result != BLOCK_SUCCESS) {
+                return FAT32_ERROR_WRITE_FAILED;
+            }
+        } else {
+            memcpy(data, &buffer->data[sector_offset], chunk);
+            bcache_release(buffer);
+        }
+
+        if (data) {
+            data += chunk;
+        }
+        length -= chunk;
+        sector_offset = 0;
+        lba++;
+    }
+
+    return FAT32_SUCCESS;
+}
+
+/* Move length bytes between the file at position and data */
+static fat32_result_t fat32_file_transfer(fat32_file_t* file, uint32_t position, uint8_t* data,
+                                          uint32_t length, bool write) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+
+    while (length > 0) {
+        uint32_t offset = position % bytes_per_cluster;
+        uint32_t cluster, contiguous, bytes;
+        fat32_result_t result;
+
+        result = fat32_file_map_cluster(file, position / bytes_per_cluster, &cluster, &contiguous);
+        if (result != FAT32_SUCCESS) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+        file->current_cluster = cluster;
+
+        if (offset == 0 && length >= bytes_per_cluster && data) {
+            /* Whole clusters: one request for the contiguous run, no copy */
+            uint32_t clusters = length / bytes_per_cluster;
+            if (clusters > contiguous) {
+                clusters = contiguous;
+            }
+            bytes = clusters * bytes_per_cluster;
+
+            uint32_t lba = fat32_cluster_to_lba(cluster);
+            uint32_t sectors = clusters * fat32_volume.sectors_per_cluster;
+            block_result_t status;
+            if (write) {
+                fat32_journal_data_write(lba, sectors);
+                status = bcache_write_direct(fat32_volume.device, lba, sectors, data);
+            } else {
+                status = bcache_read_direct(fat32_volume.device, lba, sectors, data);
+            }
+            if (status != BLOCK_SUCCESS) {
+                return write ? FAT32_ERROR_WRITE_FAILED : FAT32_ERROR_READ_FAILED;
+            }
+        } else {
+            bytes = bytes_per_cluster - offset;
+            if (bytes > length) {
+                bytes = length;
+            }
+            result = fat32_file_partial_io(cluster, offset, data, bytes, write);
+            if (result != FAT32_SUCCESS) {
+                return result;
+            }
+        }
+
+        if (data) {
+            data += bytes;
+        }
+        position += bytes;
+        length -= bytes;
+    }
+
+    return FAT32_SUCCESS;
+}
+
+/* Track sequential access after a read of count bytes at start and keep
+ * a window of clusters ahead of it prefetched. The window doubles while
+ * reads stay sequential and collapses on a random read. */
+static void fat32_file_readahead(fat32_file_t* file, uint32_t start, uint32_t count) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    uint32_t file_clusters = (file->size + bytes_per_cluster - 1) / bytes_per_cluster;
+    uint32_t next, last, cluster, contiguous;
+
+    if (start == file->readahead_position) {
+        if (file->readahead_window == 0) {
+            file->readahead_window = FAT32_READAHEAD_MIN;
+        } else if (file->readahead_window < FAT32_READAHEAD_MAX) {
+            file->readahead_window *= 2;
+        }
+    } else {
+        file->readahead_window = 0;
+        file->readahead_issued = 0;
+    }
+    file->readahead_position = start + count;
+
+    if (file->readahead_window == 0) {
+        return;
+    }
+
+    /* Clusters after the one the read ended in, up to the window or EOF */
+    next = (start + count + bytes_per_cluster - 1) / bytes_per_cluster;
+    if (next < file->readahead_issued) {
+        next = file->readahead_issued;
+    }
+    last = (start + count) / bytes_per_cluster + file->readahead_window;
+    if (last > file_clusters) {
+        last = file_clusters;
+    }
+    if (next >= last) {
+        return;
+    }
+
+    /* One contiguous run per request; the rest goes out on the next read */
+    if (fat32_file_map_cluster(file, next, &cluster, &contiguous) != FAT32_SUCCESS) {
+        return;
+    }
+    if (contiguous > last - next) {
+        contiguous = last - next;
+    }
+    if (bcache_prefetch(fat32_volume.device, fat32_cluster_to_lba(cluster),
+                        contiguous * fat32_volume.sectors_per_cluster) == BLOCK_SUCCESS) {
+        file->readahead_issued = next + contiguous;
+    }
+}
+
+/* Make sure clusters back the file up to end bytes */
+static fat32_result_t fat32_file_reserve(fat32_file_t* file, uint32_t end) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    uint32_t needed = (end + bytes_per_cluster - 1) / bytes_per_cluster;
+    uint32_t have = file->allocated_size / bytes_per_cluster;
+    fat32_result_t result;
+
+    if (needed <= have) {
+        return FAT32_SUCCESS;
+    }
+
+    if (file->first_cluster == 0) {
+        result = fat32_allocate_cluster_chain(needed, &file->first_cluster);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        fat32_file_release_extents(file);
+    } else {
+        uint32_t last;
+        result = fat32_file_map_cluster(file, have - 1, &last, NULL);
+        if (result != FAT32_SUCCESS) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+        result = fat32_extend_cluster_chain(last, needed - have);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    file->allocated_size = needed * bytes_per_cluster;
+    file->is_modified = true;
+    return FAT32_SUCCESS;
+}
+
+/* Give a handle a zeroed buffer for delayed data; false if none is free */
+static bool fat32_delalloc_attach(fat32_file_t* file) {
+    for (uint32_t i = 0; i < FAT32_DELALLOC_MAX_FILES; i++) {
+        if (fat32_delalloc_files[i] == NULL) {
+            uint8_t* buffer = (uint8_t*)memory_alloc_pages(FAT32_DELALLOC_PAGES);
+            if (!buffer) {
+                return false;
+            }
+            memset(buffer, 0, FAT32_DELALLOC_BUFFER_SIZE);
+            file->delalloc_buffer = buffer;
+            file->delalloc_clusters = 0;
+            fat32_delalloc_files[i] = file;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Free a handle's delayed data buffer and return its reservation */
+static void fat32_delalloc_detach(fat32_file_t* file) {
+    if (!file->delalloc_buffer) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < FAT32_DELALLOC_MAX_FILES; i++) {
+        if (fat32_delalloc_files[i] == file) {
+            fat32_delalloc_files[i] = NULL;
+        }
+    }
+    fat32_release_reserved_clusters(file->delalloc_clusters);
+    memory_free_pages(file->delalloc_buffer, FAT32_DELALLOC_PAGES);
+    file->delalloc_buffer = NULL;
+    file->delalloc_clusters = 0;
+}
+
+/* Check whether the bytes up to end that lie past the allocated clusters
+ * can wait in the delayed buffer, and reserve the clusters they will need */
+static bool fat32_file_delay(fat32_file_t* file, uint32_t end) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    uint32_t needed;
+
+    if (end <= file->allocated_size) {
+        return true;
+    }
+    if (end - file->allocated_size > FAT32_DELALLOC_BUFFER_SIZE) {
+        return false;
+    }
+    if (!file->delalloc_buffer && !fat32_delalloc_attach(file)) {
+        return false;
+    }
+
+    needed = (end - file->allocated_size + bytes_per_cluster - 1) / bytes_per_cluster;
+    if (needed > file->delalloc_clusters) {
+        if (fat32_reserve_clusters(needed - file->delalloc_clusters) != FAT32_SUCCESS) {
+            return false;
+        }
+        file->delalloc_clusters = needed;
+    }
+    return true;
+}
+
+/* Write length bytes at position: the part inside the allocated clusters
+ * goes to disk, the rest into the delayed buffer. NULL data stores zeros. */
+static fat32_result_t fat32_file_store(fat32_file_t* file, uint32_t position, const uint8_t* data,
+                                       uint32_t length) {
+    if (position < file->allocated_size) {
+        uint32_t chunk = file->allocated_size - position;
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        fat32_result_t result = fat32_file_transfer(file, position, (uint8_t*)data, chunk, true);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        if (data) {
+            data += chunk;
+        }
+        position += chunk;
+        length -= chunk;
+    }
+
+    if (length > 0) {
+        uint8_t* target = file->delalloc_buffer + (position - file->allocated_size);
+        if (data) {
+            memcpy(target, data, length);
+        } else {
+            memset(target, 0, length);
+        }
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Read length bytes at position from disk and the delayed buffer; bytes
+ * past the valid data read as zeros */
+static fat32_result_t fat32_file_load(fat32_file_t* file, uint32_t position, uint8_t* data, uint32_t length) {
+    if (position + length > file->valid_size) {
+        uint32_t unwritten = position >= file->valid_size ? length : position + length - file->valid_size;
+        memset(data + length - unwritten, 0, unwritten);
+        length -= unwritten;
+    }
+
+    if (position < file->allocated_size && length > 0) {
+        uint32_t chunk = file->allocated_size - position;
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        fat32_result_t result = fat32_file_transfer(file, position, data, chunk, false);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        data += chunk;
+        position += chunk;
+        length -= chunk;
+    }
+
+    if (length > 0) {
+        memcpy(data, file->delalloc_buffer + (position - file->allocated_size), length);
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Give the delayed data its clusters, as one run where free space allows,
+ * and write it out */
+static fat32_result_t fat32_file_commit(fat32_file_t* file) {
+    uint32_t start = file->allocated_size;
+    uint32_t count = file->delalloc_clusters;
+    fat32_result_t result = FAT32_SUCCESS;
+
+    if (!file->delalloc_buffer) {
+        return FAT32_SUCCESS;
+    }
+
+    if (file->size > start) {
+        /* The reservation becomes the allocation */
+        fat32_release_reserved_clusters(count);
+        file->delalloc_clusters = 0;
+        result = fat32_file_reserve(file, start + count * fat32_bytes_per_cluster());
+        if (result != FAT32_SUCCESS) {
+            if (fat32_reserve_clusters(count) == FAT32_SUCCESS) {
+                file->delalloc_clusters = count;
+            }
+            return result;
+        }
+        result = fat32_file_transfer(file, start, file->delalloc_buffer, file->size - start, true);
+    }
+
+    fat32_delalloc_detach(file);
+    return result;
+}
+
+/* Zero the part of the file that was allocated but never written, so the
+ * size recorded on disk only covers written data or zeros */
+static fat32_result_t fat32_file_zero_unwritten(fat32_file_t* file) {
+    if (file->valid_size >= file->size) {
+        return FAT32_SUCCESS;
+    }
+
+    fat32_result_t result = fat32_file_store(file, file->valid_size, NULL, file->size - file->valid_size);
+    if (result == FAT32_SUCCESS) {
+        file->valid_size = file->size;
+    }
+    return result;
+}
+
+/* Keep the first keep clusters of the file and free the rest */
+static fat32_result_t fat32_file_release_tail(fat32_file_t* file, uint32_t keep) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    uint32_t last, next;
+    fat32_result_t result;
+
+    if (keep >= file->allocated_size / bytes_per_cluster || file->first_cluster == 0) {
+        return FAT32_SUCCESS;
+    }
+
+    if (keep == 0) {
+        result = fat32_free_cluster_chain(file->first_cluster);
+        file->first_cluster = 0;
+        file->current_cluster = 0;
+    } else {
+        result = fat32_file_map_cluster(file, keep - 1, &last, NULL);
+        if (result != FAT32_SUCCESS) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+        next = fat32_get_next_cluster(last);
+        result = fat32_set_next_cluster(last, FAT32_EOC);
+        if (result == FAT32_SUCCESS && !FAT32_IS_EOC(next) && FAT32_VALIDATE_CLUSTER(next)) {
+            result = fat32_free_cluster_chain(next);
+        }
+    }
+
+    fat32_file_release_extents(file);
+    file->allocated_size = keep * bytes_per_cluster;
+    file->is_modified = true;
+    return result;
+}
+
+/* Check that a handle may change the file's contents */
+static fat32_result_t fat32_file_check_writable(fat32_file_t* file) {
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    if (file->is_directory) {
+        return FAT32_ERROR_IS_DIRECTORY;
+    }
+
+    if (!(file->access_mode & (FAT32_MODE_WRITE | FAT32_MODE_APPEND))) {
+        return FAT32_ERROR_ACCESS_DENIED;
+    }
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    return FAT32_SUCCESS;
+}
+
+/* Write size, first cluster and the archive bit back to the directory entry */
+static fat32_result_t fat32_file_update_entry(fat32_file_t* file) {
+    fat32_dir_entry_t entry;
+    fat32_result_t result;
+
+    if (file->dir_entry_cluster == 0) {
+        return FAT32_SUCCESS;  /* Root directory: no entry */
+    }
+
+    result = fat32_dir_read_entry(file->dir_entry_cluster, file->dir_entry_offset, &entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    entry.file_size = file->is_directory ? 0 : file->size;
+    fat32_set_first_cluster(&entry, file->first_cluster);
+    if (!file->is_directory) {
+        entry.attributes |= FAT32_ATTR_ARCHIVE;
+    }
+
+    result = fat32_dir_write_entry(file->dir_entry_cluster, file->dir_entry_offset, &entry);
+    if (result == FAT32_SUCCESS) {
+        file->is_modified = false;
+    }
+    return result;
+}
+
+/* Fill a handle from a directory entry */
+static void fat32_file_setup(fat32_file_t* file, const fat32_dir_entry_t* entry, const char* path,
+                             uint32_t entry_cluster, uint32_t entry_offset, uint8_t mode) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    const char* name = path;
+
+    memset(file, 0, sizeof(fat32_file_t));
+    file->is_open = true;
+    file->is_directory = (entry->attributes & FAT32_ATTR_DIRECTORY) != 0;
+    file->access_mode = mode;
+    file->first_cluster = fat32_get_first_cluster(entry);
+    file->current_cluster = file->first_cluster;
+    file->size = file->is_directory ? 0 : entry->file_size;
+    file->valid_size = file->size;
+    file->dir_entry_cluster = entry_cluster;
+    file->dir_entry_offset = entry_offset;
+
+    /* A chain is at least as long as the data; a non-empty chain holds at least one cluster */
+    file->allocated_size = ((file->size + bytes_per_cluster - 1) / bytes_per_cluster) * bytes_per_cluster;
+    if (file->first_cluster != 0 && file->allocated_size == 0) {
+        file->allocated_size = bytes_per_cluster;
+    }
+
+    /* Keep the last path component as the name */
+    for (const char* p = path; *p; p++) {
+        if ((*p == '/' || *p == '\\') && p[1] != '\0') {
+            name = p + 1;
+        }
+    }
+    strncpy(file->name, name, FAT32_MAX_FILENAME);
+    file->name[FAT32_MAX_FILENAME] = '\0';
+    memcpy(file->short_name, entry->name, 11);
+    file->short_name[11] = '\0';
+
+    file->creation_date = entry->creation_date;
+    file->creation_time = entry->creation_time;
+    file->last_access_date = entry->last_access_date;
+    file->last_write_date = entry->write_date;
+    file->last_write_time = entry->write_time;
+}
+
+/* Open an existing file for reading and writing */
+fat32_result_t fat32_open_file(const char* path, fat32_file_t* file) {
+    return fat32_open_file_ex(path, file, FAT32_MODE_READ | FAT32_MODE_WRITE);
+}
+
+/* Open a file with explicit access mode flags */
+fat32_result_t fat32_open_file_ex(const char* path, fat32_file_t* file, fat32_file_mode_t mode) {
+    fat32_dir_entry_t entry;
+    uint32_t parent_cluster, entry_cluster, entry_offset;
+    fat32_result_t result;
+    bool writable = (mode & (FAT32_MODE_WRITE | FAT32_MODE_APPEND)) != 0;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (path == NULL || file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (fat32_open_handles >= FAT32_MAX_OPEN_FILES) {
+        return FAT32_ERROR_TOO_MANY_OPEN;
+    }
+
+    result = fat32_resolve_path(path, &entry, &parent_cluster, &entry_cluster, &entry_offset);
+
+    if (result == FAT32_ERROR_NOT_FOUND && (mode & FAT32_MODE_CREATE)) {
+        char name[FAT32_MAX_FILENAME + 1];
+
+        if (fat32_volume.read_only) {
+            return FAT32_ERROR_READ_ONLY;
+        }
+        result = fat32_resolve_parent(path, &parent_cluster, name);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        entry.attributes = FAT32_ATTR_ARCHIVE;
+        result = fat32_dir_add_entry(parent_cluster, name, &entry, &entry_cluster, &entry_offset);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    } else if (result != FAT32_SUCCESS) {
+        return result;
+    } else if ((mode & FAT32_MODE_CREATE) && (mode & FAT32_MODE_EXCLUSIVE)) {
+        return FAT32_ERROR_FILE_EXISTS;
+    }
+
+    if (writable && (entry.attributes & FAT32_ATTR_DIRECTORY)) {
+        return FAT32_ERROR_IS_DIRECTORY;
+    }
+    if (writable && ((entry.attributes & FAT32_ATTR_READ_ONLY) || fat32_volume.read_only)) {
+        return FAT32_ERROR_ACCESS_DENIED;
+    }
+
+    fat32_file_setup(file, &entry, path, entry_cluster, entry_offset, (uint8_t)mode);
+
+    /* Truncate: release the chain and record the empty file right away */
+    if ((mode & FAT32_MODE_TRUNCATE) && writable && file->first_cluster != 0) {
+        result = fat32_free_cluster_chain(file->first_cluster);
+        if (result != FAT32_SUCCESS) {
+            file->is_open = false;
+            return result;
+        }
+        file->first_cluster = 0;
+        file->current_cluster = 0;
+        file->size = 0;
+        file->valid_size = 0;
+        file->allocated_size = 0;
+        result = fat32_file_update_entry(file);
+        if (result != FAT32_SUCCESS) {
+            file->is_open = false;
+            return result;
+        }
+    }
+
+    if (mode & FAT32_MODE_APPEND) {
+        file->position = file->size;
+    }
+
+    fat32_open_register(file);
+    return FAT32_SUCCESS;
+}
+
+/* Create a new, empty file and open it */
+fat32_result_t fat32_create_file(const char* path, fat32_file_t* file) {
+    return fat32_open_file_ex(path, file, FAT32_MODE_READ | FAT32_MODE_WRITE |
+                                          FAT32_MODE_CREATE | FAT32_MODE_EXCLUSIVE);
+}
+
+/* Read up to size bytes from the current position */
+fat32_result_t fat32_read_file(fat32_file_t* file, void* buffer, uint32_t size, uint32_t* bytes_read) {
+    uint32_t count;
+    fat32_result_t result;
+
+    if (bytes_read) {
+        *bytes_read = 0;
+    }
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (file == NULL || buffer == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    if (file->is_directory) {
+        return FAT32_ERROR_IS_DIRECTORY;
+    }
+
+    if (!(file->access_mode & FAT32_MODE_READ)) {
+        return FAT32_ERROR_ACCESS_DENIED;
+    }
+
+    if (file->position >= file->size) {
+        return FAT32_SUCCESS;  /* End of file */
+    }
+
+    count = file->size - file->position;
+    if (count > size) {
+        count = size;
+    }
+
+    result = fat32_file_load(file, file->position, (uint8_t*)buffer, count);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    fat32_file_readahead(file, file->position, count);
+    file->position += count;
+    fat32_volume.read_operations++;
+    if (bytes_read) {
+        *bytes_read = count;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Write size bytes at the current position (at the end in append mode) */
+fat32_result_t fat32_write_file(fat32_file_t* file, const void* buffer, uint32_t size, uint32_t* bytes_written) {
+    uint32_t end;
+    fat32_result_t result;
+
+    if (bytes_written) {
+        *bytes_written = 0;
+    }
+
+    if (buffer == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_file_check_writable(file);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (file->access_mode & FAT32_MODE_APPEND) {
+        file->position = file->size;
+    }
+
+    if (size == 0) {
+        return FAT32_SUCCESS;
+    }
+
+    end = file->position + size;
+    if (end < file->position) {
+        return FAT32_ERROR_INVALID_PARAMETER;  /* Past 4GB */
+    }
+
+    /* Small writes past the allocated clusters wait for flush or close;
+     * anything larger puts the waiting data on disk and allocates now */
+    if (!fat32_file_delay(file, end)) {
+        result = fat32_file_commit(file);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        result = fat32_file_reserve(file, end);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    /* Writing past the written data: the gap reads back as zeros */
+    if (file->position > file->valid_size) {
+        result = fat32_file_store(file, file->valid_size, NULL, file->position - file->valid_size);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    result = fat32_file_store(file, file->position, (const uint8_t*)buffer, size);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    file->position = end;
+    if (end > file->size) {
+        file->size = end;
+    }
+    if (end > file->valid_size) {
+        file->valid_size = end;
+    }
+    file->is_modified = true;
+    fat32_volume.write_operations++;
+    if (bytes_written) {
+        *bytes_written = size;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Move the file position; positions past the end are allowed for writing */
+fat32_result_t fat32_seek_file(fat32_file_t* file, uint32_t position) {
+    if (file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    file->position = position;
+    return FAT32_SUCCESS;
+}
+
+/* Seek relative to the start, the current position or the end */
+fat32_result_t fat32_seek_file_ex(fat32_file_t* file, int32_t offset, fat32_seek_origin_t origin) {
+    int64_t base;
+    int64_t target;
+
+    if (file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    switch (origin) {
+        case FAT32_SEEK_SET: base = 0; break;
+        case FAT32_SEEK_CUR: base = file->position; break;
+        case FAT32_SEEK_END: base = file->size; break;
+        default: return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    target = base + offset;
+    if (target < 0 || target > 0xFFFFFFFF) {
+        return FAT32_ERROR_SEEK_FAILED;
+    }
+
+    return fat32_seek_file(file, (uint32_t)target);
+}
+
+fat32_result_t fat32_tell_file(fat32_file_t* file, uint32_t* position) {
+    if (file == NULL || position == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    *position = file->position;
+    return FAT32_SUCCESS;
+}
+
+/* Allocate clusters for size bytes up front, as one run where free space
+ * allows and without zeroing them; with set_size the file grows to size
+ * as well. Later writes inside the allocation do no allocation work. */
+fat32_result_t fat32_preallocate_file(fat32_file_t* file, uint32_t size, bool set_size) {
+    fat32_result_t result = fat32_file_check_writable(file);
+
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    result = fat32_file_commit(file);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    result = fat32_file_reserve(file, size);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (set_size && size > file->size) {
+        file->size = size;
+        file->is_modified = true;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Set the file size. Shrinking frees the clusters past the new end;
+ * growing allocates clusters, and the new bytes read as zeros. */
+fat32_result_t fat32_truncate_file(fat32_file_t* file, uint32_t size) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    fat32_result_t result = fat32_file_check_writable(file);
+
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    result = fat32_file_commit(file);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (size < file->size) {
+        result = fat32_file_release_tail(file, (size + bytes_per_cluster - 1) / bytes_per_cluster);
+    } else {
+        result = fat32_file_reserve(file, size);
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    file->size = size;
+    if (file->valid_size > size) {
+        file->valid_size = size;
+    }
+    file->is_modified = true;
+    return FAT32_SUCCESS;
+}
+
+/* Allocate delayed data, update the directory entry and write the
+ * volume's dirty data to disk */
+fat32_result_t fat32_flush_file(fat32_file_t* file) {
+    fat32_result_t result;
+
+    if (file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    result = fat32_file_commit(file);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_file_zero_unwritten(file);
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (file->is_modified) {
+        result = fat32_file_update_entry(file);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    return fat32_flush_all_caches();
+}
+
+/* Close a file, allocating its delayed data and recording its new size
+ * in the directory entry */
+fat32_result_t fat32_close_file(fat32_file_t* file) {
+    fat32_result_t result, update = FAT32_SUCCESS;
+
+    if (file == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!file->is_open) {
+        return FAT32_ERROR_NOT_OPEN;
+    }
+
+    /* Data that could not be placed is lost; the entry keeps what was */
+    result = fat32_file_commit(file);
+    if (result != FAT32_SUCCESS) {
+        fat32_delalloc_detach(file);
+        if (file->size > file->allocated_size) {
+            file->size = file->allocated_size;
+        }
+    }
+
+    /* FAT has no place to record preallocation: unwritten bytes inside
+     * the size become zeros and clusters past it are freed */
+    if (!file->is_directory && (file->access_mode & (FAT32_MODE_WRITE | FAT32_MODE_APPEND))) {
+        uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+        uint32_t keep = (file->size + bytes_per_cluster - 1) / bytes_per_cluster;
+        fat32_result_t settle = fat32_file_zero_unwritten(file);
+
+        if (settle == FAT32_SUCCESS) {
+            settle = fat32_file_release_tail(file, keep);
+        }
+        if (result == FAT32_SUCCESS) {
+            result = settle;
+        }
+    }
+
+    if (file->is_modified) {
+        update = fat32_file_update_entry(file);
+    }
+
+    fat32_file_release_extents(file);
+    file->is_open = false;
+    fat32_open_unregister(file);
+    return result != FAT32_SUCCESS ? result : update;
+}
+
+uint32_t fat32_open_file_count(void) {
+    return fat32_open_handles;
+}
+
+/* Delete a file and free its clusters. Every handle still open on it is
+ * closed, so none can later read or write clusters that were freed; those
+ * holding delayed data lose it, so a temporary file deleted before it was
+ * flushed never touches the FAT. */
+fat32_result_t fat32_delete_file(const char* path) {
+    char name[FAT32_MAX_FILENAME + 1];
+    fat32_dir_entry_t entry;
+    uint32_t parent_cluster, entry_cluster, entry_offset;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    result = fat32_resolve_path(path, &entry, &parent_cluster, &entry_cluster, &entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (entry.attributes & FAT32_ATTR_DIRECTORY) {
+        return FAT32_ERROR_IS_DIRECTORY;
+    }
+    if ((entry.attributes & FAT32_ATTR_READ_ONLY) || fat32_journal_protects(fat32_get_first_cluster(&entry))) {
+        return FAT32_ERROR_ACCESS_DENIED;
+    }
+
+    for (uint32_t i = 0; i < FAT32_MAX_OPEN_FILES; i++) {
+        fat32_file_t* open = fat32_open_files[i];
+
+        if (open && open->dir_entry_cluster == entry_cluster && open->dir_entry_offset == entry_offset) {
+            fat32_delalloc_detach(open);
+            fat32_file_release_extents(open);
+            open->is_open = false;
+            fat32_open_unregister(open);
+        }
+    }
+
+    result = fat32_resolve_parent(path, &parent_cluster, name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    result = fat32_dir_remove_entry(parent_cluster, name, &entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    if (fat32_get_first_cluster(&entry) != 0) {
+        return fat32_free_cluster_chain(fat32_get_first_cluster(&entry));
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Check that moving a directory into new_parent does not put it inside
+ * itself, by following ".." entries from new_parent up to the root */
+static fat32_result_t fat32_file_check_ancestry(uint32_t dir_cluster, uint32_t new_parent) {
+    uint32_t cluster = new_parent;
+
+    for (uint32_t steps = 0; steps <= fat32_volume.total_clusters; steps++) {
+        fat32_dir_entry_t dotdot;
+
+        if (cluster == dir_cluster) {
+            return FAT32_ERROR_INVALID_PATH;
+        }
+        if (cluster == fat32_volume.root_dir_first_cluster) {
+            return FAT32_SUCCESS;
+        }
+
+        /* ".." is the second slot of every subdirectory */
+        fat32_result_t result = fat32_dir_read_entry(cluster, FAT32_DIR_ENTRY_SIZE, &dotdot);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+        cluster = fat32_get_first_cluster(&dotdot);
+        if (cluster == 0) {
+            cluster = fat32_volume.root_dir_first_cluster;
+        }
+    }
+    return FAT32_ERROR_CORRUPTED_FS;
+}
+
+/* Give the file or directory at old_path the name new_name in new_parent.
+ * Only directory entries are written, never file data. The new entry is
+ * written before the old one is removed, so a crash cannot lose the file. */
+static fat32_result_t fat32_file_relink(const char* old_path, uint32_t new_parent, const char* new_name) {
+    char old_name[FAT32_MAX_FILENAME + 1];
+    fat32_dir_entry_t entry, dotdot;
+    uint32_t old_parent, entry_cluster, entry_offset;
+    uint32_t new_cluster, new_offset, target_cluster, target_offset;
+    bool is_directory, same_entry = false;
+    fat32_result_t result;
+
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    result = fat32_resolve_path(old_path, &entry, &old_parent, &entry_cluster, &entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (entry_cluster == 0) {
+        return FAT32_ERROR_ACCESS_DENIED;  /* Root directory */
+    }
+    if (fat32_journal_protects(fat32_get_first_cluster(&entry))) {
+        return FAT32_ERROR_ACCESS_DENIED;  /* Mount finds the journal by name */
+    }
+    result = fat32_resolve_parent(old_path, &old_parent, old_name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    /* The target may only exist as the same entry (a change of case) */
+    result = fat32_dir_find_entry(new_parent, new_name, NULL, &target_cluster, &target_offset);
+    if (result == FAT32_SUCCESS) {
+        if (target_cluster != entry_cluster || target_offset != entry_offset) {
+            return FAT32_ERROR_FILE_EXISTS;
+        }
+        if (strcmp(old_name, new_name) == 0) {
+            return FAT32_SUCCESS;
+        }
+        same_entry = true;
+    } else if (result != FAT32_ERROR_NOT_FOUND) {
+        return result;
+    }
+
+    is_directory = (entry.attributes & FAT32_ATTR_DIRECTORY) != 0;
+    if (is_directory && new_parent != old_parent) {
+        result = fat32_file_check_ancestry(fat32_get_first_cluster(&entry), new_parent);
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    if (same_entry) {
+        /* Both names find the old entry, so it has to go first */
+        result = fat32_dir_remove_entry(old_parent, old_name, NULL);
+        if (result == FAT32_SUCCESS) {
+            result = fat32_dir_add_entry(new_parent, new_name, &entry, &new_cluster, &new_offset);
+        }
+    } else {
+        result = fat32_dir_add_entry(new_parent, new_name, &entry, &new_cluster, &new_offset);
+        if (result == FAT32_SUCCESS) {
+            result = fat32_dir_remove_entry(old_parent, old_name, NULL);
+        }
+    }
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    /* A moved directory's ".." points at its new parent (0 for the root) */
+    if (is_directory && new_parent != old_parent) {
+        uint32_t dir_cluster = fat32_get_first_cluster(&entry);
+
+        result = fat32_dir_read_entry(dir_cluster, FAT32_DIR_ENTRY_SIZE, &dotdot);
+        if (result == FAT32_SUCCESS && memcmp(dotdot.name, "..      ", 8) == 0) {
+            fat32_set_first_cluster(&dotdot, new_parent == fat32_volume.root_dir_first_cluster ? 0 : new_parent);
+            result = fat32_dir_write_entry(dir_cluster, FAT32_DIR_ENTRY_SIZE, &dotdot);
+        }
+        if (result != FAT32_SUCCESS) {
+            return result;
+        }
+    }
+
+    /* Open handles record their size and times in the new entry */
+    for (uint32_t i = 0; i < FAT32_MAX_OPEN_FILES; i++) {
+        fat32_file_t* open = fat32_open_files[i];
+
+        if (open && open->dir_entry_cluster == entry_cluster && open->dir_entry_offset == entry_offset) {
+            open->dir_entry_cluster = new_cluster;
+            open->dir_entry_offset = new_offset;
+        }
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Rename a file or directory; new_path may be in another directory */
+fat32_result_t fat32_rename_file(const char* old_path, const char* new_path) {
+    char new_name[FAT32_MAX_FILENAME + 1];
+    uint32_t new_parent;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (old_path == NULL || new_path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_resolve_parent(new_path, &new_parent, new_name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (new_name[0] == '\0') {
+        return FAT32_ERROR_INVALID_FILENAME;
+    }
+
+    return fat32_file_relink(old_path, new_parent, new_name);
+}
+
+/* Move a file or directory. If new_path is an existing directory the
+ * source keeps its name inside it; otherwise this is a rename. */
+fat32_result_t fat32_move_file(const char* old_path, const char* new_path) {
+    char name[FAT32_MAX_FILENAME + 1];
+    fat32_dir_entry_t target;
+    uint32_t old_parent, target_cluster;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (old_path == NULL || new_path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_resolve_path(new_path, &target, NULL, NULL, NULL);
+    if (result != FAT32_SUCCESS || !(target.attributes & FAT32_ATTR_DIRECTORY)) {
+        return fat32_rename_file(old_path, new_path);
+    }
+
+    result = fat32_resolve_parent(old_path, &old_parent, name);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    target_cluster = fat32_get_first_cluster(&target);
+    if (target_cluster == 0) {
+        target_cluster = fat32_volume.root_dir_first_cluster;
+    }
+    return fat32_file_relink(old_path, target_cluster, name);
+}
+
+/* Copy clusters from src to dst, both allocated for the whole file. Runs
+ * move disk to disk through one buffer; the next source run is read ahead
+ * into the cache while the current one is written. */
+static fat32_result_t fat32_file_copy_clusters(fat32_file_t* src, fat32_file_t* dst, uint8_t* buffer) {
+    uint32_t bytes_per_cluster = fat32_bytes_per_cluster();
+    uint32_t total = (src->size + bytes_per_cluster - 1) / bytes_per_cluster;
+    uint32_t chunk = FAT32_COPY_BUFFER_SIZE / bytes_per_cluster;
+    uint32_t index = 0;
+
+    while (index < total) {
+        uint32_t in_cluster, in_run, out_cluster, out_run, count, sectors;
+
+        if (fat32_file_map_cluster(src, index, &in_cluster, &in_run) != FAT32_SUCCESS ||
+            fat32_file_map_cluster(dst, index, &out_cluster, &out_run) != FAT32_SUCCESS) {
+            return FAT32_ERROR_CLUSTER_CHAIN_BROKEN;
+        }
+
+        count = total - index;
+        if (count > chunk) {
+            count = chunk;
+        }
+        if (count > in_run) {
+            count = in_run;
+        }
+        if (count > out_run) {
+            count = out_run;
+        }
+        sectors = count * fat32_volume.sectors_per_cluster;
+
+        if (bcache_read_direct(fat32_volume.device, fat32_cluster_to_lba(in_cluster), sectors, buffer) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+
+        index += count;
+        if (index < total && fat32_file_map_cluster(src, index, &in_cluster, &in_run) == FAT32_SUCCESS) {
+            if (in_run > chunk) {
+                in_run = chunk;
+            }
+            bcache_prefetch(fat32_volume.device, fat32_cluster_to_lba(in_cluster),
+                            in_run * fat32_volume.sectors_per_cluster);
+        }
+
+        fat32_journal_data_write(fat32_cluster_to_lba(out_cluster), sectors);
+        if (bcache_write_direct(fat32_volume.device, fat32_cluster_to_lba(out_cluster), sectors, buffer) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_WRITE_FAILED;
+        }
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Copy a file to a new path. The destination is preallocated contiguously
+ * and filled cluster by cluster, without going through the file layer. */
+fat32_result_t fat32_copy_file(const char* src_path, const char* dst_path) {
+    fat32_file_t src, dst;
+    fat32_dir_entry_t source, entry;
+    uint32_t pages = FAT32_COPY_BUFFER_SIZE / MEMORY_PAGE_SIZE;
+    uint8_t* buffer;
+    fat32_result_t result, closed;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (src_path == NULL || dst_path == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    result = fat32_open_file_ex(src_path, &src, FAT32_MODE_READ);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (src.is_directory) {
+        fat32_close_file(&src);
+        return FAT32_ERROR_IS_DIRECTORY;
+    }
+
+    buffer = (uint8_t*)memory_alloc_pages(pages);
+    if (!buffer) {
+        fat32_close_file(&src);
+        return FAT32_ERROR_OUT_OF_MEMORY;
+    }
+
+    result = fat32_create_file(dst_path, &dst);
+    if (result != FAT32_SUCCESS) {
+        memory_free_pages(buffer, pages);
+        fat32_close_file(&src);
+        return result;
+    }
+
+    result = fat32_preallocate_file(&dst, src.size, true);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_file_copy_clusters(&src, &dst, buffer);
+    }
+    if (result == FAT32_SUCCESS) {
+        dst.valid_size = dst.size;
+        fat32_volume.write_operations++;
+    }
+
+    memory_free_pages(buffer, pages);
+    fat32_close_file(&src);
+    closed = fat32_close_file(&dst);
+    if (result == FAT32_SUCCESS) {
+        result = closed;
+    }
+
+    if (result != FAT32_SUCCESS) {
+        fat32_delete_file(dst_path);
+        return result;
+    }
+
+    /* Carry over the attributes and last write time */
+    result = fat32_dir_read_entry(src.dir_entry_cluster, src.dir_entry_offset, &source);
+    if (result == FAT32_SUCCESS) {
+        result = fat32_dir_read_entry(dst.dir_entry_cluster, dst.dir_entry_offset, &entry);
+    }
+    if (result == FAT32_SUCCESS) {
+        entry.attributes = source.attributes;
+        entry.write_date = source.write_date;
+        entry.write_time = source.write_time;
+        result = fat32_dir_write_entry(dst.dir_entry_cluster, dst.dir_entry_offset, &entry);
+    }
+    return result;
+}
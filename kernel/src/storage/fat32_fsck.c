@@ -0,0 +1,474 @@
+/*
+ * FAT32 File System Check
+ * ChanUX Operating System
+ *
+ * One pass over the volume in O(clusters + entries). The FAT is streamed
+ * into memory in large sequential reads, with the next batch read ahead
+ * while the current one is scanned. The directory tree is then walked
+ * breadth-first using the in-memory FAT; every chain sets a bit per
+ * cluster in a reference map. A cluster that is already referenced is a
+ * cross-link (or a loop). Allocated clusters that nothing references are
+ * lost chains, and a chain whose length disagrees with the file size is a
+ * size mismatch.
+ *
+ * Repair truncates cross-linked and broken chains, fits sizes to chains
+ * (or chains to sizes), frees lost chains and corrects the free count.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/process/process.h"
+#include "../../include/timer/pit.h"
+#include "../../include/common/utils.h"
+
+/* A directory waiting to be scanned; length is the part of its chain the
+ * walk accepted, which in check-only mode is shorter than the FAT links */
+typedef struct {
+    uint32_t cluster;
+    uint32_t length;
+} fat32_fsck_dir_t;
+
+/* Check state; every array lives in the page pool for one run */
+typedef struct {
+    uint32_t* fat;                      /* Copy of the FAT (cluster -> next) */
+    uint32_t* referenced;               /* Bit per cluster: reached from the tree */
+    uint32_t* has_previous;             /* Bit per cluster: some cluster links to it */
+    fat32_fsck_dir_t* queue;            /* Ring of directories still to scan */
+    uint8_t* cluster_buffer;
+    uint32_t fat_pages, map_pages, queue_pages, buffer_pages;
+    uint32_t queue_head, queue_count;
+    bool repair;
+    fat32_fsck_report_t* report;
+} fat32_fsck_t;
+
+static fat32_fsck_report_t fat32_fsck_last;
+
+static inline bool fat32_fsck_test(const uint32_t* map, uint32_t cluster) {
+    return (map[cluster / 32] & (1u << (cluster % 32))) != 0;
+}
+
+static inline void fat32_fsck_set(uint32_t* map, uint32_t cluster) {
+    map[cluster / 32] |= 1u << (cluster % 32);
+}
+
+static inline void fat32_fsck_clear(uint32_t* map, uint32_t cluster) {
+    map[cluster / 32] &= ~(1u << (cluster % 32));
+}
+
+static void fat32_fsck_free(fat32_fsck_t* fsck) {
+    if (fsck->fat) {
+        memory_free_pages(fsck->fat, fsck->fat_pages);
+    }
+    if (fsck->referenced) {
+        memory_free_pages(fsck->referenced, fsck->map_pages);
+    }
+    if (fsck->has_previous) {
+        memory_free_pages(fsck->has_previous, fsck->map_pages);
+    }
+    if (fsck->queue) {
+        memory_free_pages(fsck->queue, fsck->queue_pages);
+    }
+    if (fsck->cluster_buffer) {
+        memory_free_pages(fsck->cluster_buffer, fsck->buffer_pages);
+    }
+}
+
+static fat32_result_t fat32_fsck_alloc(fat32_fsck_t* fsck, uint32_t fat_sectors) {
+    uint32_t clusters = fat32_volume.total_clusters + 2;
+
+    fsck->fat_pages = (fat_sectors * FAT32_SECTOR_SIZE + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    fsck->map_pages = ((clusters + 31) / 32 * sizeof(uint32_t) + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    fsck->queue_pages = FAT32_FSCK_QUEUE_SIZE * sizeof(fat32_fsck_dir_t) / MEMORY_PAGE_SIZE;
+    fsck->buffer_pages = FAT32_MAX_CLUSTER_SIZE / MEMORY_PAGE_SIZE;
+
+    fsck->fat = (uint32_t*)memory_alloc_pages(fsck->fat_pages);
+    fsck->referenced = (uint32_t*)memory_alloc_pages(fsck->map_pages);
+    fsck->has_previous = (uint32_t*)memory_alloc_pages(fsck->map_pages);
+    fsck->queue = (fat32_fsck_dir_t*)memory_alloc_pages(fsck->queue_pages);
+    fsck->cluster_buffer = (uint8_t*)memory_alloc_pages(fsck->buffer_pages);
+    if (!fsck->fat || !fsck->referenced || !fsck->has_previous || !fsck->queue || !fsck->cluster_buffer) {
+        return FAT32_ERROR_OUT_OF_MEMORY;
+    }
+
+    memset(fsck->referenced, 0, fsck->map_pages * MEMORY_PAGE_SIZE);
+    memset(fsck->has_previous, 0, fsck->map_pages * MEMORY_PAGE_SIZE);
+    return FAT32_SUCCESS;
+}
+
+/* Read the primary FAT into memory in batches, scanning each batch for
+ * free and bad clusters and links while the next one is read ahead */
+static fat32_result_t fat32_fsck_load_fat(fat32_fsck_t* fsck, uint32_t fat_sectors) {
+    uint32_t entries_per_sector = FAT32_SECTOR_SIZE / sizeof(uint32_t);
+    uint32_t last = fat32_volume.total_clusters + 1;
+
+    for (uint32_t sector = 0; sector < fat_sectors; sector += FAT32_FSCK_BATCH_SECTORS) {
+        uint32_t count = fat_sectors - sector;
+        if (count > FAT32_FSCK_BATCH_SECTORS) {
+            count = FAT32_FSCK_BATCH_SECTORS;
+        }
+
+        if (bcache_read_direct(fat32_volume.device, fat32_volume.fat_begin_lba + sector, count,
+                               (uint8_t*)fsck->fat + sector * FAT32_SECTOR_SIZE) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+
+        if (sector + count < fat_sectors) {
+            uint32_t next = fat_sectors - sector - count;
+            bcache_prefetch(fat32_volume.device, fat32_volume.fat_begin_lba + sector + count,
+                            next < FAT32_FSCK_BATCH_SECTORS ? next : FAT32_FSCK_BATCH_SECTORS);
+        }
+
+        uint32_t first = sector * entries_per_sector;
+        uint32_t end = (sector + count) * entries_per_sector;
+        if (first < 2) {
+            first = 2;
+        }
+        if (end > last + 1) {
+            end = last + 1;
+        }
+        for (uint32_t cluster = first; cluster < end; cluster++) {
+            uint32_t next = fsck->fat[cluster] & FAT32_CLUSTER_MASK;
+
+            fsck->fat[cluster] = next;
+            if (next == FAT32_FREE_CLUSTER) {
+                fsck->report->free_clusters++;
+            } else if (next == FAT32_BAD_CLUSTER) {
+                fsck->report->bad_clusters++;
+            } else if (FAT32_VALIDATE_CLUSTER(next)) {
+                fat32_fsck_set(fsck->has_previous, next);
+            }
+        }
+    }
+    return FAT32_SUCCESS;
+}
+
+/* End a chain after cluster (repair) */
+static void fat32_fsck_end_chain(fat32_fsck_t* fsck, uint32_t cluster) {
+    if (fat32_set_next_cluster(cluster, FAT32_EOC) == FAT32_SUCCESS) {
+        fsck->fat[cluster] = FAT32_EOC;
+        fsck->report->repaired++;
+    }
+}
+
+/* Follow a chain, marking its clusters referenced. A link into a cluster
+ * that is already referenced, free, bad or out of range ends the walk; on
+ * repair the chain is cut there. Returns the clusters kept, and 0 in
+ * *first if even the first cluster had to go. */
+static uint32_t fat32_fsck_walk_chain(fat32_fsck_t* fsck, uint32_t* first) {
+    uint32_t previous = 0;
+    uint32_t cluster = *first;
+    uint32_t length = 0;
+
+    while (1) {
+        if (!FAT32_VALIDATE_CLUSTER(cluster) || fsck->fat[cluster] == FAT32_FREE_CLUSTER ||
+            fsck->fat[cluster] == FAT32_BAD_CLUSTER) {
+            fsck->report->bad_links++;
+            break;
+        }
+        if (fat32_fsck_test(fsck->referenced, cluster)) {
+            fsck->report->cross_links++;
+            break;
+        }
+
+        fat32_fsck_set(fsck->referenced, cluster);
+        length++;
+
+        if (FAT32_IS_EOC(fsck->fat[cluster])) {
+            return length;
+        }
+        previous = cluster;
+        cluster = fsck->fat[cluster];
+    }
+
+    /* Broken off at cluster */
+    if (fsck->repair) {
+        if (previous != 0) {
+            fat32_fsck_end_chain(fsck, previous);
+        } else {
+            *first = 0;
+        }
+    }
+    return length;
+}
+
+/* Cut a chain down to keep clusters; the rest becomes lost and is freed
+ * with the other lost chains */
+static void fat32_fsck_trim_chain(fat32_fsck_t* fsck, uint32_t first, uint32_t keep) {
+    uint32_t cluster = first;
+
+    for (uint32_t i = 1; i < keep; i++) {
+        cluster = fsck->fat[cluster];
+    }
+
+    uint32_t next = fsck->fat[cluster];
+    fat32_fsck_end_chain(fsck, cluster);
+    while (FAT32_VALIDATE_CLUSTER(next) && fat32_fsck_test(fsck->referenced, next)) {
+        fat32_fsck_clear(fsck->referenced, next);
+        next = fsck->fat[next];
+    }
+}
+
+/* Queue a directory for scanning; a full queue leaves the check incomplete */
+static void fat32_fsck_queue_dir(fat32_fsck_t* fsck, uint32_t cluster, uint32_t length) {
+    fat32_fsck_dir_t* dir;
+
+    if (fsck->queue_count >= FAT32_FSCK_QUEUE_SIZE) {
+        fsck->report->complete = false;
+        return;
+    }
+
+    dir = &fsck->queue[(fsck->queue_head + fsck->queue_count) % FAT32_FSCK_QUEUE_SIZE];
+    dir->cluster = cluster;
+    dir->length = length;
+    fsck->queue_count++;
+}
+
+/* Check one entry of a directory */
+static void fat32_fsck_entry(fat32_fsck_t* fsck, fat32_dir_entry_t* entry, uint32_t cluster, uint32_t offset) {
+    uint32_t bytes_per_cluster = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE;
+    bool is_directory = (entry->attributes & FAT32_ATTR_DIRECTORY) != 0;
+    uint32_t first = fat32_get_first_cluster(entry);
+    uint32_t original = first;
+    uint32_t size = is_directory ? 0 : entry->file_size;
+    uint32_t length = 0;
+
+    if (is_directory) {
+        fsck->report->directories++;
+    } else {
+        fsck->report->files++;
+    }
+
+    if (first != 0) {
+        length = fat32_fsck_walk_chain(fsck, &first);
+    }
+
+    if (is_directory) {
+        if (first != 0 && length > 0 && original == first) {
+            fat32_fsck_queue_dir(fsck, first, length);
+        }
+    } else {
+        /* An empty file may keep one cluster */
+        uint32_t needed = (size + bytes_per_cluster - 1) / bytes_per_cluster;
+        if (needed == 0 && length > 0) {
+            needed = 1;
+        }
+
+        if (length != needed) {
+            fsck->report->size_mismatches++;
+            if (fsck->repair) {
+                if (length > needed) {
+                    fat32_fsck_trim_chain(fsck, first, needed);
+                } else {
+                    size = length * bytes_per_cluster;
+                }
+            }
+        }
+    }
+
+    if (fsck->repair && (first != original || (!is_directory && size != entry->file_size))) {
+        fat32_set_first_cluster(entry, first);
+        if (!is_directory) {
+            entry->file_size = first == 0 ? 0 : size;
+        }
+        if (fat32_dir_write_entry(cluster, offset, entry) == FAT32_SUCCESS) {
+            fsck->report->repaired++;
+        }
+    }
+}
+
+/* Scan the clusters of one directory, queueing its subdirectories. Only
+ * the length clusters the chain walk accepted are read: past a cross-link
+ * the FAT leads into another file's clusters. */
+static fat32_result_t fat32_fsck_directory(fat32_fsck_t* fsck, const fat32_fsck_dir_t* dir) {
+    uint32_t entries = fat32_volume.sectors_per_cluster * FAT32_SECTOR_SIZE / FAT32_DIR_ENTRY_SIZE;
+    uint32_t cluster = dir->cluster;
+
+    for (uint32_t steps = 0; FAT32_VALIDATE_CLUSTER(cluster) && steps < dir->length; steps++) {
+        fat32_dir_entry_t* slots = (fat32_dir_entry_t*)fsck->cluster_buffer;
+
+        if (bcache_read_direct(fat32_volume.device, fat32_cluster_to_lba(cluster),
+                               fat32_volume.sectors_per_cluster, fsck->cluster_buffer) != BLOCK_SUCCESS) {
+            return FAT32_ERROR_READ_FAILED;
+        }
+
+        for (uint32_t i = 0; i < entries; i++) {
+            fat32_dir_entry_t* entry = &slots[i];
+            uint8_t first = (uint8_t)entry->name[0];
+
+            if (first == 0x00) {
+                return FAT32_SUCCESS;
+            }
+            if (first == 0xE5 || entry->name[0] == '.' ||
+                (entry->attributes & FAT32_ATTR_LONG_NAME_MASK) == FAT32_ATTR_LONG_NAME ||
+                (entry->attributes & FAT32_ATTR_VOLUME_ID)) {
+                continue;
+            }
+            fat32_fsck_entry(fsck, entry, cluster, i * FAT32_DIR_ENTRY_SIZE);
+        }
+
+        if (FAT32_IS_EOC(fsck->fat[cluster])) {
+            break;
+        }
+        cluster = fsck->fat[cluster];
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Allocated clusters that no chain from the tree reached */
+static void fat32_fsck_lost_chains(fat32_fsck_t* fsck) {
+    uint32_t last = fat32_volume.total_clusters + 1;
+
+    for (uint32_t cluster = 2; cluster <= last; cluster++) {
+        uint32_t next = fsck->fat[cluster];
+
+        if (next == FAT32_FREE_CLUSTER || next == FAT32_BAD_CLUSTER ||
+            fat32_fsck_test(fsck->referenced, cluster)) {
+            continue;
+        }
+
+        fsck->report->lost_clusters++;
+        if (!fat32_fsck_test(fsck->has_previous, cluster)) {
+            fsck->report->lost_chains++;
+        }
+        if (fsck->repair && fat32_set_next_cluster(cluster, FAT32_FREE_CLUSTER) == FAT32_SUCCESS) {
+            fsck->report->free_clusters++;
+            fsck->report->repaired++;
+        }
+    }
+}
+
+static fat32_result_t fat32_fsck_run_locked(bool repair) {
+    fat32_fsck_t fsck;
+    fat32_fsck_report_t* report = &fat32_fsck_last;
+    uint32_t fat_sectors = ((fat32_volume.total_clusters + 2) * sizeof(uint32_t) + FAT32_SECTOR_SIZE - 1) /
+                           FAT32_SECTOR_SIZE;
+    uint32_t start_ticks = timer_get_ticks();
+    uint32_t root, length;
+    fat32_result_t result;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+
+    if (repair && fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+
+    /* Open handles hold cluster numbers and sizes repair could change */
+    if (repair && fat32_open_file_count() > 0) {
+        return FAT32_ERROR_LOCKED;
+    }
+
+    memset(&fsck, 0, sizeof(fsck));
+    memset(report, 0, sizeof(fat32_fsck_report_t));
+    report->complete = true;
+    fsck.repair = repair;
+    fsck.report = report;
+
+    /* The on-disk FAT must hold every update made so far */
+    result = fat32_flush_all_caches();
+    if (result == FAT32_SUCCESS) {
+        result = fat32_fsck_alloc(&fsck, fat_sectors);
+    }
+    if (result == FAT32_SUCCESS) {
+        result = fat32_fsck_load_fat(&fsck, fat_sectors);
+    }
+    if (result != FAT32_SUCCESS) {
+        fat32_fsck_free(&fsck);
+        return result;
+    }
+
+    if (fat32_volume.free_clusters != 0xFFFFFFFF && fat32_volume.free_clusters != report->free_clusters) {
+        report->free_count_wrong = true;
+        if (repair) {
+            fat32_volume.free_clusters = report->free_clusters;
+            report->repaired++;
+        }
+    }
+
+    /* Breadth-first from the root */
+    root = fat32_volume.root_dir_first_cluster;
+    length = fat32_fsck_walk_chain(&fsck, &root);
+    if (length > 0 && root != 0) {
+        fat32_fsck_queue_dir(&fsck, root, length);
+    }
+    while (fsck.queue_count > 0 && result == FAT32_SUCCESS) {
+        fat32_fsck_dir_t dir = fsck.queue[fsck.queue_head];
+        fsck.queue_head = (fsck.queue_head + 1) % FAT32_FSCK_QUEUE_SIZE;
+        fsck.queue_count--;
+        result = fat32_fsck_directory(&fsck, &dir);
+    }
+
+    /* Lost chains are only known once every directory has been seen */
+    if (result == FAT32_SUCCESS && report->complete) {
+        fat32_fsck_lost_chains(&fsck);
+    } else {
+        report->complete = false;
+    }
+
+    report->clusters_in_use = fat32_volume.total_clusters - report->free_clusters - report->bad_clusters;
+    fat32_fsck_free(&fsck);
+
+    if (repair && result == FAT32_SUCCESS) {
+        result = fat32_flush_all_caches();
+    }
+
+    uint32_t ticks = timer_get_ticks() - start_ticks;
+    if (timer_frequency > 0) {
+        report->elapsed_ms = (ticks / timer_frequency) * 1000 + (ticks % timer_frequency) * 1000 / timer_frequency;
+    }
+
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (!repair && (report->lost_clusters || report->cross_links || report->bad_links ||
+                    report->size_mismatches || report->free_count_wrong)) {
+        return FAT32_ERROR_CORRUPTED_FS;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Run the check with the volume lock held throughout, so no file operation
+ * or defragmenter step changes the FAT or the tree under it */
+static fat32_result_t fat32_fsck_run(bool repair) {
+    fat32_result_t result;
+
+    fat32_lock();
+
+    /* The defragmenter copies data with the lock dropped; until the move
+     * finishes its new run would look like a lost chain */
+    while (fat32_defrag_moving()) {
+        fat32_unlock();
+        if (get_current_process()) {
+            process_yield();
+        }
+        fat32_lock();
+    }
+
+    result = fat32_fsck_run_locked(repair);
+    fat32_unlock();
+    return result;
+}
+
+/* Check the mounted volume without changing it. Returns
+ * FAT32_ERROR_CORRUPTED_FS if any problem was found; the details are in
+ * fat32_get_fsck_report. */
+fat32_result_t fat32_check_filesystem_integrity(void) {
+    return fat32_fsck_run(false);
+}
+
+/* Check the mounted volume and, with fix_errors, repair what was found */
+fat32_result_t fat32_repair_filesystem(bool fix_errors) {
+    return fat32_fsck_run(fix_errors);
+}
+
+/* Results of the last check or repair */
+fat32_result_t fat32_get_fsck_report(fat32_fsck_report_t* report) {
+    if (report == NULL) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+
+    *report = fat32_fsck_last;
+    return FAT32_SUCCESS;
+}
@@ -0,0 +1,569 @@
+/*
+ * FAT32 Metadata Journal
+ * ChanUX Operating System
+ *
+ * Optional write-ahead log for FAT and directory sectors, kept in a
+ * contiguous file in the root directory (FAT32_JOURNAL_NAME). Metadata
+ * sectors are pinned in the buffer cache before they are modified, so the
+ * cache never writes them in place on its own. A commit first writes back
+ * everything else that is dirty (file data and earlier transactions), then
+ * writes the pinned sectors to the journal as one transaction - a
+ * descriptor with their home LBAs, followed by their images, covered by
+ * one CRC - and unpins them. From then on they reach their home locations
+ * through ordinary write-back. When the journal fills up, a checkpoint
+ * writes everything back and empties it.
+ *
+ * Mount replays every complete transaction logged since the last
+ * checkpoint, so after a crash the FAT and the directories are as of the
+ * last commit. Other systems see a read-only, hidden, system file.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/storage/bcache.h"
+#include "../../include/memory/memory.h"
+#include "../../include/timer/pit.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_JOURNAL_MAGIC         0x4C4A4843  /* "CHJL" */
+#define FAT32_JOURNAL_TXN_MAGIC     0x4E58544A  /* "JTXN" */
+#define FAT32_JOURNAL_VERSION       1
+#define FAT32_JOURNAL_PATH          "/" FAT32_JOURNAL_NAME
+
+/* First sector of the journal */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sectors;                   /* Journal size, header included */
+    uint32_t sequence;                  /* Sequence number of the first transaction in the log */
+    uint32_t checksum;                  /* CRC32 of the header with this field zero */
+    uint8_t reserved[FAT32_SECTOR_SIZE - 20];
+} fat32_journal_header_t;
+
+/* First sector of a transaction; count sector images follow it */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t checksum;                  /* CRC32 of descriptor and images, this field zero */
+    uint32_t lba[FAT32_JOURNAL_MAX_BLOCKS];     /* Home location of each image */
+} fat32_journal_descriptor_t;
+
+/* Journal state of the mounted volume */
+typedef struct {
+    bool active;
+    uint32_t first_cluster;
+    uint32_t start_lba;                 /* Header sector */
+    uint32_t sectors;
+    uint32_t sequence;                  /* Sequence number of the next transaction */
+    uint32_t head;                      /* Next free journal sector */
+    bcache_buffer_t* pending[FAT32_JOURNAL_MAX_BLOCKS];    /* Pinned since the last commit */
+    uint32_t pending_count;
+    uint32_t pending_since;             /* Tick of the oldest pending update */
+    uint8_t* staging;                   /* One transaction: descriptor and images */
+    uint32_t* logged;                   /* Data-region sectors logged since the checkpoint */
+    uint32_t logged_count;
+    uint32_t logged_min, logged_max;
+    uint32_t staging_pages, logged_pages;
+    fat32_journal_stats_t stats;
+} fat32_journal_t;
+
+static fat32_journal_t fat32_journal;
+
+/* Unpin whatever is pending and free the journal's memory */
+static void fat32_journal_detach(void) {
+    for (uint32_t i = 0; i < fat32_journal.pending_count; i++) {
+        bcache_unpin(fat32_journal.pending[i]);
+    }
+    if (fat32_journal.staging) {
+        memory_free_pages(fat32_journal.staging, fat32_journal.staging_pages);
+    }
+    if (fat32_journal.logged) {
+        memory_free_pages(fat32_journal.logged, fat32_journal.logged_pages);
+    }
+
+    fat32_journal.active = false;
+    fat32_journal.pending_count = 0;
+    fat32_journal.staging = NULL;
+    fat32_journal.logged = NULL;
+    fat32_journal.logged_count = 0;
+}
+
+/* Pinned sectors per transaction: at most a quarter of the buffer cache */
+static uint32_t fat32_journal_capacity(void) {
+    bcache_stats_t stats;
+    uint32_t limit;
+
+    bcache_get_stats(&stats);
+    limit = stats.buffer_count / 4;
+    if (limit > FAT32_JOURNAL_MAX_BLOCKS) {
+        limit = FAT32_JOURNAL_MAX_BLOCKS;
+    }
+    return limit > 0 ? limit : 1;
+}
+
+/* Write the journal header; the log starts over at sequence */
+static fat32_result_t fat32_journal_write_header(uint32_t sequence) {
+    fat32_journal_header_t* header = (fat32_journal_header_t*)fat32_journal.staging;
+
+    memset(header, 0, sizeof(fat32_journal_header_t));
+    header->magic = FAT32_JOURNAL_MAGIC;
+    header->version = FAT32_JOURNAL_VERSION;
+    header->sectors = fat32_journal.sectors;
+    header->sequence = sequence;
+    header->checksum = crc32(0, header, sizeof(fat32_journal_header_t));
+
+    if (bcache_write_direct(fat32_volume.device, fat32_journal.start_lba, 1, header) != BLOCK_SUCCESS ||
+        block_flush(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    return FAT32_SUCCESS;
+}
+
+/* Take over the journal file described by entry. A fresh journal gets a
+ * new header; otherwise the header on disk must be valid. */
+static fat32_result_t fat32_journal_attach(const fat32_dir_entry_t* entry, bool fresh) {
+    fat32_journal_header_t* header;
+    uint32_t first = fat32_get_first_cluster(entry);
+    uint32_t sectors = entry->file_size / FAT32_SECTOR_SIZE;
+    uint32_t clusters, cluster, checksum;
+    fat32_result_t result;
+
+    if (sectors < FAT32_JOURNAL_MIN_SECTORS || !FAT32_VALIDATE_CLUSTER(first)) {
+        return FAT32_ERROR_CORRUPTED_FS;
+    }
+
+    /* The journal is addressed by LBA, so its chain must be one run */
+    clusters = (sectors + fat32_volume.sectors_per_cluster - 1) / fat32_volume.sectors_per_cluster;
+    cluster = first;
+    for (uint32_t i = 1; i < clusters; i++) {
+        if (fat32_get_next_cluster(cluster) != cluster + 1) {
+            return FAT32_ERROR_NOT_SUPPORTED;
+        }
+        cluster++;
+    }
+
+    fat32_journal.staging_pages = ((FAT32_JOURNAL_MAX_BLOCKS + 1) * FAT32_SECTOR_SIZE + MEMORY_PAGE_SIZE - 1) /
+                                  MEMORY_PAGE_SIZE;
+    fat32_journal.logged_pages = (sectors * sizeof(uint32_t) + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    fat32_journal.staging = (uint8_t*)memory_alloc_pages(fat32_journal.staging_pages);
+    fat32_journal.logged = (uint32_t*)memory_alloc_pages(fat32_journal.logged_pages);
+    if (!fat32_journal.staging || !fat32_journal.logged) {
+        fat32_journal_detach();
+        return FAT32_ERROR_OUT_OF_MEMORY;
+    }
+
+    fat32_journal.first_cluster = first;
+    fat32_journal.start_lba = fat32_cluster_to_lba(first);
+    fat32_journal.sectors = sectors;
+    fat32_journal.head = 1;
+    fat32_journal.sequence = 1;
+
+    if (fresh) {
+        result = fat32_journal_write_header(fat32_journal.sequence);
+        if (result != FAT32_SUCCESS) {
+            fat32_journal_detach();
+            return result;
+        }
+    } else {
+        header = (fat32_journal_header_t*)fat32_journal.staging;
+        if (bcache_read_direct(fat32_volume.device, fat32_journal.start_lba, 1, header) != BLOCK_SUCCESS) {
+            fat32_journal_detach();
+            return FAT32_ERROR_READ_FAILED;
+        }
+        checksum = header->checksum;
+        header->checksum = 0;
+        if (header->magic != FAT32_JOURNAL_MAGIC || header->version != FAT32_JOURNAL_VERSION ||
+            header->sectors != sectors || crc32(0, header, sizeof(fat32_journal_header_t)) != checksum) {
+            fat32_journal_detach();
+            return FAT32_ERROR_CORRUPTED_FS;
+        }
+        fat32_journal.sequence = header->sequence;
+    }
+
+    fat32_journal.active = true;
+    return FAT32_SUCCESS;
+}
+
+/* A logged sector must lie in the FAT or data area, outside the journal */
+static bool fat32_journal_valid_lba(uint32_t lba) {
+    return lba >= fat32_volume.fat_begin_lba && lba < fat32_volume.total_sectors &&
+           (lba < fat32_journal.start_lba || lba >= fat32_journal.start_lba + fat32_journal.sectors);
+}
+
+/* Copy every complete transaction left in the log to its home sectors,
+ * then start the log over. Stops at the first transaction that is torn,
+ * out of sequence or left over from before the last checkpoint. */
+static fat32_result_t fat32_journal_replay(void) {
+    fat32_journal_descriptor_t* descriptor = (fat32_journal_descriptor_t*)fat32_journal.staging;
+    uint8_t* images = fat32_journal.staging + FAT32_SECTOR_SIZE;
+    uint32_t sequence = fat32_journal.sequence;
+    uint32_t head = 1;
+
+    while (head < fat32_journal.sectors) {
+        uint32_t count, checksum, i;
+
+        if (bcache_read_direct(fat32_volume.device, fat32_journal.start_lba + head, 1, descriptor) != BLOCK_SUCCESS) {
+            break;
+        }
+        count = descriptor->count;
+        if (descriptor->magic != FAT32_JOURNAL_TXN_MAGIC || descriptor->sequence != sequence ||
+            count == 0 || count > FAT32_JOURNAL_MAX_BLOCKS || count >= fat32_journal.sectors - head) {
+            break;
+        }
+        if (bcache_read_direct(fat32_volume.device, fat32_journal.start_lba + head + 1, count, images) != BLOCK_SUCCESS) {
+            break;
+        }
+
+        checksum = descriptor->checksum;
+        descriptor->checksum = 0;
+        if (crc32(0, fat32_journal.staging, (count + 1) * FAT32_SECTOR_SIZE) != checksum) {
+            break;
+        }
+        for (i = 0; i < count && fat32_journal_valid_lba(descriptor->lba[i]); i++);
+        if (i < count) {
+            break;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (bcache_write_direct(fat32_volume.device, descriptor->lba[i], 1,
+                                    images + i * FAT32_SECTOR_SIZE) != BLOCK_SUCCESS) {
+                return FAT32_ERROR_WRITE_FAILED;  /* The log is kept; the next mount retries */
+            }
+        }
+
+        fat32_journal.stats.replayed_transactions++;
+        fat32_journal.stats.replayed_sectors += count;
+        head += count + 1;
+        sequence++;
+    }
+
+    fat32_journal.sequence = sequence;
+    if (fat32_journal.stats.replayed_transactions == 0) {
+        return FAT32_SUCCESS;
+    }
+
+    /* The homes must be on disk before the log is emptied */
+    if (block_flush(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+    return fat32_journal_write_header(sequence);
+}
+
+/* Write the pending sectors to the log as one transaction and unpin them */
+static fat32_result_t fat32_journal_write_transaction(void) {
+    fat32_journal_descriptor_t* descriptor = (fat32_journal_descriptor_t*)fat32_journal.staging;
+    uint32_t count = fat32_journal.pending_count;
+
+    if (count == 0) {
+        return FAT32_SUCCESS;
+    }
+
+    /* Data, and sectors of earlier transactions, go first: a committed
+     * FAT or entry never points at clusters whose data is still cached */
+    if (bcache_sync(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+
+    memset(descriptor, 0, FAT32_SECTOR_SIZE);
+    descriptor->magic = FAT32_JOURNAL_TXN_MAGIC;
+    descriptor->sequence = fat32_journal.sequence;
+    descriptor->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        descriptor->lba[i] = fat32_journal.pending[i]->lba;
+        memcpy(fat32_journal.staging + (i + 1) * FAT32_SECTOR_SIZE, fat32_journal.pending[i]->data,
+               FAT32_SECTOR_SIZE);
+    }
+    descriptor->checksum = crc32(0, fat32_journal.staging, (count + 1) * FAT32_SECTOR_SIZE);
+
+    /* The CRC makes the transaction all or nothing; one flush commits it */
+    if (bcache_write_direct(fat32_volume.device, fat32_journal.start_lba + fat32_journal.head, count + 1,
+                            fat32_journal.staging) != BLOCK_SUCCESS ||
+        block_flush(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t lba = fat32_journal.pending[i]->lba;
+
+        /* Remember logged directory sectors; data may not overwrite them
+         * until the next checkpoint */
+        if (lba >= fat32_volume.cluster_begin_lba) {
+            if (fat32_journal.logged_count == 0 || lba < fat32_journal.logged_min) {
+                fat32_journal.logged_min = lba;
+            }
+            if (fat32_journal.logged_count == 0 || lba > fat32_journal.logged_max) {
+                fat32_journal.logged_max = lba;
+            }
+            fat32_journal.logged[fat32_journal.logged_count++] = lba;
+        }
+        bcache_unpin(fat32_journal.pending[i]);
+    }
+
+    fat32_journal.head += count + 1;
+    fat32_journal.sequence++;
+    fat32_journal.pending_count = 0;
+    fat32_journal.stats.transactions++;
+    fat32_journal.stats.sectors_logged += count;
+    return FAT32_SUCCESS;
+}
+
+/* Find and recover the journal of the volume being mounted; called before
+ * the FAT is first read. A volume without a journal mounts as before. */
+void fat32_journal_mount(void) {
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+
+    fat32_journal_detach();
+    memset(&fat32_journal.stats, 0, sizeof(fat32_journal_stats_t));
+
+    if (fat32_volume.read_only ||
+        fat32_dir_find_entry(fat32_volume.root_dir_first_cluster, FAT32_JOURNAL_NAME, &entry,
+                             &entry_cluster, &entry_offset) != FAT32_SUCCESS) {
+        return;
+    }
+    if (fat32_journal_attach(&entry, false) != FAT32_SUCCESS) {
+        return;
+    }
+
+    if (fat32_journal_replay() != FAT32_SUCCESS) {
+        fat32_journal_detach();
+    }
+
+    /* The lookup cached directory contents the replay may have changed */
+    fat32_dcache_invalidate_all();
+    fat32_dindex_invalidate_all();
+}
+
+/* Checkpoint and let go of the journal of the mounted volume */
+void fat32_journal_unmount(void) {
+    if (fat32_journal.active) {
+        fat32_journal_checkpoint();
+        fat32_journal_detach();
+    }
+}
+
+/* Pin a FAT or directory sector into the running transaction; called
+ * before the sector is modified. A full or old transaction is committed
+ * first, while this sector still holds committed contents. */
+void fat32_journal_note(bcache_buffer_t* buffer) {
+    if (!fat32_journal.active || buffer == NULL || buffer->pinned) {
+        return;
+    }
+
+    if (fat32_journal.pending_count >= fat32_journal_capacity() ||
+        (fat32_journal.pending_count > 0 &&
+         timer_get_ticks() - fat32_journal.pending_since >= FAT32_JOURNAL_COMMIT_MS * timer_frequency / 1000)) {
+        fat32_journal_commit();
+    }
+    if (fat32_journal.pending_count >= FAT32_JOURNAL_MAX_BLOCKS) {
+        return;  /* Commits are failing; the update is written back unlogged */
+    }
+
+    if (fat32_journal.pending_count == 0) {
+        fat32_journal.pending_since = timer_get_ticks();
+    }
+    bcache_pin(buffer);
+    fat32_journal.pending[fat32_journal.pending_count++] = buffer;
+}
+
+/* File data about to be written to [lba, lba + count). A directory
+ * cluster that was freed and reused for data may still have an image in
+ * the log, which a replay would copy over the data, so such writes
+ * checkpoint the journal first. */
+void fat32_journal_data_write(uint32_t lba, uint32_t count) {
+    if (!fat32_journal.active || fat32_journal.logged_count == 0 ||
+        lba > fat32_journal.logged_max || lba + count <= fat32_journal.logged_min) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < fat32_journal.logged_count; i++) {
+        if (fat32_journal.logged[i] >= lba && fat32_journal.logged[i] < lba + count) {
+            fat32_journal_checkpoint();
+            return;
+        }
+    }
+}
+
+/* Whether a chain starting at first_cluster is the active journal */
+bool fat32_journal_protects(uint32_t first_cluster) {
+    return fat32_journal.active && first_cluster == fat32_journal.first_cluster;
+}
+
+/* Whether metadata updates of the mounted volume are being journalled */
+bool fat32_journal_is_active(void) {
+    return fat32_journal.active;
+}
+
+/* Commit the pending metadata updates. Once this returns they survive a
+ * crash; checkpoints the journal when it cannot take another transaction. */
+fat32_result_t fat32_journal_commit(void) {
+    fat32_result_t result;
+
+    if (!fat32_journal.active) {
+        return FAT32_SUCCESS;
+    }
+
+    /* Nothing to log, but file data must still reach the disk */
+    if (fat32_journal.pending_count == 0) {
+        return bcache_sync(fat32_volume.device) == BLOCK_SUCCESS ? FAT32_SUCCESS : FAT32_ERROR_WRITE_FAILED;
+    }
+
+    result = fat32_journal_write_transaction();
+    if (result == FAT32_SUCCESS && fat32_journal.sectors - fat32_journal.head < FAT32_JOURNAL_MAX_BLOCKS + 1) {
+        result = fat32_journal_checkpoint();
+    }
+    return result;
+}
+
+/* Commit, write every logged sector (and the mirror FATs) in place, and
+ * empty the log */
+fat32_result_t fat32_journal_checkpoint(void) {
+    fat32_result_t result;
+
+    if (!fat32_journal.active) {
+        return FAT32_SUCCESS;
+    }
+
+    result = fat32_journal_write_transaction();
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (fat32_journal.head == 1) {
+        return FAT32_SUCCESS;
+    }
+
+    /* Nothing is pinned now, so a sync puts everything in place */
+    result = fat32_sync_fat();
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    if (bcache_sync(fat32_volume.device) != BLOCK_SUCCESS || block_flush(fat32_volume.device) != BLOCK_SUCCESS) {
+        return FAT32_ERROR_WRITE_FAILED;
+    }
+
+    result = fat32_journal_write_header(fat32_journal.sequence);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+
+    fat32_journal.head = 1;
+    fat32_journal.logged_count = 0;
+    fat32_journal.stats.checkpoints++;
+    return FAT32_SUCCESS;
+}
+
+/* Create a journal of about sectors sectors (0 = default) on the mounted
+ * volume and start using it */
+fat32_result_t fat32_journal_create(uint32_t sectors) {
+    fat32_file_t file;
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+    uint32_t clusters, start, length;
+    fat32_result_t result, closed;
+
+    if (!fat32_volume.initialized) {
+        return FAT32_ERROR_NOT_INITIALIZED;
+    }
+    if (fat32_volume.read_only) {
+        return FAT32_ERROR_READ_ONLY;
+    }
+    if (fat32_journal.active) {
+        return FAT32_ERROR_FILE_EXISTS;
+    }
+
+    if (sectors == 0) {
+        sectors = FAT32_JOURNAL_SECTORS;
+    }
+    if (sectors < FAT32_JOURNAL_MIN_SECTORS) {
+        return FAT32_ERROR_INVALID_PARAMETER;
+    }
+    clusters = (sectors + fat32_volume.sectors_per_cluster - 1) / fat32_volume.sectors_per_cluster;
+    sectors = clusters * fat32_volume.sectors_per_cluster;
+
+    /* Fail early if no free run is long enough */
+    result = fat32_find_free_run(clusters, &start, &length);
+    if (result == FAT32_SUCCESS && length < clusters) {
+        return FAT32_ERROR_DISK_FULL;
+    }
+
+    result = fat32_create_file(FAT32_JOURNAL_PATH, &file);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    /* Closing zero-fills the preallocated region, clearing any old log */
+    result = fat32_preallocate_file(&file, sectors * FAT32_SECTOR_SIZE, true);
+    closed = fat32_close_file(&file);
+    if (result == FAT32_SUCCESS) {
+        result = closed;
+    }
+
+    if (result == FAT32_SUCCESS) {
+        result = fat32_dir_find_entry(fat32_volume.root_dir_first_cluster, FAT32_JOURNAL_NAME, &entry,
+                                      &entry_cluster, &entry_offset);
+    }
+    if (result == FAT32_SUCCESS) {
+        entry.attributes |= FAT32_ATTR_READ_ONLY | FAT32_ATTR_HIDDEN | FAT32_ATTR_SYSTEM;
+        result = fat32_dir_write_entry(entry_cluster, entry_offset, &entry);
+    }
+    if (result == FAT32_SUCCESS) {
+        result = fat32_flush_all_caches();
+    }
+    if (result == FAT32_SUCCESS) {
+        result = fat32_journal_attach(&entry, true);
+    }
+
+    if (result != FAT32_SUCCESS) {
+        if (fat32_dir_find_entry(fat32_volume.root_dir_first_cluster, FAT32_JOURNAL_NAME, &entry,
+                                 &entry_cluster, &entry_offset) == FAT32_SUCCESS) {
+            entry.attributes &= ~FAT32_ATTR_READ_ONLY;
+            fat32_dir_write_entry(entry_cluster, entry_offset, &entry);
+        }
+        fat32_delete_file(FAT32_JOURNAL_PATH);
+        return result;
+    }
+
+    memset(&fat32_journal.stats, 0, sizeof(fat32_journal_stats_t));
+    return FAT32_SUCCESS;
+}
+
+/* Checkpoint the journal and delete it; metadata goes back to plain
+ * write-back */
+fat32_result_t fat32_journal_remove(void) {
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+    fat32_result_t result;
+
+    if (!fat32_journal.active) {
+        return FAT32_ERROR_NOT_FOUND;
+    }
+
+    result = fat32_journal_checkpoint();
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    fat32_journal_detach();
+
+    result = fat32_dir_find_entry(fat32_volume.root_dir_first_cluster, FAT32_JOURNAL_NAME, &entry,
+                                  &entry_cluster, &entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    entry.attributes &= ~FAT32_ATTR_READ_ONLY;
+    result = fat32_dir_write_entry(entry_cluster, entry_offset, &entry);
+    if (result != FAT32_SUCCESS) {
+        return result;
+    }
+    return fat32_delete_file(FAT32_JOURNAL_PATH);
+}
+
+void fat32_journal_get_stats(fat32_journal_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    memcpy(stats, &fat32_journal.stats, sizeof(fat32_journal_stats_t));
+    stats->active = fat32_journal.active;
+    stats->sectors = fat32_journal.active ? fat32_journal.sectors : 0;
+    stats->used = fat32_journal.active ? fat32_journal.head - 1 : 0;
+    stats->pending = fat32_journal.pending_count;
+}
@@ -0,0 +1,470 @@
+/*
+ * FAT32 VFS Backend
+ * ChanUX Operating System
+ *
+ * Plugs the FAT32 driver in behind the VFS. FAT32 serves one volume at a
+ * time, so only one fat32 mount can exist. Directory vnodes carry their
+ * first cluster as ino and are searched directly; everything else goes
+ * through the path API with the vnode's path inside the volume. Open files
+ * use handles from a pool allocated at mount time; all opens of one file
+ * share a single handle, kept in the vnode's data, so that writes through
+ * one descriptor are seen by the others. Each open directory gets its own
+ * handle, which serves as its readdir cursor. Every entry point holds
+ * the FAT32 volume lock, so calls from processes never interleave with
+ * each other or with the defragmenter.
+ */
+
+#include "../../include/storage/fat32.h"
+#include "../../include/fs/vfs.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+#define FAT32_VFS_HANDLE_PAGES \
+    ((VFS_MAX_OPEN_FILES * sizeof(fat32_file_t) + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE)
+
+static bool fat32_vfs_mounted = false;
+static bool fat32_vfs_owns_volume = false;     /* Volume was initialized by the mount */
+static fat32_file_t* fat32_vfs_handles = NULL;
+static uint32_t fat32_vfs_handle_refs[VFS_MAX_OPEN_FILES];   /* 0 = free */
+
+static vfs_result_t fat32_vfs_result(fat32_result_t result) {
+    switch (result) {
+        case FAT32_SUCCESS: return VFS_SUCCESS;
+        case FAT32_ERROR_NOT_INITIALIZED: return VFS_ERROR_NOT_INITIALIZED;
+        case FAT32_ERROR_INVALID_PARAMETER: return VFS_ERROR_INVALID_PARAMETER;
+        case FAT32_ERROR_NOT_FOUND: return VFS_ERROR_NOT_FOUND;
+        case FAT32_ERROR_FILE_EXISTS: return VFS_ERROR_EXISTS;
+        case FAT32_ERROR_NOT_DIRECTORY: return VFS_ERROR_NOT_DIRECTORY;
+        case FAT32_ERROR_IS_DIRECTORY: return VFS_ERROR_IS_DIRECTORY;
+        case FAT32_ERROR_NOT_EMPTY: return VFS_ERROR_NOT_EMPTY;
+        case FAT32_ERROR_DISK_FULL:
+        case FAT32_ERROR_NO_FREE_CLUSTER: return VFS_ERROR_NO_SPACE;
+        case FAT32_ERROR_OUT_OF_MEMORY: return VFS_ERROR_NO_MEMORY;
+        case FAT32_ERROR_TOO_MANY_OPEN: return VFS_ERROR_TOO_MANY_OPEN;
+        case FAT32_ERROR_ACCESS_DENIED: return VFS_ERROR_ACCESS_DENIED;
+        case FAT32_ERROR_READ_ONLY: return VFS_ERROR_READ_ONLY;
+        case FAT32_ERROR_INVALID_FILENAME: return VFS_ERROR_INVALID_PARAMETER;
+        case FAT32_ERROR_EOF: return VFS_ERROR_EOF;
+        default: return VFS_ERROR_IO;
+    }
+}
+
+static fat32_file_t* fat32_vfs_handle_alloc(void) {
+    for (uint32_t i = 0; i < VFS_MAX_OPEN_FILES; i++) {
+        if (fat32_vfs_handle_refs[i] == 0) {
+            fat32_vfs_handle_refs[i] = 1;
+            memset(&fat32_vfs_handles[i], 0, sizeof(fat32_file_t));
+            return &fat32_vfs_handles[i];
+        }
+    }
+    return NULL;
+}
+
+static void fat32_vfs_handle_free(fat32_file_t* file) {
+    fat32_vfs_handle_refs[file - fat32_vfs_handles] = 0;
+}
+
+/* Fill a vnode from its directory entry */
+static void fat32_vfs_fill(vfs_vnode_t* node, const fat32_dir_entry_t* entry) {
+    node->type = (entry->attributes & FAT32_ATTR_DIRECTORY) ? VFS_TYPE_DIRECTORY : VFS_TYPE_FILE;
+    node->size = entry->file_size;
+    node->ino = fat32_get_first_cluster(entry);
+    if (node->type == VFS_TYPE_DIRECTORY && node->ino == 0) {
+        node->ino = fat32_volume.root_dir_first_cluster;
+    }
+}
+
+static vfs_result_t fat32_vfs_mount_locked(vfs_mount_t* mount, void* source, vfs_vnode_t* root) {
+    fat32_result_t result;
+
+    if (fat32_vfs_mounted) {
+        return VFS_ERROR_BUSY;
+    }
+
+    /* Reuse the volume the kernel already brought up on this device */
+    fat32_vfs_owns_volume = false;
+    if (!fat32_volume.initialized || (source && source != fat32_volume.device)) {
+        if (source == NULL) {
+            return VFS_ERROR_INVALID_PARAMETER;
+        }
+        result = fat32_initialize((block_device_t*)source);
+        if (result != FAT32_SUCCESS) {
+            return fat32_vfs_result(result);
+        }
+        fat32_vfs_owns_volume = true;
+    }
+
+    fat32_vfs_handles = (fat32_file_t*)memory_alloc_pages(FAT32_VFS_HANDLE_PAGES);
+    if (fat32_vfs_handles == NULL) {
+        if (fat32_vfs_owns_volume) {
+            fat32_shutdown();
+        }
+        return VFS_ERROR_NO_MEMORY;
+    }
+    memset(fat32_vfs_handle_refs, 0, sizeof(fat32_vfs_handle_refs));
+
+    mount->data = &fat32_volume;
+    root->ino = fat32_volume.root_dir_first_cluster;
+    fat32_vfs_mounted = true;
+    return VFS_SUCCESS;
+}
+
+static void fat32_vfs_unmount_locked(vfs_mount_t* mount) {
+    (void)mount;
+
+    memory_free_pages(fat32_vfs_handles, FAT32_VFS_HANDLE_PAGES);
+    fat32_vfs_handles = NULL;
+    if (fat32_vfs_owns_volume) {
+        fat32_shutdown();
+    }
+    fat32_vfs_mounted = false;
+}
+
+static vfs_result_t fat32_vfs_lookup_locked(vfs_vnode_t* dir, vfs_vnode_t* node) {
+    fat32_dir_entry_t entry;
+    uint32_t entry_cluster, entry_offset;
+    fat32_result_t result;
+
+    result = fat32_dir_find_entry(dir->ino, node->name, &entry, &entry_cluster, &entry_offset);
+    if (result != FAT32_SUCCESS) {
+        return fat32_vfs_result(result);
+    }
+    fat32_vfs_fill(node, &entry);
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t fat32_vfs_create_locked(vfs_vnode_t* dir, vfs_vnode_t* node, vfs_type_t type) {
+    char path[VFS_PATH_MAX];
+    fat32_result_t result;
+    vfs_result_t status;
+
+    status = vfs_node_path(node, path, sizeof(path));
+    if (status != VFS_SUCCESS) {
+        return status;
+    }
+
+    if (type == VFS_TYPE_DIRECTORY) {
+        result = fat32_create_directory(path);
+    } else {
+        fat32_file_t* file = fat32_vfs_handle_alloc();
+        if (file == NULL) {
+            return VFS_ERROR_TOO_MANY_OPEN;
+        }
+        result = fat32_create_file(path, file);
+        if (result == FAT32_SUCCESS) {
+            result = fat32_close_file(file);
+        }
+        fat32_vfs_handle_free(file);
+    }
+    if (result != FAT32_SUCCESS) {
+        return fat32_vfs_result(result);
+    }
+    return fat32_vfs_lookup_locked(dir, node);
+}
+
+static vfs_result_t fat32_vfs_remove_locked(vfs_vnode_t* dir, vfs_vnode_t* node) {
+    char path[VFS_PATH_MAX];
+    vfs_result_t status;
+
+    (void)dir;
+    status = vfs_node_path(node, path, sizeof(path));
+    if (status != VFS_SUCCESS) {
+        return status;
+    }
+    if (node->type == VFS_TYPE_DIRECTORY) {
+        return fat32_vfs_result(fat32_delete_directory(path));
+    }
+    return fat32_vfs_result(fat32_delete_file(path));
+}
+
+static vfs_result_t fat32_vfs_rename_locked(vfs_vnode_t* node, vfs_vnode_t* new_dir, const char* new_name) {
+    char old_path[VFS_PATH_MAX];
+    char new_path[VFS_PATH_MAX];
+    vfs_result_t status;
+
+    status = vfs_node_path(node, old_path, sizeof(old_path));
+    if (status == VFS_SUCCESS) {
+        status = vfs_node_path(new_dir, new_path, sizeof(new_path));
+    }
+    if (status != VFS_SUCCESS) {
+        return status;
+    }
+    if (strlen(new_path) + strlen(new_name) + 2 > sizeof(new_path)) {
+        return VFS_ERROR_NAME_TOO_LONG;
+    }
+    if (strcmp(new_path, "/") != 0) {
+        strcat(new_path, "/");
+    }
+    strcat(new_path, new_name);
+
+    return fat32_vfs_result(fat32_rename_file(old_path, new_path));
+}
+
+static vfs_result_t fat32_vfs_open_locked(vfs_vnode_t* node, uint32_t flags, void** handle) {
+    char path[VFS_PATH_MAX];
+    fat32_file_t* file = (fat32_file_t*)node->data;
+    fat32_result_t result;
+    vfs_result_t status;
+    bool writable = (flags & (VFS_O_WRITE | VFS_O_APPEND)) != 0;
+
+    status = vfs_node_path(node, path, sizeof(path));
+    if (status != VFS_SUCCESS) {
+        return status;
+    }
+
+    /* Another open of the file: share its handle, reopening it for
+     * writing in place if it was read-only so far */
+    if (file) {
+        if (writable && !(file->access_mode & FAT32_MODE_WRITE)) {
+            fat32_close_file(file);
+            result = fat32_open_file_ex(path, file, (fat32_file_mode_t)(FAT32_MODE_READ | FAT32_MODE_WRITE));
+            if (result != FAT32_SUCCESS) {
+                /* Keep serving the readers */
+                fat32_open_file_ex(path, file, FAT32_MODE_READ);
+                return fat32_vfs_result(result);
+            }
+        }
+        fat32_vfs_handle_refs[file - fat32_vfs_handles]++;
+        *handle = file;
+        return VFS_SUCCESS;
+    }
+
+    file = fat32_vfs_handle_alloc();
+    if (file == NULL) {
+        return VFS_ERROR_TOO_MANY_OPEN;
+    }
+
+    /* The VFS keeps the position, so append is an ordinary write here */
+    if (node->type == VFS_TYPE_DIRECTORY) {
+        result = fat32_open_directory(path, file);
+    } else {
+        uint32_t mode = FAT32_MODE_READ;
+        if (writable) {
+            mode |= FAT32_MODE_WRITE;
+        }
+        result = fat32_open_file_ex(path, file, (fat32_file_mode_t)mode);
+    }
+    if (result != FAT32_SUCCESS) {
+        fat32_vfs_handle_free(file);
+        return fat32_vfs_result(result);
+    }
+
+    if (node->type == VFS_TYPE_FILE) {
+        node->data = file;
+    }
+    *handle = file;
+    return VFS_SUCCESS;
+}
+
+static void fat32_vfs_close_locked(vfs_vnode_t* node, void* handle) {
+    fat32_file_t* file = (fat32_file_t*)handle;
+
+    if (--fat32_vfs_handle_refs[file - fat32_vfs_handles] > 0) {
+        return;
+    }
+
+    fat32_close_file(file);
+    /* A new first cluster shows up once data was written */
+    if (node->type == VFS_TYPE_FILE) {
+        node->ino = file->first_cluster;
+        node->data = NULL;
+    }
+    fat32_vfs_handle_free(file);
+}
+
+static vfs_result_t fat32_vfs_read_locked(vfs_vnode_t* node, void* handle, uint32_t offset, void* buffer,
+                                          uint32_t size, uint32_t* done) {
+    fat32_file_t* file = (fat32_file_t*)handle;
+    fat32_result_t result;
+
+    (void)node;
+    if (file->position != offset) {
+        result = fat32_seek_file(file, offset);
+        if (result != FAT32_SUCCESS) {
+            return fat32_vfs_result(result);
+        }
+    }
+    result = fat32_read_file(file, buffer, size, done);
+    return result == FAT32_ERROR_EOF ? VFS_SUCCESS : fat32_vfs_result(result);
+}
+
+static vfs_result_t fat32_vfs_write_locked(vfs_vnode_t* node, void* handle, uint32_t offset,
+                                           const void* buffer, uint32_t size, uint32_t* done) {
+    fat32_file_t* file = (fat32_file_t*)handle;
+    fat32_result_t result;
+
+    (void)node;
+    if (file->position != offset) {
+        result = fat32_seek_file(file, offset);
+        if (result != FAT32_SUCCESS) {
+            return fat32_vfs_result(result);
+        }
+    }
+    return fat32_vfs_result(fat32_write_file(file, buffer, size, done));
+}
+
+static vfs_result_t fat32_vfs_readdir_locked(vfs_vnode_t* dir, void* handle, uint32_t index, vfs_dirent_t* entry) {
+    fat32_dir_entry_t raw;
+    fat32_result_t result;
+
+    /* The handle walks the directory in order, so index is not needed */
+    (void)dir;
+    (void)index;
+    result = fat32_read_directory((fat32_file_t*)handle, &raw, entry->name);
+    if (result != FAT32_SUCCESS) {
+        return fat32_vfs_result(result);
+    }
+    entry->type = (raw.attributes & FAT32_ATTR_DIRECTORY) ? VFS_TYPE_DIRECTORY : VFS_TYPE_FILE;
+    entry->size = raw.file_size;
+    entry->ino = fat32_get_first_cluster(&raw);
+    return VFS_SUCCESS;
+}
+
+static vfs_result_t fat32_vfs_truncate_locked(vfs_vnode_t* node, void* handle, uint32_t size) {
+    (void)node;
+    return fat32_vfs_result(fat32_truncate_file((fat32_file_t*)handle, size));
+}
+
+static vfs_result_t fat32_vfs_sync_locked(vfs_mount_t* mount, void* handle) {
+    (void)mount;
+    if (handle) {
+        return fat32_vfs_result(fat32_flush_file((fat32_file_t*)handle));
+    }
+    return fat32_vfs_result(fat32_flush_all_caches());
+}
+
+/* Entry points, each under the volume lock */
+static vfs_result_t fat32_vfs_mount(vfs_mount_t* mount, void* source, vfs_vnode_t* root) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_mount_locked(mount, source, root);
+    fat32_unlock();
+    return result;
+}
+
+static void fat32_vfs_unmount(vfs_mount_t* mount) {
+    fat32_lock();
+    fat32_vfs_unmount_locked(mount);
+    fat32_unlock();
+}
+
+static vfs_result_t fat32_vfs_lookup(vfs_vnode_t* dir, vfs_vnode_t* node) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_lookup_locked(dir, node);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_create(vfs_vnode_t* dir, vfs_vnode_t* node, vfs_type_t type) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_create_locked(dir, node, type);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_remove(vfs_vnode_t* dir, vfs_vnode_t* node) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_remove_locked(dir, node);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_rename(vfs_vnode_t* node, vfs_vnode_t* new_dir, const char* new_name) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_rename_locked(node, new_dir, new_name);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_open(vfs_vnode_t* node, uint32_t flags, void** handle) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_open_locked(node, flags, handle);
+    fat32_unlock();
+    return result;
+}
+
+static void fat32_vfs_close(vfs_vnode_t* node, void* handle) {
+    fat32_lock();
+    fat32_vfs_close_locked(node, handle);
+    fat32_unlock();
+}
+
+static vfs_result_t fat32_vfs_read(vfs_vnode_t* node, void* handle, uint32_t offset, void* buffer, uint32_t size,
+                                   uint32_t* done) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_read_locked(node, handle, offset, buffer, size, done);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_write(vfs_vnode_t* node, void* handle, uint32_t offset, const void* buffer,
+                                    uint32_t size, uint32_t* done) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_write_locked(node, handle, offset, buffer, size, done);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_readdir(vfs_vnode_t* dir, void* handle, uint32_t index, vfs_dirent_t* entry) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_readdir_locked(dir, handle, index, entry);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_truncate(vfs_vnode_t* node, void* handle, uint32_t size) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_truncate_locked(node, handle, size);
+    fat32_unlock();
+    return result;
+}
+
+static vfs_result_t fat32_vfs_sync(vfs_mount_t* mount, void* handle) {
+    vfs_result_t result;
+
+    fat32_lock();
+    result = fat32_vfs_sync_locked(mount, handle);
+    fat32_unlock();
+    return result;
+}
+
+static const vfs_ops_t fat32_vfs_ops = {
+    .mount = fat32_vfs_mount,
+    .unmount = fat32_vfs_unmount,
+    .lookup = fat32_vfs_lookup,
+    .create = fat32_vfs_create,
+    .remove = fat32_vfs_remove,
+    .rename = fat32_vfs_rename,
+    .open = fat32_vfs_open,
+    .close = fat32_vfs_close,
+    .read = fat32_vfs_read,
+    .write = fat32_vfs_write,
+    .readdir = fat32_vfs_readdir,
+    .truncate = fat32_vfs_truncate,
+    .sync = fat32_vfs_sync,
+    .release = NULL
+};
+
+/* Register the "fat32" filesystem type with the VFS */
+void fat32_vfs_register(void) {
+    vfs_register_filesystem("fat32", &fat32_vfs_ops, VFS_FS_CASE_INSENSITIVE);
+}
@@ -2,10 +2,16 @@
 #include "../../include/vga/vga.h"
 #include "../../include/terminal/terminal.h"
 #include "../../include/common/utils.h"
+#include "../../include/memory/memory.h"
+#include "../../include/timer/pit.h"
+#include "../../include/process/process.h"
 
 /* Global HDD controller state */
 static hdd_controller_t hdd_controller;
 
+/* Request queues, one per ATA channel */
+static hdd_channel_t hdd_channels[HDD_NUM_CHANNELS];
+
 /* Port I/O helper functions */
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -27,6 +33,42 @@ static inline uint16_t inw(uint16_t port) {
     return ret;
 }
 
+/* Transfer words from a port with a single string instruction */
+static inline void insw(uint16_t port, uint16_t* buffer, uint32_t count) {
+    __asm__ volatile("cld; rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+/* Transfer words to a port with a single string instruction */
+static inline void outsw(uint16_t port, const uint16_t* buffer, uint32_t count) {
+    __asm__ volatile("cld; rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+/* String I/O for the data phase; hdd_benchmark() clears it to time the
+ * old transfer of one inw/outw per word */
+static bool hdd_string_io = true;
+
+/* Move sector data from the drive */
+static void hdd_pio_in(uint16_t port, uint16_t* buffer, uint32_t count) {
+    if (hdd_string_io) {
+        insw(port, buffer, count);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        buffer[i] = inw(port);
+    }
+}
+
+/* Move sector data to the drive */
+static void hdd_pio_out(uint16_t port, const uint16_t* buffer, uint32_t count) {
+    if (hdd_string_io) {
+        outsw(port, buffer, count);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        outw(port, buffer[i]);
+    }
+}
+
 /* Simple delay function */
 static void io_delay(void) {
     inb(0x80);  /* Read from unused port for delay */
@@ -39,6 +81,11 @@ void hdd_initialize(void) {
     /* Clear controller structure */
     memset(&hdd_controller, 0, sizeof(hdd_controller_t));
     
+    /* Set up empty request queues */
+    memset(hdd_channels, 0, sizeof(hdd_channels));
+    hdd_channels[HDD_CHANNEL_PRIMARY].base_port = ATA_PRIMARY_BASE;
+    hdd_channels[HDD_CHANNEL_SECONDARY].base_port = ATA_SECONDARY_BASE;
+    
     /* Reset both ATA controllers */
     hdd_soft_reset(ATA_PRIMARY_BASE);
     hdd_soft_reset(ATA_SECONDARY_BASE);
@@ -64,6 +111,7 @@ bool hdd_detect_drives(void) {
         hdd_controller.drives_detected++;
         drives_found = true;
         terminal_writeline("✅ Primary Master drive detected");
+        hdd_set_multiple_mode(HDD_PRIMARY_MASTER, hdd_controller.primary_master.max_multiple_sectors);
     }
     
     /* Check Primary Slave */
@@ -72,6 +120,7 @@ bool hdd_detect_drives(void) {
         hdd_controller.drives_detected++;
         drives_found = true;
         terminal_writeline("✅ Primary Slave drive detected");
+        hdd_set_multiple_mode(HDD_PRIMARY_SLAVE, hdd_controller.primary_slave.max_multiple_sectors);
     }
     
     /* Check Secondary Master */
@@ -80,6 +129,7 @@ bool hdd_detect_drives(void) {
         hdd_controller.drives_detected++;
         drives_found = true;
         terminal_writeline("✅ Secondary Master drive detected");
+        hdd_set_multiple_mode(HDD_SECONDARY_MASTER, hdd_controller.secondary_master.max_multiple_sectors);
     }
     
     /* Check Secondary Slave */
@@ -88,6 +138,7 @@ bool hdd_detect_drives(void) {
         hdd_controller.drives_detected++;
         drives_found = true;
         terminal_writeline("✅ Secondary Slave drive detected");
+        hdd_set_multiple_mode(HDD_SECONDARY_SLAVE, hdd_controller.secondary_slave.max_multiple_sectors);
     }
     
     return drives_found;
@@ -96,7 +147,6 @@ bool hdd_detect_drives(void) {
 /* Identify a specific drive */
 hdd_result_t hdd_identify_drive(uint16_t base_port, uint8_t drive_select, hdd_drive_info_t* info) {
     uint16_t identify_data[256];
-    int i;
     
     if (!info) {
         return HDD_ERROR_BUFFER_NULL;
@@ -136,9 +186,7 @@ hdd_result_t hdd_identify_drive(uint16_t base_port, uint8_t drive_select, hdd_dr
     }
     
     /* Read identify data (256 words = 512 bytes) */
-    for (i = 0; i < 256; i++) {
-        identify_data[i] = inw(base_port);  /* Data register */
-    }
+    insw(base_port, identify_data, 256);
     
     /* Parse the identify data */
     hdd_parse_identify_data(identify_data, info);
@@ -183,19 +231,37 @@ void hdd_parse_identify_data(uint16_t* identify_data, hdd_drive_info_t* info) {
     /* Check DMA support (bit 8 of word 49) */
     info->dma_supported = (identify_data[49] & 0x0100) != 0;
     
-    /* Get total sectors (words 60-61 for LBA28) */
-    if (info->lba_supported) {
+    /* Largest READ/WRITE MULTIPLE block (word 47) and current setting (word 59) */
+    info->max_multiple_sectors = identify_data[47] & 0xFF;
+    if (identify_data[59] & 0x0100) {
+        info->multiple_sectors = identify_data[59] & 0xFF;
+    }
+    
+    /* Check 48-bit LBA feature set (bit 10 of word 83) */
+    info->lba48_supported = info->lba_supported && (identify_data[83] & 0x0400) != 0;
+    
+    /* Get total sectors (words 100-103 for LBA48, words 60-61 for LBA28) */
+    if (info->lba48_supported) {
+        /* Sector numbers are kept in 32 bits, which still covers 2 TB */
+        if (identify_data[102] != 0 || identify_data[103] != 0) {
+            info->total_sectors = 0xFFFFFFFF;
+        } else {
+            info->total_sectors = (uint32_t)identify_data[100] | 
+                                 ((uint32_t)identify_data[101] << 16);
+        }
+    } else if (info->lba_supported) {
         info->total_sectors = (uint32_t)identify_data[60] | 
                              ((uint32_t)identify_data[61] << 16);
-        info->total_size_mb = (info->total_sectors * HDD_SECTOR_SIZE) / (1024 * 1024);
     } else {
         /* For non-LBA drives, calculate from CHS parameters */
         uint16_t cylinders = identify_data[1];
         uint16_t heads = identify_data[3];
         uint16_t sectors = identify_data[6];
         info->total_sectors = cylinders * heads * sectors;
-        info->total_size_mb = (info->total_sectors * HDD_SECTOR_SIZE) / (1024 * 1024);
     }
+    
+    /* 2048 sectors per MB; avoids overflowing on drives over 4 GB */
+    info->total_size_mb = info->total_sectors / ((1024 * 1024) / HDD_SECTOR_SIZE);
 }
 
 /* Display information about detected drives */
@@ -222,6 +288,8 @@ void hdd_display_info(void) {
         terminal_writeline(num_str);
         terminal_writestring("LBA Support: ");
         terminal_writeline(hdd_controller.primary_master.lba_supported ? "Yes" : "No");
+        terminal_writestring("LBA48 Support: ");
+        terminal_writeline(hdd_controller.primary_master.lba48_supported ? "Yes" : "No");
     }
     
     /* Primary Slave */
@@ -238,6 +306,8 @@ void hdd_display_info(void) {
         terminal_writeline(num_str);
         terminal_writestring("LBA Support: ");
         terminal_writeline(hdd_controller.primary_slave.lba_supported ? "Yes" : "No");
+        terminal_writestring("LBA48 Support: ");
+        terminal_writeline(hdd_controller.primary_slave.lba48_supported ? "Yes" : "No");
     }
     
     /* Secondary Master */
@@ -254,6 +324,8 @@ void hdd_display_info(void) {
         terminal_writeline(num_str);
         terminal_writestring("LBA Support: ");
         terminal_writeline(hdd_controller.secondary_master.lba_supported ? "Yes" : "No");
+        terminal_writestring("LBA48 Support: ");
+        terminal_writeline(hdd_controller.secondary_master.lba48_supported ? "Yes" : "No");
     }
     
     /* Secondary Slave */
@@ -270,6 +342,8 @@ void hdd_display_info(void) {
         terminal_writeline(num_str);
         terminal_writestring("LBA Support: ");
         terminal_writeline(hdd_controller.secondary_slave.lba_supported ? "Yes" : "No");
+        terminal_writestring("LBA48 Support: ");
+        terminal_writeline(hdd_controller.secondary_slave.lba48_supported ? "Yes" : "No");
     }
     
     terminal_writeline("===============================\n");
@@ -289,30 +363,51 @@ static hdd_drive_info_t* hdd_get_drive_info(uint8_t drive) {
     }
 }
 
-/* Read sectors from HDD */
-hdd_result_t hdd_read_sectors(uint8_t drive, uint32_t lba, uint8_t sector_count, uint16_t* buffer) {
-    hdd_drive_info_t* drive_info;
-    uint16_t base_port;
-    int i, j;
+/* Select LBA48 for requests the 28-bit command set cannot address */
+static bool hdd_use_lba48(hdd_drive_info_t* drive_info, uint32_t lba, uint32_t sector_count) {
+    if (!drive_info->lba48_supported) {
+        return false;
+    }
     
+    return sector_count > HDD_MAX_SECTORS ||
+           lba + sector_count > HDD_LBA28_SECTORS;
+}
+
+/* Validate a transfer and return the drive it targets */
+static hdd_result_t hdd_check_request(uint8_t drive, uint32_t lba, uint32_t sector_count,
+                                      uint16_t* buffer, hdd_drive_info_t** drive_info) {
     /* Validate parameters */
-    if (!buffer || sector_count == 0 || sector_count > HDD_MAX_SECTORS) {
+    if (!buffer || sector_count == 0) {
         return HDD_ERROR_BUFFER_NULL;
     }
     
     /* Get drive information */
-    drive_info = hdd_get_drive_info(drive);
-    if (!drive_info) {
+    *drive_info = hdd_get_drive_info(drive);
+    if (!*drive_info) {
         return HDD_ERROR_INVALID_DRIVE;
     }
     
-    /* Check sector bounds */
-    if (lba >= drive_info->total_sectors || 
-        (lba + sector_count) > drive_info->total_sectors) {
+    /* Check sector bounds (written to avoid lba + count overflow) */
+    if (lba >= (*drive_info)->total_sectors || 
+        sector_count > (*drive_info)->total_sectors - lba) {
+        return HDD_ERROR_INVALID_SECTOR;
+    }
+    
+    /* Without LBA48 nothing past the 28-bit limit is reachable */
+    if (!(*drive_info)->lba48_supported && lba + sector_count > HDD_LBA28_SECTORS) {
         return HDD_ERROR_INVALID_SECTOR;
     }
     
-    base_port = drive_info->base_port;
+    return HDD_SUCCESS;
+}
+
+/* Program the task file and send a read/write command
+ * sector_count is at most HDD_MAX_SECTORS_LBA48 (lba48) or HDD_MAX_SECTORS;
+ * the maximum is encoded as 0 in the sector count register. */
+static hdd_result_t hdd_issue_command(hdd_drive_info_t* drive_info, uint32_t lba,
+                                      uint32_t sector_count, bool lba48,
+                                      uint8_t command28, uint8_t command48) {
+    uint16_t base_port = drive_info->base_port;
     
     /* Select drive */
     hdd_select_drive(base_port, drive_info->drive_select);
@@ -322,108 +417,582 @@ hdd_result_t hdd_read_sectors(uint8_t drive, uint32_t lba, uint8_t sector_count,
         return HDD_ERROR_NOT_READY;
     }
     
-    /* Set up LBA parameters */
-    outb(base_port + 2, sector_count);              /* Sector count */
-    outb(base_port + 3, lba & 0xFF);                /* LBA low */
-    outb(base_port + 4, (lba >> 8) & 0xFF);         /* LBA mid */
-    outb(base_port + 5, (lba >> 16) & 0xFF);        /* LBA high */
-    outb(base_port + 6, 0xE0 | (drive & 1) << 4 | ((lba >> 24) & 0x0F)); /* Drive/head */
+    if (lba48) {
+        /* High-order bytes first, then low-order bytes (FIFO registers) */
+        outb(base_port + 2, (sector_count >> 8) & 0xFF);    /* Sector count high */
+        outb(base_port + 3, (lba >> 24) & 0xFF);            /* LBA bits 24-31 */
+        outb(base_port + 4, 0);                             /* LBA bits 32-39 */
+        outb(base_port + 5, 0);                             /* LBA bits 40-47 */
+        outb(base_port + 2, sector_count & 0xFF);           /* Sector count low */
+        outb(base_port + 3, lba & 0xFF);                    /* LBA bits 0-7 */
+        outb(base_port + 4, (lba >> 8) & 0xFF);             /* LBA bits 8-15 */
+        outb(base_port + 5, (lba >> 16) & 0xFF);            /* LBA bits 16-23 */
+        outb(base_port + 6, drive_info->drive_select | ATA_LBA_MODE); /* Drive */
+        
+        outb(base_port + 7, command48);
+    } else {
+        outb(base_port + 2, sector_count & 0xFF);           /* Sector count */
+        outb(base_port + 3, lba & 0xFF);                    /* LBA low */
+        outb(base_port + 4, (lba >> 8) & 0xFF);             /* LBA mid */
+        outb(base_port + 5, (lba >> 16) & 0xFF);            /* LBA high */
+        outb(base_port + 6, drive_info->drive_select | ATA_LBA_MODE | 
+                            ((lba >> 24) & 0x0F));          /* Drive/head */
+        
+        outb(base_port + 7, command28);
+    }
+    
+    return HDD_SUCCESS;
+}
+
+/* Read the alternate status register four times (~400ns) so the
+ * status register reflects a command or data block just sent */
+static void hdd_delay_400ns(uint16_t base_port) {
+    inb(base_port + 0x206);
+    inb(base_port + 0x206);
+    inb(base_port + 0x206);
+    inb(base_port + 0x206);
+}
+
+/* Sectors moved per DRQ block for a drive */
+static uint32_t hdd_block_sectors(hdd_drive_info_t* drive_info) {
+    return drive_info->multiple_sectors > 1 ? drive_info->multiple_sectors : 1;
+}
+
+/* Start the next command of a request (read, write or flush) */
+static hdd_result_t hdd_request_start_command(hdd_channel_t* channel, hdd_request_t* request) {
+    hdd_drive_info_t* drive_info = hdd_get_drive_info(request->drive);
+    hdd_result_t result;
+    
+    if (request->op == HDD_REQUEST_FLUSH || request->flushing) {
+        hdd_select_drive(channel->base_port, drive_info->drive_select);
+        outb(channel->base_port + 7, 
+             drive_info->lba48_supported ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+        hdd_delay_400ns(channel->base_port);
+        return HDD_SUCCESS;
+    }
+    
+    uint32_t lba = request->lba + request->sectors_done;
+    uint32_t remaining = request->sector_count - request->sectors_done;
+    bool lba48 = hdd_use_lba48(drive_info, lba, remaining);
+    uint32_t max_sectors = lba48 ? HDD_MAX_SECTORS_LBA48 : HDD_MAX_SECTORS;
+    bool block_mode = drive_info->multiple_sectors > 1;
+    
+    request->command_lba = lba;
+    request->command_sectors = remaining < max_sectors ? remaining : max_sectors;
+    request->command_done = 0;
+    
+    if (request->op == HDD_REQUEST_READ) {
+        result = hdd_issue_command(drive_info, lba, request->command_sectors, lba48,
+                                   block_mode ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS,
+                                   block_mode ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_SECTORS_EXT);
+        hdd_delay_400ns(channel->base_port);
+        return result;
+    }
+    
+    result = hdd_issue_command(drive_info, lba, request->command_sectors, lba48,
+                               block_mode ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS,
+                               block_mode ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_SECTORS_EXT);
+    if (result != HDD_SUCCESS) {
+        return result;
+    }
+    
+    /* The first block of a write is requested without an interrupt */
+    if (!hdd_wait_drq(channel->base_port)) {
+        return HDD_ERROR_TIMEOUT;
+    }
+    
+    uint32_t sectors = hdd_block_sectors(drive_info);
+    if (sectors > request->command_sectors) {
+        sectors = request->command_sectors;
+    }
+    hdd_pio_out(channel->base_port, request->buffer + request->sectors_done * 256, sectors * 256);
+    request->command_done = sectors;
+    request->sectors_done += sectors;
+    hdd_delay_400ns(channel->base_port);
     
-    /* Send read command */
-    outb(base_port + 7, ATA_CMD_READ_SECTORS);
+    return HDD_SUCCESS;
+}
+
+/* Finish the active request and start the next one in the queue
+ * Must be called with interrupts disabled. */
+static void hdd_request_complete(hdd_channel_t* channel, hdd_result_t result) {
+    hdd_request_t* request = channel->head;
+    
+    while (request) {
+        channel->head = request->next;
+        if (!channel->head) {
+            channel->tail = NULL;
+        }
+        request->next = NULL;
+        request->result = result;
+        request->done = true;
+        channel->requests_completed++;
+        channel->progress++;
+        
+        if (request->callback) {
+            request->callback(request);
+        }
+        
+        /* Start the next queued request; fail it and move on if that errors */
+        request = channel->head;
+        if (!request) {
+            break;
+        }
+        result = hdd_request_start_command(channel, request);
+        if (result == HDD_SUCCESS) {
+            break;
+        }
+    }
+}
+
+/* Advance the active request according to the drive status
+ * Driven from the channel interrupt or by polling; must be called with
+ * interrupts disabled. Reading the status register acknowledges the drive. */
+static void hdd_channel_service(hdd_channel_t* channel) {
+    hdd_request_t* request = channel->head;
+    uint8_t status = inb(channel->base_port + 7);
+    
+    if (!request || (status & ATA_STATUS_BSY)) {
+        return;
+    }
     
-    /* Read each sector */
-    for (i = 0; i < sector_count; i++) {
-        /* Wait for data ready */
-        if (!hdd_wait_drq(base_port)) {
-            return HDD_ERROR_TIMEOUT;
+    if (status & ATA_STATUS_DF) {
+        hdd_request_complete(channel, HDD_ERROR_DRIVE_FAULT);
+        return;
+    }
+    if (status & ATA_STATUS_ERR) {
+        hdd_request_complete(channel, HDD_ERROR_BAD_SECTOR);
+        return;
+    }
+    
+    if (request->op == HDD_REQUEST_FLUSH || request->flushing) {
+        hdd_request_complete(channel, HDD_SUCCESS);
+        return;
+    }
+    
+    hdd_drive_info_t* drive_info = hdd_get_drive_info(request->drive);
+    uint32_t sectors = hdd_block_sectors(drive_info);
+    
+    if (request->op == HDD_REQUEST_READ) {
+        /* Nothing to do until the drive has a block ready */
+        if (!(status & ATA_STATUS_DRQ)) {
+            return;
         }
         
-        /* Check for errors */
-        uint8_t status = hdd_get_status(base_port);
-        if (status & ATA_STATUS_ERR) {
-            return HDD_ERROR_BAD_SECTOR;
+        if (sectors > request->command_sectors - request->command_done) {
+            sectors = request->command_sectors - request->command_done;
         }
+        hdd_pio_in(channel->base_port, request->buffer + request->sectors_done * 256, sectors * 256);
+        request->command_done += sectors;
+        request->sectors_done += sectors;
+        channel->progress++;
+        hdd_delay_400ns(channel->base_port);
         
-        /* Read 256 words (512 bytes) */
-        for (j = 0; j < 256; j++) {
-            buffer[i * 256 + j] = inw(base_port);
+        if (request->command_done < request->command_sectors) {
+            return;
+        }
+    } else {
+        /* Drive wants the next block of the current command */
+        if (status & ATA_STATUS_DRQ) {
+            if (request->command_done >= request->command_sectors) {
+                hdd_request_complete(channel, HDD_ERROR_DRIVE_FAULT);
+                return;
+            }
+            if (sectors > request->command_sectors - request->command_done) {
+                sectors = request->command_sectors - request->command_done;
+            }
+            hdd_pio_out(channel->base_port, request->buffer + request->sectors_done * 256, sectors * 256);
+            request->command_done += sectors;
+            request->sectors_done += sectors;
+            channel->progress++;
+            hdd_delay_400ns(channel->base_port);
+            return;
+        }
+        
+        /* Last block not yet sent: interrupt for a block the drive is still taking */
+        if (request->command_done < request->command_sectors) {
+            return;
         }
     }
     
-    return HDD_SUCCESS;
+    /* Current command finished: start the next one, the flush, or complete */
+    if (request->sectors_done < request->sector_count) {
+        hdd_result_t result = hdd_request_start_command(channel, request);
+        if (result != HDD_SUCCESS) {
+            hdd_request_complete(channel, result);
+        }
+    } else if (request->op == HDD_REQUEST_WRITE) {
+        request->flushing = true;
+        hdd_request_start_command(channel, request);
+    } else {
+        hdd_request_complete(channel, HDD_SUCCESS);
+    }
+}
+
+/* Interrupt entry point for an ATA channel */
+void hdd_irq_handler(uint8_t channel) {
+    if (channel >= HDD_NUM_CHANNELS) {
+        return;
+    }
+    
+    hdd_channels[channel].irq_count++;
+    hdd_channel_service(&hdd_channels[channel]);
+}
+
+/* Save EFLAGS and disable interrupts */
+static inline uint32_t hdd_irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt flag saved by hdd_irq_save() */
+static inline void hdd_irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
 }
 
-/* Write sectors to HDD */
-hdd_result_t hdd_write_sectors(uint8_t drive, uint32_t lba, uint8_t sector_count, uint16_t* buffer) {
+/* Queue a request on its drive's channel; starts it if the channel is idle */
+hdd_result_t hdd_submit_request(hdd_request_t* request) {
     hdd_drive_info_t* drive_info;
-    uint16_t base_port;
-    int i, j;
+    hdd_channel_t* channel;
+    hdd_result_t result;
+    uint32_t flags;
     
-    /* Validate parameters */
-    if (!buffer || sector_count == 0 || sector_count > HDD_MAX_SECTORS) {
+    if (!request) {
         return HDD_ERROR_BUFFER_NULL;
     }
     
-    /* Get drive information */
-    drive_info = hdd_get_drive_info(drive);
-    if (!drive_info) {
-        return HDD_ERROR_INVALID_DRIVE;
+    if (request->op == HDD_REQUEST_FLUSH) {
+        result = hdd_get_drive_info(request->drive) ? HDD_SUCCESS : HDD_ERROR_INVALID_DRIVE;
+    } else {
+        result = hdd_check_request(request->drive, request->lba, request->sector_count,
+                                   request->buffer, &drive_info);
+    }
+    if (result != HDD_SUCCESS) {
+        request->result = result;
+        request->done = true;
+        return result;
     }
     
-    /* Check sector bounds */
-    if (lba >= drive_info->total_sectors || 
-        (lba + sector_count) > drive_info->total_sectors) {
-        return HDD_ERROR_INVALID_SECTOR;
+    channel = &hdd_channels[request->drive >> 1];
+    
+    request->done = false;
+    request->result = HDD_SUCCESS;
+    request->sectors_done = 0;
+    request->command_done = 0;
+    request->command_sectors = 0;
+    request->flushing = false;
+    request->next = NULL;
+    
+    flags = hdd_irq_save();
+    
+    if (channel->tail) {
+        channel->tail->next = request;
+        channel->tail = request;
+    } else {
+        channel->head = request;
+        channel->tail = request;
+        result = hdd_request_start_command(channel, request);
+        if (result != HDD_SUCCESS) {
+            hdd_request_complete(channel, result);
+        }
     }
     
-    base_port = drive_info->base_port;
+    hdd_irq_restore(flags);
+    return HDD_SUCCESS;
+}
+
+/* Return a channel to a known idle state after abandoning its active
+ * command: the drive may still be BSY or holding DRQ for it. A software
+ * reset also drops the block size, so SET MULTIPLE is issued again. */
+static void hdd_channel_reset(hdd_channel_t* channel) {
+    uint8_t first_drive = (uint8_t)((channel - hdd_channels) * 2);
+    
+    hdd_soft_reset(channel->base_port);
+    
+    for (uint8_t drive = first_drive; drive < first_drive + 2; drive++) {
+        hdd_drive_info_t* drive_info = hdd_get_drive_info(drive);
+        if (drive_info && drive_info->multiple_sectors > 1) {
+            hdd_set_multiple_mode(drive, drive_info->multiple_sectors);
+        }
+    }
+}
+
+/* Take a request off its channel and complete it with result, running its
+ * callback as a normal completion would. The active request is abandoned,
+ * the channel reset and the next queued one started. Returns false if the
+ * request had already completed. */
+bool hdd_cancel_request(hdd_request_t* request, hdd_result_t result) {
+    hdd_channel_t* channel;
+    hdd_request_t** link;
+    uint32_t flags;
+    
+    if (!request) {
+        return false;
+    }
     
-    /* Select drive */
-    hdd_select_drive(base_port, drive_info->drive_select);
+    channel = &hdd_channels[request->drive >> 1];
+    flags = hdd_irq_save();
     
-    /* Wait for drive ready */
-    if (!hdd_wait_ready(base_port)) {
-        return HDD_ERROR_NOT_READY;
+    if (request->done) {
+        hdd_irq_restore(flags);
+        return false;
     }
     
-    /* Set up LBA parameters */
-    outb(base_port + 2, sector_count);              /* Sector count */
-    outb(base_port + 3, lba & 0xFF);                /* LBA low */
-    outb(base_port + 4, (lba >> 8) & 0xFF);         /* LBA mid */
-    outb(base_port + 5, (lba >> 16) & 0xFF);        /* LBA high */
-    outb(base_port + 6, 0xE0 | (drive & 1) << 4 | ((lba >> 24) & 0x0F)); /* Drive/head */
+    if (channel->head == request) {
+        hdd_channel_reset(channel);
+        hdd_request_complete(channel, result);
+        hdd_irq_restore(flags);
+        return true;
+    }
     
-    /* Send write command */
-    outb(base_port + 7, ATA_CMD_WRITE_SECTORS);
+    /* Queued behind the active request: unlink it */
+    for (link = (hdd_request_t**)&channel->head; *link && *link != request; link = &(*link)->next);
+    if (*link) {
+        *link = request->next;
+        if (channel->tail == request) {
+            channel->tail = NULL;
+            for (hdd_request_t* walk = channel->head; walk; walk = walk->next) {
+                channel->tail = walk;
+            }
+        }
+    }
+    request->next = NULL;
+    request->result = result;
+    request->done = true;
+    channel->requests_completed++;
+    if (request->callback) {
+        request->callback(request);
+    }
     
-    /* Write each sector */
-    for (i = 0; i < sector_count; i++) {
-        /* Wait for data ready */
-        if (!hdd_wait_drq(base_port)) {
-            return HDD_ERROR_TIMEOUT;
+    hdd_irq_restore(flags);
+    return true;
+}
+
+/* Wait for a submitted request to finish and return its result
+ * With interrupts enabled other processes run while the transfer is in
+ * flight; with interrupts disabled (early boot) the channel is polled.
+ * The timeout restarts whenever the channel makes progress on any request,
+ * so a request queued behind a long transfer does not expire. On timeout
+ * the request is cancelled, so it is off the queue when this returns. */
+hdd_result_t hdd_wait_request(hdd_request_t* request) {
+    hdd_channel_t* channel;
+    uint32_t flags;
+    uint32_t progress;
+    uint32_t timeout_ticks;
+    uint32_t deadline;
+    uint32_t idle_loops = 0;
+    
+    if (!request) {
+        return HDD_ERROR_BUFFER_NULL;
+    }
+    
+    channel = &hdd_channels[request->drive >> 1];
+    timeout_ticks = (HDD_REQUEST_TIMEOUT_MS * timer_frequency) / 1000 + 1;
+    flags = hdd_irq_save();
+    progress = channel->progress;
+    deadline = timer_get_ticks() + timeout_ticks;
+    
+    while (!request->done) {
+        /* Poll as well, so a lost interrupt cannot stall the request */
+        hdd_channel_service(channel);
+        if (request->done) {
+            break;
         }
         
-        /* Check for errors */
-        uint8_t status = hdd_get_status(base_port);
-        if (status & ATA_STATUS_ERR) {
-            return HDD_ERROR_BAD_SECTOR;
+        /* Ticks only advance with interrupts on; otherwise count iterations */
+        if (channel->progress != progress) {
+            progress = channel->progress;
+            deadline = timer_get_ticks() + timeout_ticks;
+            idle_loops = 0;
+        } else if (((flags & 0x200) && timer_frequency != 0) ? (int32_t)(timer_get_ticks() - deadline) >= 0
+                                                              : ++idle_loops > HDD_REQUEST_POLL_TIMEOUT) {
+            hdd_irq_restore(flags);
+            hdd_cancel_request(request, HDD_ERROR_TIMEOUT);
+            return request->result;
         }
         
-        /* Write 256 words (512 bytes) */
-        for (j = 0; j < 256; j++) {
-            outw(base_port, buffer[i * 256 + j]);
+        if (!(flags & 0x200)) {
+            io_delay();
+        } else if (get_current_process()) {
+            hdd_irq_restore(flags);
+            process_yield();
+            hdd_irq_save();
+        } else {
+            /* sti takes effect after hlt starts, so the wakeup cannot be missed */
+            __asm__ volatile("sti; hlt; cli" : : : "memory");
         }
     }
     
-    /* Flush cache to ensure data is written */
-    outb(base_port + 7, ATA_CMD_FLUSH_CACHE);
-    if (!hdd_wait_ready(base_port)) {
-        return HDD_ERROR_TIMEOUT;
+    hdd_irq_restore(flags);
+    return request->result;
+}
+
+/* Run a request to completion */
+static hdd_result_t hdd_transfer(hdd_request_op_t op, uint8_t drive, uint32_t lba,
+                                 uint32_t sector_count, uint16_t* buffer) {
+    hdd_request_t request;
+    
+    memset(&request, 0, sizeof(hdd_request_t));
+    request.op = op;
+    request.drive = drive;
+    request.lba = lba;
+    request.sector_count = sector_count;
+    request.buffer = buffer;
+    
+    if (hdd_submit_request(&request) != HDD_SUCCESS) {
+        return request.result;
+    }
+    
+    return hdd_wait_request(&request);
+}
+
+/* Read sectors from HDD */
+hdd_result_t hdd_read_sectors(uint8_t drive, uint32_t lba, uint32_t sector_count, uint16_t* buffer) {
+    return hdd_transfer(HDD_REQUEST_READ, drive, lba, sector_count, buffer);
+}
+
+/* Write sectors to HDD (the drive cache is flushed before completion) */
+hdd_result_t hdd_write_sectors(uint8_t drive, uint32_t lba, uint32_t sector_count, uint16_t* buffer) {
+    return hdd_transfer(HDD_REQUEST_WRITE, drive, lba, sector_count, buffer);
+}
+
+/* Flush the drive's write cache */
+hdd_result_t hdd_flush_cache(uint8_t drive) {
+    return hdd_transfer(HDD_REQUEST_FLUSH, drive, 0, 0, NULL);
+}
+
+/* Copy pipeline over two chunk buffers
+ * The read of chunk N+1 is queued on the source channel while chunk N is
+ * written on the destination channel, so drives on different channels
+ * transfer at the same time. */
+static hdd_result_t hdd_copy_pipeline(uint8_t src_drive, uint32_t src_lba, uint8_t dst_drive, uint32_t dst_lba,
+                                      uint32_t sector_count, uint16_t* copy_buffers[2]) {
+    hdd_request_t read_request, write_request;
+    hdd_result_t result;
+    uint32_t offset = 0;
+    uint32_t count;
+    int current = 0;
+    
+    /* Prime the pipeline with the first chunk */
+    count = sector_count < HDD_COPY_CHUNK ? sector_count : HDD_COPY_CHUNK;
+    result = hdd_read_sectors(src_drive, src_lba, count, copy_buffers[current]);
+    if (result != HDD_SUCCESS) {
+        return result;
+    }
+    
+    while (offset < sector_count) {
+        uint32_t next_offset = offset + count;
+        uint32_t next_count = 0;
+        
+        memset(&write_request, 0, sizeof(hdd_request_t));
+        write_request.op = HDD_REQUEST_WRITE;
+        write_request.drive = dst_drive;
+        write_request.lba = dst_lba + offset;
+        write_request.sector_count = count;
+        write_request.buffer = copy_buffers[current];
+        hdd_submit_request(&write_request);
+        
+        if (next_offset < sector_count) {
+            next_count = sector_count - next_offset;
+            if (next_count > HDD_COPY_CHUNK) {
+                next_count = HDD_COPY_CHUNK;
+            }
+            
+            memset(&read_request, 0, sizeof(hdd_request_t));
+            read_request.op = HDD_REQUEST_READ;
+            read_request.drive = src_drive;
+            read_request.lba = src_lba + next_offset;
+            read_request.sector_count = next_count;
+            read_request.buffer = copy_buffers[current ^ 1];
+            hdd_submit_request(&read_request);
+        }
+        
+        result = hdd_wait_request(&write_request);
+        if (next_count > 0) {
+            hdd_result_t read_result = hdd_wait_request(&read_request);
+            if (result == HDD_SUCCESS) {
+                result = read_result;
+            }
+        }
+        if (result != HDD_SUCCESS) {
+            return result;
+        }
+        
+        offset = next_offset;
+        count = next_count;
+        current ^= 1;
     }
     
     return HDD_SUCCESS;
-}/* High-level single sector read */
+}
+
+/* Copy sectors between drives with two buffers in flight
+ * The buffers come from the page pool for each call, so concurrent copies
+ * never share them. */
+hdd_result_t hdd_copy_sectors(uint8_t src_drive, uint32_t src_lba,
+                              uint8_t dst_drive, uint32_t dst_lba, uint32_t sector_count) {
+    uint32_t pages = (2 * HDD_COPY_CHUNK * HDD_SECTOR_SIZE + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    uint16_t* copy_buffers[2];
+    hdd_result_t result;
+    
+    if (sector_count == 0) {
+        return HDD_SUCCESS;
+    }
+    
+    copy_buffers[0] = (uint16_t*)memory_alloc_pages(pages);
+    if (!copy_buffers[0]) {
+        return HDD_ERROR_NO_MEMORY;
+    }
+    copy_buffers[1] = copy_buffers[0] + HDD_COPY_CHUNK * 256;
+    
+    result = hdd_copy_pipeline(src_drive, src_lba, dst_drive, dst_lba, sector_count, copy_buffers);
+    memory_free_pages(copy_buffers[0], pages);
+    return result;
+}
+
+/* Set the number of sectors transferred per DRQ block (0 disables block mode)
+ * Issued directly, so only call it while the drive's channel is idle. */
+hdd_result_t hdd_set_multiple_mode(uint8_t drive, uint8_t sectors_per_block) {
+    hdd_drive_info_t* drive_info = hdd_get_drive_info(drive);
+    
+    if (!drive_info) {
+        return HDD_ERROR_INVALID_DRIVE;
+    }
+    
+    if (sectors_per_block <= 1) {
+        drive_info->multiple_sectors = 0;
+        return HDD_SUCCESS;
+    }
+    
+    /* Block size must be a power of two the drive can handle */
+    if (sectors_per_block > drive_info->max_multiple_sectors ||
+        (sectors_per_block & (sectors_per_block - 1)) != 0) {
+        return HDD_ERROR_UNSUPPORTED;
+    }
+    
+    hdd_select_drive(drive_info->base_port, drive_info->drive_select);
+    if (!hdd_wait_ready(drive_info->base_port)) {
+        return HDD_ERROR_NOT_READY;
+    }
+    
+    outb(drive_info->base_port + 2, sectors_per_block);
+    outb(drive_info->base_port + 7, ATA_CMD_SET_MULTIPLE_MODE);
+    
+    if (!hdd_wait_ready(drive_info->base_port) ||
+        (hdd_get_status(drive_info->base_port) & ATA_STATUS_ERR)) {
+        /* Drive rejected the block size; fall back to one sector per DRQ */
+        drive_info->multiple_sectors = 0;
+        return HDD_ERROR_UNSUPPORTED;
+    }
+    
+    drive_info->multiple_sectors = sectors_per_block;
+    return HDD_SUCCESS;
+}
+
+/* High-level single sector read */
 hdd_result_t hdd_read_sector(uint8_t drive, uint32_t lba, void* buffer) {
     return hdd_read_sectors(drive, lba, 1, (uint16_t*)buffer);
 }
@@ -524,6 +1093,8 @@ const char* hdd_get_error_string(hdd_result_t error) {
             return "Invalid sector";
         case HDD_ERROR_BUFFER_NULL:
             return "NULL buffer";
+        case HDD_ERROR_NO_MEMORY:
+            return "Out of memory";
         default:
             return "Unknown error";
     }
@@ -543,4 +1114,101 @@ hdd_result_t hdd_get_drive_size(uint8_t drive, uint32_t* total_sectors) {
     
     *total_sectors = drive_info->total_sectors;
     return HDD_SUCCESS;
-}
\ No newline at end of file
+}
+
+/* Time one sequential read pass and return elapsed milliseconds */
+static uint32_t hdd_benchmark_pass(uint8_t drive, uint32_t sector_count, uint16_t* buffer) {
+    uint32_t start = timer_get_ticks();
+    uint32_t lba;
+    
+    for (lba = 0; lba < sector_count; lba += HDD_BENCHMARK_CHUNK) {
+        uint32_t count = sector_count - lba;
+        if (count > HDD_BENCHMARK_CHUNK) {
+            count = HDD_BENCHMARK_CHUNK;
+        }
+        if (hdd_read_sectors(drive, lba, count, buffer) != HDD_SUCCESS) {
+            return 0;
+        }
+    }
+    
+    return ((timer_get_ticks() - start) * 1000) / timer_frequency;
+}
+
+/* Print throughput for a finished pass */
+static void hdd_benchmark_report(const char* label, uint32_t sector_count, uint32_t elapsed_ms) {
+    char num_str[16];
+    uint32_t kb_per_sec;
+    
+    terminal_writestring(label);
+    if (elapsed_ms == 0) {
+        terminal_writeline("too fast to measure (or read failed)");
+        return;
+    }
+    
+    kb_per_sec = ((sector_count / 2) * 1000) / elapsed_ms;
+    int_to_string(kb_per_sec / 1024, num_str);
+    terminal_writestring(num_str);
+    terminal_writestring(".");
+    int_to_string(((kb_per_sec % 1024) * 10) / 1024, num_str);
+    terminal_writestring(num_str);
+    terminal_writestring(" MB/s (");
+    int_to_string(elapsed_ms, num_str);
+    terminal_writestring(num_str);
+    terminal_writeline(" ms)");
+}
+
+/* Sequential read benchmark: the old transfer (one inw per word, one DRQ
+ * per sector) against string I/O, then string I/O in block mode.
+ * Needs the timer interrupt running to measure elapsed time. */
+void hdd_benchmark(uint8_t drive, uint32_t sector_count) {
+    uint32_t pages = (HDD_BENCHMARK_CHUNK * HDD_SECTOR_SIZE + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    hdd_drive_info_t* drive_info = hdd_get_drive_info(drive);
+    uint16_t* buffer;
+    uint8_t saved_block;
+    uint32_t elapsed_ms;
+    char num_str[16];
+    
+    if (!drive_info || timer_frequency == 0) {
+        terminal_writeline("HDD benchmark: drive or timer not available");
+        return;
+    }
+    
+    buffer = (uint16_t*)memory_alloc_pages(pages);
+    if (!buffer) {
+        terminal_writeline("HDD benchmark: out of memory");
+        return;
+    }
+    
+    if (sector_count > drive_info->total_sectors) {
+        sector_count = drive_info->total_sectors;
+    }
+    
+    terminal_writestring("\n=== HDD Benchmark: ");
+    int_to_string(sector_count / 2, num_str);
+    terminal_writestring(num_str);
+    terminal_writeline(" KB sequential read ===");
+    
+    saved_block = drive_info->multiple_sectors;
+    
+    /* Before: READ SECTORS, one DRQ wait per sector, one inw per word */
+    hdd_set_multiple_mode(drive, 0);
+    hdd_string_io = false;
+    elapsed_ms = hdd_benchmark_pass(drive, sector_count, buffer);
+    hdd_benchmark_report("Per-word PIO:      ", sector_count, elapsed_ms);
+    
+    /* rep insw for each sector */
+    hdd_string_io = true;
+    elapsed_ms = hdd_benchmark_pass(drive, sector_count, buffer);
+    hdd_benchmark_report("String PIO:        ", sector_count, elapsed_ms);
+    
+    /* After: READ MULTIPLE with the drive's block size */
+    if (hdd_set_multiple_mode(drive, drive_info->max_multiple_sectors) == HDD_SUCCESS) {
+        elapsed_ms = hdd_benchmark_pass(drive, sector_count, buffer);
+        hdd_benchmark_report("Block-mode PIO:    ", sector_count, elapsed_ms);
+    } else {
+        terminal_writeline("Block-mode PIO:    not supported by drive");
+    }
+    
+    hdd_set_multiple_mode(drive, saved_block);
+    memory_free_pages(buffer, pages);
+}
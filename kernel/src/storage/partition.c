@@ -0,0 +1,250 @@
+/*
+ * Partition Tables
+ * ChanUX Operating System
+ *
+ * Parses MBR (primary and logical partitions) and GPT tables and registers
+ * each partition as an offset block device on top of its disk.
+ */
+
+#include "../../include/storage/partition.h"
+#include "../../include/common/utils.h"
+
+/* Registered partitions */
+static partition_info_t partitions[PARTITION_MAX_ENTRIES];
+static uint32_t partition_count = 0;
+
+/* Sector buffer for table reads */
+static uint8_t partition_sector[BLOCK_SECTOR_SIZE] __attribute__((aligned(4)));
+
+/* Register one partition as "<disk><number>" */
+static bool partition_add(block_device_t* disk, partition_scheme_t scheme, uint8_t number,
+                          uint32_t first_lba, uint32_t sector_count) {
+    char name[BLOCK_NAME_LENGTH];
+    char number_str[12];
+    block_device_t* device;
+
+    if (partition_count >= PARTITION_MAX_ENTRIES) {
+        return false;
+    }
+
+    int_to_string(number, number_str);
+    if (strlen(disk->name) + strlen(number_str) >= BLOCK_NAME_LENGTH) {
+        return false;
+    }
+    strcpy(name, disk->name);
+    strcat(name, number_str);
+
+    device = block_create_partition(disk, name, first_lba, sector_count);
+    if (!device) {
+        return false;
+    }
+
+    partition_info_t* info = &partitions[partition_count++];
+    memset(info, 0, sizeof(partition_info_t));
+    info->device = device;
+    info->disk = disk;
+    info->scheme = scheme;
+    info->number = number;
+    return true;
+}
+
+/* Walk the EBR chain of an extended partition; logical partitions are numbered from 5 */
+static uint32_t partition_scan_extended(block_device_t* disk, uint32_t extended_lba, uint32_t extended_sectors) {
+    uint32_t found = 0;
+    uint32_t ebr_lba = extended_lba;
+    uint8_t number = 5;
+
+    /* Bound the walk so a looping chain cannot hang the boot */
+    for (uint32_t i = 0; i < PARTITION_MAX_ENTRIES; i++) {
+        mbr_partition_entry_t* entries = (mbr_partition_entry_t*)&partition_sector[MBR_PARTITION_TABLE_OFFSET];
+
+        if (block_read(disk, ebr_lba, 1, partition_sector) != BLOCK_SUCCESS ||
+            *(uint16_t*)&partition_sector[510] != MBR_SIGNATURE) {
+            break;
+        }
+
+        /* Entry 0: logical partition relative to this EBR */
+        mbr_partition_entry_t logical = entries[0];
+        /* Entry 1: next EBR relative to the start of the extended partition */
+        mbr_partition_entry_t next = entries[1];
+
+        if (logical.type != MBR_TYPE_EMPTY && logical.sector_count != 0) {
+            if (partition_add(disk, PARTITION_SCHEME_MBR, number, ebr_lba + logical.first_lba, logical.sector_count)) {
+                partitions[partition_count - 1].mbr_type = logical.type;
+                found++;
+            }
+            number++;
+        }
+
+        if (next.type == MBR_TYPE_EMPTY || next.first_lba == 0 || next.first_lba >= extended_sectors) {
+            break;
+        }
+        ebr_lba = extended_lba + next.first_lba;
+    }
+
+    return found;
+}
+
+/* Parse a GPT; returns the number of partitions registered */
+static uint32_t partition_scan_gpt(block_device_t* disk) {
+    gpt_header_t header;
+    uint32_t header_crc;
+    uint32_t entries_crc = 0;
+    uint32_t entries_per_sector;
+    uint32_t entry_sectors;
+    uint32_t found = 0;
+    uint32_t index = 0;
+    static uint8_t entry_type[PARTITION_MAX_ENTRIES][16];
+    static uint32_t entry_first[PARTITION_MAX_ENTRIES];
+    static uint32_t entry_count[PARTITION_MAX_ENTRIES];
+    static uint8_t entry_number[PARTITION_MAX_ENTRIES];
+    uint32_t pending = 0;
+
+    if (block_read(disk, GPT_HEADER_LBA, 1, partition_sector) != BLOCK_SUCCESS) {
+        return 0;
+    }
+    memcpy(&header, partition_sector, sizeof(gpt_header_t));
+
+    if (memcmp(header.signature, GPT_SIGNATURE, 8) != 0 ||
+        header.header_size < sizeof(gpt_header_t) || header.header_size > BLOCK_SECTOR_SIZE ||
+        header.partition_entry_size < GPT_MIN_ENTRY_SIZE ||
+        header.partition_entry_size > BLOCK_SECTOR_SIZE ||
+        (BLOCK_SECTOR_SIZE % header.partition_entry_size) != 0 ||
+        header.partition_entry_lba >= disk->sector_count) {
+        return 0;
+    }
+
+    /* Header CRC is computed with its own field zeroed */
+    header_crc = header.header_crc32;
+    *(uint32_t*)&partition_sector[16] = 0;
+    if (crc32(0, partition_sector, header.header_size) != header_crc) {
+        return 0;
+    }
+
+    entries_per_sector = BLOCK_SECTOR_SIZE / header.partition_entry_size;
+    entry_sectors = (header.num_partition_entries + entries_per_sector - 1) / entries_per_sector;
+
+    /* Collect used entries while checksumming the whole array; register
+     * them only once the array CRC has been verified */
+    for (uint32_t sector = 0; sector < entry_sectors; sector++) {
+        uint32_t bytes = BLOCK_SECTOR_SIZE;
+
+        if (block_read(disk, (uint32_t)header.partition_entry_lba + sector, 1, partition_sector) != BLOCK_SUCCESS) {
+            return 0;
+        }
+
+        if (sector == entry_sectors - 1) {
+            bytes = (header.num_partition_entries - index) * header.partition_entry_size;
+        }
+        entries_crc = crc32(entries_crc, partition_sector, bytes);
+
+        for (uint32_t slot = 0; slot < entries_per_sector && index < header.num_partition_entries; slot++, index++) {
+            gpt_partition_entry_t* entry = (gpt_partition_entry_t*)&partition_sector[slot * header.partition_entry_size];
+            bool used = false;
+
+            for (int b = 0; b < 16; b++) {
+                if (entry->type_guid[b] != 0) {
+                    used = true;
+                    break;
+                }
+            }
+
+            /* Partitions beyond 32-bit LBA cannot be addressed by the block layer */
+            if (!used || entry->first_lba > 0xFFFFFFFF || entry->last_lba > 0xFFFFFFFF ||
+                entry->last_lba < entry->first_lba || pending >= PARTITION_MAX_ENTRIES || index >= 255) {
+                continue;
+            }
+
+            memcpy(entry_type[pending], entry->type_guid, 16);
+            entry_first[pending] = (uint32_t)entry->first_lba;
+            entry_count[pending] = (uint32_t)(entry->last_lba - entry->first_lba) + 1;
+            entry_number[pending] = (uint8_t)(index + 1);
+            pending++;
+        }
+    }
+
+    if (entries_crc != header.partition_entries_crc32) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < pending; i++) {
+        if (partition_add(disk, PARTITION_SCHEME_GPT, entry_number[i], entry_first[i], entry_count[i])) {
+            memcpy(partitions[partition_count - 1].type_guid, entry_type[i], 16);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+/* Scan a disk's partition table and register its partitions */
+uint32_t partition_scan(block_device_t* disk) {
+    mbr_partition_entry_t entries[MBR_PARTITION_COUNT];
+    uint32_t found = 0;
+
+    if (!disk || disk->parent) {
+        return 0;
+    }
+
+    if (block_read(disk, 0, 1, partition_sector) != BLOCK_SUCCESS ||
+        *(uint16_t*)&partition_sector[510] != MBR_SIGNATURE) {
+        return 0;
+    }
+    memcpy(entries, &partition_sector[MBR_PARTITION_TABLE_OFFSET], sizeof(entries));
+
+    /* A protective MBR means the real table is the GPT */
+    for (int i = 0; i < MBR_PARTITION_COUNT; i++) {
+        if (entries[i].type == MBR_TYPE_GPT_PROTECTIVE) {
+            return partition_scan_gpt(disk);
+        }
+    }
+
+    for (int i = 0; i < MBR_PARTITION_COUNT; i++) {
+        mbr_partition_entry_t* entry = &entries[i];
+
+        /* A FAT boot sector also ends in 0xAA55; reject tables with junk status bytes */
+        if ((entry->status & 0x7F) != 0) {
+            return found;
+        }
+        if (entry->type == MBR_TYPE_EMPTY || entry->sector_count == 0) {
+            continue;
+        }
+
+        if (entry->type == MBR_TYPE_EXTENDED_CHS || entry->type == MBR_TYPE_EXTENDED_LBA) {
+            found += partition_scan_extended(disk, entry->first_lba, entry->sector_count);
+            continue;
+        }
+
+        if (partition_add(disk, PARTITION_SCHEME_MBR, (uint8_t)(i + 1), entry->first_lba, entry->sector_count)) {
+            partitions[partition_count - 1].mbr_type = entry->type;
+            partitions[partition_count - 1].bootable = (entry->status & 0x80) != 0;
+            found++;
+        }
+    }
+
+    return found;
+}
+
+/* Scan every whole-disk device in the registry */
+uint32_t partition_scan_all(void) {
+    uint32_t found = 0;
+    uint32_t disk_count = block_get_device_count();
+
+    /* Partitions are appended to the registry while scanning; only visit the disks */
+    for (uint32_t i = 0; i < disk_count; i++) {
+        block_device_t* device = block_get_device(i);
+        if (device && !device->parent) {
+            found += partition_scan(device);
+        }
+    }
+
+    return found;
+}
+
+const partition_info_t* partition_get_info(uint32_t index) {
+    return index < partition_count ? &partitions[index] : NULL;
+}
+
+uint32_t partition_get_count(void) {
+    return partition_count;
+}
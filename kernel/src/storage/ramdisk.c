@@ -0,0 +1,95 @@
+/*
+ * RAM Disk
+ * ChanUX Operating System
+ *
+ * Block devices backed by pages from the memory pool.
+ */
+
+#include "../../include/storage/ramdisk.h"
+#include "../../include/memory/memory.h"
+#include "../../include/common/utils.h"
+
+/* RAM disk state */
+typedef struct {
+    uint8_t* data;                      /* Start of the backing memory */
+    uint32_t page_count;                /* Pages allocated for data */
+} ramdisk_t;
+
+static block_device_t ramdisk_devices[RAMDISK_MAX_DEVICES];
+static ramdisk_t ramdisks[RAMDISK_MAX_DEVICES];
+
+static block_result_t ramdisk_read(block_device_t* device, uint32_t lba, uint32_t count, void* buffer) {
+    ramdisk_t* disk = (ramdisk_t*)device->private_data;
+    memcpy(buffer, disk->data + lba * BLOCK_SECTOR_SIZE, count * BLOCK_SECTOR_SIZE);
+    return BLOCK_SUCCESS;
+}
+
+static block_result_t ramdisk_write(block_device_t* device, uint32_t lba, uint32_t count, const void* buffer) {
+    ramdisk_t* disk = (ramdisk_t*)device->private_data;
+    memcpy(disk->data + lba * BLOCK_SECTOR_SIZE, buffer, count * BLOCK_SECTOR_SIZE);
+    return BLOCK_SUCCESS;
+}
+
+/* Requests complete synchronously through block_submit (no submit/wait ops) */
+static const block_device_ops_t ramdisk_ops = {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+};
+
+/* Create a zero-filled RAM disk and register it */
+block_device_t* ramdisk_create(const char* name, uint32_t sector_count) {
+    uint32_t slot;
+    uint32_t pages;
+    
+    if (!name || sector_count == 0) {
+        return NULL;
+    }
+    
+    for (slot = 0; slot < RAMDISK_MAX_DEVICES; slot++) {
+        if (!ramdisks[slot].data) {
+            break;
+        }
+    }
+    if (slot == RAMDISK_MAX_DEVICES) {
+        return NULL;
+    }
+    
+    pages = (sector_count + (MEMORY_PAGE_SIZE / BLOCK_SECTOR_SIZE) - 1) / (MEMORY_PAGE_SIZE / BLOCK_SECTOR_SIZE);
+    ramdisks[slot].data = (uint8_t*)memory_alloc_pages(pages);
+    if (!ramdisks[slot].data) {
+        return NULL;
+    }
+    ramdisks[slot].page_count = pages;
+    memset(ramdisks[slot].data, 0, pages * MEMORY_PAGE_SIZE);
+    
+    block_device_t* device = &ramdisk_devices[slot];
+    memset(device, 0, sizeof(block_device_t));
+    strncpy(device->name, name, BLOCK_NAME_LENGTH - 1);
+    device->sector_count = sector_count;
+    device->ops = &ramdisk_ops;
+    device->private_data = &ramdisks[slot];
+    
+    if (block_register(device) != BLOCK_SUCCESS) {
+        memory_free_pages(ramdisks[slot].data, pages);
+        ramdisks[slot].data = NULL;
+        return NULL;
+    }
+    
+    return device;
+}
+
+/* Unregister a RAM disk and release its memory */
+void ramdisk_destroy(block_device_t* device) {
+    if (!device || device->ops != &ramdisk_ops) {
+        return;
+    }
+    
+    ramdisk_t* disk = (ramdisk_t*)device->private_data;
+    block_unregister(device);
+    memory_free_pages(disk->data, disk->page_count);
+    disk->data = NULL;
+    disk->page_count = 0;
+}
@@ -4,6 +4,7 @@
 #include "../../include/terminal/terminal.h"
 #include "../../include/common/utils.h"
 #include "../../include/interrupts/interrupts.h"
+#include "../../include/fs/vfs.h"
 
 /* Initialize system calls */
 void syscalls_init(void) {
@@ -41,6 +42,24 @@ uint32_t syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uin
         case SYS_EXEC:
             return (uint32_t)sys_exec((const char*)arg1, (char* const*)arg2);
             
+        case SYS_OPEN:
+            return (uint32_t)sys_open((const char*)arg1, arg2);
+            
+        case SYS_CLOSE:
+            return (uint32_t)sys_close((int)arg1);
+            
+        case SYS_READ:
+            return (uint32_t)sys_read((int)arg1, (void*)arg2, arg3);
+            
+        case SYS_WRITE:
+            return (uint32_t)sys_write((int)arg1, (const void*)arg2, arg3);
+            
+        case SYS_SEEK:
+            return (uint32_t)sys_seek((int)arg1, (int32_t)arg2, (int)arg3);
+            
+        case SYS_CHDIR:
+            return (uint32_t)sys_chdir((const char*)arg1);
+            
         default:
             terminal_writeline("Error: Invalid system call");
             return -1;
@@ -136,6 +155,56 @@ int sys_exec(const char* path, char* const argv[]) {
     return process_exec(current, path, argv);
 }
 
+/* Open a file; returns a descriptor */
+int sys_open(const char* path, uint32_t flags) {
+    int fd;
+    
+    if (vfs_open(path, flags, &fd) != VFS_SUCCESS) {
+        return -1;
+    }
+    return fd;
+}
+
+/* Close a file descriptor */
+int sys_close(int fd) {
+    return vfs_close(fd) == VFS_SUCCESS ? 0 : -1;
+}
+
+/* Read from a file descriptor; returns the byte count */
+int sys_read(int fd, void* buffer, uint32_t size) {
+    uint32_t bytes_read;
+    
+    if (vfs_read(fd, buffer, size, &bytes_read) != VFS_SUCCESS) {
+        return -1;
+    }
+    return (int)bytes_read;
+}
+
+/* Write to a file descriptor; returns the byte count */
+int sys_write(int fd, const void* buffer, uint32_t size) {
+    uint32_t bytes_written;
+    
+    if (vfs_write(fd, buffer, size, &bytes_written) != VFS_SUCCESS) {
+        return -1;
+    }
+    return (int)bytes_written;
+}
+
+/* Reposition a file descriptor; returns the new position */
+int sys_seek(int fd, int32_t offset, int origin) {
+    uint32_t position;
+    
+    if (vfs_seek(fd, offset, origin, &position) != VFS_SUCCESS) {
+        return -1;
+    }
+    return (int)position;
+}
+
+/* Change the working directory */
+int sys_chdir(const char* path) {
+    return vfs_chdir(path) == VFS_SUCCESS ? 0 : -1;
+}
+
 /* Setup system call interrupt (INT 0x80) */
 void setup_syscall_interrupt(void) {
     /* Register INT 0x80 handler in IDT */